@@ -19,6 +19,8 @@ var globalStatus = {
     folders: { },
     newestUid: null,
     oldestUid: null,
+    searchQuery: null,
+    sortKey: "uid",
     requests: { },
     operations: { }
 };
@@ -64,7 +66,9 @@ function globalSetFolders (foldersData)
 
 function globalSetAccountFolders (accountId, foldersData)
 {
-    globalStatus.folders[accountId] = foldersData;
+    /* Objects coming from backend are read only, and we update them
+     * on folder change events */
+    globalStatus.folders[accountId] = $.extend(true, {}, foldersData);
     updateFoldersDisplayNames();
 }
 
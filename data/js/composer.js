@@ -24,6 +24,7 @@ function clearComposer ()
 {
     clearForm($('#form-composer'));
     $("#composer-attachments-list").empty();
+    $("#composer-completions").empty();
 
     $("#composer-body").empty();
 
@@ -45,6 +46,10 @@ function clearComposer ()
     $("#composer-attachments-list").append(addAttachment);
 
     composerSetDirty (false);
+    _composerChanges = 0;
+    _composerSavedChanges = 0;
+    _composerDraftUid = null;
+    _composerSession++;
 }
 
 function forward ()
@@ -190,7 +195,7 @@ function attachFiles ()
 
 		$(item).click(function () {
 		    $(this).remove();
-		    composerChanged();
+		    composerSetDirty(true);
 		});
 		$("#composer-attachments-list").append(item);
 		composerSetDirty(true);
@@ -200,23 +205,194 @@ function attachFiles ()
     });
 }
 
-function composerSend (data)
+function showAddressCompletions (input)
 {
-    iwkRequest ("composerSend", "Adding to outbox", {
-	formData: data
-    }).done(function (msg) {
-	if (!msg.is_ok)
-	    showError (msg.error);
-	else
-	    syncFolders();
+    $("#composer-completions").empty();
+
+    /* Only the recipient being typed, after the last comma */
+    var text = $(input).val();
+    var start = text.lastIndexOf(",") + 1;
+    var prefix = $.trim(text.substring(start));
+    if (prefix == "")
+	return;
+
+    var op = iwk.ServiceMgr.completeAddress (prefix, COMPLETE_ADDRESS_COUNT);
+    op.onSuccess = function (completions) {
+	if ($.trim($(input).val().substring(start)) != prefix)
+	    return;
+	for (var i in completions) {
+	    var completion = completions[i];
+	    var recipient;
+	    if (completion.name != "")
+		recipient = '"' + completion.name + '" <' + completion.address + '>';
+	    else
+		recipient = completion.address;
+
+	    var item = document.createElement ("li");
+	    var link = document.createElement ("a");
+	    link.setAttribute('href', '#');
+	    link.recipient = recipient;
+	    $(link).text(recipient);
+	    $(link).click(function () {
+		var value = $(input).val().substring(0, start);
+		if (start > 0)
+		    value += " ";
+		$(input).val(value + this.recipient + ", ");
+		$("#composer-completions").empty();
+		composerSetDirty(true);
+		$(input).focus();
+		return false;
+	    });
+	    item.appendChild(link);
+	    $("#composer-completions").append(item);
+	}
+	if ($("#composer-completions").hasClass("ui-listview"))
+	    $("#composer-completions").listview('refresh');
+    };
+}
+
+function getComposerFields ()
+{
+    attachments = [];
+    $(".iwk-attachment-item").each(function () {
+	attachments[attachments.length] = this.uri;
     });
+
+    return {
+	from: $("#composer-from-choice").val(),
+	to: $("#composer-to").val(),
+	cc: $("#composer-cc").val(),
+	bcc: $("#composer-bcc").val(),
+	subject: $("#composer-subject").val(),
+	body: $("#composer-body").val(),
+	attachments: attachments
+    };
 }
 
+/* Time without changes before the draft is autosaved, in ms */
+var COMPOSER_AUTOSAVE_DELAY = 5000;
+
 var _composerDirty = false;
+/* Increased each time the composer is cleared for a new message */
+var _composerSession = 0;
+/* Changes since the composer was opened, and changes stored in the draft */
+var _composerChanges = 0;
+var _composerSavedChanges = 0;
+/* Uid of the last saved version of the draft, replaced on each save */
+var _composerDraftUid = null;
+var _composerAutosaveTimeout = null;
+var _composerSaveOp = null;
+var _composerAfterSave = null;
+
+function composerSave (fields, isSending, description)
+{
+    op = iwk.ServiceMgr.composerSave(fields, isSending);
+    op.opId = addOperation (op, description);
+    op.onError = function () {
+	showError (this.error.message);
+    };
+    op.onFinish = function () {
+	removeOperation (this.opId);
+    };
+
+    return op;
+}
+
+function deleteComposerDraft (accountId)
+{
+    if (_composerDraftUid == null)
+	return;
+
+    op = iwk.ServiceMgr.removeMessage(accountId, "__LOCAL_DRAFTS__",
+				      _composerDraftUid);
+    op.opId = addOperation (op, "Removing draft");
+    op.onFinish = function () {
+	removeOperation (this.opId);
+    };
+    _composerDraftUid = null;
+}
+
+function composerSend ()
+{
+    fields = getComposerFields ();
+    afterSave (function () {
+	op = composerSave (fields, true, "Adding to outbox");
+	op.onSuccess = function () {
+	    deleteComposerDraft (fields.from);
+	    syncFolders();
+	};
+    });
+}
+
+/* Saving a draft replaces the previous version, so saves don't
+ * overlap: this runs func when the running save, if any, finishes */
+function afterSave (func)
+{
+    if (_composerSaveOp)
+	_composerAfterSave = func;
+    else
+	func ();
+}
+
+function saveDraftVersion (description, onSaved)
+{
+    if (_composerSaveOp) {
+	afterSave (function () { saveDraftVersion (description, onSaved); });
+	return;
+    }
+
+    if (_composerAutosaveTimeout) {
+	clearTimeout (_composerAutosaveTimeout);
+	_composerAutosaveTimeout = null;
+    }
+
+    fields = getComposerFields ();
+    if (_composerDraftUid)
+	fields.replaceUid = _composerDraftUid;
+
+    op = composerSave (fields, false, description);
+    op.changes = _composerChanges;
+    op.session = _composerSession;
+    op.onSuccess = function (result) {
+	if (this.session != _composerSession)
+	    return;
+	_composerDraftUid = result.messageUid;
+	_composerSavedChanges = this.changes;
+	if (_composerSavedChanges == _composerChanges)
+	    _composerDirty = false;
+	if (onSaved)
+	    onSaved ();
+    };
+    op.onFinish = function () {
+	removeOperation (this.opId);
+	_composerSaveOp = null;
+	if (_composerAfterSave) {
+	    func = _composerAfterSave;
+	    _composerAfterSave = null;
+	    func ();
+	}
+    };
+    _composerSaveOp = op;
+}
+
+function autosaveDraft ()
+{
+    _composerAutosaveTimeout = null;
+    if (_composerDirty && _composerSavedChanges != _composerChanges)
+	saveDraftVersion ("Autosaving draft");
+}
 
 function composerSetDirty (dirty)
 {
     _composerDirty = dirty;
+    if (_composerAutosaveTimeout) {
+	clearTimeout (_composerAutosaveTimeout);
+	_composerAutosaveTimeout = null;
+    }
+    if (dirty) {
+	_composerChanges++;
+	_composerAutosaveTimeout = setTimeout (autosaveDraft, COMPOSER_AUTOSAVE_DELAY);
+    }
 }
 
 function composerIsDirty ()
@@ -226,21 +402,23 @@ function composerIsDirty ()
 
 function saveDraft ()
 {
-    iwkRequest ("composerSaveDraft", "Saving to drafts", {
-	formData: $("#form-composer").serialize()
-    }).done(function (msg) {
-	if (!msg.is_ok)
-	    showError (msg.error);
-	else {
-	    syncFolders ();
-	    fetchNewMessages ();
-	    history.back();
-	}
+    saveDraftVersion ("Saving to drafts", function () {
+	syncFolders ();
+	fetchNewMessages ();
+	history.back();
     });
 }
 
 function discardChanges ()
 {
+    if (_composerAutosaveTimeout) {
+	clearTimeout (_composerAutosaveTimeout);
+	_composerAutosaveTimeout = null;
+    }
+    from = $("#composer-from-choice").val();
+    afterSave (function () {
+	deleteComposerDraft (from);
+    });
     /* One for closing dialog, another for closing composer */
     history.go (-2);
 }
@@ -252,11 +430,6 @@ $(function () {
     });
 
     $("#composer-send").click(function () {
-	attachments = [];
-	$(".iwk-attachment-item").each(function () {
-	    attachments[attachments.length] = this.uri;
-	});
-	$("#composer-attachments").val(attachments.join(","));
 	$("#form-composer").submit();
     });
 
@@ -270,12 +443,16 @@ $(function () {
     });
 
     $("#form-composer").submit(function () {
-	composerSend($(this).serialize());
+	composerSend();
 	return false;
     });
 
-    $("#form-composer :input").change(function () {
+    $("#form-composer :input").bind("input change", function () {
 	composerSetDirty(true);
     });
 
+    $("#composer-to, #composer-cc, #composer-bcc").bind("input", function () {
+	showAddressCompletions (this);
+    });
+
 });
@@ -13,3 +13,4 @@
  */
 
 var SHOW_MESSAGES_COUNT = 20;
+var COMPLETE_ADDRESS_COUNT = 5;
@@ -46,10 +46,13 @@ function dumpAccountInAccountsList (account, parent)
 
 	if (globalStatus.currentAccount != this.accountId || globalStatus.currentFolder != folder.fullName) {
 	    globalStatus.currentAccount = this.accountId;
+	    iwk.ServiceMgr.setCurrentAccount (this.accountId);
 	    globalStatus.currentFolder = newFolder.fullName;
 	    globalStatus.currentmessage = null;
 	    globalStatus.newestUid = null;
 	    globalStatus.oldestUid = null;
+	    globalStatus.searchQuery = null;
+	    $("#messages-search").val("");
 	    $("#page-messages-title").text();
 	    $("#page-message-title").text(folder.displayName);
 	    $("#page-messages #messages-list").html("");
@@ -68,12 +71,19 @@ function dumpAccountInAccountsList (account, parent)
 	$(p).text(account.email_address + " (default)")
     else
 	$(p).text(account.email_address);
+    syncP = document.createElement("p");
+    syncP.className += " ui-li-aside account-sync";
+    sendP = document.createElement("p");
+    sendP.className += " account-send";
+    $(sendP).hide();
     countSpan = document.createElement("span");
     countSpan.className += " ui-li-count account-count";
     $(countSpan).hide();
     $(countSpan).text(0);
     a.appendChild(h3);
     a.appendChild(p);
+    a.appendChild(sendP);
+    a.appendChild(syncP);
     a.appendChild(countSpan);
     li.appendChild(a);
     $(parent).append(li);	    
@@ -211,10 +221,13 @@ function dumpFolderInFolderList (accountId, folderFullName, folder, parent)
 	$(a).click(function () {
 	    if (globalStatus.currentAccount != this.accountId || globalStatus.currentFolder != this.folderFullName) {
 		globalStatus.currentAccount = this.accountId;
+		iwk.ServiceMgr.setCurrentAccount (this.accountId);
 		globalStatus.currentFolder = this.folderFullName;
 		globalStatus.currentmessage = null;
 		globalStatus.newestUid = null;
 		globalStatus.oldestUid = null;
+		globalStatus.searchQuery = null;
+		$("#messages-search").val("");
 		$("#page-messages-title").text(this.displayName);
 		$("#page-message-title").text(this.displayName);
 		$("#page-messages #messages-list").html("");
@@ -244,6 +257,26 @@ function dumpFolderInFolderList (accountId, folderFullName, folder, parent)
     $(parent).append(li);
 }
 
+function getSendStatusText (message)
+{
+    switch (message.send_status) {
+    case "retry":
+	if (message.next_attempt)
+	    return "Retry " + formatTime (message.next_attempt / 1000) +
+		" (attempt " + (message.send_attempts + 1) + ")";
+	return "Waiting to retry";
+    case "failed":
+	return "Not sent";
+    case "sending":
+	return "Sending";
+    case "sent":
+    case "copying-to-sentbox":
+	return "Sent";
+    default:
+	return "";
+    }
+}
+
 function dumpMessageInMessagesList (message, isNew, parent)
 {
     if (message.deleted && !getCurrentFolder().isTrash)
@@ -286,10 +319,35 @@ function dumpMessageInMessagesList (message, isNew, parent)
     a.appendChild(h3);
     a.appendChild(p);
     a.appendChild(date);
+    if (message.send_status) {
+	sendP = document.createElement("p");
+	sendP.className += "iwk-send-status";
+	$(sendP).text(getSendStatusText (message));
+	a.appendChild(sendP);
+    }
     li.appendChild(a);
 
     if (isNew)
 	$(parent).prepend(li);
     else
 	$(parent).append(li);
-}
\ No newline at end of file
+}
+function updateMessageInMessagesList (message)
+{
+    li = $("#message-item-"+message.uid);
+    if (message.deleted && !getCurrentFolder().isTrash) {
+	li.remove();
+	return;
+    }
+    if (message.unread) {
+	li.removeClass("iwk-read-item");
+	li.addClass("iwk-unread-item");
+    } else {
+	li.removeClass("iwk-unread-item");
+	li.addClass("iwk-read-item");
+    }
+    li.find(".iwk-send-status").text(getSendStatusText (message));
+    li.find(".iwk-message-item-link").each(function () {
+	this.message = message;
+    });
+}
@@ -51,6 +51,24 @@ function fillAccountsListCounts ()
 	$("#accounts-list").listview('refresh');
 }
 
+function fillAccountsListSchedule ()
+{
+    result = iwk.ServiceMgr.getSyncSchedule ();
+    result.onSuccess = function (schedule) {
+	for (i in schedule) {
+	    item = schedule[i];
+	    text = "";
+	    if (item.push)
+		text = "Push";
+	    else if (item.nextRun != null && item.failures > 0)
+		text = "Retry " + formatTime (item.nextRun / 1000);
+	    else if (item.nextRun != null)
+		text = "Next " + formatTime (item.nextRun / 1000);
+	    $("#page-accounts #account-item-"+item.accountId+" .account-sync").text(text);
+	}
+    }
+}
+
 function fillFoldersList(accountId)
 {
     for (i in globalStatus.folders) {
@@ -184,6 +202,47 @@ function deleteMessage ()
     history.back ();
 }
 
+function runFolderOperation (op, description)
+{
+    op.opId = addOperation (op, description);
+    op.onProgress = function (processed, total) {
+	if (total > 0)
+	    globalStatus.operations[this.opId].description =
+		description + " (" + Math.floor (processed * 100 / total) + "%)";
+    };
+    op.onError = function () {
+	showError (this.error.message);
+    };
+    op.onFinish = function () {
+	removeOperation (this.opId);
+	globalStatus.newestUid = null;
+	globalStatus.oldestUid = null;
+	$("#page-messages #messages-list").html("");
+	showMessages (globalStatus.currentAccount, globalStatus.currentFolder, false);
+    };
+}
+
+function markFolderAsRead ()
+{
+    runFolderOperation (iwk.ServiceMgr.markFolderRead (globalStatus.currentAccount,
+						       globalStatus.currentFolder),
+			"Marking all messages as read");
+}
+
+function expungeFolder ()
+{
+    runFolderOperation (iwk.ServiceMgr.expungeFolder (globalStatus.currentAccount,
+						      globalStatus.currentFolder),
+			"Removing deleted messages");
+}
+
+function emptyFolder ()
+{
+    runFolderOperation (iwk.ServiceMgr.emptyFolder (globalStatus.currentAccount,
+						    globalStatus.currentFolder),
+			"Emptying folder");
+}
+
 function hasBlockedImages()
 {
     globalStatus.hasBlockedImages = true;
@@ -281,11 +340,31 @@ function showMessages(accountId, folderId, onlyNew)
 
     retrieveCount = onlyNew?0:SHOW_MESSAGES_COUNT;
 
-    op = iwk.ServiceMgr.fetchMessages (accountId, folderId, retrieveCount,
-				       globalStatus.newestUid,
-				       globalStatus.oldestUid);
+    if (globalStatus.searchQuery != null) {
+	/* Refreshing a search runs it again from the newest match */
+	if (onlyNew) {
+	    globalStatus.oldestUid = null;
+	    $("#page-messages #messages-list").html("");
+	}
+	op = iwk.ServiceMgr.search (accountId, folderId, globalStatus.searchQuery,
+				    SHOW_MESSAGES_COUNT, globalStatus.oldestUid);
+    } else if (globalStatus.sortKey != "uid") {
+	/* New messages may go anywhere in the order, so refreshing
+	 * reloads the list */
+	if (onlyNew) {
+	    globalStatus.oldestUid = null;
+	    $("#page-messages #messages-list").html("");
+	}
+	op = iwk.ServiceMgr.fetchMessages (accountId, folderId, SHOW_MESSAGES_COUNT,
+					   null, globalStatus.oldestUid,
+					   globalStatus.sortKey);
+    } else {
+	op = iwk.ServiceMgr.fetchMessages (accountId, folderId, retrieveCount,
+					   globalStatus.newestUid,
+					   globalStatus.oldestUid);
+    }
     globalStatus.requests["showMessages"] = op;
-    op.opId = addOperation (op, "Fetching messages");
+    op.opId = addOperation (op, globalStatus.searchQuery != null?"Searching messages":"Fetching messages");
     op.onSuccess = function (result) {
 	if (result.new_messages.length > 0) {
 	    globalStatus.newestUid = result.new_messages[0].uid;
@@ -320,6 +399,25 @@ function showMessages(accountId, folderId, onlyNew)
     };
 }
 
+function searchMessages (query)
+{
+    query = $.trim (query);
+    globalStatus.searchQuery = (query == "")?null:query;
+    globalStatus.newestUid = null;
+    globalStatus.oldestUid = null;
+    $("#page-messages #messages-list").html("");
+    showMessages (globalStatus.currentAccount, globalStatus.currentFolder, false);
+}
+
+function sortMessages (sortKey)
+{
+    globalStatus.sortKey = sortKey;
+    globalStatus.newestUid = null;
+    globalStatus.oldestUid = null;
+    $("#page-messages #messages-list").html("");
+    showMessages (globalStatus.currentAccount, globalStatus.currentFolder, false);
+}
+
 function fetchMoreMessages ()
 {
     showMessages (globalStatus.currentAccount, globalStatus.currentFolder, false);
@@ -339,6 +437,7 @@ function refreshAccounts ()
 	globalStatus.accounts = result;
 	fillComposerFrom (result);
 	fillAccountsList (result);
+	fillAccountsListSchedule ();
 	syncFolders();
     }
 }
@@ -371,6 +470,31 @@ function runSendQueues ()
     }
 }
 
+function onSendQueueProgress (event)
+{
+    sendP = $("#page-accounts #account-item-"+event.accountId+" .account-send");
+    if (event.state == "waiting") {
+	text = "Waiting to send";
+    } else if (event.state == "running") {
+	text = "Sending";
+	if (event.queued > 0)
+	    text += " " + (event.sent + event.retried + event.failed) + "/" + event.queued;
+    } else if (event.error != null) {
+	text = "Send failed: " + event.error;
+	if (event.nextAttempt != null)
+	    text += ", retry " + formatTime (event.nextAttempt / 1000);
+    } else if (event.nextAttempt != null) {
+	text = event.sent + " sent, retry " + formatTime (event.nextAttempt / 1000);
+    } else if (event.retried + event.failed > 0) {
+	text = event.sent + " sent, " + (event.retried + event.failed) + " not sent";
+    } else {
+	sendP.hide();
+	return;
+    }
+    sendP.text(text);
+    sendP.show();
+}
+
 function syncFolders ()
 {
     iwkRequest("syncOutboxStore", "Syncing local outbox store", {
@@ -380,6 +504,40 @@ function syncFolders ()
     });
 }
 
+function onFolderChanged (event)
+{
+    for (i in globalStatus.folders) {
+	account = globalStatus.folders[i];
+	if (event.accountId != null && account.accountId != event.accountId)
+	    continue;
+	folder = account.folders[event.folderName];
+	if (folder) {
+	    folder.unreadCount = event.unreadCount;
+	    folder.messageCount = event.messageCount;
+	}
+    }
+    fillAccountsListCounts ();
+    if (globalStatus.currentAccount != null)
+	fillFoldersList (globalStatus.currentAccount);
+
+    if (event.folderName != globalStatus.currentFolder ||
+	(event.accountId != null && event.accountId != globalStatus.currentAccount))
+	return;
+
+    for (i in event.removed) {
+	$("#message-item-"+event.removed[i]).remove();
+    }
+    for (i in event.changed) {
+	message = event.changedMessages[event.changed[i]];
+	if (message)
+	    updateMessageInMessagesList (message);
+    }
+    if (event.added.length > 0)
+	fetchNewMessages ();
+    if ($("#messages-list").hasClass("ui-listview"))
+	$("#messages-list").listview('refresh');
+}
+
 function deleteAccount ()
 {
     result = iwk.AccountMgr.deleteAccount (globalStatus.currentAccount);
@@ -396,5 +554,14 @@ function deleteAccount ()
 
 $(function () {
     $("#page-message-blocked-images-banner").hide();
+    iwk.ServiceMgr.onFolderChanged = onFolderChanged;
+    iwk.ServiceMgr.onSendQueueProgress = onSendQueueProgress;
     refreshAccounts();
+    setInterval (fillAccountsListSchedule, 60000);
+    $("#messages-search").bind("change", function () {
+	searchMessages ($(this).val());
+    });
+    $("#messages-sort").bind("change", function () {
+	sortMessages ($(this).val());
+    });
 });
@@ -0,0 +1,334 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-address-index.c : Benchmark of the address completion */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-address-index-priv.h"
+
+#include <string.h>
+
+#define ADDRESSES 50000
+#define QUERIES 5000
+#define COMPLETIONS 5
+/* Average time of a completion of a short prefix, in usec */
+#define MAX_SHORT_PREFIX_TIME 1000
+
+static const gchar *first_names[] = {
+	"Alice", "Bob", "Carol", "David", "Eve", "Frank", "Grace", "Heidi",
+	"Ivan", "Judy", "Mallory", "Niaj", "Olivia", "Peggy", "Rupert",
+	"Sybil", "Trent", "Victor", "Walter", "Xavier", "Yolanda", "Zoe"
+};
+
+static const gchar *last_names[] = {
+	"Smith", "Jones", "Garcia", "Miller", "Davis", "Lopez", "Wilson",
+	"Anderson", "Thomas", "Taylor", "Moore", "Jackson", "Martin", "Lee",
+	"Perez", "Thompson", "White", "Harris", "Clark", "Lewis"
+};
+
+/* What the index should have for an address */
+typedef struct _Address {
+	gchar *name;
+	/* the names and addresses are ASCII, so they're folded once */
+	gchar *folded_name;
+	gchar *address;
+	guint work;
+	guint home;
+} Address;
+
+static void
+set_name (Address *address,
+	  gchar *name)
+{
+	g_free (address->name);
+	g_free (address->folded_name);
+	address->name = name;
+	address->folded_name = g_ascii_strdown (name, -1);
+}
+
+/* The prefix is case folded */
+static gboolean
+address_matches (const Address *address,
+		 const gchar *prefix)
+{
+	const gchar *word;
+
+	if (g_str_has_prefix (address->address, prefix) ||
+	    g_str_has_prefix (address->folded_name, prefix))
+		return TRUE;
+	for (word = strchr (address->folded_name, ' '); word != NULL; word = strchr (word + 1, ' ')) {
+		if (g_str_has_prefix (word + 1, prefix))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gint
+compare_counts (gconstpointer a,
+		gconstpointer b)
+{
+	guint count_a = *((const guint *) a);
+	guint count_b = *((const guint *) b);
+
+	return count_a == count_b ? 0 : (count_a > count_b ? -1 : 1);
+}
+
+/* All the addresses are seen at the same time, so the score is the
+ * count, and the completions must have the best counts of the
+ * addresses matching, in order */
+static void
+check_completions (ImAddressIndex *self,
+		   Address *addresses,
+		   GHashTable *by_address,
+		   const gchar *prefix)
+{
+	GList *completions, *node;
+	GHashTable *seen;
+	GArray *expected;
+	gchar *folded_prefix;
+	guint i;
+
+	folded_prefix = g_utf8_casefold (prefix, -1);
+	expected = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (i = 0; i < ADDRESSES; i++) {
+		guint count = addresses[i].work + addresses[i].home;
+
+		if (count > 0 && address_matches (&addresses[i], folded_prefix))
+			g_array_append_val (expected, count);
+	}
+	g_array_sort (expected, compare_counts);
+
+	completions = im_address_index_complete (self, prefix, COMPLETIONS);
+	g_assert_cmpuint (g_list_length (completions), ==, MIN (expected->len, COMPLETIONS));
+	seen = g_hash_table_new (g_str_hash, g_str_equal);
+	for (node = completions, i = 0; node != NULL; node = g_list_next (node), i++) {
+		ImAddressCompletion *completion = (ImAddressCompletion *) node->data;
+		Address *address = g_hash_table_lookup (by_address, completion->address);
+
+		g_assert (address != NULL);
+		g_assert (!g_hash_table_contains (seen, address));
+		g_hash_table_add (seen, address);
+		g_assert (address_matches (address, folded_prefix));
+		g_assert_cmpstr (completion->name, ==, address->name);
+		g_assert_cmpuint (completion->count, ==, address->work + address->home);
+		g_assert_cmpuint (completion->count, ==, g_array_index (expected, guint, i));
+	}
+	g_hash_table_destroy (seen);
+	im_address_index_free_completions (completions);
+
+	/* More completions than kept visit all the addresses */
+	if (expected->len <= ADDRESSES / 20) {
+		completions = im_address_index_complete (self, prefix, G_MAXUINT);
+		g_assert_cmpuint (g_list_length (completions), ==, expected->len);
+		im_address_index_free_completions (completions);
+	}
+
+	g_array_free (expected, TRUE);
+	g_free (folded_prefix);
+}
+
+/* Single letters, and the first two letters of the names */
+static GPtrArray *
+get_short_prefixes (void)
+{
+	GPtrArray *prefixes;
+	gchar letter;
+	guint i;
+
+	prefixes = g_ptr_array_new_with_free_func (g_free);
+	for (letter = 'a'; letter <= 'z'; letter++)
+		g_ptr_array_add (prefixes, g_strdup_printf ("%c", letter));
+	for (i = 0; i < G_N_ELEMENTS (first_names); i++)
+		g_ptr_array_add (prefixes, g_ascii_strdown (first_names[i], 2));
+	for (i = 0; i < G_N_ELEMENTS (last_names); i++)
+		g_ptr_array_add (prefixes, g_ascii_strdown (last_names[i], 2));
+
+	return prefixes;
+}
+
+static void
+check_all_completions (ImAddressIndex *self,
+		       Address *addresses,
+		       GHashTable *by_address,
+		       GPtrArray *short_prefixes)
+{
+	guint i;
+
+	for (i = 0; i < short_prefixes->len; i++)
+		check_completions (self, addresses, by_address, short_prefixes->pdata[i]);
+	check_completions (self, addresses, by_address, "");
+	check_completions (self, addresses, by_address, "Smi");
+	check_completions (self, addresses, by_address, "alice.s");
+	check_completions (self, addresses, by_address, "ZZ");
+}
+
+static gdouble
+time_completions (ImAddressIndex *self,
+		  GPtrArray *prefixes)
+{
+	GRand *rand;
+	gint64 start;
+	guint i;
+
+	rand = g_rand_new_with_seed (1);
+	start = g_get_monotonic_time ();
+	for (i = 0; i < QUERIES; i++) {
+		const gchar *prefix = prefixes->pdata[g_rand_int_range (rand, 0, prefixes->len)];
+
+		im_address_index_free_completions (im_address_index_complete (self, prefix, COMPLETIONS));
+	}
+	g_rand_free (rand);
+
+	return (gdouble) (g_get_monotonic_time () - start) / QUERIES;
+}
+
+int
+main (int argc, char **argv)
+{
+	ImAddressIndex *self;
+	Address *addresses;
+	GHashTable *by_address;
+	GPtrArray *short_prefixes, *long_prefixes;
+	GList *completions;
+	GRand *rand;
+	gint64 now, start;
+	gdouble average;
+	guint i;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	/* Not finalized, as it has no managers */
+	self = g_object_new (IM_TYPE_ADDRESS_INDEX, NULL);
+	now = g_get_real_time () / G_USEC_PER_SEC;
+
+	/* The odd addresses are only in the work account, those multiple
+	 * of 4 only in the home one, and the rest in both */
+	rand = g_rand_new_with_seed (1);
+	addresses = g_new0 (Address, ADDRESSES);
+	by_address = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < ADDRESSES; i++) {
+		const gchar *first = first_names[g_rand_int_range (rand, 0, G_N_ELEMENTS (first_names))];
+		const gchar *last = last_names[g_rand_int_range (rand, 0, G_N_ELEMENTS (last_names))];
+		gchar *address;
+
+		set_name (&addresses[i], g_strdup_printf ("%s %s", first, last));
+		address = g_strdup_printf ("%s.%s%u@example.com", first, last, i);
+		addresses[i].address = g_ascii_strdown (address, -1);
+		g_free (address);
+		if (i % 4 != 0)
+			addresses[i].work = g_rand_int_range (rand, 1, 50);
+		if (i % 2 == 0)
+			addresses[i].home = g_rand_int_range (rand, 1, 10);
+		g_hash_table_insert (by_address, addresses[i].address, &addresses[i]);
+	}
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < ADDRESSES; i++) {
+		if (addresses[i].work)
+			_im_address_index_add_address (self, "work", addresses[i].name,
+						       addresses[i].address, addresses[i].work, now);
+		if (addresses[i].home)
+			_im_address_index_add_address (self, "home", addresses[i].name,
+						       addresses[i].address, addresses[i].home, now);
+	}
+	g_print ("indexed %u addresses in %" G_GINT64_FORMAT " usec\n",
+		 ADDRESSES, g_get_monotonic_time () - start);
+
+	short_prefixes = get_short_prefixes ();
+	check_all_completions (self, addresses, by_address, short_prefixes);
+
+	/* The first keystrokes must not visit all the addresses */
+	average = time_completions (self, short_prefixes);
+	g_print ("completed prefixes of 1 and 2 characters in %.1f usec on average\n", average);
+	g_assert_cmpfloat (average, <, MAX_SHORT_PREFIX_TIME);
+
+	long_prefixes = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < 100; i++)
+		g_ptr_array_add (long_prefixes, g_strndup (addresses[i].address,
+							   strchr (addresses[i].address, '.') - addresses[i].address + 2));
+	average = time_completions (self, long_prefixes);
+	g_print ("completed longer prefixes in %.1f usec on average\n", average);
+
+	/* Removing an account keeps the counts of the others */
+	start = g_get_monotonic_time ();
+	_im_address_index_remove_account_addresses (self, "home");
+	g_print ("removed an account in %" G_GINT64_FORMAT " usec\n",
+		 g_get_monotonic_time () - start);
+	for (i = 0; i < ADDRESSES; i++)
+		addresses[i].home = 0;
+	check_all_completions (self, addresses, by_address, short_prefixes);
+	completions = im_address_index_complete (self, addresses[4].address, COMPLETIONS);
+	g_assert (completions == NULL);
+
+	/* The newest messages rename the addresses */
+	for (i = 0; i < 1000; i++) {
+		set_name (&addresses[i], g_strdup_printf ("Renamed %s", first_names[i % G_N_ELEMENTS (first_names)]));
+		addresses[i].work++;
+		_im_address_index_add_address (self, "work", addresses[i].name,
+					       addresses[i].address, 1, now);
+	}
+	check_all_completions (self, addresses, by_address, short_prefixes);
+	check_completions (self, addresses, by_address, "re");
+
+	/* The score halves every IM_ADDRESS_INDEX_RECENCY_DAYS, so 5
+	 * messages then count less than 3 now, and as much as 10 messages
+	 * twice that time ago */
+	_im_address_index_add_address (self, "old", NULL, "qa@example.com", 5,
+				       now - IM_ADDRESS_INDEX_RECENCY_DAYS * 24 * 60 * 60);
+	_im_address_index_add_address (self, "old", NULL, "qb@example.com", 3, now);
+	_im_address_index_add_address (self, "old", NULL, "qc@example.com", 10,
+				       now - 2 * IM_ADDRESS_INDEX_RECENCY_DAYS * 24 * 60 * 60);
+	_im_address_index_add_address (self, "old", NULL, "qd@example.com", 2, now);
+	completions = im_address_index_complete (self, "q", COMPLETIONS);
+	g_assert_cmpuint (g_list_length (completions), ==, 4);
+	g_assert_cmpstr (((ImAddressCompletion *) g_list_nth_data (completions, 0))->address, ==, "qb@example.com");
+	g_assert_cmpstr (((ImAddressCompletion *) g_list_nth_data (completions, 3))->address, ==, "qd@example.com");
+	im_address_index_free_completions (completions);
+
+	g_ptr_array_unref (long_prefixes);
+	g_ptr_array_unref (short_prefixes);
+	g_hash_table_destroy (by_address);
+	for (i = 0; i < ADDRESSES; i++) {
+		g_free (addresses[i].name);
+		g_free (addresses[i].folded_name);
+		g_free (addresses[i].address);
+	}
+	g_free (addresses);
+	g_rand_free (rand);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-composer-save.c : Benchmark of the memory used saving attachments */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-mail-ops-priv.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define ATTACHMENTS 3
+#define ATTACHMENT_SIZE (50 * 1024 * 1024)
+/* Growth of the peak RSS allowed while saving, in KiB. Below the size
+ * of a single attachment, so no attachment is ever loaded as a whole */
+#define MAX_RSS_GROWTH_KIB (32 * 1024)
+
+static glong
+get_peak_rss (void)
+{
+	struct rusage usage;
+
+	g_assert (getrusage (RUSAGE_SELF, &usage) == 0);
+
+	/* In KiB */
+	return usage.ru_maxrss;
+}
+
+static CamelFolder *
+create_folder (CamelSession *session,
+	       const gchar *path)
+{
+	GError *_error = NULL;
+	CamelService *store;
+	CamelFolder *folder;
+	CamelSettings *settings;
+
+	store = camel_session_add_service (session, "local", "maildir",
+					   CAMEL_PROVIDER_STORE, &_error);
+	g_assert_no_error (_error);
+	settings = camel_service_get_settings (store);
+	camel_local_settings_set_path (CAMEL_LOCAL_SETTINGS (settings), path);
+
+	folder = camel_store_get_folder_sync (CAMEL_STORE (store), "Drafts",
+					      CAMEL_STORE_FOLDER_CREATE,
+					      NULL, &_error);
+	g_assert_no_error (_error);
+
+	return folder;
+}
+
+/* Written in small chunks, so creating it does not raise the peak RSS */
+static gchar *
+create_attachment (const gchar *path,
+		   guint index)
+{
+	gchar *filename, *uri;
+	guchar buffer[64 * 1024];
+	FILE *file;
+	gsize written, i;
+
+	for (i = 0; i < sizeof (buffer); i++)
+		buffer[i] = (i * 31 + index) & 0xff;
+
+	filename = g_strdup_printf ("%s/video%u.ogv", path, index);
+	file = fopen (filename, "wb");
+	g_assert (file != NULL);
+	for (written = 0; written < ATTACHMENT_SIZE; written += sizeof (buffer))
+		g_assert (fwrite (buffer, 1, sizeof (buffer), file) == sizeof (buffer));
+	g_assert (fclose (file) == 0);
+
+	uri = g_filename_to_uri (filename, NULL, NULL);
+	g_assert (uri != NULL);
+	g_free (filename);
+
+	return uri;
+}
+
+static void
+remove_dir (const gchar *path)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			gchar *child = g_build_filename (path, name, NULL);
+
+			if (g_file_test (child, G_FILE_TEST_IS_DIR))
+				remove_dir (child);
+			else
+				g_unlink (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+	}
+	g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *_error = NULL;
+	CamelSession *session;
+	CamelFolder *folder;
+	CamelMimeMessage *message;
+	CamelMessageInfo *mi;
+	GList *uris = NULL;
+	gchar *path, *store_path, *uid = NULL;
+	gint64 start;
+	glong rss_before, rss_after;
+	guint i;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	path = g_build_filename (g_get_tmp_dir (), "bench-composer-save.XXXXXX", NULL);
+	g_assert (g_mkdtemp (path) != NULL);
+	store_path = g_build_filename (path, "local", NULL);
+
+	camel_init (path, FALSE);
+	camel_provider_init ();
+	session = g_object_new (CAMEL_TYPE_SESSION,
+				"user-data-dir", path,
+				"user-cache-dir", path,
+				NULL);
+	folder = create_folder (session, store_path);
+
+	for (i = 0; i < ATTACHMENTS; i++)
+		uris = g_list_append (uris, create_attachment (path, i));
+
+	message = camel_mime_message_new ();
+	camel_mime_message_set_subject (message, "Videos");
+
+	rss_before = get_peak_rss ();
+	start = g_get_monotonic_time ();
+	im_mail_op_composer_save_sync (folder, message, "See the attached videos.",
+				       uris, NULL, &uid, NULL, &_error);
+	g_assert_no_error (_error);
+	rss_after = get_peak_rss ();
+
+	g_print ("saved %u attachments of %u bytes in %" G_GINT64_FORMAT " usec, peak RSS %ld KiB (%ld KiB more)\n",
+		 ATTACHMENTS, ATTACHMENT_SIZE, g_get_monotonic_time () - start,
+		 rss_after, rss_after - rss_before);
+
+	/* The attachments were really stored, encoded in base64 */
+	mi = camel_folder_get_message_info (folder, uid);
+	g_assert (mi != NULL);
+	g_assert_cmpuint (camel_message_info_size (mi), >=, (guint64) ATTACHMENTS * ATTACHMENT_SIZE / 3 * 4);
+	camel_folder_free_message_info (folder, mi);
+
+	g_assert_cmpint (rss_after - rss_before, <, MAX_RSS_GROWTH_KIB);
+
+	g_free (uid);
+	g_object_unref (message);
+	g_list_free_full (uris, g_free);
+	g_object_unref (folder);
+	g_object_unref (session);
+	remove_dir (path);
+	g_free (store_path);
+	g_free (path);
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-filter-rules.c : Benchmark of the filter rules matcher */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-filter-rules.h"
+
+#include <string.h>
+
+/* Rules matching the sender address, the subject and the recipients */
+#define SENDER_RULES 400
+#define SUBJECT_RULES 50
+#define RECIPIENT_RULES 50
+#define MESSAGES 20000
+
+static GSList *
+create_rules (void)
+{
+	GSList *rules = NULL;
+	guint i;
+
+	for (i = 0; i < SENDER_RULES; i++)
+		rules = g_slist_prepend (rules, g_strdup_printf ("from\tis\tsender%u@example.com\tmove\tSender %u", i, i));
+	for (i = 0; i < SUBJECT_RULES; i++)
+		rules = g_slist_prepend (rules, g_strdup_printf ("subject\tcontains\t[list%u]\tmove\tList %u", i, i));
+	for (i = 0; i < RECIPIENT_RULES; i++)
+		rules = g_slist_prepend (rules, g_strdup_printf ("to\tends-with\t@group%u.example.org\tflag\tflagged", i));
+
+	return g_slist_reverse (rules);
+}
+
+/* A quarter of the messages match a sender, a quarter a subject, a
+ * quarter a recipient, only by its address as the header ends with
+ * '>', and the rest nothing, so all the rules are checked for them */
+static CamelMessageInfo *
+create_message_info (guint i)
+{
+	CamelMessageInfoBase *mi;
+	gchar *text;
+
+	mi = (CamelMessageInfoBase *) camel_message_info_new (NULL);
+	text = g_strdup_printf ("Sender %u <%s%u@example.com>", i,
+				i % 4 == 0 ? "SENDER" : "other", i % SENDER_RULES);
+	mi->from = camel_pstring_strdup (text);
+	g_free (text);
+	text = g_strdup_printf ("Re: [%s%u] Message %u", i % 4 == 1 ? "LIST" : "other", i % SUBJECT_RULES, i);
+	mi->subject = camel_pstring_strdup (text);
+	g_free (text);
+	text = g_strdup_printf ("Me <me@example.com>, Team <team@%s%u.example.org>",
+				i % 4 == 2 ? "GROUP" : "other", i % RECIPIENT_RULES);
+	mi->to = camel_pstring_strdup (text);
+	g_free (text);
+	mi->cc = camel_pstring_strdup ("");
+
+	return (CamelMessageInfo *) mi;
+}
+
+static gint
+get_expected_rule (guint i)
+{
+	switch (i % 4) {
+	case 0:
+		return i % SENDER_RULES;
+	case 1:
+		return SENDER_RULES + i % SUBJECT_RULES;
+	case 2:
+		return SENDER_RULES + SUBJECT_RULES + i % RECIPIENT_RULES;
+	default:
+		return -1;
+	}
+}
+
+static const gchar *
+get_field_text (CamelMessageInfo *mi,
+		ImFilterField field)
+{
+	const gchar *text = NULL;
+
+	switch (field) {
+	case IM_FILTER_FIELD_FROM:
+		text = camel_message_info_from (mi);
+		break;
+	case IM_FILTER_FIELD_TO:
+		text = camel_message_info_to (mi);
+		break;
+	case IM_FILTER_FIELD_CC:
+		text = camel_message_info_cc (mi);
+		break;
+	case IM_FILTER_FIELD_SUBJECT:
+		text = camel_message_info_subject (mi);
+		break;
+	}
+
+	return text ? text : "";
+}
+
+static gboolean
+text_matches (const gchar *text,
+	      ImFilterMatch match,
+	      const gchar *value)
+{
+	gchar *folded;
+	gboolean matches = FALSE;
+
+	folded = g_utf8_casefold (text, -1);
+	switch (match) {
+	case IM_FILTER_MATCH_IS:
+		matches = strcmp (folded, value) == 0;
+		break;
+	case IM_FILTER_MATCH_CONTAINS:
+		matches = strstr (folded, value) != NULL;
+		break;
+	case IM_FILTER_MATCH_STARTS_WITH:
+		matches = g_str_has_prefix (folded, value);
+		break;
+	case IM_FILTER_MATCH_ENDS_WITH:
+		matches = g_str_has_suffix (folded, value);
+		break;
+	}
+	g_free (folded);
+
+	return matches;
+}
+
+/* Address headers also match by each of their addresses */
+static gboolean
+rule_matches (const ImFilterRule *rule,
+	      const gchar *value,
+	      CamelMessageInfo *mi)
+{
+	CamelInternetAddress *cia;
+	const gchar *text, *address;
+	gboolean matches;
+	gint i;
+
+	text = get_field_text (mi, rule->field);
+	matches = text_matches (text, rule->match, value);
+	if (matches || rule->field == IM_FILTER_FIELD_SUBJECT)
+		return matches;
+
+	cia = camel_internet_address_new ();
+	camel_address_unformat (CAMEL_ADDRESS (cia), text);
+	for (i = 0; !matches && camel_internet_address_get (cia, i, NULL, &address); i++)
+		matches = text_matches (address, rule->match, value);
+	g_object_unref (cia);
+
+	return matches;
+}
+
+/* Checks the rules one by one, as a filter driver would */
+static gint
+match_linearly (GPtrArray *rules,
+		GPtrArray *values,
+		CamelMessageInfo *mi)
+{
+	guint i;
+
+	for (i = 0; i < rules->len; i++) {
+		if (rule_matches (rules->pdata[i], values->pdata[i], mi))
+			return i;
+	}
+
+	return -1;
+}
+
+static gboolean
+is_rule (const ImFilterRule *rule,
+	 const ImFilterRule *expected)
+{
+	if (rule == NULL || expected == NULL)
+		return rule == expected;
+
+	return rule->field == expected->field &&
+		rule->match == expected->match &&
+		strcmp (rule->value, expected->value) == 0;
+}
+
+int
+main (int argc, char **argv)
+{
+	ImFilterMatcher *matcher;
+	CamelMessageInfo **infos;
+	const ImFilterRule **results;
+	GPtrArray *rules, *values;
+	GSList *sources, *node;
+	gint64 start;
+	guint i, hits[4] = { 0, };
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	sources = create_rules ();
+	start = g_get_monotonic_time ();
+	matcher = im_filter_matcher_new (sources);
+	g_print ("compiled %u rules in %" G_GINT64_FORMAT " usec\n",
+		 im_filter_matcher_get_rules_count (matcher), g_get_monotonic_time () - start);
+	g_assert_cmpuint (im_filter_matcher_get_rules_count (matcher), ==,
+			  SENDER_RULES + SUBJECT_RULES + RECIPIENT_RULES);
+
+	rules = g_ptr_array_new_with_free_func ((GDestroyNotify) im_filter_rule_free);
+	values = g_ptr_array_new_with_free_func (g_free);
+	for (node = sources; node != NULL; node = g_slist_next (node)) {
+		ImFilterRule *rule = im_filter_rule_parse ((const gchar *) node->data, NULL);
+
+		g_assert (rule != NULL);
+		g_ptr_array_add (rules, rule);
+		g_ptr_array_add (values, g_utf8_casefold (rule->value, -1));
+	}
+
+	infos = g_new (CamelMessageInfo *, MESSAGES);
+	for (i = 0; i < MESSAGES; i++)
+		infos[i] = create_message_info (i);
+	results = g_new (const ImFilterRule *, MESSAGES);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < MESSAGES; i++)
+		results[i] = im_filter_matcher_match (matcher, infos[i]);
+	g_print ("matched %u messages in %" G_GINT64_FORMAT " usec\n",
+		 MESSAGES, g_get_monotonic_time () - start);
+
+	for (i = 0; i < MESSAGES; i++) {
+		gint expected = get_expected_rule (i);
+
+		g_assert (is_rule (results[i], expected < 0 ? NULL : rules->pdata[expected]));
+		if (results[i] == NULL)
+			hits[3]++;
+		else if (results[i]->field == IM_FILTER_FIELD_FROM)
+			hits[0]++;
+		else if (results[i]->field == IM_FILTER_FIELD_SUBJECT)
+			hits[1]++;
+		else if (results[i]->field == IM_FILTER_FIELD_TO)
+			hits[2]++;
+	}
+	g_print ("%u matched the sender, %u the subject, %u a recipient and %u nothing\n",
+		 hits[0], hits[1], hits[2], hits[3]);
+	for (i = 0; i < G_N_ELEMENTS (hits); i++)
+		g_assert_cmpuint (hits[i], ==, MESSAGES / 4);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < MESSAGES; i++) {
+		gint index = match_linearly (rules, values, infos[i]);
+
+		g_assert (is_rule (results[i], index < 0 ? NULL : rules->pdata[index]));
+	}
+	g_print ("matched %u messages rule by rule in %" G_GINT64_FORMAT " usec\n",
+		 MESSAGES, g_get_monotonic_time () - start);
+
+	for (i = 0; i < MESSAGES; i++)
+		camel_message_info_free (infos[i]);
+	g_free (infos);
+	g_free (results);
+	g_ptr_array_unref (values);
+	g_ptr_array_unref (rules);
+	im_filter_matcher_unref (matcher);
+	g_slist_free_full (sources, g_free);
+
+	return 0;
+}
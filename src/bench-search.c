@@ -0,0 +1,259 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-search.c : Benchmark of the search of messages */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-mail-ops-priv.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define MESSAGES 100000
+/* One message of each MATCH_EVERY has the searched word */
+#define MATCH_EVERY 10
+#define PAGE 50
+/* Average time a page of a cached search may take, in microseconds */
+#define MAX_USEC_PER_PAGE 5000
+
+static CamelFolder *
+create_folder (CamelSession *session,
+	       const gchar *path)
+{
+	GError *_error = NULL;
+	CamelService *store;
+	CamelFolder *folder;
+	CamelSettings *settings;
+
+	store = camel_session_add_service (session, "local", "maildir",
+					   CAMEL_PROVIDER_STORE, &_error);
+	g_assert_no_error (_error);
+	settings = camel_service_get_settings (store);
+	camel_local_settings_set_path (CAMEL_LOCAL_SETTINGS (settings), path);
+
+	folder = camel_store_get_folder_sync (CAMEL_STORE (store), "account",
+					      CAMEL_STORE_FOLDER_CREATE |
+					      CAMEL_STORE_FOLDER_BODY_INDEX,
+					      NULL, &_error);
+	g_assert_no_error (_error);
+
+	return folder;
+}
+
+/* Half of the matches have the word in the subject, the other half in
+ * the body. Each message is received a second after the previous one */
+static void
+fill_folder (CamelFolder *folder)
+{
+	GError *_error = NULL;
+	gint64 start;
+	guint i;
+
+	start = g_get_monotonic_time ();
+	camel_folder_freeze (folder);
+	for (i = 0; i < MESSAGES; i++) {
+		CamelMimeMessage *message;
+		CamelInternetAddress *address;
+		gboolean match = i % MATCH_EVERY == 0;
+		gchar *text, *date, *received;
+
+		message = camel_mime_message_new ();
+		address = camel_internet_address_new ();
+		text = g_strdup_printf ("sender%u@example.com", i % 100);
+		camel_internet_address_add (address, NULL, text);
+		camel_mime_message_set_from (message, address);
+		g_object_unref (address);
+		g_free (text);
+
+		date = camel_header_format_date (1000000000 + i, 0);
+		received = g_strdup_printf ("from bench by localhost; %s", date);
+		camel_medium_add_header (CAMEL_MEDIUM (message), "Received", received);
+		g_free (received);
+		g_free (date);
+
+		text = g_strdup_printf ("Message %u%s", i, match && i % 2 == 0 ? " about the needle" : "");
+		camel_mime_message_set_subject (message, text);
+		g_free (text);
+		text = g_strdup_printf ("Body of the message %u.%s\n", i,
+					match && i % 2 != 0 ? " It talks about a needle." : "");
+		camel_mime_part_set_content (CAMEL_MIME_PART (message), text, strlen (text),
+					     "text/plain");
+		g_free (text);
+
+		camel_folder_append_message_sync (folder, message, NULL, NULL, NULL, &_error);
+		g_assert_no_error (_error);
+		g_object_unref (message);
+	}
+	camel_folder_thaw (folder);
+	camel_folder_synchronize_sync (folder, FALSE, NULL, &_error);
+	g_assert_no_error (_error);
+
+	g_print ("stored %u messages in %" G_GINT64_FORMAT " usec\n", MESSAGES,
+		 g_get_monotonic_time () - start);
+}
+
+static gint64
+get_date (CamelFolder *folder,
+	  const gchar *uid)
+{
+	CamelMessageInfo *mi;
+	gint64 date;
+
+	mi = camel_folder_get_message_info (folder, uid);
+	g_assert (mi != NULL);
+	date = camel_message_info_date_received (mi);
+	camel_folder_free_message_info (folder, mi);
+
+	return date;
+}
+
+/* Pages through all the matches of @query, checking they come from
+ * newest to oldest and only once */
+static void
+bench_search (CamelFolder *folder,
+	      const gchar *query)
+{
+	GError *_error = NULL;
+	GHashTable *seen;
+	GPtrArray *uids;
+	gchar *oldest_uid = NULL;
+	gint64 start, elapsed, last_date = G_MAXINT64;
+	guint total, pages = 0, i;
+
+	start = g_get_monotonic_time ();
+	_im_mail_op_search_folder_sync (folder, query, NULL, PAGE, &uids, &total, NULL, &_error);
+	g_assert_no_error (_error);
+	g_print ("first page of \"%s\": %u matches in %" G_GINT64_FORMAT " usec\n",
+		 query, total, g_get_monotonic_time () - start);
+	g_assert_cmpuint (total, ==, MESSAGES / MATCH_EVERY);
+
+	seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	start = g_get_monotonic_time ();
+	while (uids->len > 0) {
+		for (i = 0; i < uids->len; i++) {
+			gint64 date = get_date (folder, uids->pdata[i]);
+
+			g_assert (!g_hash_table_contains (seen, uids->pdata[i]));
+			g_hash_table_add (seen, g_strdup (uids->pdata[i]));
+			g_assert_cmpint (date, <=, last_date);
+			last_date = date;
+		}
+		g_free (oldest_uid);
+		oldest_uid = g_strdup (uids->pdata[uids->len - 1]);
+		g_ptr_array_unref (uids);
+
+		_im_mail_op_search_folder_sync (folder, query, oldest_uid, PAGE,
+						&uids, NULL, NULL, &_error);
+		g_assert_no_error (_error);
+		pages++;
+	}
+	g_ptr_array_unref (uids);
+	elapsed = g_get_monotonic_time () - start;
+
+	g_print ("%u more pages in %" G_GINT64_FORMAT " usec, %" G_GINT64_FORMAT " usec per page\n",
+		 pages, elapsed, elapsed / pages);
+	g_assert_cmpuint (g_hash_table_size (seen), ==, MESSAGES / MATCH_EVERY);
+	g_assert_cmpint (elapsed / pages, <, MAX_USEC_PER_PAGE);
+
+	g_hash_table_destroy (seen);
+	g_free (oldest_uid);
+}
+
+static void
+remove_dir (const gchar *path)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			gchar *child = g_build_filename (path, name, NULL);
+
+			if (g_file_test (child, G_FILE_TEST_IS_DIR))
+				remove_dir (child);
+			else
+				g_unlink (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+	}
+	g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *_error = NULL;
+	CamelSession *session;
+	CamelFolder *folder;
+	GPtrArray *uids;
+	gchar *path, *store_path;
+	guint total;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	path = g_build_filename (g_get_tmp_dir (), "bench-search.XXXXXX", NULL);
+	g_assert (g_mkdtemp (path) != NULL);
+	store_path = g_build_filename (path, "local", NULL);
+
+	camel_init (path, FALSE);
+	camel_provider_init ();
+	session = g_object_new (CAMEL_TYPE_SESSION,
+				"user-data-dir", path,
+				"user-cache-dir", path,
+				NULL);
+	folder = create_folder (session, store_path);
+	fill_folder (folder);
+
+	/* Words in the subject or the body */
+	bench_search (folder, "needle");
+
+	/* A blank query matches nothing, without searching */
+	_im_mail_op_search_folder_sync (folder, " \t ", NULL, PAGE, &uids, &total, NULL, &_error);
+	g_assert_no_error (_error);
+	g_assert_cmpuint (uids->len, ==, 0);
+	g_assert_cmpuint (total, ==, 0);
+	g_ptr_array_unref (uids);
+
+	g_object_unref (folder);
+	g_object_unref (session);
+	remove_dir (path);
+	g_free (store_path);
+	g_free (path);
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-send-queue.c : Benchmark of the send queue runs */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-mail-ops-priv.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define MESSAGES 1000
+/* Average time a run may take per message, with a transport that
+ * sends at once, in microseconds */
+#define MAX_USEC_PER_MESSAGE 5000
+
+/* Transport that accepts every message without connecting anywhere,
+ * so the run measures the queue itself */
+typedef struct _BenchTransport {
+	CamelTransport parent;
+	guint sent;
+} BenchTransport;
+
+typedef struct _BenchTransportClass {
+	CamelTransportClass parent_class;
+} BenchTransportClass;
+
+GType bench_transport_get_type (void);
+
+G_DEFINE_TYPE (BenchTransport, bench_transport, CAMEL_TYPE_TRANSPORT);
+
+static gboolean
+bench_transport_connect_sync (CamelService *service,
+			      GCancellable *cancellable,
+			      GError **error)
+{
+	return TRUE;
+}
+
+static gboolean
+bench_transport_send_to_sync (CamelTransport *transport,
+			      CamelMimeMessage *message,
+			      CamelAddress *from,
+			      CamelAddress *recipients,
+			      GCancellable *cancellable,
+			      GError **error)
+{
+	((BenchTransport *) transport)->sent++;
+
+	return TRUE;
+}
+
+static void
+bench_transport_class_init (BenchTransportClass *klass)
+{
+	CAMEL_SERVICE_CLASS (klass)->connect_sync = bench_transport_connect_sync;
+	CAMEL_TRANSPORT_CLASS (klass)->send_to_sync = bench_transport_send_to_sync;
+}
+
+static void
+bench_transport_init (BenchTransport *self)
+{
+}
+
+static CamelFolder *
+create_outbox (CamelSession *session,
+	       const gchar *path)
+{
+	GError *_error = NULL;
+	CamelService *store;
+	CamelFolder *outbox;
+	CamelSettings *settings;
+
+	store = camel_session_add_service (session, "outboxes", "maildir",
+					   CAMEL_PROVIDER_STORE, &_error);
+	g_assert_no_error (_error);
+	settings = camel_service_get_settings (store);
+	camel_local_settings_set_path (CAMEL_LOCAL_SETTINGS (settings), path);
+
+	outbox = camel_store_get_folder_sync (CAMEL_STORE (store), "account",
+					      CAMEL_STORE_FOLDER_CREATE, NULL, &_error);
+	g_assert_no_error (_error);
+
+	return outbox;
+}
+
+static void
+fill_outbox (CamelFolder *outbox)
+{
+	GError *_error = NULL;
+	guint i;
+
+	for (i = 0; i < MESSAGES; i++) {
+		CamelMimeMessage *message;
+		CamelInternetAddress *address;
+		gchar *text;
+
+		message = camel_mime_message_new ();
+		address = camel_internet_address_new ();
+		camel_internet_address_add (address, "Me", "me@example.com");
+		camel_mime_message_set_from (message, address);
+		g_object_unref (address);
+		address = camel_internet_address_new ();
+		text = g_strdup_printf ("friend%u@example.com", i);
+		camel_internet_address_add (address, NULL, text);
+		camel_mime_message_set_recipients (message, CAMEL_RECIPIENT_TYPE_TO, address);
+		g_object_unref (address);
+		g_free (text);
+
+		text = g_strdup_printf ("Message %u", i);
+		camel_mime_message_set_subject (message, text);
+		camel_mime_part_set_content (CAMEL_MIME_PART (message), text, strlen (text),
+					     "text/plain");
+		g_free (text);
+
+		camel_folder_append_message_sync (outbox, message, NULL, NULL, NULL, &_error);
+		g_assert_no_error (_error);
+		g_object_unref (message);
+	}
+	camel_folder_synchronize_sync (outbox, FALSE, NULL, &_error);
+	g_assert_no_error (_error);
+}
+
+static void
+check_sent (CamelFolder *outbox)
+{
+	GPtrArray *uids;
+	guint i;
+
+	uids = camel_folder_get_uids (outbox);
+	g_assert_cmpuint (uids->len, ==, MESSAGES);
+	for (i = 0; i < uids->len; i++) {
+		g_assert_cmpstr (camel_folder_get_message_user_tag (outbox, uids->pdata[i],
+								    IM_OUTBOX_SEND_STATUS),
+				 ==, IM_OUTBOX_SEND_STATUS_SENT);
+		g_assert (camel_folder_get_message_user_tag (outbox, uids->pdata[i],
+							     IM_OUTBOX_SEND_CLAIMED) == NULL);
+	}
+	camel_folder_free_uids (outbox, uids);
+}
+
+static void
+remove_dir (const gchar *path)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			gchar *child = g_build_filename (path, name, NULL);
+
+			if (g_file_test (child, G_FILE_TEST_IS_DIR))
+				remove_dir (child);
+			else
+				g_unlink (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+	}
+	g_rmdir (path);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *_error = NULL;
+	CamelSession *session;
+	CamelFolder *outbox;
+	BenchTransport *transport;
+	ImSendQueueStats stats;
+	gchar *path, *store_path;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	path = g_build_filename (g_get_tmp_dir (), "bench-send-queue.XXXXXX", NULL);
+	g_assert (g_mkdtemp (path) != NULL);
+	store_path = g_build_filename (path, "outboxes", NULL);
+
+	camel_init (path, FALSE);
+	camel_provider_init ();
+	session = g_object_new (CAMEL_TYPE_SESSION,
+				"user-data-dir", path,
+				"user-cache-dir", path,
+				NULL);
+	outbox = create_outbox (session, store_path);
+	fill_outbox (outbox);
+	transport = g_object_new (bench_transport_get_type (),
+				  "session", session,
+				  "uid", "bench",
+				  NULL);
+
+	/* The results are flushed once per batch, not once per message */
+	_im_mail_op_run_send_queue_with_transport_sync (outbox, CAMEL_TRANSPORT (transport),
+							NULL, NULL, NULL, &stats,
+							NULL, &_error);
+	g_assert_no_error (_error);
+	g_print ("sent %u messages in %" G_GINT64_FORMAT " usec, %" G_GINT64_FORMAT
+		 " usec per message\n", stats.sent, stats.elapsed,
+		 stats.elapsed / MAX (stats.sent, 1));
+	g_assert_cmpuint (stats.queued, ==, MESSAGES);
+	g_assert_cmpuint (stats.sent, ==, MESSAGES);
+	g_assert_cmpuint (transport->sent, ==, MESSAGES);
+	g_assert_cmpint (stats.elapsed / MESSAGES, <, MAX_USEC_PER_MESSAGE);
+	check_sent (outbox);
+
+	/* Nothing is sent again, they're waiting for sentbox */
+	_im_mail_op_run_send_queue_with_transport_sync (outbox, CAMEL_TRANSPORT (transport),
+							NULL, NULL, NULL, &stats,
+							NULL, &_error);
+	g_assert_no_error (_error);
+	g_assert_cmpuint (stats.sent, ==, 0);
+	g_assert_cmpuint (stats.to_sentbox, ==, MESSAGES);
+	g_assert_cmpuint (transport->sent, ==, MESSAGES);
+
+	g_object_unref (transport);
+	g_object_unref (outbox);
+	g_object_unref (session);
+	remove_dir (path);
+	g_free (store_path);
+	g_free (path);
+
+	return 0;
+}
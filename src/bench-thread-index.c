@@ -0,0 +1,202 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* bench-thread-index.c : Benchmark of the threads index */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-thread-index-priv.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Messages of the folder, in threads of THREAD_LENGTH replies */
+#define MESSAGES 50000
+#define THREAD_LENGTH 10
+/* Replies added and removed one by one after the build */
+#define CHANGES 2000
+#define BASE_DATE 1300000000
+
+static void
+add_reply (ImThreadTree *tree,
+	   guint index)
+{
+	guint64 references[THREAD_LENGTH];
+	guint position, count;
+	gchar *uid;
+
+	/* References go from the parent to the root */
+	position = index % THREAD_LENGTH;
+	for (count = 0; count < position; count++)
+		references[count] = index - count;
+
+	uid = g_strdup_printf ("%u", index);
+	_im_thread_tree_add_message (tree, uid, index + 1, BASE_DATE + index,
+				     references, count);
+	g_free (uid);
+}
+
+/* Checks that the threads come newest first, and that each thread has
+ * all its messages, returning the number of threads */
+static guint
+check_threads (ImThreadTree *tree)
+{
+	GPtrArray *threads;
+	gint64 latest = G_MAXINT64;
+	guint i, messages = 0, count;
+
+	threads = _im_thread_tree_get_threads (tree, NULL, G_MAXUINT);
+	for (i = 0; i < threads->len; i++) {
+		ImMessageThread *thread = (ImMessageThread *) threads->pdata[i];
+		gint64 thread_latest;
+
+		/* The cursor starts with the date of the newest message */
+		thread_latest = g_ascii_strtoll (thread->cursor, NULL, 10);
+		g_assert_cmpint (thread_latest, <=, latest);
+		latest = thread_latest;
+		g_assert_cmpuint (g_array_index (thread->depths, guint, 0), ==, 0);
+		messages += thread->uids->len;
+	}
+	g_assert_cmpuint (messages, ==, _im_thread_tree_get_messages_count (tree));
+	count = threads->len;
+	g_ptr_array_unref (threads);
+
+	return count;
+}
+
+/* TRUE if @uid is in the newest thread */
+static gboolean
+is_in_first_thread (ImThreadTree *tree,
+		    const gchar *uid)
+{
+	GPtrArray *threads;
+	ImMessageThread *thread;
+	gboolean result = FALSE;
+	guint i;
+
+	threads = _im_thread_tree_get_threads (tree, NULL, 1);
+	thread = (ImMessageThread *) threads->pdata[0];
+	for (i = 0; !result && i < thread->uids->len; i++)
+		result = strcmp (thread->uids->pdata[i], uid) == 0;
+	g_ptr_array_unref (threads);
+
+	return result;
+}
+
+int
+main (int argc, char **argv)
+{
+	ImThreadTree *tree, *loaded;
+	GRand *rand;
+	GArray *order;
+	GString *dump;
+	gchar *path;
+	gint64 start;
+	guint i;
+
+	/* Messages arrive out of order, so replies come before their
+	 * parents and placeholders are filled later */
+	rand = g_rand_new_with_seed (1);
+	order = g_array_sized_new (FALSE, FALSE, sizeof (guint), MESSAGES);
+	for (i = 0; i < MESSAGES; i++)
+		g_array_append_val (order, i);
+	for (i = MESSAGES - 1; i > 0; i--) {
+		guint j = g_rand_int_range (rand, 0, i + 1);
+		guint swap = g_array_index (order, guint, i);
+
+		g_array_index (order, guint, i) = g_array_index (order, guint, j);
+		g_array_index (order, guint, j) = swap;
+	}
+
+	start = g_get_monotonic_time ();
+	tree = _im_thread_tree_new ();
+	for (i = 0; i < MESSAGES; i++)
+		add_reply (tree, g_array_index (order, guint, i));
+	_im_thread_tree_end_build (tree);
+	g_print ("threaded %u messages in %" G_GINT64_FORMAT " usec\n",
+		 MESSAGES, g_get_monotonic_time () - start);
+	g_assert_cmpuint (_im_thread_tree_get_messages_count (tree), ==, MESSAGES);
+	g_assert_cmpuint (check_threads (tree), ==, MESSAGES / THREAD_LENGTH);
+
+	/* A reply to an old thread brings it to the top */
+	start = g_get_monotonic_time ();
+	for (i = 0; i < CHANGES; i++) {
+		guint64 parent = (guint64) g_rand_int_range (rand, 0, MESSAGES) + 1;
+		gchar *uid = g_strdup_printf ("new%u", i);
+
+		_im_thread_tree_add_message (tree, uid, MESSAGES + i + 1, BASE_DATE + MESSAGES + i,
+					     &parent, 1);
+		g_assert (is_in_first_thread (tree, uid));
+		g_free (uid);
+	}
+	g_print ("added %u replies in %" G_GINT64_FORMAT " usec\n",
+		 CHANGES, g_get_monotonic_time () - start);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < CHANGES; i++) {
+		gchar *uid = g_strdup_printf ("new%u", i);
+
+		_im_thread_tree_remove_message (tree, uid);
+		g_free (uid);
+	}
+	g_print ("removed %u replies in %" G_GINT64_FORMAT " usec\n",
+		 CHANGES, g_get_monotonic_time () - start);
+	g_assert_cmpuint (_im_thread_tree_get_messages_count (tree), ==, MESSAGES);
+	g_assert_cmpuint (check_threads (tree), ==, MESSAGES / THREAD_LENGTH);
+
+	/* What is stored on disk between runs */
+	path = g_build_filename (g_get_tmp_dir (), "bench-thread-index.XXXXXX", NULL);
+	close (g_mkstemp (path));
+	dump = _im_thread_tree_dump (tree);
+	if (!g_file_set_contents (path, dump->str, dump->len, NULL))
+		g_error ("failed to write %s", path);
+	start = g_get_monotonic_time ();
+	loaded = _im_thread_tree_new ();
+	_im_thread_tree_load (loaded, path);
+	_im_thread_tree_end_build (loaded);
+	g_print ("loaded %u messages in %" G_GINT64_FORMAT " usec\n",
+		 _im_thread_tree_get_messages_count (loaded), g_get_monotonic_time () - start);
+	g_assert_cmpuint (_im_thread_tree_get_messages_count (loaded), ==, MESSAGES);
+	g_assert_cmpuint (check_threads (loaded), ==, MESSAGES / THREAD_LENGTH);
+
+	g_unlink (path);
+	g_free (path);
+	g_string_free (dump, TRUE);
+	_im_thread_tree_free (loaded);
+	_im_thread_tree_free (tree);
+	g_array_free (order, TRUE);
+	g_rand_free (rand);
+
+	return 0;
+}
@@ -1139,6 +1139,274 @@ im_account_mgr_set_has_new_mails (ImAccountMgr *self,
 	/* TODO: notify about changes */
 }
 
+/**
+ * im_account_mgr_get_push_mode:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains if the account should keep an IDLE connection to get
+ * new messages as soon as they arrive, instead of polling.
+ *
+ * Returns: %TRUE if push mode is enabled for the account
+ */
+gboolean
+im_account_mgr_get_push_mode (ImAccountMgr *self, 
+			      const gchar* account_name)
+{
+	return im_account_mgr_get_bool (self,
+					account_name, 
+					IM_ACCOUNT_PUSH_MODE, 
+					FALSE);
+}
+
+/**
+ * im_account_mgr_set_push_mode:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @push_mode: %TRUE to enable push mode in the account.
+ *
+ * Sets if the account should keep an IDLE connection to get
+ * new messages as soon as they arrive. It only applies to IMAP
+ * accounts, and it will fallback to polling if the server does
+ * not support IDLE.
+ */
+void 
+im_account_mgr_set_push_mode (ImAccountMgr *self, 
+			      const gchar* account_name,
+			      gboolean push_mode)
+{
+	im_account_mgr_set_bool (self, 
+				 account_name, 
+				 IM_ACCOUNT_PUSH_MODE, 
+				 push_mode, 
+				 FALSE);
+}
+
+/**
+ * im_account_mgr_get_send_rate_limit:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains the maximum number of messages the send queue of the
+ * account should send per minute.
+ *
+ * Returns: the messages per minute, or 0 if there's no limit
+ */
+guint
+im_account_mgr_get_send_rate_limit (ImAccountMgr *self, 
+				    const gchar* account_name)
+{
+	gint rate_limit;
+
+	rate_limit = im_account_mgr_get_int (self,
+					     account_name,
+					     IM_ACCOUNT_SEND_RATE_LIMIT,
+					     FALSE);
+
+	return MAX (rate_limit, 0);
+}
+
+/**
+ * im_account_mgr_set_send_rate_limit:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @rate_limit: the messages per minute, or 0 for no limit
+ *
+ * Sets the maximum number of messages the send queue of the account
+ * should send per minute. Used for servers throttling clients that
+ * send too fast.
+ */
+void
+im_account_mgr_set_send_rate_limit (ImAccountMgr *self, 
+				    const gchar* account_name,
+				    guint rate_limit)
+{
+	im_account_mgr_set_int (self,
+				account_name,
+				IM_ACCOUNT_SEND_RATE_LIMIT,
+				rate_limit,
+				FALSE /* not server account */);
+}
+
+/**
+ * im_account_mgr_get_filter_rules:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains the filter rules applied to the new messages of the inbox
+ * of the account, in the format parsed by im_filter_rule_parse().
+ *
+ * Returns: (transfer full) (element-type utf8): the rules, in order
+ */
+GSList *
+im_account_mgr_get_filter_rules (ImAccountMgr *self, 
+				 const gchar* account_name)
+{
+	return im_account_mgr_get_list (self,
+					account_name,
+					IM_ACCOUNT_FILTER_RULES,
+					IM_CONF_VALUE_STRING,
+					FALSE);
+}
+
+/**
+ * im_account_mgr_set_filter_rules:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @rules: (element-type utf8): the rules, as returned by
+ * im_filter_rule_to_string()
+ *
+ * Sets the filter rules of the account. The first rule matching a new
+ * message decides what to do with it.
+ */
+void
+im_account_mgr_set_filter_rules (ImAccountMgr *self, 
+				 const gchar* account_name,
+				 GSList *rules)
+{
+	im_account_mgr_set_list (self,
+				 account_name,
+				 IM_ACCOUNT_FILTER_RULES,
+				 rules,
+				 IM_CONF_VALUE_STRING,
+				 FALSE /* not server account */);
+}
+
+/**
+ * im_account_mgr_get_retention_days:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains the number of days the messages retrieved with POP are kept
+ * in the local inbox of the account.
+ *
+ * Returns: the days, or 0 if messages never expire
+ */
+guint
+im_account_mgr_get_retention_days (ImAccountMgr *self, 
+				   const gchar* account_name)
+{
+	gint days;
+
+	days = im_account_mgr_get_int (self,
+				       account_name,
+				       IM_ACCOUNT_RETENTION_DAYS,
+				       FALSE);
+
+	return MAX (days, 0);
+}
+
+/**
+ * im_account_mgr_set_retention_days:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @days: the days, or 0 to keep the messages forever
+ *
+ * Sets the number of days the messages retrieved with POP are kept
+ * in the local inbox. Older ones are expunged by #ImLocalCompactor.
+ */
+void
+im_account_mgr_set_retention_days (ImAccountMgr *self, 
+				   const gchar* account_name,
+				   guint days)
+{
+	im_account_mgr_set_int (self,
+				account_name,
+				IM_ACCOUNT_RETENTION_DAYS,
+				days,
+				FALSE /* not server account */);
+}
+
+/**
+ * im_account_mgr_get_retention_count:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains the maximum number of messages kept in the local inbox of
+ * the account.
+ *
+ * Returns: the messages, or 0 if there's no limit
+ */
+guint
+im_account_mgr_get_retention_count (ImAccountMgr *self, 
+				    const gchar* account_name)
+{
+	gint count;
+
+	count = im_account_mgr_get_int (self,
+					account_name,
+					IM_ACCOUNT_RETENTION_COUNT,
+					FALSE);
+
+	return MAX (count, 0);
+}
+
+/**
+ * im_account_mgr_set_retention_count:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @count: the messages, or 0 for no limit
+ *
+ * Sets the maximum number of messages kept in the local inbox. The
+ * oldest ones over the limit are expunged by #ImLocalCompactor.
+ */
+void
+im_account_mgr_set_retention_count (ImAccountMgr *self, 
+				    const gchar* account_name,
+				    guint count)
+{
+	im_account_mgr_set_int (self,
+				account_name,
+				IM_ACCOUNT_RETENTION_COUNT,
+				count,
+				FALSE /* not server account */);
+}
+
+/**
+ * im_account_mgr_get_retention_size:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ *
+ * Obtains the maximum size of the messages kept in the local inbox of
+ * the account.
+ *
+ * Returns: the size in kilobytes, or 0 if there's no limit
+ */
+guint
+im_account_mgr_get_retention_size (ImAccountMgr *self, 
+				   const gchar* account_name)
+{
+	gint size;
+
+	size = im_account_mgr_get_int (self,
+				       account_name,
+				       IM_ACCOUNT_RETENTION_SIZE,
+				       FALSE);
+
+	return MAX (size, 0);
+}
+
+/**
+ * im_account_mgr_set_retention_size:
+ * @self: an #ImAccountMgr
+ * @account_name: the account name
+ * @size: the size in kilobytes, or 0 for no limit
+ *
+ * Sets the maximum size of the messages kept in the local inbox. The
+ * oldest ones over the limit are expunged by #ImLocalCompactor.
+ */
+void
+im_account_mgr_set_retention_size (ImAccountMgr *self, 
+				   const gchar* account_name,
+				   guint size)
+{
+	im_account_mgr_set_int (self,
+				account_name,
+				IM_ACCOUNT_RETENTION_SIZE,
+				size,
+				FALSE /* not server account */);
+}
+
 gint  
 im_account_mgr_get_retrieve_limit (ImAccountMgr *self, 
 				   const gchar* account_name)
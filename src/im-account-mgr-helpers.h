@@ -134,6 +134,36 @@ gboolean            im_account_mgr_get_has_new_mails               (ImAccountMgr
 void                im_account_mgr_set_has_new_mails               (ImAccountMgr *self, 
 								    const gchar* account_name,
 								    gboolean has_new_mails);
+gboolean            im_account_mgr_get_push_mode                   (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_push_mode                   (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    gboolean push_mode);
+guint               im_account_mgr_get_send_rate_limit             (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_send_rate_limit             (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    guint rate_limit);
+GSList *            im_account_mgr_get_filter_rules                (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_filter_rules                (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    GSList *rules);
+guint               im_account_mgr_get_retention_days              (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_retention_days              (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    guint days);
+guint               im_account_mgr_get_retention_count             (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_retention_count             (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    guint count);
+guint               im_account_mgr_get_retention_size              (ImAccountMgr *self, 
+								    const gchar* account_name);
+void                im_account_mgr_set_retention_size              (ImAccountMgr *self, 
+								    const gchar* account_name,
+								    guint size);
 gint                im_account_mgr_get_retrieve_limit              (ImAccountMgr *self, 
 								    const gchar* account_name);
 void                im_account_mgr_set_retrieve_limit             (ImAccountMgr *self, 
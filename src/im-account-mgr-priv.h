@@ -50,6 +50,10 @@
 #define IM_ACCOUNT_SUBNAMESPACE      "/accounts"
 #define IM_ACCOUNT_NAMESPACE         (im_defs_namespace (IM_ACCOUNT_SUBNAMESPACE))
 #define IM_CONF_DEFAULT_ACCOUNT      (im_defs_namespace ("/default_account"))
+#define IM_CONF_UPDATE_INTERVAL      (im_defs_namespace ("/update_interval")) /* int, minutes */
+#define IM_CONF_SEND_RETRY_DELAY     (im_defs_namespace ("/send_retry_delay")) /* int, seconds */
+#define IM_CONF_SEND_RETRY_MAX_DELAY (im_defs_namespace ("/send_retry_max_delay")) /* int, seconds */
+#define IM_CONF_SEND_MAX_ATTEMPTS    (im_defs_namespace ("/send_max_attempts")) /* int */
 
 #define IM_SERVER_ACCOUNT_SUBNAMESPACE "/server_accounts"
 #define IM_SERVER_ACCOUNT_NAMESPACE  (im_defs_namespace (IM_SERVER_ACCOUNT_SUBNAMESPACE))
@@ -84,6 +88,12 @@
 #define IM_ACCOUNT_TYPE		 "type"	             /* string */
 #define IM_ACCOUNT_LAST_UPDATED      "last_updated"      /* int */
 #define IM_ACCOUNT_HAS_NEW_MAILS     "has_new_mails"     /* boolean */
+#define IM_ACCOUNT_PUSH_MODE         "push_mode"         /* boolean */
+#define IM_ACCOUNT_SEND_RATE_LIMIT   "send_rate_limit"   /* int, messages per minute */
+#define IM_ACCOUNT_FILTER_RULES      "filter_rules"      /* string list */
+#define IM_ACCOUNT_RETENTION_DAYS    "retention_days"    /* int, days in the local inbox */
+#define IM_ACCOUNT_RETENTION_COUNT   "retention_count"   /* int, messages in the local inbox */
+#define IM_ACCOUNT_RETENTION_SIZE    "retention_size"    /* int, kilobytes in the local inbox */
 
 #define IM_ACCOUNT_LEAVE_ON_SERVER   "leave_on_server"   /* boolean */
 #define IM_ACCOUNT_PREFERRED_CNX     "preferred_cnx"     /* string */
@@ -473,6 +473,9 @@ im_account_mgr_add_account (ImAccountMgr *self,
 	 * (possibly this gconf key should be under the server account): */
 	im_account_mgr_set_bool (self, name, IM_ACCOUNT_LEAVE_ON_SERVER, TRUE, FALSE);
 	im_account_mgr_set_bool (self, name, IM_ACCOUNT_ENABLED, enabled,FALSE);
+	/* Push needs the imapx provider, so it's only used when
+	 * the user asks for it */
+	im_account_mgr_set_bool (self, name, IM_ACCOUNT_PUSH_MODE, FALSE, FALSE);
 
 	/* Fill other data */
 	im_account_mgr_set_string (self, name,
@@ -1114,6 +1117,11 @@ im_account_mgr_set_bool (ImAccountMgr * self, const gchar * name,
 			g_signal_emit (G_OBJECT(self), signals[ACCOUNT_UPDATED_SIGNAL], 
 					0, name);
 		}
+		/* Push mode changes the provider of the store */
+		if (strcmp (key, IM_ACCOUNT_PUSH_MODE) == 0) {
+			g_signal_emit (G_OBJECT(self), signals[ACCOUNT_CHANGED_SIGNAL],
+				       0, name, IM_ACCOUNT_TYPE_STORE);
+		}
 	}
 
 	return retval;
@@ -1675,6 +1683,56 @@ im_account_mgr_get_default_account  (ImAccountMgr *self)
 	return account;
 }
 
+/* Gets a positive int setting, or @default_value if it's unset or not valid */
+static gint
+get_positive_int (ImAccountMgr *self,
+		  const gchar *key,
+		  gint default_value)
+{
+	ImConf *conf;
+	gint value;
+
+	g_return_val_if_fail (self, default_value);
+
+	conf = IM_ACCOUNT_MGR_GET_PRIVATE (self)->im_conf;
+	if (!im_conf_key_exists (conf, key, NULL))
+		return default_value;
+
+	value = im_conf_get_int (conf, key, NULL);
+	if (value <= 0)
+		return default_value;
+
+	return value;
+}
+
+gint
+im_account_mgr_get_update_interval (ImAccountMgr *self)
+{
+	return get_positive_int (self, IM_CONF_UPDATE_INTERVAL,
+				 IM_ACCOUNT_MGR_DEFAULT_UPDATE_INTERVAL);
+}
+
+gint
+im_account_mgr_get_send_retry_delay (ImAccountMgr *self)
+{
+	return get_positive_int (self, IM_CONF_SEND_RETRY_DELAY,
+				 IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_DELAY);
+}
+
+gint
+im_account_mgr_get_send_retry_max_delay (ImAccountMgr *self)
+{
+	return get_positive_int (self, IM_CONF_SEND_RETRY_MAX_DELAY,
+				 IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_MAX_DELAY);
+}
+
+gint
+im_account_mgr_get_send_max_attempts (ImAccountMgr *self)
+{
+	return get_positive_int (self, IM_CONF_SEND_MAX_ATTEMPTS,
+				 IM_ACCOUNT_MGR_DEFAULT_SEND_MAX_ATTEMPTS);
+}
+
 static gboolean
 im_account_mgr_unset_default_account (ImAccountMgr *self)
 {
@@ -373,6 +373,61 @@ gboolean im_account_mgr_set_default_account  (ImAccountMgr *self,
  */
 gchar* im_account_mgr_get_default_account  (ImAccountMgr *self);
 
+/* Default interval between automatic updates, in minutes */
+#define IM_ACCOUNT_MGR_DEFAULT_UPDATE_INTERVAL 15
+
+/**
+ * im_account_mgr_get_update_interval:
+ * @self: a ImAccountMgr instance
+ *
+ * get the interval between automatic updates of accounts not
+ * using push mode.
+ *
+ * Returns: the interval in minutes
+ */
+gint im_account_mgr_get_update_interval (ImAccountMgr *self);
+
+/* Delay before first retry of a message that failed to be sent, in seconds.
+ * It doubles on each failure */
+#define IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_DELAY 60
+/* Maximum delay between retries of a message, in seconds */
+#define IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_MAX_DELAY (60 * 60)
+/* Attempts to send a message before it's considered failed */
+#define IM_ACCOUNT_MGR_DEFAULT_SEND_MAX_ATTEMPTS 8
+
+/**
+ * im_account_mgr_get_send_retry_delay:
+ * @self: a ImAccountMgr instance
+ *
+ * get the delay before retrying a message that failed to be
+ * sent the first time. Next retries double it, up to
+ * im_account_mgr_get_send_retry_max_delay().
+ *
+ * Returns: the delay in seconds
+ */
+gint im_account_mgr_get_send_retry_delay (ImAccountMgr *self);
+
+/**
+ * im_account_mgr_get_send_retry_max_delay:
+ * @self: a ImAccountMgr instance
+ *
+ * get the maximum delay between retries of a message that failed
+ * to be sent.
+ *
+ * Returns: the delay in seconds
+ */
+gint im_account_mgr_get_send_retry_max_delay (ImAccountMgr *self);
+
+/**
+ * im_account_mgr_get_send_max_attempts:
+ * @self: a ImAccountMgr instance
+ *
+ * get the number of attempts to send a message before giving up.
+ *
+ * Returns: the number of attempts
+ */
+gint im_account_mgr_get_send_max_attempts (ImAccountMgr *self);
+
 /**
  * im_account_mgr_get_display_name:
  * @self: a ImAccountMgr instance
@@ -0,0 +1,81 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-address-index-priv.h : Private methods for ImAddressIndex */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IM_ADDRESS_INDEX_PRIV_H__
+#define __IM_ADDRESS_INDEX_PRIV_H__
+
+#include <im-address-index.h>
+
+/*
+ * private functions, only for use in im-address-index and its
+ * benchmark, to fill an index without reading the accounts
+ */
+
+G_BEGIN_DECLS
+
+/**
+ * _im_address_index_add_address:
+ * @self: a #ImAddressIndex
+ * @account_id: the account the address was seen in
+ * @name: (allow-none): the display name
+ * @address: the email address
+ * @count: the number of messages it was seen in
+ * @date: the date of the newest of them
+ *
+ * Adds the messages of an address to the index.
+ */
+void                _im_address_index_add_address (ImAddressIndex *self,
+						   const gchar *account_id,
+						   const gchar *name,
+						   const gchar *address,
+						   guint count,
+						   gint64 date);
+
+/**
+ * _im_address_index_remove_account_addresses:
+ * @self: a #ImAddressIndex
+ * @account_id: an account id
+ *
+ * Takes out of the index the messages of @account_id, dropping the
+ * addresses only seen in them.
+ */
+void                _im_address_index_remove_account_addresses (ImAddressIndex *self,
+								const gchar *account_id);
+
+G_END_DECLS
+
+#endif /* __IM_ADDRESS_INDEX_PRIV_H__ */
@@ -0,0 +1,1151 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-address-index.c : Index of the addresses for recipient completion */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-address-index.h"
+#include "im-address-index-priv.h"
+
+#include "im-account-mgr.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _ImAddressIndexPrivate ImAddressIndexPrivate;
+struct _ImAddressIndexPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* Protects the index, as it's built from threads */
+	GMutex lock;
+	/* case folded address -> AddressEntry */
+	GHashTable *entries;
+	/* AddressKey, sorted by key */
+	GSequence *keys;
+	/* case folded prefix of up to IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH
+	 * characters of the keys -> GPtrArray with the best ranked
+	 * AddressEntry of the keys starting with it, best first */
+	GHashTable *top;
+	/* ids of the accounts whose messages are indexed */
+	GHashTable *indexed_accounts;
+	/* id of the accounts being indexed -> full names of their
+	 * folders already read by the scan */
+	GHashTable *scanning_accounts;
+	gchar *path;
+	guint save_id;
+	/* Serializes the writes of the file */
+	GMutex save_lock;
+};
+
+#define IM_ADDRESS_INDEX_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					      IM_TYPE_ADDRESS_INDEX, \
+					      ImAddressIndexPrivate))
+
+typedef struct _AccountCount {
+	/* interned */
+	const gchar *account_id;
+	guint count;
+} AccountCount;
+
+typedef struct _AddressEntry {
+	gchar *address;
+	gchar *name;
+	guint count;
+	gint64 last_seen;
+	/* log of the score, see update_rank */
+	gdouble rank;
+	/* AccountCount, the contributions to count of each account */
+	GArray *accounts;
+	/* iters of the keys of the entry */
+	GPtrArray *key_iters;
+} AddressEntry;
+
+/* The address, the name, and each word of the name after the first,
+ * case folded, are the keys of an entry */
+typedef struct _AddressKey {
+	gchar *key;
+	AddressEntry *entry;
+} AddressKey;
+
+G_DEFINE_TYPE (ImAddressIndex, im_address_index, G_TYPE_OBJECT);
+
+static void
+address_entry_free (AddressEntry *entry)
+{
+	g_ptr_array_unref (entry->key_iters);
+	g_array_free (entry->accounts, TRUE);
+	g_free (entry->address);
+	g_free (entry->name);
+	g_slice_free (AddressEntry, entry);
+}
+
+static void
+address_key_free (AddressKey *key)
+{
+	g_free (key->key);
+	g_slice_free (AddressKey, key);
+}
+
+/* Keys without entry, used to search, go before the equal ones */
+static gint
+compare_keys (gconstpointer a,
+	      gconstpointer b,
+	      gpointer userdata)
+{
+	const AddressKey *key_a = (const AddressKey *) a;
+	const AddressKey *key_b = (const AddressKey *) b;
+	gint result;
+
+	result = strcmp (key_a->key, key_b->key);
+	if (result == 0 && key_a->entry != key_b->entry) {
+		if (key_a->entry == NULL)
+			result = -1;
+		else if (key_b->entry == NULL)
+			result = 1;
+		else
+			result = (GPOINTER_TO_SIZE (key_a->entry) < GPOINTER_TO_SIZE (key_b->entry)) ? -1 : 1;
+	}
+
+	return result;
+}
+
+/* The score is the count halved every IM_ADDRESS_INDEX_RECENCY_DAYS
+ * since the address was last seen, count * 2^(-age / days). Its log,
+ * log (count) + log (2) * (last_seen - now) / days, without the term of
+ * now, gives the same order at any time, so the best entries of a
+ * prefix can be kept */
+static void
+update_rank (AddressEntry *entry)
+{
+	if (entry->count == 0)
+		entry->rank = -G_MAXDOUBLE;
+	else
+		entry->rank = log (entry->count) + G_LN2 * entry->last_seen /
+			(IM_ADDRESS_INDEX_RECENCY_DAYS * 24 * 60 * 60);
+}
+
+/* Best ranked first */
+static gint
+compare_ranks (const AddressEntry *entry_a,
+	       const AddressEntry *entry_b)
+{
+	if (entry_a->rank != entry_b->rank)
+		return entry_a->rank > entry_b->rank ? -1 : 1;
+
+	return strcmp (entry_a->address, entry_b->address);
+}
+
+/* Keeps @entry in its place in @top, if it's among the best */
+static void
+top_offer (GPtrArray *top,
+	   AddressEntry *entry)
+{
+	guint i, position;
+
+	for (i = 0; i < top->len && top->pdata[i] != entry; i++);
+	if (i < top->len)
+		g_ptr_array_remove_index (top, i);
+
+	for (position = 0; position < top->len &&
+		     compare_ranks (top->pdata[position], entry) < 0; position++);
+	if (position >= IM_ADDRESS_INDEX_TOP_COUNT)
+		return;
+
+	g_ptr_array_add (top, NULL);
+	memmove (top->pdata + position + 1, top->pdata + position,
+		 (top->len - position - 1) * sizeof (gpointer));
+	top->pdata[position] = entry;
+	if (top->len > IM_ADDRESS_INDEX_TOP_COUNT)
+		g_ptr_array_set_size (top, IM_ADDRESS_INDEX_TOP_COUNT);
+}
+
+/* Copies to @prefix the first @length characters of @key, returning
+ * FALSE if it's shorter */
+static gboolean
+get_key_prefix (const gchar *key,
+		guint length,
+		gchar *prefix)
+{
+	const gchar *end = key;
+	guint i;
+
+	for (i = 0; i < length; i++) {
+		if (*end == '\0')
+			return FALSE;
+		end = g_utf8_next_char (end);
+	}
+	memcpy (prefix, key, end - key);
+	prefix[end - key] = '\0';
+
+	return TRUE;
+}
+
+/* Requires the lock. Offers @entry to the tops of the prefixes of @key */
+static void
+top_offer_key (ImAddressIndexPrivate *priv,
+	       const gchar *key,
+	       AddressEntry *entry)
+{
+	gchar prefix[IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH * 6 + 1];
+	guint length;
+
+	for (length = 0; length <= IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH &&
+		     get_key_prefix (key, length, prefix); length++) {
+		GPtrArray *top = g_hash_table_lookup (priv->top, prefix);
+
+		if (top == NULL) {
+			top = g_ptr_array_sized_new (IM_ADDRESS_INDEX_TOP_COUNT);
+			g_hash_table_insert (priv->top, g_strdup (prefix), top);
+		}
+		top_offer (top, entry);
+	}
+}
+
+/* Requires the lock. Places @entry in the tops after its rank grows */
+static void
+top_offer_entry (ImAddressIndexPrivate *priv,
+		 AddressEntry *entry)
+{
+	guint i;
+
+	for (i = 0; i < entry->key_iters->len; i++) {
+		AddressKey *key = (AddressKey *) g_sequence_get (entry->key_iters->pdata[i]);
+
+		top_offer_key (priv, key->key, entry);
+	}
+}
+
+/* Requires the lock. Fills again the top of @prefix from the keys */
+static void
+top_rebuild_prefix (ImAddressIndexPrivate *priv,
+		    GPtrArray *top,
+		    const gchar *prefix)
+{
+	AddressKey probe;
+	GSequenceIter *iter;
+
+	g_ptr_array_set_size (top, 0);
+	probe.key = (gchar *) prefix;
+	probe.entry = NULL;
+	for (iter = g_sequence_search (priv->keys, &probe, compare_keys, NULL);
+	     !g_sequence_iter_is_end (iter);
+	     iter = g_sequence_iter_next (iter)) {
+		AddressKey *key = (AddressKey *) g_sequence_get (iter);
+
+		if (!g_str_has_prefix (key->key, prefix))
+			break;
+		top_offer (top, key->entry);
+	}
+}
+
+/* Requires the lock. Fills again all the tops, after the ranks of many
+ * entries went down */
+static void
+top_rebuild (ImAddressIndexPrivate *priv)
+{
+	GSequenceIter *iter;
+
+	g_hash_table_remove_all (priv->top);
+	for (iter = g_sequence_get_begin_iter (priv->keys);
+	     !g_sequence_iter_is_end (iter);
+	     iter = g_sequence_iter_next (iter)) {
+		AddressKey *key = (AddressKey *) g_sequence_get (iter);
+
+		top_offer_key (priv, key->key, key->entry);
+	}
+}
+
+/* Requires the lock */
+static void
+add_key (ImAddressIndexPrivate *priv,
+	 AddressEntry *entry,
+	 const gchar *text)
+{
+	AddressKey *key;
+
+	key = g_slice_new (AddressKey);
+	key->key = g_utf8_casefold (text, -1);
+	key->entry = entry;
+	g_ptr_array_add (entry->key_iters,
+			 g_sequence_insert_sorted (priv->keys, key, compare_keys, NULL));
+}
+
+/* Requires the lock */
+static void
+index_entry (ImAddressIndexPrivate *priv,
+	     AddressEntry *entry)
+{
+	const gchar *word;
+
+	add_key (priv, entry, entry->address);
+	if (entry->name == NULL)
+		return;
+
+	add_key (priv, entry, entry->name);
+	for (word = strchr (entry->name, ' '); word != NULL; word = strchr (word, ' ')) {
+		while (*word == ' ')
+			word++;
+		if (*word != '\0')
+			add_key (priv, entry, word);
+	}
+}
+
+/* Requires the lock. The tops the entry leaves are filled again from
+ * the keys if they were full, so they keep the best of the prefix */
+static void
+unindex_entry (ImAddressIndexPrivate *priv,
+	       AddressEntry *entry)
+{
+	GHashTable *prefixes;
+	GHashTableIter iter;
+	gpointer key;
+	guint i;
+
+	prefixes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < entry->key_iters->len; i++) {
+		AddressKey *address_key = (AddressKey *) g_sequence_get (entry->key_iters->pdata[i]);
+		gchar prefix[IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH * 6 + 1];
+		guint length;
+
+		for (length = 0; length <= IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH &&
+			     get_key_prefix (address_key->key, length, prefix); length++)
+			g_hash_table_add (prefixes, g_strdup (prefix));
+		g_sequence_remove (entry->key_iters->pdata[i]);
+	}
+	g_ptr_array_set_size (entry->key_iters, 0);
+
+	g_hash_table_iter_init (&iter, prefixes);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GPtrArray *top = g_hash_table_lookup (priv->top, key);
+
+		if (top && g_ptr_array_remove (top, entry) &&
+		    top->len == IM_ADDRESS_INDEX_TOP_COUNT - 1)
+			top_rebuild_prefix (priv, top, (const gchar *) key);
+	}
+	g_hash_table_destroy (prefixes);
+}
+
+/* Requires the lock */
+static void
+add_account_count (AddressEntry *entry,
+		   const gchar *account_id,
+		   guint count)
+{
+	AccountCount account_count;
+	guint i;
+
+	entry->count += count;
+	account_id = g_intern_string (account_id);
+	for (i = 0; i < entry->accounts->len; i++) {
+		if (g_array_index (entry->accounts, AccountCount, i).account_id == account_id) {
+			g_array_index (entry->accounts, AccountCount, i).count += count;
+			return;
+		}
+	}
+
+	account_count.account_id = account_id;
+	account_count.count = count;
+	g_array_append_val (entry->accounts, account_count);
+}
+
+/* Requires the lock */
+static void
+add_address (ImAddressIndexPrivate *priv,
+	     const gchar *account_id,
+	     const gchar *name,
+	     const gchar *address,
+	     guint count,
+	     gint64 date)
+{
+	AddressEntry *entry;
+	gchar *folded;
+
+	if (address == NULL || strchr (address, '@') == NULL)
+		return;
+	if (name && *name == '\0')
+		name = NULL;
+
+	folded = g_utf8_casefold (address, -1);
+	entry = g_hash_table_lookup (priv->entries, folded);
+	if (entry == NULL) {
+		entry = g_slice_new0 (AddressEntry);
+		entry->address = g_strdup (address);
+		entry->name = g_strdup (name);
+		entry->last_seen = date;
+		entry->key_iters = g_ptr_array_new ();
+		entry->accounts = g_array_new (FALSE, FALSE, sizeof (AccountCount));
+		add_account_count (entry, account_id, count);
+		g_hash_table_insert (priv->entries, folded, entry);
+		index_entry (priv, entry);
+	} else {
+		g_free (folded);
+
+		add_account_count (entry, account_id, count);
+		/* The newest messages give the name */
+		if (date >= entry->last_seen) {
+			entry->last_seen = date;
+			if (name && g_strcmp0 (name, entry->name) != 0) {
+				unindex_entry (priv, entry);
+				g_free (entry->name);
+				entry->name = g_strdup (name);
+				index_entry (priv, entry);
+			}
+		}
+	}
+
+	/* The rank only grows here */
+	update_rank (entry);
+	top_offer_entry (priv, entry);
+}
+
+/* Requires the lock */
+static void
+add_addresses (ImAddressIndexPrivate *priv,
+	       const gchar *account_id,
+	       const gchar *addresses,
+	       gint64 date)
+{
+	CamelInternetAddress *cia;
+	gint i;
+
+	if (addresses == NULL || *addresses == '\0')
+		return;
+
+	cia = camel_internet_address_new ();
+	if (camel_address_unformat (CAMEL_ADDRESS (cia), addresses) > 0) {
+		for (i = 0; i < camel_address_length (CAMEL_ADDRESS (cia)); i++) {
+			const gchar *name = NULL, *address = NULL;
+
+			if (camel_internet_address_get (cia, i, &name, &address))
+				add_address (priv, account_id, name, address, 1, date);
+		}
+	}
+	g_object_unref (cia);
+}
+
+/* Requires the lock */
+static void
+add_message_info (ImAddressIndexPrivate *priv,
+		  const gchar *account_id,
+		  CamelMessageInfo *mi)
+{
+	gint64 date;
+
+	date = camel_message_info_date_sent (mi);
+	if (date <= 0)
+		date = camel_message_info_date_received (mi);
+
+	add_addresses (priv, account_id, camel_message_info_from (mi), date);
+	add_addresses (priv, account_id, camel_message_info_to (mi), date);
+	add_addresses (priv, account_id, camel_message_info_cc (mi), date);
+}
+
+/* Requires the lock. Drops the addresses only seen in messages of the account */
+static void
+remove_account_addresses (ImAddressIndexPrivate *priv,
+			  const gchar *account_id)
+{
+	GHashTableIter iter;
+	gpointer value;
+	guint i;
+
+	/* The tops are filled again at the end, instead of each time an
+	 * entry leaves them */
+	g_hash_table_remove_all (priv->top);
+	account_id = g_intern_string (account_id);
+	g_hash_table_iter_init (&iter, priv->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		AddressEntry *entry = (AddressEntry *) value;
+
+		for (i = 0; i < entry->accounts->len; i++) {
+			AccountCount *account_count = &g_array_index (entry->accounts, AccountCount, i);
+
+			if (account_count->account_id == account_id) {
+				entry->count -= account_count->count;
+				g_array_remove_index_fast (entry->accounts, i);
+				update_rank (entry);
+				break;
+			}
+		}
+		if (entry->count == 0) {
+			unindex_entry (priv, entry);
+			g_hash_table_iter_remove (&iter);
+		}
+	}
+	top_rebuild (priv);
+}
+
+/* The index is written out of the main loop, as it takes a few
+ * megabytes with many addresses */
+static void
+save_thread (GSimpleAsyncResult *simple,
+	     GObject *object,
+	     GCancellable *cancellable)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (object);
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *contents;
+	GError *_error = NULL;
+	gchar *dir;
+
+	contents = g_string_new ("");
+
+	/* A later save writes a newer index, so it waits for this one */
+	g_mutex_lock (&priv->save_lock);
+	g_mutex_lock (&priv->lock);
+	g_hash_table_iter_init (&iter, priv->indexed_accounts);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		gchar *account_id = g_strescape ((const gchar *) key, NULL);
+
+		g_string_append_printf (contents, "account\t%s\n", account_id);
+		g_free (account_id);
+	}
+	g_hash_table_iter_init (&iter, priv->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		AddressEntry *entry = (AddressEntry *) value;
+		gchar *address, *name;
+		guint i;
+
+		address = g_strescape (entry->address, NULL);
+		name = g_strescape (entry->name ? entry->name : "", NULL);
+		for (i = 0; i < entry->accounts->len; i++) {
+			AccountCount *account_count = &g_array_index (entry->accounts, AccountCount, i);
+			gchar *account_id = g_strescape (account_count->account_id, NULL);
+
+			g_string_append_printf (contents, "%u\t%" G_GINT64_FORMAT "\t%s\t%s\t%s\n",
+						account_count->count, entry->last_seen,
+						address, name, account_id);
+			g_free (account_id);
+		}
+		g_free (address);
+		g_free (name);
+	}
+	g_mutex_unlock (&priv->lock);
+
+	dir = g_path_get_dirname (priv->path);
+	g_mkdir_with_parents (dir, 0700);
+	if (!g_file_set_contents (priv->path, contents->str, contents->len, &_error)) {
+		g_warning ("%s: failed to write %s: %s", __FUNCTION__,
+			   priv->path, _error->message);
+		g_error_free (_error);
+	}
+	g_mutex_unlock (&priv->save_lock);
+	g_string_free (contents, TRUE);
+	g_free (dir);
+}
+
+static gboolean
+on_save_timeout (gpointer userdata)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (userdata);
+	GSimpleAsyncResult *simple;
+
+	g_mutex_lock (&priv->lock);
+	priv->save_id = 0;
+	g_mutex_unlock (&priv->lock);
+
+	simple = g_simple_async_result_new (G_OBJECT (userdata),
+					    NULL, NULL,
+					    on_save_timeout);
+	g_simple_async_result_run_in_thread (simple, save_thread,
+					     G_PRIORITY_LOW, NULL);
+	g_object_unref (simple);
+
+	return FALSE;
+}
+
+/* Requires the lock */
+static void
+schedule_save (ImAddressIndex *self)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	if (priv->save_id)
+		return;
+
+	priv->save_id = g_timeout_add_seconds_full (G_PRIORITY_LOW,
+						    IM_ADDRESS_INDEX_SAVE_DELAY,
+						    on_save_timeout,
+						    g_object_ref (self),
+						    g_object_unref);
+}
+
+static void
+load_index (ImAddressIndex *self)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+	gchar *contents = NULL;
+	gchar **lines;
+	gint64 start;
+	gint i;
+
+	if (!g_file_get_contents (priv->path, &contents, NULL, NULL))
+		return;
+
+	start = g_get_monotonic_time ();
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	g_mutex_lock (&priv->lock);
+	for (i = 0; lines[i] != NULL; i++) {
+		gchar **fields = g_strsplit (lines[i], "\t", 5);
+
+		if (g_strv_length (fields) == 2 && strcmp (fields[0], "account") == 0) {
+			g_hash_table_add (priv->indexed_accounts, g_strcompress (fields[1]));
+		} else if (g_strv_length (fields) >= 4) {
+			gchar *address = g_strcompress (fields[2]);
+			gchar *name = g_strcompress (fields[3]);
+			/* Entries saved without account are never dropped */
+			gchar *account_id = g_strcompress (fields[4] ? fields[4] : "");
+
+			add_address (priv, account_id, name, address,
+				     strtoul (fields[0], NULL, 10),
+				     g_ascii_strtoll (fields[1], NULL, 10));
+			g_free (account_id);
+			g_free (address);
+			g_free (name);
+		}
+		g_strfreev (fields);
+	}
+	g_debug ("%s: loaded %u addresses in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+		 g_hash_table_size (priv->entries), g_get_monotonic_time () - start);
+	g_mutex_unlock (&priv->lock);
+
+	g_strfreev (lines);
+}
+
+static void
+index_folder_sync (ImAddressIndex *self,
+		   const gchar *account_id,
+		   CamelFolder *folder,
+		   GCancellable *cancellable)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+	GHashTable *scanned;
+	GPtrArray *uids;
+	guint i;
+
+	/* From now on, the changes of the folder are not in the uids read
+	 * by the scan, so on_folder_changed adds them */
+	g_mutex_lock (&priv->lock);
+	uids = camel_folder_get_uids (folder);
+	scanned = g_hash_table_lookup (priv->scanning_accounts, account_id);
+	if (scanned)
+		g_hash_table_add (scanned, g_strdup (camel_folder_get_full_name (folder)));
+	g_mutex_unlock (&priv->lock);
+
+	for (i = 0; i < uids->len; i++) {
+		CamelMessageInfo *mi;
+
+		if (g_cancellable_is_cancelled (cancellable))
+			break;
+
+		mi = camel_folder_get_message_info (folder, uids->pdata[i]);
+		if (mi == NULL)
+			continue;
+		g_mutex_lock (&priv->lock);
+		add_message_info (priv, account_id, mi);
+		g_mutex_unlock (&priv->lock);
+		camel_folder_free_message_info (folder, mi);
+	}
+	camel_folder_free_uids (folder, uids);
+}
+
+static void
+index_folder_info_sync (ImAddressIndex *self,
+			const gchar *account_id,
+			CamelFolderInfo *fi,
+			GCancellable *cancellable)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	for (; fi != NULL; fi = fi->next) {
+		/* The inbox is indexed apart, as it may be local */
+		if (!(fi->flags & CAMEL_FOLDER_NOSELECT) &&
+		    g_ascii_strcasecmp (fi->full_name, "INBOX") != 0) {
+			CamelFolder *folder;
+
+			folder = im_service_mgr_get_folder (priv->service_mgr, account_id,
+							    fi->full_name, cancellable, NULL);
+			if (folder) {
+				index_folder_sync (self, account_id, folder, cancellable);
+				g_object_unref (folder);
+			}
+		}
+		if (fi->child)
+			index_folder_info_sync (self, account_id, fi->child, cancellable);
+	}
+}
+
+static gboolean
+index_account_sync (ImAddressIndex *self,
+		    const gchar *account_id,
+		    GCancellable *cancellable,
+		    GError **error)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+	GError *_error = NULL;
+	CamelService *store;
+	CamelFolderInfo *fi;
+	CamelFolder *folder;
+
+	folder = im_service_mgr_get_folder (priv->service_mgr, account_id, "INBOX",
+					    cancellable, &_error);
+	if (folder) {
+		index_folder_sync (self, account_id, folder, cancellable);
+		g_object_unref (folder);
+	}
+
+	folder = im_service_mgr_get_sent (priv->service_mgr, account_id, cancellable, NULL);
+	if (folder) {
+		index_folder_sync (self, account_id, folder, cancellable);
+		g_object_unref (folder);
+	}
+
+	store = im_service_mgr_get_service (priv->service_mgr, account_id, IM_ACCOUNT_TYPE_STORE);
+	if (_error == NULL && store) {
+		fi = camel_store_get_folder_info_sync (CAMEL_STORE (store), NULL,
+						       CAMEL_STORE_FOLDER_INFO_RECURSIVE |
+						       CAMEL_STORE_FOLDER_INFO_SUBSCRIBED,
+						       cancellable, &_error);
+		if (fi) {
+			index_folder_info_sync (self, account_id, fi, cancellable);
+			camel_store_free_folder_info (CAMEL_STORE (store), fi);
+		}
+	}
+
+	if (_error == NULL)
+		g_cancellable_set_error_if_cancelled (cancellable, &_error);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+typedef struct _BuildIndexAsyncContext {
+	gboolean load;
+	GSList *account_ids;
+} BuildIndexAsyncContext;
+
+static void
+build_index_async_context_free (BuildIndexAsyncContext *context)
+{
+	im_account_mgr_free_account_ids (context->account_ids);
+	g_free (context);
+}
+
+static void
+build_index_thread (GSimpleAsyncResult *simple,
+		    GObject *object,
+		    GCancellable *cancellable)
+{
+	ImAddressIndex *self = IM_ADDRESS_INDEX (object);
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+	BuildIndexAsyncContext *context;
+	GSList *node;
+
+	context = (BuildIndexAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (context->load)
+		load_index (self);
+
+	for (node = context->account_ids; node != NULL; node = g_slist_next (node)) {
+		const gchar *account_id = (const gchar *) node->data;
+		GError *_error = NULL;
+		GHashTable *scanned = NULL;
+		gboolean indexed;
+		gint64 start;
+
+		g_mutex_lock (&priv->lock);
+		indexed = g_hash_table_contains (priv->indexed_accounts, account_id) ||
+			g_hash_table_contains (priv->scanning_accounts, account_id);
+		if (!indexed) {
+			scanned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+			g_hash_table_insert (priv->scanning_accounts, g_strdup (account_id), scanned);
+		}
+		g_mutex_unlock (&priv->lock);
+		if (indexed)
+			continue;
+
+		start = g_get_monotonic_time ();
+		indexed = index_account_sync (self, account_id, cancellable, &_error);
+
+		g_mutex_lock (&priv->lock);
+		/* The account may have been removed while it was scanned */
+		if (g_hash_table_lookup (priv->scanning_accounts, account_id) != scanned) {
+			remove_account_addresses (priv, account_id);
+		} else if (indexed) {
+			g_hash_table_remove (priv->scanning_accounts, account_id);
+			g_hash_table_add (priv->indexed_accounts, g_strdup (account_id));
+			schedule_save (self);
+			g_debug ("%s: indexed %s in %" G_GINT64_FORMAT " usec, %u addresses",
+				 __FUNCTION__, account_id, g_get_monotonic_time () - start,
+				 g_hash_table_size (priv->entries));
+		} else {
+			/* Retried on next start, from scratch */
+			g_hash_table_remove (priv->scanning_accounts, account_id);
+			remove_account_addresses (priv, account_id);
+			g_debug ("%s: failed to index %s: %s", __FUNCTION__,
+				 account_id, _error->message);
+		}
+		g_mutex_unlock (&priv->lock);
+		g_clear_error (&_error);
+	}
+}
+
+static void
+build_index (ImAddressIndex *self,
+	     gboolean load,
+	     GSList *account_ids)
+{
+	GSimpleAsyncResult *simple;
+	BuildIndexAsyncContext *context;
+
+	context = g_new0 (BuildIndexAsyncContext, 1);
+	context->load = load;
+	context->account_ids = account_ids;
+
+	simple = g_simple_async_result_new (G_OBJECT (self),
+					    NULL, NULL,
+					    build_index);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) build_index_async_context_free);
+	g_simple_async_result_run_in_thread (simple, build_index_thread,
+					     G_PRIORITY_LOW, NULL);
+	g_object_unref (simple);
+}
+
+/* Requires the lock. Visits all the keys starting with the prefix */
+static void
+scan_prefix (ImAddressIndexPrivate *priv,
+	     AddressKey *probe,
+	     guint count,
+	     GPtrArray *best,
+	     guint *candidates)
+{
+	GSequenceIter *iter;
+	GHashTable *seen;
+	guint i;
+
+	seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (iter = g_sequence_search (priv->keys, probe, compare_keys, NULL);
+	     !g_sequence_iter_is_end (iter);
+	     iter = g_sequence_iter_next (iter)) {
+		AddressKey *key = (AddressKey *) g_sequence_get (iter);
+
+		if (!g_str_has_prefix (key->key, probe->key))
+			break;
+		if (g_hash_table_contains (seen, key->entry))
+			continue;
+		g_hash_table_add (seen, key->entry);
+
+		/* Keep the best count entries, sorted */
+		for (i = best->len; i > 0 && compare_ranks (best->pdata[i - 1], key->entry) > 0; i--);
+		if (i >= count)
+			continue;
+		g_ptr_array_add (best, NULL);
+		memmove (best->pdata + i + 1, best->pdata + i,
+			 (best->len - i - 1) * sizeof (gpointer));
+		best->pdata[i] = key->entry;
+		if (best->len > count)
+			g_ptr_array_set_size (best, count);
+	}
+	*candidates = g_hash_table_size (seen);
+	g_hash_table_destroy (seen);
+}
+
+GList *
+im_address_index_complete (ImAddressIndex *self,
+			   const gchar *prefix,
+			   guint count)
+{
+	ImAddressIndexPrivate *priv;
+	AddressKey probe;
+	GPtrArray *best;
+	GList *result = NULL;
+	gint64 start;
+	guint i, candidates = 0;
+	gboolean cached;
+
+	g_return_val_if_fail (IM_IS_ADDRESS_INDEX (self), NULL);
+
+	priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+	if (count == 0)
+		return NULL;
+
+	start = g_get_monotonic_time ();
+	probe.key = g_utf8_casefold (prefix ? prefix : "", -1);
+	probe.entry = NULL;
+	best = g_ptr_array_new ();
+
+	/* Short prefixes match most of the keys, so their best entries
+	 * are kept as the index changes */
+	cached = count <= IM_ADDRESS_INDEX_TOP_COUNT &&
+		g_utf8_strlen (probe.key, -1) <= IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH;
+
+	g_mutex_lock (&priv->lock);
+	if (cached) {
+		GPtrArray *top = g_hash_table_lookup (priv->top, probe.key);
+
+		/* No top means no key starts with the prefix */
+		for (i = 0; top && i < top->len && i < count; i++)
+			g_ptr_array_add (best, top->pdata[i]);
+		candidates = top ? top->len : 0;
+	} else {
+		scan_prefix (priv, &probe, count, best, &candidates);
+	}
+
+	for (i = best->len; i > 0; i--) {
+		AddressEntry *entry = (AddressEntry *) best->pdata[i - 1];
+		ImAddressCompletion *completion;
+
+		completion = g_slice_new (ImAddressCompletion);
+		completion->name = g_strdup (entry->name);
+		completion->address = g_strdup (entry->address);
+		completion->count = entry->count;
+		completion->last_seen = entry->last_seen;
+		result = g_list_prepend (result, completion);
+	}
+	g_mutex_unlock (&priv->lock);
+
+	g_debug ("%s: %u completions of %u %s in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+		 best->len, candidates, cached ? "kept" : "candidates",
+		 g_get_monotonic_time () - start);
+
+	g_ptr_array_unref (best);
+	g_free (probe.key);
+
+	return result;
+}
+
+static void
+address_completion_free (ImAddressCompletion *completion)
+{
+	g_free (completion->name);
+	g_free (completion->address);
+	g_slice_free (ImAddressCompletion, completion);
+}
+
+void
+im_address_index_free_completions (GList *completions)
+{
+	g_list_free_full (completions, (GDestroyNotify) address_completion_free);
+}
+
+static void
+on_folder_changed (ImServiceMgr *service_mgr,
+		   ImFolderChanges *changes,
+		   gpointer userdata)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (userdata);
+	GHashTable *scanned;
+	guint i;
+
+	/* Drafts are not indexed */
+	if (changes->account_id == NULL || changes->uids_added->len == 0)
+		return;
+
+	g_mutex_lock (&priv->lock);
+	/* The messages of the accounts not indexed yet, and of the
+	 * folders not scanned yet, are added by the scan */
+	if (!g_hash_table_contains (priv->indexed_accounts, changes->account_id)) {
+		scanned = g_hash_table_lookup (priv->scanning_accounts, changes->account_id);
+		if (scanned == NULL ||
+		    !g_hash_table_contains (scanned, camel_folder_get_full_name (changes->folder))) {
+			g_mutex_unlock (&priv->lock);
+			return;
+		}
+	}
+	for (i = 0; i < changes->uids_added->len; i++) {
+		CamelMessageInfo *mi;
+
+		mi = camel_folder_get_message_info (changes->folder, changes->uids_added->pdata[i]);
+		if (mi == NULL)
+			continue;
+		add_message_info (priv, changes->account_id, mi);
+		camel_folder_free_message_info (changes->folder, mi);
+	}
+	schedule_save (IM_ADDRESS_INDEX (userdata));
+	g_mutex_unlock (&priv->lock);
+}
+
+static void
+on_account_inserted (ImAccountMgr *account_mgr,
+		     const gchar *account_id,
+		     gpointer userdata)
+{
+	build_index (IM_ADDRESS_INDEX (userdata), FALSE,
+		     g_slist_prepend (NULL, g_strdup (account_id)));
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (userdata);
+
+	/* A scan of the account drops its addresses when it finishes */
+	g_mutex_lock (&priv->lock);
+	g_hash_table_remove (priv->scanning_accounts, account_id);
+	if (g_hash_table_remove (priv->indexed_accounts, account_id)) {
+		remove_account_addresses (priv, account_id);
+		schedule_save (IM_ADDRESS_INDEX (userdata));
+	}
+	g_mutex_unlock (&priv->lock);
+}
+
+void
+_im_address_index_add_address (ImAddressIndex *self,
+			       const gchar *account_id,
+			       const gchar *name,
+			       const gchar *address,
+			       guint count,
+			       gint64 date)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->lock);
+	add_address (priv, account_id, name, address, count, date);
+	g_mutex_unlock (&priv->lock);
+}
+
+void
+_im_address_index_remove_account_addresses (ImAddressIndex *self,
+					    const gchar *account_id)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->lock);
+	remove_account_addresses (priv, account_id);
+	g_mutex_unlock (&priv->lock);
+}
+
+static void
+im_address_index_init (ImAddressIndex *self)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	g_mutex_init (&priv->lock);
+	g_mutex_init (&priv->save_lock);
+	priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) address_entry_free);
+	priv->keys = g_sequence_new ((GDestroyNotify) address_key_free);
+	priv->top = g_hash_table_new_full (g_str_hash, g_str_equal,
+					   g_free, (GDestroyNotify) g_ptr_array_unref);
+	priv->indexed_accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+							g_free, NULL);
+	priv->scanning_accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+							 g_free, (GDestroyNotify) g_hash_table_unref);
+	priv->path = g_build_filename (im_service_mgr_get_user_data_dir (),
+				       "addresses", NULL);
+}
+
+static void
+im_address_index_finalize (GObject *object)
+{
+	ImAddressIndexPrivate *priv = IM_ADDRESS_INDEX_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+	g_hash_table_unref (priv->top);
+	g_sequence_free (priv->keys);
+	g_hash_table_unref (priv->entries);
+	g_hash_table_unref (priv->indexed_accounts);
+	g_hash_table_unref (priv->scanning_accounts);
+	g_free (priv->path);
+	g_mutex_clear (&priv->save_lock);
+	g_mutex_clear (&priv->lock);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_address_index_parent_class)->finalize (object);
+}
+
+static void
+im_address_index_class_init (ImAddressIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_address_index_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImAddressIndexPrivate));
+}
+
+static ImAddressIndex *
+im_address_index_new (ImServiceMgr *service_mgr,
+		      ImAccountMgr *account_mgr)
+{
+	ImAddressIndex *self;
+	ImAddressIndexPrivate *priv;
+
+	self = g_object_new (IM_TYPE_ADDRESS_INDEX, NULL);
+	priv = IM_ADDRESS_INDEX_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_inserted",
+			  G_CALLBACK (on_account_inserted), self);
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "folder_changed",
+			  G_CALLBACK (on_folder_changed), self);
+
+	build_index (self, TRUE, im_account_mgr_get_account_ids (account_mgr, TRUE));
+
+	return self;
+}
+
+ImAddressIndex *
+im_address_index_get_instance (void)
+{
+	static ImAddressIndex *instance = 0;
+
+	if (instance == 0)
+		instance = im_address_index_new (im_service_mgr_get_instance (),
+						 im_account_mgr_get_instance ());
+
+	return instance;
+}
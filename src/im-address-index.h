@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-address-index.h : Index of the addresses for recipient completion */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_ADDRESS_INDEX_H__
+#define __IM_ADDRESS_INDEX_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_ADDRESS_INDEX             (im_address_index_get_type())
+#define IM_ADDRESS_INDEX(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_ADDRESS_INDEX,ImAddressIndex))
+#define IM_ADDRESS_INDEX_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_ADDRESS_INDEX,ImAddressIndexClass))
+#define IM_IS_ADDRESS_INDEX(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_ADDRESS_INDEX))
+#define IM_IS_ADDRESS_INDEX_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_ADDRESS_INDEX))
+#define IM_ADDRESS_INDEX_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_ADDRESS_INDEX,ImAddressIndexClass))
+
+typedef struct _ImAddressIndex      ImAddressIndex;
+typedef struct _ImAddressIndexClass ImAddressIndexClass;
+typedef struct _ImAddressCompletion ImAddressCompletion;
+
+struct _ImAddressIndex {
+	GObject parent;
+};
+
+struct _ImAddressIndexClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImAddressCompletion:
+ * @name: the display name, or %NULL
+ * @address: the email address
+ * @count: number of messages the address appeared in
+ * @last_seen: date of the newest of those messages, in seconds since the epoch
+ *
+ * An address, as returned by im_address_index_complete().
+ */
+struct _ImAddressCompletion {
+	gchar *name;
+	gchar *address;
+	guint count;
+	gint64 last_seen;
+};
+
+/* Delay to store the index after a change, in seconds */
+#define IM_ADDRESS_INDEX_SAVE_DELAY 30
+/* Age, in days, that halves the score of an address */
+#define IM_ADDRESS_INDEX_RECENCY_DAYS 30
+/* Prefixes up to this number of characters keep their best addresses */
+#define IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH 2
+/* Number of best addresses kept for each short prefix */
+#define IM_ADDRESS_INDEX_TOP_COUNT 16
+
+/**
+ * im_address_index_get_type:
+ *
+ * Returns: GType of the address index
+ */
+GType  im_address_index_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_address_index_get_instance:
+ *
+ * obtains the singleton #ImAddressIndex. On first call it loads the
+ * stored index in background, and indexes the messages of the accounts
+ * not indexed yet. From then on, the addresses of new messages are
+ * added as they arrive.
+ *
+ * Returns: (transfer none): an #ImAddressIndex
+ */
+ImAddressIndex*     im_address_index_get_instance (void);
+
+/**
+ * im_address_index_complete:
+ * @self: a #ImAddressIndex
+ * @prefix: the text typed
+ * @count: maximum number of completions
+ *
+ * Obtains the addresses with an address, a display name, or a word
+ * of the display name starting with @prefix, ignoring case. They're
+ * sorted by score, the number of messages halved every
+ * %IM_ADDRESS_INDEX_RECENCY_DAYS days since the last one. The best ones of
+ * prefixes up to %IM_ADDRESS_INDEX_TOP_PREFIX_LENGTH characters are
+ * kept, so they don't visit all the addresses.
+ *
+ * Returns: (transfer full) (element-type ImAddressCompletion): a list
+ * to free with im_address_index_free_completions()
+ */
+GList *             im_address_index_complete (ImAddressIndex *self,
+					       const gchar *prefix,
+					       guint count);
+
+/**
+ * im_address_index_free_completions:
+ * @completions: (element-type ImAddressCompletion): a list returned by
+ * im_address_index_complete()
+ *
+ * Frees @completions.
+ */
+void                im_address_index_free_completions (GList *completions);
+
+G_END_DECLS
+
+#endif /* __IM_ADDRESS_INDEX_H__ */
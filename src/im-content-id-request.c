@@ -459,14 +459,14 @@ im_content_id_request_send_async (SoupRequest          *soup_request,
 	}
 
 	
-	if (g_strcmp0 (folder, "INBOX") == 0 && 
-	    im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
+	/* Non storage accounts have all their folders in the local store */
+	if (im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
 					    account)) {
 		CamelFolder *inbox;
-		inbox = im_service_mgr_get_local_inbox (im_service_mgr_get_instance (),
-							account,
-							data->cancellable,
-							&data->error);
+		inbox = im_service_mgr_get_folder (im_service_mgr_get_instance (),
+						   account, folder,
+						   data->cancellable,
+						   &data->error);
 		fetch_part_get_message (inbox, data);
 	} else if (g_strcmp0 (folder, IM_LOCAL_DRAFTS_TAG) == 0) {
 		CamelFolder *drafts;
@@ -571,13 +571,12 @@ im_content_id_request_get_data_wrapper (const char *uri, gboolean get_container,
 		goto finish;
 	}
 
-	if (g_strcmp0 (folder_name, "INBOX") == 0 && 
-	    im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
+	if (im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
 					    account)) {
-		folder = im_service_mgr_get_local_inbox (im_service_mgr_get_instance (),
-							 account,
-							 NULL,
-							 &_error);
+		folder = im_service_mgr_get_folder (im_service_mgr_get_instance (),
+						    account, folder_name,
+						    NULL,
+						    &_error);
 	} else if (g_strcmp0 (folder_name, IM_LOCAL_DRAFTS_TAG) == 0) {
 		folder = im_service_mgr_get_drafts (im_service_mgr_get_instance (),
 						    NULL,
@@ -652,13 +651,12 @@ im_content_id_request_get_user_flag (const char *uri, const char *flag, GError *
 		goto finish;
 	}
 
-	if (g_strcmp0 (folder_name, "INBOX") == 0 && 
-	    im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
+	if (im_service_mgr_has_local_inbox (im_service_mgr_get_instance (),
 					    account)) {
-		folder = im_service_mgr_get_local_inbox (im_service_mgr_get_instance (),
-							 account,
-							 NULL,
-							 &_error);
+		folder = im_service_mgr_get_folder (im_service_mgr_get_instance (),
+						    account, folder_name,
+						    NULL,
+						    &_error);
 	} else if (g_strcmp0 (folder_name, IM_LOCAL_DRAFTS_TAG) == 0) {
 		folder = im_service_mgr_get_drafts (im_service_mgr_get_instance (),
 						    NULL,
@@ -0,0 +1,719 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-credential-mgr.c : Cached access to service passwords */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-credential-mgr.h"
+#include "im-credential-mgr-priv.h"
+
+#include "im-error.h"
+#include "im-service-mgr.h"
+
+#include <glib/gi18n.h>
+#include <gnome-keyring.h>
+
+typedef struct _ImCredentialMgrPrivate ImCredentialMgrPrivate;
+struct _ImCredentialMgrPrivate {
+	/* Protected by cache_lock, as it can be replaced */
+	const ImCredentialBackend *backend;
+
+	/* Key string -> CacheEntry. Accessed from any thread */
+	GMutex cache_lock;
+	GHashTable *cache;
+	/* Key string -> PendingLookup, for the backend lookups in
+	 * progress. Other lookups of the same key wait on lookup_cond
+	 * for their result */
+	GHashTable *pending;
+	GCond lookup_cond;
+};
+
+#define IM_CREDENTIAL_MGR_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					       IM_TYPE_CREDENTIAL_MGR, \
+					       ImCredentialMgrPrivate))
+
+typedef struct _CacheEntry {
+	gchar *password;
+	gint64 expires;
+} CacheEntry;
+
+typedef struct _PendingLookup {
+	gint ref_count;
+	gboolean done;
+	gchar *password;
+	GError *error;
+} PendingLookup;
+
+G_DEFINE_TYPE (ImCredentialMgr, im_credential_mgr, G_TYPE_OBJECT);
+
+/* gnome-keyring backend */
+
+static void
+set_keyring_error (GnomeKeyringResult result,
+		   GError **error)
+{
+	g_set_error (error, IM_ERROR_DOMAIN,
+		     IM_ERROR_CREDENTIALS_BACKEND_FAILED,
+		     _("Keyring error: %s"),
+		     gnome_keyring_result_to_message (result));
+}
+
+static gchar *
+keyring_lookup (const ImCredentialKey *key,
+		GError **error)
+{
+	GnomeKeyringResult result;
+	GList *results = NULL;
+	gchar *password = NULL;
+
+	result = gnome_keyring_find_network_password_sync (key->user, NULL, key->host,
+							   NULL, key->protocol, NULL,
+							   key->port, &results);
+	if (result == GNOME_KEYRING_RESULT_OK) {
+		if (results != NULL) {
+			GnomeKeyringNetworkPasswordData *data = 
+				(GnomeKeyringNetworkPasswordData *) results->data;
+
+			password = g_strdup (data->password);
+			gnome_keyring_network_password_list_free (results);
+		}
+	} else if (result != GNOME_KEYRING_RESULT_NO_MATCH) {
+		set_keyring_error (result, error);
+	}
+
+	return password;
+}
+
+static gboolean
+keyring_store (const ImCredentialKey *key,
+	       const gchar *password,
+	       GError **error)
+{
+	GnomeKeyringResult result;
+	guint32 item_id;
+
+	result = gnome_keyring_set_network_password_sync (NULL, key->user, NULL, key->host,
+							  NULL, key->protocol, NULL,
+							  key->port, password, &item_id);
+	if (result != GNOME_KEYRING_RESULT_OK) {
+		set_keyring_error (result, error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+keyring_forget (const ImCredentialKey *key,
+		GError **error)
+{
+	GnomeKeyringResult result;
+	GList *results = NULL, *node;
+
+	result = gnome_keyring_find_network_password_sync (key->user, NULL, key->host,
+							   NULL, key->protocol, NULL,
+							   key->port, &results);
+	if (result == GNOME_KEYRING_RESULT_NO_MATCH)
+		return TRUE;
+	if (result != GNOME_KEYRING_RESULT_OK) {
+		set_keyring_error (result, error);
+		return FALSE;
+	}
+
+	for (node = results; node != NULL; node = g_list_next (node)) {
+		GnomeKeyringNetworkPasswordData *data = 
+			(GnomeKeyringNetworkPasswordData *) node->data;
+		gnome_keyring_item_delete_sync (data->keyring, data->item_id);
+	}
+	gnome_keyring_network_password_list_free (results);
+
+	return TRUE;
+}
+
+static const ImCredentialBackend keyring_backend = {
+	"keyring",
+	keyring_lookup,
+	keyring_store,
+	keyring_forget
+};
+
+/* Key file backend. Passwords are stored in plain text, so it's
+ * only meant for testing, and only set from the private API */
+
+static GMutex key_file_lock;
+/* Protected by key_file_lock */
+static gchar *key_file_path = NULL;
+
+static gchar *
+get_key_string (const ImCredentialKey *key)
+{
+	return g_strdup_printf ("%s://%s@%s:%u",
+				key->protocol,
+				key->user ? key->user : "",
+				key->host ? key->host : "",
+				key->port);
+}
+
+static GKeyFile *
+key_file_load (GError **error)
+{
+	GKeyFile *key_file;
+	GError *_error = NULL;
+
+	key_file = g_key_file_new ();
+	g_key_file_load_from_file (key_file, key_file_path,
+				   G_KEY_FILE_NONE, &_error);
+	if (g_error_matches (_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+		g_clear_error (&_error);
+
+	if (_error) {
+		g_propagate_error (error, _error);
+		g_key_file_free (key_file);
+		return NULL;
+	}
+
+	return key_file;
+}
+
+static gboolean
+key_file_save (GKeyFile *key_file,
+	       GError **error)
+{
+	gchar *data;
+	gsize length;
+	gboolean result;
+
+	data = g_key_file_to_data (key_file, &length, NULL);
+	result = g_file_set_contents (key_file_path,
+				      data, length, error);
+	g_free (data);
+
+	return result;
+}
+
+static gchar *
+key_file_lookup (const ImCredentialKey *key,
+		 GError **error)
+{
+	GKeyFile *key_file;
+	gchar *group;
+	gchar *password = NULL;
+
+	g_mutex_lock (&key_file_lock);
+	key_file = key_file_load (error);
+	if (key_file) {
+		group = get_key_string (key);
+		password = g_key_file_get_string (key_file, group, "password", NULL);
+		g_free (group);
+		g_key_file_free (key_file);
+	}
+	g_mutex_unlock (&key_file_lock);
+
+	return password;
+}
+
+static gboolean
+key_file_store (const ImCredentialKey *key,
+		const gchar *password,
+		GError **error)
+{
+	GKeyFile *key_file;
+	gchar *group;
+	gboolean result = FALSE;
+
+	g_mutex_lock (&key_file_lock);
+	key_file = key_file_load (error);
+	if (key_file) {
+		group = get_key_string (key);
+		g_key_file_set_string (key_file, group, "password", password);
+		result = key_file_save (key_file, error);
+		g_free (group);
+		g_key_file_free (key_file);
+	}
+	g_mutex_unlock (&key_file_lock);
+
+	return result;
+}
+
+static gboolean
+key_file_forget (const ImCredentialKey *key,
+		 GError **error)
+{
+	GKeyFile *key_file;
+	gchar *group;
+	gboolean result = FALSE;
+
+	g_mutex_lock (&key_file_lock);
+	key_file = key_file_load (error);
+	if (key_file) {
+		group = get_key_string (key);
+		g_key_file_remove_group (key_file, group, NULL);
+		result = key_file_save (key_file, error);
+		g_free (group);
+		g_key_file_free (key_file);
+	}
+	g_mutex_unlock (&key_file_lock);
+
+	return result;
+}
+
+static const ImCredentialBackend key_file_backend = {
+	"key-file",
+	key_file_lookup,
+	key_file_store,
+	key_file_forget
+};
+
+/* Credential manager */
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->password);
+	g_slice_free (CacheEntry, entry);
+}
+
+/* Fills @key from the network settings of @service. Returns FALSE if
+ * the service has no network settings */
+static gboolean
+get_service_key (CamelService *service,
+		 ImCredentialKey *key)
+{
+	CamelSettings *settings;
+	CamelNetworkSettings *network;
+	CamelProvider *provider;
+
+	settings = camel_service_get_settings (service);
+	if (!CAMEL_IS_NETWORK_SETTINGS (settings))
+		return FALSE;
+
+	network = CAMEL_NETWORK_SETTINGS (settings);
+	provider = camel_service_get_provider (service);
+
+	key->user = camel_network_settings_get_user (network);
+	key->host = camel_network_settings_get_host (network);
+	key->port = camel_network_settings_get_port (network);
+	/* Push mode accounts use a different provider for the same server,
+	 * so we keep storing their passwords as imap ones */
+	if (g_strcmp0 (provider->protocol, IM_SERVICE_MGR_PUSH_PROVIDER) == 0)
+		key->protocol = "imap";
+	else
+		key->protocol = provider->protocol;
+
+	return TRUE;
+}
+
+/* Must be called with cache_lock held */
+static gchar *
+cache_lookup_locked (ImCredentialMgr *self,
+		     const gchar *key_string)
+{
+	ImCredentialMgrPrivate *priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+	CacheEntry *entry;
+	gchar *password = NULL;
+
+	entry = g_hash_table_lookup (priv->cache, key_string);
+	if (entry) {
+		if (entry->expires > g_get_monotonic_time ())
+			password = g_strdup (entry->password);
+		else
+			g_hash_table_remove (priv->cache, key_string);
+	}
+
+	return password;
+}
+
+/* Must be called with cache_lock held */
+static void
+pending_lookup_unref_locked (PendingLookup *pending)
+{
+	if (--pending->ref_count > 0)
+		return;
+
+	g_free (pending->password);
+	if (pending->error)
+		g_error_free (pending->error);
+	g_slice_free (PendingLookup, pending);
+}
+
+static const ImCredentialBackend *
+get_backend (ImCredentialMgr *self)
+{
+	ImCredentialMgrPrivate *priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+	const ImCredentialBackend *backend;
+
+	g_mutex_lock (&priv->cache_lock);
+	backend = priv->backend;
+	g_mutex_unlock (&priv->cache_lock);
+
+	return backend;
+}
+
+static void
+cache_set (ImCredentialMgr *self,
+	   const gchar *key_string,
+	   const gchar *password)
+{
+	ImCredentialMgrPrivate *priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+	CacheEntry *entry;
+
+	g_mutex_lock (&priv->cache_lock);
+	if (password) {
+		entry = g_slice_new0 (CacheEntry);
+		entry->password = g_strdup (password);
+		entry->expires = g_get_monotonic_time () +
+			(gint64) IM_CREDENTIAL_MGR_CACHE_TTL * G_TIME_SPAN_SECOND;
+		g_hash_table_replace (priv->cache, g_strdup (key_string), entry);
+	} else {
+		g_hash_table_remove (priv->cache, key_string);
+	}
+	g_mutex_unlock (&priv->cache_lock);
+}
+
+static void
+im_credential_mgr_init (ImCredentialMgr *self)
+{
+	ImCredentialMgrPrivate *priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+
+	g_mutex_init (&priv->cache_lock);
+	priv->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+					     g_free, (GDestroyNotify) cache_entry_free);
+	priv->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, NULL);
+	g_cond_init (&priv->lookup_cond);
+	priv->backend = &keyring_backend;
+}
+
+static void
+im_credential_mgr_finalize (GObject *object)
+{
+	ImCredentialMgrPrivate *priv = IM_CREDENTIAL_MGR_GET_PRIVATE (object);
+
+	g_hash_table_unref (priv->cache);
+	g_hash_table_unref (priv->pending);
+	g_cond_clear (&priv->lookup_cond);
+	g_mutex_clear (&priv->cache_lock);
+
+	G_OBJECT_CLASS (im_credential_mgr_parent_class)->finalize (object);
+}
+
+static void
+im_credential_mgr_class_init (ImCredentialMgrClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_credential_mgr_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImCredentialMgrPrivate));
+}
+
+ImCredentialMgr *
+im_credential_mgr_get_instance (void)
+{
+	static gsize instance = 0;
+
+	/* Obtained from worker threads, so we guard initialization */
+	if (g_once_init_enter (&instance))
+		g_once_init_leave (&instance,
+				   (gsize) g_object_new (IM_TYPE_CREDENTIAL_MGR, NULL));
+
+	return (ImCredentialMgr *) instance;
+}
+
+void
+im_credential_mgr_set_backend (ImCredentialMgr *self,
+			       const ImCredentialBackend *backend)
+{
+	ImCredentialMgrPrivate *priv;
+
+	g_return_if_fail (IM_IS_CREDENTIAL_MGR (self));
+	g_return_if_fail (backend != NULL);
+
+	priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->cache_lock);
+	priv->backend = backend;
+	g_hash_table_remove_all (priv->cache);
+	g_mutex_unlock (&priv->cache_lock);
+}
+
+void
+_im_credential_mgr_use_key_file (ImCredentialMgr *self,
+				 const gchar *path)
+{
+	g_return_if_fail (IM_IS_CREDENTIAL_MGR (self));
+	g_return_if_fail (path != NULL);
+
+	g_mutex_lock (&key_file_lock);
+	g_free (key_file_path);
+	key_file_path = g_strdup (path);
+	g_mutex_unlock (&key_file_lock);
+
+	im_credential_mgr_set_backend (self, &key_file_backend);
+}
+
+gchar *
+im_credential_mgr_lookup_sync (ImCredentialMgr *self,
+			       CamelService *service,
+			       GError **error)
+{
+	ImCredentialMgrPrivate *priv;
+	const ImCredentialBackend *backend;
+	ImCredentialKey key;
+	PendingLookup *pending;
+	gchar *key_string;
+	gchar *password;
+	gint64 start;
+	GError *_error = NULL;
+
+	g_return_val_if_fail (IM_IS_CREDENTIAL_MGR (self), NULL);
+	g_return_val_if_fail (CAMEL_IS_SERVICE (service), NULL);
+
+	priv = IM_CREDENTIAL_MGR_GET_PRIVATE (self);
+
+	if (!get_service_key (service, &key))
+		return NULL;
+
+	start = g_get_monotonic_time ();
+	key_string = get_key_string (&key);
+
+	g_mutex_lock (&priv->cache_lock);
+	password = cache_lookup_locked (self, key_string);
+	if (password) {
+		g_mutex_unlock (&priv->cache_lock);
+		g_free (key_string);
+		return password;
+	}
+
+	/* Another thread is already asking the backend, so we take
+	 * its result instead of asking again */
+	pending = g_hash_table_lookup (priv->pending, key_string);
+	if (pending) {
+		pending->ref_count++;
+		while (!pending->done)
+			g_cond_wait (&priv->lookup_cond, &priv->cache_lock);
+		password = g_strdup (pending->password);
+		if (pending->error)
+			_error = g_error_copy (pending->error);
+		pending_lookup_unref_locked (pending);
+		g_mutex_unlock (&priv->cache_lock);
+		g_free (key_string);
+
+		if (_error)
+			g_propagate_error (error, _error);
+		return password;
+	}
+
+	pending = g_slice_new0 (PendingLookup);
+	pending->ref_count = 1;
+	g_hash_table_insert (priv->pending, g_strdup (key_string), pending);
+	backend = priv->backend;
+	g_mutex_unlock (&priv->cache_lock);
+
+	password = backend->lookup (&key, &_error);
+	g_debug ("%s: %s lookup of %s took %" G_GINT64_FORMAT " us", __FUNCTION__,
+		 backend->name, key_string, g_get_monotonic_time () - start);
+
+	if (password)
+		cache_set (self, key_string, password);
+
+	g_mutex_lock (&priv->cache_lock);
+	pending->done = TRUE;
+	pending->password = g_strdup (password);
+	if (_error)
+		pending->error = g_error_copy (_error);
+	g_hash_table_remove (priv->pending, key_string);
+	pending_lookup_unref_locked (pending);
+	g_cond_broadcast (&priv->lookup_cond);
+	g_mutex_unlock (&priv->cache_lock);
+
+	g_free (key_string);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return password;
+}
+
+gboolean
+im_credential_mgr_store_sync (ImCredentialMgr *self,
+			      CamelService *service,
+			      const gchar *password,
+			      GError **error)
+{
+	ImCredentialKey key;
+	gchar *key_string;
+
+	g_return_val_if_fail (IM_IS_CREDENTIAL_MGR (self), FALSE);
+	g_return_val_if_fail (CAMEL_IS_SERVICE (service), FALSE);
+	g_return_val_if_fail (password != NULL, FALSE);
+
+	if (!get_service_key (service, &key))
+		return FALSE;
+
+	key_string = get_key_string (&key);
+	cache_set (self, key_string, password);
+	g_free (key_string);
+
+	return get_backend (self)->store (&key, password, error);
+}
+
+gboolean
+im_credential_mgr_forget_sync (ImCredentialMgr *self,
+			       CamelService *service,
+			       GError **error)
+{
+	ImCredentialKey key;
+	gchar *key_string;
+
+	g_return_val_if_fail (IM_IS_CREDENTIAL_MGR (self), FALSE);
+	g_return_val_if_fail (CAMEL_IS_SERVICE (service), FALSE);
+
+	if (!get_service_key (service, &key))
+		return FALSE;
+
+	key_string = get_key_string (&key);
+	cache_set (self, key_string, NULL);
+	g_free (key_string);
+
+	return get_backend (self)->forget (&key, error);
+}
+
+gboolean
+im_credential_mgr_reject_sync (ImCredentialMgr *self,
+			       CamelService *service,
+			       const gchar *password,
+			       GError **error)
+{
+	GError *_error = NULL;
+	gchar *stored;
+
+	g_return_val_if_fail (IM_IS_CREDENTIAL_MGR (self), FALSE);
+	g_return_val_if_fail (CAMEL_IS_SERVICE (service), FALSE);
+	g_return_val_if_fail (password != NULL, FALSE);
+
+	stored = im_credential_mgr_lookup_sync (self, service, &_error);
+	if (_error == NULL && g_strcmp0 (stored, password) == 0)
+		im_credential_mgr_forget_sync (self, service, &_error);
+	g_free (stored);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+typedef struct _LookupAsyncContext {
+	CamelService *service;
+	gchar *password;
+} LookupAsyncContext;
+
+static void
+lookup_async_context_free (LookupAsyncContext *context)
+{
+	g_object_unref (context->service);
+	g_free (context->password);
+	g_slice_free (LookupAsyncContext, context);
+}
+
+static void
+lookup_thread (GSimpleAsyncResult *simple,
+	       GObject *object,
+	       GCancellable *cancellable)
+{
+	LookupAsyncContext *context;
+	GError *_error = NULL;
+
+	context = (LookupAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	context->password = im_credential_mgr_lookup_sync (IM_CREDENTIAL_MGR (object),
+							   context->service,
+							   &_error);
+	if (_error)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+void
+im_credential_mgr_lookup_async (ImCredentialMgr *self,
+				CamelService *service,
+				gint io_priority,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	GSimpleAsyncResult *simple;
+	LookupAsyncContext *context;
+
+	g_return_if_fail (IM_IS_CREDENTIAL_MGR (self));
+	g_return_if_fail (CAMEL_IS_SERVICE (service));
+
+	context = g_slice_new0 (LookupAsyncContext);
+	context->service = g_object_ref (service);
+
+	simple = g_simple_async_result_new (G_OBJECT (self), callback, user_data,
+					    im_credential_mgr_lookup_async);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) lookup_async_context_free);
+	g_simple_async_result_run_in_thread (simple, lookup_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+gchar *
+im_credential_mgr_lookup_finish (ImCredentialMgr *self,
+				 GAsyncResult *result,
+				 GError **error)
+{
+	GSimpleAsyncResult *simple;
+	LookupAsyncContext *context;
+
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (self),
+							      im_credential_mgr_lookup_async),
+			      NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	context = (LookupAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	return g_strdup (context->password);
+}
@@ -0,0 +1,235 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-credential-mgr.h : Cached access to service passwords */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_CREDENTIAL_MGR_H__
+#define __IM_CREDENTIAL_MGR_H__
+
+#include <camel/camel.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_CREDENTIAL_MGR             (im_credential_mgr_get_type())
+#define IM_CREDENTIAL_MGR(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_CREDENTIAL_MGR,ImCredentialMgr))
+#define IM_CREDENTIAL_MGR_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_CREDENTIAL_MGR,ImCredentialMgrClass))
+#define IM_IS_CREDENTIAL_MGR(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_CREDENTIAL_MGR))
+#define IM_IS_CREDENTIAL_MGR_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_CREDENTIAL_MGR))
+#define IM_CREDENTIAL_MGR_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_CREDENTIAL_MGR,ImCredentialMgrClass))
+
+typedef struct _ImCredentialMgr      ImCredentialMgr;
+typedef struct _ImCredentialMgrClass ImCredentialMgrClass;
+typedef struct _ImCredentialKey      ImCredentialKey;
+typedef struct _ImCredentialBackend  ImCredentialBackend;
+
+struct _ImCredentialMgr {
+	GObject parent;
+};
+
+struct _ImCredentialMgrClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImCredentialKey:
+ * @user: the user name
+ * @host: the server host name
+ * @protocol: the protocol name (imap, pop, smtp)
+ * @port: the server port, or 0 for the default one
+ *
+ * Identifies the password of a service.
+ */
+struct _ImCredentialKey {
+	const gchar *user;
+	const gchar *host;
+	const gchar *protocol;
+	guint port;
+};
+
+/**
+ * ImCredentialBackend:
+ * @name: name of the backend, for debugging
+ * @lookup: obtains the stored password for a key, or %NULL if there's none
+ * @store: stores the password for a key
+ * @forget: removes the password for a key
+ *
+ * Persistent storage of passwords. Its methods are called from worker
+ * threads, so they should be thread safe, and they can block.
+ */
+struct _ImCredentialBackend {
+	const gchar *name;
+	gchar *		(*lookup)	(const ImCredentialKey *key,
+					 GError **error);
+	gboolean	(*store)	(const ImCredentialKey *key,
+					 const gchar *password,
+					 GError **error);
+	gboolean	(*forget)	(const ImCredentialKey *key,
+					 GError **error);
+};
+
+/* Time (in seconds) passwords are kept in memory */
+#define IM_CREDENTIAL_MGR_CACHE_TTL (30 * 60)
+
+/**
+ * im_credential_mgr_get_type:
+ *
+ * Returns: GType of the credential manager
+ */
+GType  im_credential_mgr_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_credential_mgr_get_instance:
+ *
+ * obtains the singleton #ImCredentialMgr. It uses the gnome-keyring
+ * backend.
+ *
+ * Returns: (transfer none): an #ImCredentialMgr
+ */
+ImCredentialMgr*    im_credential_mgr_get_instance (void);
+
+/**
+ * im_credential_mgr_set_backend:
+ * @self: a #ImCredentialMgr
+ * @backend: a #ImCredentialBackend, that should be valid while in use
+ *
+ * Replaces the storage of passwords, and clears the cache.
+ */
+void                im_credential_mgr_set_backend  (ImCredentialMgr *self,
+						    const ImCredentialBackend *backend);
+
+/**
+ * im_credential_mgr_lookup_sync:
+ * @self: a #ImCredentialMgr
+ * @service: a #CamelService with network settings
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Obtains the password of @service, from the cache if possible. It can
+ * block on backend I/O, so it should be called from a worker thread.
+ * Concurrent lookups of the same password share a single backend
+ * query.
+ *
+ * Returns: (transfer full): the password, or %NULL if it's unknown
+ */
+gchar *             im_credential_mgr_lookup_sync  (ImCredentialMgr *self,
+						    CamelService *service,
+						    GError **error);
+
+/**
+ * im_credential_mgr_lookup_async:
+ * @self: a #ImCredentialMgr
+ * @service: a #CamelService with network settings
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: data for @callback
+ *
+ * Obtains the password of @service in a worker thread, as
+ * im_credential_mgr_lookup_sync() does. Finish it with
+ * im_credential_mgr_lookup_finish().
+ */
+void                im_credential_mgr_lookup_async (ImCredentialMgr *self,
+						    CamelService *service,
+						    gint io_priority,
+						    GCancellable *cancellable,
+						    GAsyncReadyCallback callback,
+						    gpointer user_data);
+
+/**
+ * im_credential_mgr_lookup_finish:
+ * @self: a #ImCredentialMgr
+ * @result: the #GAsyncResult passed to the callback
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Finishes the operation started with im_credential_mgr_lookup_async().
+ *
+ * Returns: (transfer full): the password, or %NULL if it's unknown
+ */
+gchar *             im_credential_mgr_lookup_finish (ImCredentialMgr *self,
+						     GAsyncResult *result,
+						     GError **error);
+
+/**
+ * im_credential_mgr_store_sync:
+ * @self: a #ImCredentialMgr
+ * @service: a #CamelService with network settings
+ * @password: the password
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Stores the password of @service in the cache and the backend.
+ *
+ * Returns: %TRUE if successful
+ */
+gboolean            im_credential_mgr_store_sync   (ImCredentialMgr *self,
+						    CamelService *service,
+						    const gchar *password,
+						    GError **error);
+
+/**
+ * im_credential_mgr_forget_sync:
+ * @self: a #ImCredentialMgr
+ * @service: a #CamelService with network settings
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Removes the password of @service from the cache and the backend.
+ *
+ * Returns: %TRUE if successful
+ */
+gboolean            im_credential_mgr_forget_sync  (ImCredentialMgr *self,
+						    CamelService *service,
+						    GError **error);
+
+/**
+ * im_credential_mgr_reject_sync:
+ * @self: a #ImCredentialMgr
+ * @service: a #CamelService with network settings
+ * @password: the password the server rejected
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Removes the password of @service from the cache and the backend if
+ * it's still @password, so it's not given to other lookups. A password
+ * stored meanwhile, i.e. after another authentication failed, is kept.
+ *
+ * Returns: %TRUE if successful
+ */
+gboolean            im_credential_mgr_reject_sync  (ImCredentialMgr *self,
+						    CamelService *service,
+						    const gchar *password,
+						    GError **error);
+
+G_END_DECLS
+
+#endif /* __IM_CREDENTIAL_MGR_H__ */
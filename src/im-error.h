@@ -69,7 +69,15 @@ typedef enum {
 	IM_ERROR_SEND_FAILED_TO_ADD_TO_OUTBOX,
 	IM_ERROR_SEND_INVALID_ATTACHMENT,
 	IM_ERROR_COMPOSER_FAILED_TO_ADD_TO_DRAFTS,
-	IM_ERROR_AUTH_FAILED
+	IM_ERROR_AUTH_FAILED,
+	IM_ERROR_SERVICE_MGR_GET_SYNC_SCHEDULE_FAILED,
+	IM_ERROR_SERVICE_MGR_SET_CURRENT_ACCOUNT_FAILED,
+	IM_ERROR_CREDENTIALS_BACKEND_FAILED,
+	IM_ERROR_SERVICE_MGR_FOLDER_OPERATION_FAILED,
+	IM_ERROR_SERVICE_MGR_TRANSFER_MESSAGES_FAILED,
+	IM_ERROR_SERVICE_MGR_SEARCH_FAILED,
+	IM_ERROR_SERVICE_MGR_COMPLETE_ADDRESS_FAILED,
+	IM_ERROR_SERVICE_MGR_LOW_DISK_SPACE
 } ImErrorCode;
 
 GQuark im_get_error_quark (void);
@@ -209,29 +209,32 @@ im_file_utils_create_temp_uri (const gchar *orig_name,
 /**
  * im_file_utils_get_available_space:
  * @folder_path: the path of the folder
+ * @available: (out): return location for the space available, in bytes
  *
  * Obtains the space available in the local folder.
  *
- * Returns: a #guint64
+ * Returns: %TRUE if the space could be obtained, %FALSE otherwise
  */
-guint64 
-im_file_utils_get_available_space (const gchar *folder_path)
+gboolean
+im_file_utils_get_available_space (const gchar *folder_path,
+				   guint64 *available)
 {
 	GFile *file;
 	GFileInfo *info;
-	guint64 size;
+	gboolean result = FALSE;
 
 	file = g_file_new_for_path (folder_path);
 	info = g_file_query_filesystem_info (file, G_FILE_ATTRIBUTE_FILESYSTEM_FREE,
 					     NULL, NULL);
 	if  (info) {
-		size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+		if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE)) {
+			*available = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+			result = TRUE;
+		}
 		g_object_unref (info);
-	} else {
-		size = 0;
 	}
 	g_object_unref (file);
 
-	return (guint64) size;
+	return result;
 }
 
@@ -52,7 +52,8 @@
 
 gboolean        im_file_utils_folder_writable        (const gchar *filename);
 gboolean        im_file_utils_file_exists            (const gchar *filename);
-guint64         im_file_utils_get_available_space    (const gchar *folder_path);
+gboolean        im_file_utils_get_available_space    (const gchar *folder_path,
+						      guint64 *available);
 
 gchar *         im_file_utils_create_temp_uri        (const gchar *orig_name,
 						      const gchar *hash_base);
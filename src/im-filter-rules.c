@@ -0,0 +1,397 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-filter-rules.c : Compiled filter rules for incoming messages */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-filter-rules.h"
+
+#include "im-account-mgr-helpers.h"
+#include "im-enum-types.h"
+#include "im-error.h"
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#define FIELDS_COUNT (IM_FILTER_FIELD_SUBJECT + 1)
+
+typedef struct _FieldRules {
+	/* case folded value -> index + 1 of the first IS rule with it */
+	GHashTable *exact;
+	/* indexes of the other rules of the field, in order */
+	GArray *others;
+} FieldRules;
+
+struct _ImFilterMatcher {
+	gint ref_count;
+	/* the rules as stored, to know when they change */
+	gchar *source;
+	/* ImFilterRule */
+	GPtrArray *rules;
+	/* case folded values of the rules */
+	GPtrArray *values;
+	FieldRules fields[FIELDS_COUNT];
+};
+
+/* account id -> ImFilterMatcher */
+static GHashTable *matchers = NULL;
+static GMutex matchers_lock;
+
+static gboolean
+get_enum_value (GType type,
+		const gchar *nick,
+		gint *value)
+{
+	GEnumClass *enum_class;
+	GEnumValue *enum_value;
+
+	enum_class = g_type_class_ref (type);
+	enum_value = g_enum_get_value_by_nick (enum_class, nick);
+	if (enum_value)
+		*value = enum_value->value;
+	g_type_class_unref (enum_class);
+
+	return enum_value != NULL;
+}
+
+ImFilterRule *
+im_filter_rule_parse (const gchar *rule,
+		      GError **error)
+{
+	ImFilterRule *result = NULL;
+	gchar **fields;
+	gint field, match, action;
+
+	fields = g_strsplit (rule, "\t", 5);
+	if (g_strv_length (fields) == 5 &&
+	    get_enum_value (IM_TYPE_FILTER_FIELD, fields[0], &field) &&
+	    get_enum_value (IM_TYPE_FILTER_MATCH, fields[1], &match) &&
+	    get_enum_value (IM_TYPE_FILTER_ACTION, fields[3], &action) &&
+	    fields[2][0] != '\0' &&
+	    (action == IM_FILTER_ACTION_DELETE || fields[4][0] != '\0')) {
+		result = g_slice_new0 (ImFilterRule);
+		result->field = field;
+		result->match = match;
+		result->value = g_strcompress (fields[2]);
+		result->action = action;
+		result->argument = g_strcompress (fields[4]);
+	} else {
+		g_set_error (error, IM_ERROR_DOMAIN,
+			     IM_ERROR_CONF_INVALID_VALUE,
+			     _("Invalid filter rule \"%s\""), rule);
+	}
+	g_strfreev (fields);
+
+	return result;
+}
+
+gchar *
+im_filter_rule_to_string (const ImFilterRule *rule)
+{
+	GEnumClass *field_class, *match_class, *action_class;
+	gchar *value, *argument, *result;
+
+	field_class = g_type_class_ref (IM_TYPE_FILTER_FIELD);
+	match_class = g_type_class_ref (IM_TYPE_FILTER_MATCH);
+	action_class = g_type_class_ref (IM_TYPE_FILTER_ACTION);
+	value = g_strescape (rule->value, NULL);
+	argument = g_strescape (rule->argument ? rule->argument : "", NULL);
+
+	result = g_strdup_printf ("%s\t%s\t%s\t%s\t%s",
+				  g_enum_get_value (field_class, rule->field)->value_nick,
+				  g_enum_get_value (match_class, rule->match)->value_nick,
+				  value,
+				  g_enum_get_value (action_class, rule->action)->value_nick,
+				  argument);
+
+	g_free (value);
+	g_free (argument);
+	g_type_class_unref (field_class);
+	g_type_class_unref (match_class);
+	g_type_class_unref (action_class);
+
+	return result;
+}
+
+void
+im_filter_rule_free (ImFilterRule *rule)
+{
+	g_free (rule->value);
+	g_free (rule->argument);
+	g_slice_free (ImFilterRule, rule);
+}
+
+/* The rules as stored, to know when they change */
+static gchar *
+get_rules_source (GSList *rules)
+{
+	GString *source;
+	GSList *node;
+
+	source = g_string_new ("");
+	for (node = rules; node != NULL; node = g_slist_next (node)) {
+		g_string_append (source, (const gchar *) node->data);
+		g_string_append_c (source, '\n');
+	}
+
+	return g_string_free (source, FALSE);
+}
+
+ImFilterMatcher *
+im_filter_matcher_new (GSList *rules)
+{
+	ImFilterMatcher *matcher;
+	GSList *node;
+	gint i;
+
+	matcher = g_slice_new0 (ImFilterMatcher);
+	matcher->ref_count = 1;
+	matcher->source = get_rules_source (rules);
+	matcher->rules = g_ptr_array_new_with_free_func ((GDestroyNotify) im_filter_rule_free);
+	matcher->values = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < FIELDS_COUNT; i++) {
+		matcher->fields[i].exact = g_hash_table_new (g_str_hash, g_str_equal);
+		matcher->fields[i].others = g_array_new (FALSE, FALSE, sizeof (guint));
+	}
+
+	for (node = rules; node != NULL; node = g_slist_next (node)) {
+		GError *_error = NULL;
+		ImFilterRule *rule;
+		FieldRules *field_rules;
+		gchar *value;
+		guint index;
+
+		rule = im_filter_rule_parse ((const gchar *) node->data, &_error);
+		if (rule == NULL) {
+			g_warning ("%s: %s", __FUNCTION__, _error->message);
+			g_error_free (_error);
+			continue;
+		}
+
+		index = matcher->rules->len;
+		value = g_utf8_casefold (rule->value, -1);
+		g_ptr_array_add (matcher->rules, rule);
+		g_ptr_array_add (matcher->values, value);
+
+		field_rules = &(matcher->fields[rule->field]);
+		if (rule->match != IM_FILTER_MATCH_IS)
+			g_array_append_val (field_rules->others, index);
+		else if (!g_hash_table_contains (field_rules->exact, value))
+			g_hash_table_insert (field_rules->exact, value, GUINT_TO_POINTER (index + 1));
+	}
+
+	return matcher;
+}
+
+void
+im_filter_matcher_unref (ImFilterMatcher *matcher)
+{
+	gint i;
+
+	if (!g_atomic_int_dec_and_test (&matcher->ref_count))
+		return;
+
+	for (i = 0; i < FIELDS_COUNT; i++) {
+		g_hash_table_destroy (matcher->fields[i].exact);
+		g_array_free (matcher->fields[i].others, TRUE);
+	}
+	g_ptr_array_unref (matcher->values);
+	g_ptr_array_unref (matcher->rules);
+	g_free (matcher->source);
+	g_slice_free (ImFilterMatcher, matcher);
+}
+
+ImFilterMatcher *
+im_filter_matcher_get_for_account (ImAccountMgr *account_mgr,
+				   const gchar *account_id)
+{
+	ImFilterMatcher *matcher;
+	GSList *rules;
+	gchar *source;
+
+	rules = im_account_mgr_get_filter_rules (account_mgr, account_id);
+	source = get_rules_source (rules);
+
+	g_mutex_lock (&matchers_lock);
+	if (matchers == NULL)
+		matchers = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) im_filter_matcher_unref);
+
+	matcher = g_hash_table_lookup (matchers, account_id);
+	if (rules == NULL) {
+		g_hash_table_remove (matchers, account_id);
+		matcher = NULL;
+	} else if (matcher == NULL || strcmp (matcher->source, source) != 0) {
+		gint64 start = g_get_monotonic_time ();
+
+		matcher = im_filter_matcher_new (rules);
+		g_hash_table_insert (matchers, g_strdup (account_id), matcher);
+		g_debug ("%s: compiled %u filter rules of %s in %" G_GINT64_FORMAT " usec",
+			 __FUNCTION__, matcher->rules->len, account_id,
+			 g_get_monotonic_time () - start);
+	}
+	if (matcher)
+		g_atomic_int_inc (&matcher->ref_count);
+	g_mutex_unlock (&matchers_lock);
+
+	g_free (source);
+	g_slist_free_full (rules, g_free);
+
+	return matcher;
+}
+
+guint
+im_filter_matcher_get_rules_count (ImFilterMatcher *matcher)
+{
+	return matcher->rules->len;
+}
+
+static const gchar *
+get_field_text (CamelMessageInfo *mi,
+		ImFilterField field)
+{
+	switch (field) {
+	case IM_FILTER_FIELD_FROM:
+		return camel_message_info_from (mi);
+	case IM_FILTER_FIELD_TO:
+		return camel_message_info_to (mi);
+	case IM_FILTER_FIELD_CC:
+		return camel_message_info_cc (mi);
+	case IM_FILTER_FIELD_SUBJECT:
+		return camel_message_info_subject (mi);
+	default:
+		return NULL;
+	}
+}
+
+/* The case folded header, and each of its addresses unless it's the
+ * subject, as rules compare with both */
+static GPtrArray *
+get_folded_texts (const gchar *text,
+		  ImFilterField field)
+{
+	GPtrArray *texts;
+
+	texts = g_ptr_array_new_with_free_func (g_free);
+	g_ptr_array_add (texts, g_utf8_casefold (text, -1));
+	if (field != IM_FILTER_FIELD_SUBJECT && *text != '\0') {
+		CamelInternetAddress *cia;
+		const gchar *address;
+		gint i;
+
+		cia = camel_internet_address_new ();
+		camel_address_unformat (CAMEL_ADDRESS (cia), text);
+		for (i = 0; camel_internet_address_get (cia, i, NULL, &address); i++) {
+			if (address)
+				g_ptr_array_add (texts, g_utf8_casefold (address, -1));
+		}
+		g_object_unref (cia);
+	}
+
+	return texts;
+}
+
+static gboolean
+text_matches (const gchar *folded,
+	      ImFilterMatch match,
+	      const gchar *value)
+{
+	switch (match) {
+	case IM_FILTER_MATCH_CONTAINS:
+		return strstr (folded, value) != NULL;
+	case IM_FILTER_MATCH_STARTS_WITH:
+		return g_str_has_prefix (folded, value);
+	case IM_FILTER_MATCH_ENDS_WITH:
+		return g_str_has_suffix (folded, value);
+	default:
+		return FALSE;
+	}
+}
+
+const ImFilterRule *
+im_filter_matcher_match (ImFilterMatcher *matcher,
+			 CamelMessageInfo *mi)
+{
+	guint best = matcher->rules->len;
+	gint field;
+	guint i, j;
+
+	for (field = 0; field < FIELDS_COUNT; field++) {
+		FieldRules *field_rules = &(matcher->fields[field]);
+		const gchar *text;
+		GPtrArray *texts;
+
+		if (field_rules->others->len == 0 &&
+		    g_hash_table_size (field_rules->exact) == 0)
+			continue;
+
+		text = get_field_text (mi, field);
+		texts = get_folded_texts (text ? text : "", field);
+
+		for (i = 0; i < texts->len; i++) {
+			guint index;
+
+			index = GPOINTER_TO_UINT (g_hash_table_lookup (field_rules->exact, texts->pdata[i]));
+			if (index > 0 && index - 1 < best)
+				best = index - 1;
+		}
+
+		for (i = 0; i < field_rules->others->len; i++) {
+			guint index = g_array_index (field_rules->others, guint, i);
+			const ImFilterRule *rule;
+			const gchar *value;
+			gboolean matches = FALSE;
+
+			if (index >= best)
+				break;
+
+			rule = (const ImFilterRule *) matcher->rules->pdata[index];
+			value = (const gchar *) matcher->values->pdata[index];
+			for (j = 0; !matches && j < texts->len; j++)
+				matches = text_matches (texts->pdata[j], rule->match, value);
+			if (matches) {
+				best = index;
+				break;
+			}
+		}
+		g_ptr_array_unref (texts);
+	}
+
+	return (best < matcher->rules->len) ? matcher->rules->pdata[best] : NULL;
+}
@@ -0,0 +1,210 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-filter-rules.h : Compiled filter rules for incoming messages */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_FILTER_RULES_H__
+#define __IM_FILTER_RULES_H__
+
+#include <im-account-mgr.h>
+
+#include <camel/camel.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * ImFilterField:
+ * @IM_FILTER_FIELD_FROM: the From header
+ * @IM_FILTER_FIELD_TO: the To header
+ * @IM_FILTER_FIELD_CC: the Cc header
+ * @IM_FILTER_FIELD_SUBJECT: the Subject header
+ *
+ * Headers a filter rule can match.
+ */
+typedef enum {
+	IM_FILTER_FIELD_FROM,
+	IM_FILTER_FIELD_TO,
+	IM_FILTER_FIELD_CC,
+	IM_FILTER_FIELD_SUBJECT
+} ImFilterField;
+
+/**
+ * ImFilterMatch:
+ * @IM_FILTER_MATCH_CONTAINS: the header contains the value
+ * @IM_FILTER_MATCH_IS: the header is the value
+ * @IM_FILTER_MATCH_STARTS_WITH: the header starts with the value
+ * @IM_FILTER_MATCH_ENDS_WITH: the header ends with the value
+ *
+ * Comparisons of a filter rule. They all ignore case, and for the
+ * address headers they also compare each address, so
+ * "to ends-with @example.com" matches "Bob &lt;bob@example.com&gt;".
+ */
+typedef enum {
+	IM_FILTER_MATCH_CONTAINS,
+	IM_FILTER_MATCH_IS,
+	IM_FILTER_MATCH_STARTS_WITH,
+	IM_FILTER_MATCH_ENDS_WITH
+} ImFilterMatch;
+
+/**
+ * ImFilterAction:
+ * @IM_FILTER_ACTION_MOVE: move the message to the folder in the argument
+ * @IM_FILTER_ACTION_FLAG: set the comma separated flags in the argument
+ * @IM_FILTER_ACTION_DELETE: mark the message as read and deleted
+ *
+ * Actions of a filter rule.
+ */
+typedef enum {
+	IM_FILTER_ACTION_MOVE,
+	IM_FILTER_ACTION_FLAG,
+	IM_FILTER_ACTION_DELETE
+} ImFilterAction;
+
+typedef struct _ImFilterRule ImFilterRule;
+typedef struct _ImFilterMatcher ImFilterMatcher;
+
+/**
+ * ImFilterRule:
+ * @field: the header to match
+ * @match: the comparison
+ * @value: the value compared with the header
+ * @action: what to do with matching messages
+ * @argument: the folder of %IM_FILTER_ACTION_MOVE, or the flags of
+ * %IM_FILTER_ACTION_FLAG
+ *
+ * A filter rule, stored in the account configuration as a string.
+ */
+struct _ImFilterRule {
+	ImFilterField field;
+	ImFilterMatch match;
+	gchar *value;
+	ImFilterAction action;
+	gchar *argument;
+};
+
+/**
+ * im_filter_rule_parse:
+ * @rule: a rule, as stored in the account configuration
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Parses a rule with the tab separated field, match, value, action and
+ * argument. The enum values use their nicks, and the value and argument
+ * are escaped with g_strescape().
+ *
+ * Returns: (transfer full): a #ImFilterRule, or %NULL if @rule is invalid
+ */
+ImFilterRule *      im_filter_rule_parse     (const gchar *rule,
+					      GError **error);
+
+/**
+ * im_filter_rule_to_string:
+ * @rule: a #ImFilterRule
+ *
+ * Obtains the string to store @rule in the account configuration.
+ *
+ * Returns: (transfer full): a string
+ */
+gchar *             im_filter_rule_to_string (const ImFilterRule *rule);
+
+/**
+ * im_filter_rule_free:
+ * @rule: a #ImFilterRule
+ *
+ * Frees @rule.
+ */
+void                im_filter_rule_free      (ImFilterRule *rule);
+
+/**
+ * im_filter_matcher_new:
+ * @rules: (element-type utf8): rules, as stored in the account
+ * configuration
+ *
+ * Compiles @rules to match messages. Invalid rules are skipped.
+ *
+ * Returns: (transfer full): a #ImFilterMatcher to release with
+ * im_filter_matcher_unref()
+ */
+ImFilterMatcher *   im_filter_matcher_new    (GSList *rules);
+
+/**
+ * im_filter_matcher_get_for_account:
+ * @account_mgr: a #ImAccountMgr
+ * @account_id: an account id
+ *
+ * Obtains the filter rules of @account_id compiled to match messages.
+ * They're only compiled again when the rules of the account change.
+ * Invalid rules are skipped.
+ *
+ * Returns: (transfer full): a #ImFilterMatcher to release with
+ * im_filter_matcher_unref(), or %NULL if the account has no rules
+ */
+ImFilterMatcher *   im_filter_matcher_get_for_account (ImAccountMgr *account_mgr,
+						       const gchar *account_id);
+
+/**
+ * im_filter_matcher_unref:
+ * @matcher: a #ImFilterMatcher
+ *
+ * Releases a reference of @matcher.
+ */
+void                im_filter_matcher_unref  (ImFilterMatcher *matcher);
+
+/**
+ * im_filter_matcher_get_rules_count:
+ * @matcher: a #ImFilterMatcher
+ *
+ * Returns: the number of rules of @matcher
+ */
+guint               im_filter_matcher_get_rules_count (ImFilterMatcher *matcher);
+
+/**
+ * im_filter_matcher_match:
+ * @matcher: a #ImFilterMatcher
+ * @mi: the #CamelMessageInfo of a message
+ *
+ * Obtains the first rule of @matcher matching the summary of a message.
+ * Rules comparing an exact value are looked up in a hash table, and
+ * the others are only checked while they come before the first match.
+ *
+ * Returns: (transfer none): the #ImFilterRule, or %NULL if none matches
+ */
+const ImFilterRule *im_filter_matcher_match  (ImFilterMatcher *matcher,
+					      CamelMessageInfo *mi);
+
+G_END_DECLS
+
+#endif /* __IM_FILTER_RULES_H__ */
@@ -35,18 +35,29 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
 #include "im-js-backend.h"
 
 #include "im-account-mgr.h"
 #include "im-account-mgr-helpers.h"
+#include "im-address-index.h"
 #include "im-enum-types.h"
 #include "im-error.h"
 #include "im-js-gobject-wrapper.h"
 #include "im-js-utils.h"
 #include "im-mail-ops.h"
+#include "im-send-queue-mgr.h"
 #include "im-service-mgr.h"
+#include "im-sync-scheduler.h"
+#include "im-thread-index.h"
 
+#include <camel/camel.h>
 #include <glib/gi18n.h>
+#include <string.h>
+
+#define IM_X_MAILER ("Igalia WebKit Mail " VERSION)
 
 typedef struct {
 	JSGlobalContextRef context;
@@ -433,6 +444,7 @@ typedef struct {
 	char *newest_uid;
 	char *oldest_uid;
 	gint count;
+	ImSortKey sort_key;
 } FetchMessagesContext;
 
 static void
@@ -545,6 +557,75 @@ fetch_messages_refresh_info_cb (GObject *source_object,
 	finish_fetch_messages (fm_context);
 }
 
+static JSObjectRef
+wrap_message_uids (JSContextRef context,
+		   CamelFolder *folder,
+		   GPtrArray *uids)
+{
+	GArray *values;
+	JSObjectRef result;
+	guint i;
+
+	values = g_array_new (TRUE, TRUE, sizeof (JSValueRef));
+	for (i = 0; uids && i < uids->len; i++) {
+		CamelMessageInfo *mi;
+		JSValueRef mi_value;
+
+		mi = camel_folder_get_message_info (folder, uids->pdata[i]);
+		if (mi == NULL)
+			continue;
+		mi_value = im_js_wrap_camel_message_info (context, mi);
+		g_array_append_val (values, mi_value);
+		camel_folder_free_message_info (folder, mi);
+	}
+
+	result = JSObjectMakeArray (context, values->len,
+				    (JSValueRef *) values->data, NULL);
+	g_array_free (values, TRUE);
+
+	return result;
+}
+
+static void
+fetch_sorted_messages_mail_op_cb (GObject *source_object,
+				  GAsyncResult *result,
+				  gpointer userdata)
+{
+	FetchMessagesContext *fm_context = (FetchMessagesContext *) userdata;
+	ImJSCallContext *call_context = fm_context->call_context;
+	JSContextRef context = call_context->context;
+	CamelFolder *folder = NULL;
+	GPtrArray *new_uids = NULL, *uids = NULL;
+	GError *error = NULL;
+
+	im_mail_op_fetch_sorted_messages_finish (IM_SERVICE_MGR (source_object),
+						 result, &folder, &new_uids, &uids,
+						 &error);
+
+	if (folder) {
+		JSObjectRef result;
+
+		result = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_value (context, result, "new_messages",
+						      wrap_message_uids (context, folder, new_uids),
+						      NULL);
+		im_js_object_set_property_from_value (context, result, "messages",
+						      wrap_message_uids (context, folder, uids),
+						      NULL);
+		im_js_call_context_dump_result (call_context, result);
+		g_object_unref (folder);
+	}
+	if (new_uids)
+		g_ptr_array_unref (new_uids);
+	if (uids)
+		g_ptr_array_unref (uids);
+
+	if (error)
+		g_propagate_error (&(call_context->error), error);
+
+	finish_fetch_messages (fm_context);
+}
+
 static JSValueRef
 im_service_mgr_js_fetch_messages (JSContextRef context,
 				  JSObjectRef function,
@@ -560,17 +641,21 @@ im_service_mgr_js_fetch_messages (JSContextRef context,
 	ImJSCallContext *call_context = im_js_call_context_new (context);
 
 	fm_context->call_context = call_context;
+	fm_context->sort_key = IM_SORT_KEY_UID;
 
-	if (argument_count != 5 ||
+	if (argument_count < 5 || argument_count > 6 ||
 	    !JSValueIsString (context, arguments[0]) ||
 	    !JSValueIsString (context, arguments[1]) ||
 	    !JSValueIsNumber (context, arguments[2]) ||
 	    (!JSValueIsString (context, arguments[3]) && !JSValueIsNull (context, arguments[3])) ||
-	    (!JSValueIsString (context, arguments[4]) && !JSValueIsNull (context, arguments[4]))) {
+	    (!JSValueIsString (context, arguments[4]) && !JSValueIsNull (context, arguments[4])) ||
+	    (argument_count > 5 &&
+	     !JSValueIsString (context, arguments[5]) && !JSValueIsNull (context, arguments[5]))) {
 		g_set_error (&(call_context->error),
 			     IM_ERROR_DOMAIN,
 			     IM_ERROR_SERVICE_MGR_FETCH_MESSAGES_FAILED,
 			     _("Invalid arguments"));
+		finish_fetch_messages (fm_context);
 		goto finish;
 	}
 
@@ -584,11 +669,40 @@ im_service_mgr_js_fetch_messages (JSContextRef context,
 		fm_context->newest_uid = im_js_value_to_utf8 (context, arguments[3], &_exception);
 	if (_exception == NULL)
 		fm_context->oldest_uid = im_js_value_to_utf8 (context, arguments[4], &_exception);
+	if (_exception == NULL && argument_count > 5 && JSValueIsString (context, arguments[5])) {
+		char *sort_key;
+		GEnumValue *value;
+
+		sort_key = im_js_value_to_utf8 (context, arguments[5], &_exception);
+		value = sort_key ? g_enum_get_value_by_nick (g_type_class_ref (IM_TYPE_SORT_KEY),
+							     sort_key) : NULL;
+		if (value)
+			fm_context->sort_key = value->value;
+		else if (_exception == NULL)
+			g_set_error (&_error,
+				     IM_ERROR_DOMAIN,
+				     IM_ERROR_SERVICE_MGR_FETCH_MESSAGES_FAILED,
+				     _("Invalid sort key"));
+		g_free (sort_key);
+	}
 
 	if (_error)
 		g_propagate_error (&(call_context->error), _error);
 
-	if (_exception == NULL)
+	if (_exception == NULL && call_context->error == NULL &&
+	    fm_context->sort_key != IM_SORT_KEY_UID)
+		im_mail_op_fetch_sorted_messages_async (im_service_mgr_get_instance (),
+							account_id,
+							folder_name,
+							fm_context->sort_key,
+							fm_context->newest_uid,
+							fm_context->oldest_uid,
+							MAX (fm_context->count, 0),
+							G_PRIORITY_DEFAULT_IDLE,
+							call_context->cancellable,
+							fetch_sorted_messages_mail_op_cb,
+							fm_context);
+	else if (_exception == NULL && call_context->error == NULL)
 		im_mail_op_refresh_folder_info_async (im_service_mgr_get_instance (),
 						      account_id,
 						      folder_name,
@@ -605,6 +719,390 @@ finish:
 	return call_context->result_obj;
 }
 
+static JSObjectRef
+wrap_unified_inbox_messages (JSContextRef context,
+			     GPtrArray *messages)
+{
+	JSValueRef *values;
+	JSObjectRef result;
+	guint i;
+
+	values = g_new0 (JSValueRef, messages->len + 1);
+	for (i = 0; i < messages->len; i++) {
+		ImUnifiedInboxMessage *message = (ImUnifiedInboxMessage *) messages->pdata[i];
+		JSObjectRef mi_value;
+
+		mi_value = im_js_wrap_camel_message_info (context, message->info);
+		im_js_object_set_property_from_string (context, mi_value,
+						       "accountId", message->account_id, NULL);
+		values[i] = mi_value;
+	}
+	result = JSObjectMakeArray (context, messages->len,
+				    (messages->len > 0)?values:NULL, NULL);
+	g_free (values);
+
+	return result;
+}
+
+static void
+fetch_unified_inbox_mail_op_cb (GObject *source_object,
+				GAsyncResult *result,
+				gpointer userdata)
+{
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+	JSContextRef context = call_context->context;
+	ImUnifiedInboxPage *page = NULL;
+	GError *error = NULL;
+
+	im_mail_op_fetch_unified_inbox_finish (IM_SERVICE_MGR (source_object),
+					       result, &page, &error);
+
+	if (page) {
+		JSObjectRef result;
+
+		result = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_value (context, result, "new_messages",
+						      wrap_unified_inbox_messages (context, page->new_messages),
+						      NULL);
+		im_js_object_set_property_from_value (context, result, "messages",
+						      wrap_unified_inbox_messages (context, page->messages),
+						      NULL);
+		im_js_object_set_property_from_string (context, result,
+						       "newest_cursor", page->newest_cursor, NULL);
+		im_js_object_set_property_from_string (context, result,
+						       "oldest_cursor", page->oldest_cursor, NULL);
+		im_js_call_context_dump_result (call_context, result);
+		im_unified_inbox_page_free (page);
+	}
+
+	if (error)
+		g_propagate_error (&(call_context->error), error);
+
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+im_service_mgr_js_fetch_unified_inbox (JSContextRef context,
+				       JSObjectRef function,
+				       JSObjectRef this_object,
+				       size_t argument_count,
+				       const JSValueRef arguments[],
+				       JSValueRef *exception)
+{
+	char *newest_cursor = NULL, *oldest_cursor = NULL;
+	JSValueRef _exception = NULL;
+	ImJSCallContext *call_context;
+	int count = 0;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 3 ||
+	    !JSValueIsNumber (context, arguments[0]) ||
+	    (!JSValueIsString (context, arguments[1]) && !JSValueIsNull (context, arguments[1])) ||
+	    (!JSValueIsString (context, arguments[2]) && !JSValueIsNull (context, arguments[2]))) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_FETCH_MESSAGES_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	count = (int) JSValueToNumber (context, arguments[0], &_exception);
+	if (_exception == NULL && JSValueIsString (context, arguments[1]))
+		newest_cursor = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL && JSValueIsString (context, arguments[2]))
+		oldest_cursor = im_js_value_to_utf8 (context, arguments[2], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (call_context->error == NULL && _exception == NULL)
+		im_mail_op_fetch_unified_inbox_async (im_service_mgr_get_instance (),
+						      newest_cursor, oldest_cursor,
+						      MAX (count, 0),
+						      G_PRIORITY_DEFAULT_IDLE,
+						      call_context->cancellable,
+						      fetch_unified_inbox_mail_op_cb,
+						      call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (newest_cursor);
+	g_free (oldest_cursor);
+	return call_context->result_obj;
+}
+
+static void
+fetch_threads_mail_op_cb (GObject *source_object,
+			  GAsyncResult *result,
+			  gpointer userdata)
+{
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+	JSContextRef context = call_context->context;
+	CamelFolder *folder = NULL;
+	GPtrArray *threads = NULL;
+	GError *error = NULL;
+
+	im_mail_op_fetch_threads_finish (IM_SERVICE_MGR (source_object),
+					 result, &folder, &threads, &error);
+
+	if (threads) {
+		JSValueRef *threads_values;
+		JSObjectRef result;
+		guint i, j;
+
+		threads_values = g_new0 (JSValueRef, threads->len + 1);
+		for (i = 0; i < threads->len; i++) {
+			ImMessageThread *thread = (ImMessageThread *) threads->pdata[i];
+			GArray *messages_values;
+			JSObjectRef thread_obj;
+
+			messages_values = g_array_new (TRUE, TRUE, sizeof (JSValueRef));
+			for (j = 0; j < thread->uids->len; j++) {
+				CamelMessageInfo *mi;
+				JSObjectRef mi_value;
+
+				mi = camel_folder_get_message_info (folder, thread->uids->pdata[j]);
+				if (mi == NULL)
+					continue;
+				mi_value = im_js_wrap_camel_message_info (context, mi);
+				im_js_object_set_property_from_value (context, mi_value, "threadDepth",
+								      JSValueMakeNumber (context, g_array_index (thread->depths, guint, j)),
+								      NULL);
+				g_array_append_val (messages_values, mi_value);
+				camel_folder_free_message_info (folder, mi);
+			}
+
+			thread_obj = JSObjectMake (context, NULL, NULL);
+			im_js_object_set_property_from_string (context, thread_obj,
+							       "cursor", thread->cursor, NULL);
+			im_js_object_set_property_from_value (context, thread_obj, "messages",
+							      JSObjectMakeArray (context,
+										 messages_values->len,
+										 (JSValueRef *) messages_values->data,
+										 NULL),
+							      NULL);
+			g_array_free (messages_values, TRUE);
+			threads_values[i] = thread_obj;
+		}
+
+		result = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_value (context, result, "threads",
+						      JSObjectMakeArray (context, threads->len,
+									 (threads->len > 0)?threads_values:NULL,
+									 NULL),
+						      NULL);
+		im_js_call_context_dump_result (call_context, result);
+		g_free (threads_values);
+		g_ptr_array_unref (threads);
+	}
+
+	if (folder)
+		g_object_unref (folder);
+
+	if (error)
+		g_propagate_error (&(call_context->error), error);
+
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+im_service_mgr_js_fetch_threads (JSContextRef context,
+				 JSObjectRef function,
+				 JSObjectRef this_object,
+				 size_t argument_count,
+				 const JSValueRef arguments[],
+				 JSValueRef *exception)
+{
+	char *account_id = NULL, *folder_name = NULL, *oldest_cursor = NULL;
+	JSValueRef _exception = NULL;
+	ImJSCallContext *call_context;
+	int count = 0;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 4 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1]) ||
+	    !JSValueIsNumber (context, arguments[2]) ||
+	    (!JSValueIsString (context, arguments[3]) && !JSValueIsNull (context, arguments[3]))) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_FETCH_MESSAGES_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL)
+		count = (int) JSValueToNumber (context, arguments[2], &_exception);
+	if (_exception == NULL && JSValueIsString (context, arguments[3]))
+		oldest_cursor = im_js_value_to_utf8 (context, arguments[3], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (call_context->error == NULL && _exception == NULL)
+		im_mail_op_fetch_threads_async (im_service_mgr_get_instance (),
+						account_id, folder_name, oldest_cursor,
+						MAX (count, 0),
+						G_PRIORITY_DEFAULT_IDLE,
+						call_context->cancellable,
+						fetch_threads_mail_op_cb,
+						call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (account_id);
+	g_free (folder_name);
+	g_free (oldest_cursor);
+	return call_context->result_obj;
+}
+
+typedef struct {
+	ImJSCallContext *call_context;
+	char *oldest_uid;
+	gint count;
+} SearchContext;
+
+static void
+finish_search (SearchContext *context)
+{
+	g_free (context->oldest_uid);
+	finish_im_js_call_context (context->call_context);
+	g_free (context);
+}
+
+static void
+search_mail_op_cb (GObject *source_object,
+		   GAsyncResult *result,
+		   gpointer userdata)
+{
+	SearchContext *s_context = (SearchContext *) userdata;
+	ImJSCallContext *call_context = s_context->call_context;
+	JSContextRef context = call_context->context;
+	GError *error = NULL;
+	CamelFolder *folder = NULL;
+	GPtrArray *uids = NULL;
+	guint total = 0;
+	guint i;
+
+	im_mail_op_search_finish (IM_SERVICE_MGR (source_object),
+				  result, &folder, &uids, &total, &error);
+
+	if (uids) {
+		GArray *messages_values;
+		JSObjectRef new_messages_array, messages_array;
+		JSObjectRef result;
+
+		result = JSObjectMake (context, NULL, NULL);
+		messages_values = g_array_new (TRUE, TRUE, sizeof(JSValueRef));
+
+		for (i = 0; i < uids->len; i++) {
+			CamelMessageInfo *mi;
+			JSValueRef mi_value;
+
+			mi = camel_folder_get_message_info (folder, uids->pdata[i]);
+			if (mi == NULL)
+				continue;
+			mi_value = im_js_wrap_camel_message_info (context, mi);
+			g_array_append_val (messages_values, mi_value);
+			camel_folder_free_message_info (folder, mi);
+		}
+
+		new_messages_array = JSObjectMakeArray (context, 0, NULL, NULL);
+		messages_array = JSObjectMakeArray (context,
+						    messages_values->len,
+						    (JSValueRef *) messages_values->data,
+						    NULL);
+		g_array_free (messages_values, TRUE);
+
+		im_js_object_set_property_from_value (context, result,
+						      "new_messages", new_messages_array, NULL);
+		im_js_object_set_property_from_value (context, result,
+						      "messages", messages_array, NULL);
+		im_js_object_set_property_from_value (context, result, "total",
+						      JSValueMakeNumber (context, total),
+						      NULL);
+		im_js_call_context_dump_result (call_context, result);
+		g_ptr_array_unref (uids);
+	}
+
+	if (folder)
+		g_object_unref (folder);
+
+	if (error)
+		g_propagate_error (&(call_context->error), error);
+
+	finish_search (s_context);
+}
+
+static JSValueRef
+im_service_mgr_js_search (JSContextRef context,
+			  JSObjectRef function,
+			  JSObjectRef this_object,
+			  size_t argument_count,
+			  const JSValueRef arguments[],
+			  JSValueRef *exception)
+{
+	char *account_id = NULL, *folder_name = NULL, *query = NULL;
+	JSValueRef _exception = NULL;
+	SearchContext *s_context = g_new0 (SearchContext, 1);
+	ImJSCallContext *call_context = im_js_call_context_new (context);
+
+	s_context->call_context = call_context;
+
+	if (argument_count != 5 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1]) ||
+	    !JSValueIsString (context, arguments[2]) ||
+	    !JSValueIsNumber (context, arguments[3]) ||
+	    (!JSValueIsString (context, arguments[4]) && !JSValueIsNull (context, arguments[4]))) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_SEARCH_FAILED,
+			     _("Invalid arguments"));
+		finish_search (s_context);
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL)
+		query = im_js_value_to_utf8 (context, arguments[2], &_exception);
+	if (_exception == NULL)
+		s_context->count = (int) JSValueToNumber (context, arguments[3], &_exception);
+	if (_exception == NULL)
+		s_context->oldest_uid = im_js_value_to_utf8 (context, arguments[4], &_exception);
+
+	if (_exception == NULL) {
+		im_mail_op_search_async (im_service_mgr_get_instance (),
+					 account_id,
+					 folder_name,
+					 query,
+					 s_context->oldest_uid,
+					 MAX (s_context->count, 0),
+					 G_PRIORITY_DEFAULT_IDLE,
+					 call_context->cancellable,
+					 search_mail_op_cb,
+					 s_context);
+	} else {
+		im_js_call_context_set_exception (call_context, _exception);
+		finish_search (s_context);
+	}
+
+finish:
+	g_free (account_id);
+	g_free (folder_name);
+	g_free (query);
+	return call_context->result_obj;
+}
+
 static void
 flag_message_mail_op_cb (GObject *object,
 			 GAsyncResult *result,
@@ -679,32 +1177,737 @@ finish:
 }
 
 static void
-dump_folder_data (JSContextRef context,
-		  JSObjectRef folders_hash,
-		  const gchar *full_name,
-		  const gchar *display_name,
-		  const gchar *parent_full_name,
-		  gboolean favourite,
-		  gboolean no_select,
-		  gboolean is_local,
-		  gboolean is_inbox,
-		  gboolean is_outbox,
-		  gboolean is_sent,
-		  gboolean is_trash,
-		  gboolean is_drafts,
-		  gint unread_count,
-		  gint total_count,
-		  JSValueRef *exception)
+remove_message_mail_op_cb (GObject *object,
+			   GAsyncResult *result,
+			   gpointer userdata)
 {
-	JSObjectRef folder;
-	folder = JSObjectMake (context, NULL, NULL);
-	im_js_object_set_property_from_string (context, folder,
-					       "fullName", full_name,
-					       exception);
-	im_js_object_set_property_from_string (context, folder,
-					       "displayName", display_name,
-					       exception);
-	if (parent_full_name)
+	GError *_error = NULL;
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+
+	im_mail_op_remove_message_finish (IM_SERVICE_MGR (object),
+					  result, &_error);
+	if (_error)
+		g_propagate_error (&(call_context->error), _error);
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+im_service_mgr_js_remove_message (JSContextRef context,
+				  JSObjectRef function,
+				  JSObjectRef this_object,
+				  size_t argument_count,
+				  const JSValueRef arguments[],
+				  JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	char *account_id = NULL, *folder_name = NULL, *message_uid = NULL;
+	JSValueRef _exception = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 3 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1]) ||
+	    !JSValueIsString (context, arguments[2])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_FLAG_MESSAGE_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL)
+		message_uid = im_js_value_to_utf8 (context, arguments[2], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (_exception == NULL && call_context->error == NULL)
+		im_mail_op_remove_message_async (im_service_mgr_get_instance (),
+						 account_id, folder_name, message_uid,
+						 G_PRIORITY_DEFAULT_IDLE,
+						 call_context->cancellable,
+						 remove_message_mail_op_cb,
+						 call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (account_id);
+	g_free (folder_name);
+	g_free (message_uid);
+
+	return call_context->result_obj;
+}
+
+typedef struct {
+	ImJSCallContext *call_context;
+	guint processed;
+	guint total;
+} FolderOperationProgress;
+
+static gboolean
+folder_operation_progress_idle (gpointer userdata)
+{
+	FolderOperationProgress *progress = (FolderOperationProgress *) userdata;
+	ImJSCallContext *call_context = progress->call_context;
+	JSContextRef context = call_context->context;
+	JSValueRef exception = NULL;
+	JSValueRef callback;
+
+	callback = im_js_object_get_property (context, call_context->result_obj,
+					      "onProgress", &exception);
+	if (exception == NULL && JSValueIsObject (context, callback)) {
+		JSObjectRef callback_obj;
+		JSValueRef args[2];
+
+		args[0] = JSValueMakeNumber (context, progress->processed);
+		args[1] = JSValueMakeNumber (context, progress->total);
+		callback_obj = JSValueToObject (context, callback, &exception);
+		if (exception == NULL && JSObjectIsFunction (context, callback_obj))
+			JSObjectCallAsFunction (context, callback_obj,
+						call_context->result_obj,
+						2, args, &exception);
+	}
+
+	g_slice_free (FolderOperationProgress, progress);
+	return FALSE;
+}
+
+/* Called in the operation thread. Idles run in order, so all of them
+ * run before the call context is finished */
+static void
+on_folder_operation_progress (CamelFolder *folder,
+			      guint processed,
+			      guint total,
+			      gpointer userdata)
+{
+	FolderOperationProgress *progress;
+
+	progress = g_slice_new (FolderOperationProgress);
+	progress->call_context = (ImJSCallContext *) userdata;
+	progress->processed = processed;
+	progress->total = total;
+	g_idle_add (folder_operation_progress_idle, progress);
+}
+
+static void
+folder_operation_mail_op_cb (GObject *object,
+			     GAsyncResult *result,
+			     gpointer userdata)
+{
+	GError *_error = NULL;
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+
+	im_mail_op_folder_operation_finish (IM_SERVICE_MGR (object),
+					    result, &_error);
+	if (_error)
+		g_propagate_error (&(call_context->error), _error);
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+run_folder_operation (JSContextRef context,
+		      ImFolderOperation operation,
+		      size_t argument_count,
+		      const JSValueRef arguments[])
+{
+	ImJSCallContext *call_context;
+	char *account_id = NULL, *folder_name = NULL;
+	JSValueRef _exception = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 2 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_FOLDER_OPERATION_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (call_context->error == NULL && _exception == NULL)
+		im_mail_op_folder_operation_async (im_service_mgr_get_instance (),
+						   account_id, folder_name,
+						   operation,
+						   on_folder_operation_progress,
+						   call_context,
+						   G_PRIORITY_DEFAULT_IDLE,
+						   call_context->cancellable,
+						   folder_operation_mail_op_cb,
+						   call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (account_id);
+	g_free (folder_name);
+
+	return call_context->result_obj;
+}
+
+static JSValueRef
+im_service_mgr_js_mark_folder_read (JSContextRef context,
+				    JSObjectRef function,
+				    JSObjectRef this_object,
+				    size_t argument_count,
+				    const JSValueRef arguments[],
+				    JSValueRef *exception)
+{
+	return run_folder_operation (context, IM_FOLDER_OPERATION_MARK_READ,
+				     argument_count, arguments);
+}
+
+static JSValueRef
+im_service_mgr_js_expunge_folder (JSContextRef context,
+				  JSObjectRef function,
+				  JSObjectRef this_object,
+				  size_t argument_count,
+				  const JSValueRef arguments[],
+				  JSValueRef *exception)
+{
+	return run_folder_operation (context, IM_FOLDER_OPERATION_EXPUNGE,
+				     argument_count, arguments);
+}
+
+static JSValueRef
+im_service_mgr_js_empty_folder (JSContextRef context,
+				JSObjectRef function,
+				JSObjectRef this_object,
+				size_t argument_count,
+				const JSValueRef arguments[],
+				JSValueRef *exception)
+{
+	return run_folder_operation (context, IM_FOLDER_OPERATION_EMPTY,
+				     argument_count, arguments);
+}
+
+static gchar *
+get_string_member (JSContextRef context,
+		   JSObjectRef object,
+		   const gchar *name,
+		   JSValueRef *exception)
+{
+	JSValueRef value;
+
+	value = im_js_object_get_property (context, object, name, exception);
+	if (*exception == NULL && JSValueIsString (context, value))
+		return im_js_value_to_utf8 (context, value, exception);
+
+	return NULL;
+}
+
+/* Gets the strings in the JS array @value, or %NULL if it's not an array */
+static GPtrArray *
+value_to_string_array (JSContextRef context,
+		       JSValueRef value,
+		       JSValueRef *exception)
+{
+	JSValueRef length_value = NULL;
+	JSObjectRef array;
+	GPtrArray *result;
+	guint length, i;
+
+	if (!JSValueIsObject (context, value))
+		return NULL;
+
+	array = JSValueToObject (context, value, exception);
+	if (*exception == NULL)
+		length_value = im_js_object_get_property (context, array, "length", exception);
+	if (*exception != NULL || !JSValueIsNumber (context, length_value))
+		return NULL;
+
+	length = (guint) JSValueToNumber (context, length_value, exception);
+	result = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; *exception == NULL && i < length; i++) {
+		JSValueRef item;
+
+		item = JSObjectGetPropertyAtIndex (context, array, i, exception);
+		if (*exception == NULL && JSValueIsString (context, item))
+			g_ptr_array_add (result, im_js_value_to_utf8 (context, item, exception));
+	}
+
+	if (*exception != NULL) {
+		g_ptr_array_unref (result);
+		return NULL;
+	}
+
+	return result;
+}
+
+static GList *
+get_string_list_member (JSContextRef context,
+			JSObjectRef object,
+			const gchar *name,
+			JSValueRef *exception)
+{
+	JSValueRef value;
+	GPtrArray *array;
+	GList *result = NULL;
+	guint i;
+
+	value = im_js_object_get_property (context, object, name, exception);
+	if (*exception != NULL)
+		return NULL;
+
+	array = value_to_string_array (context, value, exception);
+	for (i = 0; array != NULL && i < array->len; i++)
+		result = g_list_prepend (result, g_strdup (array->pdata[i]));
+	if (array)
+		g_ptr_array_unref (array);
+
+	return g_list_reverse (result);
+}
+
+static void
+flag_messages_mail_op_cb (GObject *object,
+			  GAsyncResult *result,
+			  gpointer userdata)
+{
+	GError *_error = NULL;
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+
+	im_mail_op_flag_messages_finish (IM_SERVICE_MGR (object),
+					 result, &_error);
+	if (_error)
+		g_propagate_error (&(call_context->error), _error);
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+im_service_mgr_js_flag_messages (JSContextRef context,
+				 JSObjectRef function,
+				 JSObjectRef this_object,
+				 size_t argument_count,
+				 const JSValueRef arguments[],
+				 JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	char *account_id = NULL, *folder_name = NULL;
+	char *set_flags = NULL, *unset_flags = NULL;
+	GPtrArray *message_uids = NULL;
+	JSValueRef _exception = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 5 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1]) ||
+	    !JSValueIsObject (context, arguments[2]) ||
+	    !JSValueIsString (context, arguments[3]) ||
+	    !JSValueIsString (context, arguments[4])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_FLAG_MESSAGE_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL)
+		message_uids = value_to_string_array (context, arguments[2], &_exception);
+	if (_exception == NULL)
+		set_flags = im_js_value_to_utf8 (context, arguments[3], &_exception);
+	if (_exception == NULL)
+		unset_flags = im_js_value_to_utf8 (context, arguments[4], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (_exception == NULL && message_uids != NULL && message_uids->len > 0)
+		im_mail_op_flag_messages_async (im_service_mgr_get_instance (),
+						account_id, folder_name, message_uids,
+						set_flags, unset_flags,
+						G_PRIORITY_DEFAULT_IDLE,
+						call_context->cancellable,
+						flag_messages_mail_op_cb,
+						call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (account_id);
+	g_free (folder_name);
+	g_free (set_flags);
+	g_free (unset_flags);
+	if (message_uids)
+		g_ptr_array_unref (message_uids);
+
+	return call_context->result_obj;
+}
+
+static void
+transfer_messages_mail_op_cb (GObject *object,
+			      GAsyncResult *result,
+			      gpointer userdata)
+{
+	GError *_error = NULL;
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+
+	im_mail_op_transfer_messages_finish (IM_SERVICE_MGR (object),
+					     result, &_error);
+	if (_error)
+		g_propagate_error (&(call_context->error), _error);
+	finish_im_js_call_context (call_context);
+}
+
+static JSValueRef
+transfer_messages (JSContextRef context,
+		   gboolean delete_originals,
+		   size_t argument_count,
+		   const JSValueRef arguments[])
+{
+	ImJSCallContext *call_context;
+	char *account_id = NULL, *folder_name = NULL;
+	char *dest_account_id = NULL, *dest_folder_name = NULL;
+	GPtrArray *message_uids = NULL;
+	JSValueRef _exception = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 5 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsString (context, arguments[1]) ||
+	    !JSValueIsObject (context, arguments[2]) ||
+	    !JSValueIsString (context, arguments[3]) ||
+	    !JSValueIsString (context, arguments[4])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_TRANSFER_MESSAGES_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	account_id = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		folder_name = im_js_value_to_utf8 (context, arguments[1], &_exception);
+	if (_exception == NULL)
+		message_uids = value_to_string_array (context, arguments[2], &_exception);
+	if (_exception == NULL)
+		dest_account_id = im_js_value_to_utf8 (context, arguments[3], &_exception);
+	if (_exception == NULL)
+		dest_folder_name = im_js_value_to_utf8 (context, arguments[4], &_exception);
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+
+finish:
+	if (_exception == NULL && message_uids != NULL && message_uids->len > 0)
+		im_mail_op_transfer_messages_async (im_service_mgr_get_instance (),
+						    account_id, folder_name, message_uids,
+						    dest_account_id, dest_folder_name,
+						    delete_originals,
+						    on_folder_operation_progress,
+						    call_context,
+						    G_PRIORITY_DEFAULT_IDLE,
+						    call_context->cancellable,
+						    transfer_messages_mail_op_cb,
+						    call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	g_free (account_id);
+	g_free (folder_name);
+	g_free (dest_account_id);
+	g_free (dest_folder_name);
+	if (message_uids)
+		g_ptr_array_unref (message_uids);
+
+	return call_context->result_obj;
+}
+
+static JSValueRef
+im_service_mgr_js_copy_messages (JSContextRef context,
+				 JSObjectRef function,
+				 JSObjectRef this_object,
+				 size_t argument_count,
+				 const JSValueRef arguments[],
+				 JSValueRef *exception)
+{
+	return transfer_messages (context, FALSE, argument_count, arguments);
+}
+
+static JSValueRef
+im_service_mgr_js_move_messages (JSContextRef context,
+				 JSObjectRef function,
+				 JSObjectRef this_object,
+				 size_t argument_count,
+				 const JSValueRef arguments[],
+				 JSValueRef *exception)
+{
+	return transfer_messages (context, TRUE, argument_count, arguments);
+}
+
+static CamelMimeMessage *
+create_composer_message (const gchar *account_id,
+			 const gchar *to,
+			 const gchar *cc,
+			 const gchar *bcc,
+			 const gchar *subject,
+			 gboolean is_sending,
+			 GError **error)
+{
+	GError *_error = NULL;
+	CamelMimeMessage *message = NULL;
+
+	if (account_id == NULL) {
+		g_set_error (&_error, IM_ERROR_DOMAIN,
+			     IM_ERROR_SEND_INVALID_PARAMETERS,
+			     _("No transport account specified trying to send the message"));
+	}
+
+	if (_error == NULL) {
+		if (!im_account_mgr_account_exists (im_account_mgr_get_instance (),
+						    account_id, FALSE)) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_SEND_INVALID_PARAMETERS,
+				     _("Invalid transport account specified trying to send the message"));
+		}
+	}
+
+	if (_error == NULL) {
+		gchar *from_string;
+		gint from_count;
+		CamelInternetAddress *from_cia;
+
+		message = camel_mime_message_new ();
+		camel_medium_set_header (CAMEL_MEDIUM (message), "X-Mailer", IM_X_MAILER);
+		camel_mime_message_set_subject (message, subject);
+		camel_mime_message_set_date (message, CAMEL_MESSAGE_DATE_CURRENT, 0);
+
+		from_string = im_account_mgr_get_from_string (im_account_mgr_get_instance (),
+							      account_id, NULL);
+
+		from_cia = camel_internet_address_new ();
+		from_count = camel_address_unformat (CAMEL_ADDRESS (from_cia), from_string);
+		if (from_count != 1) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_SEND_INVALID_ACCOUNT_FROM,
+				     _("Account has an invalid from field"));
+		} else {
+			camel_mime_message_set_from (message,
+						     from_cia);
+		}
+		g_object_unref (from_cia);
+		g_free (from_string);
+	}
+
+	if (_error == NULL) {
+		CamelInternetAddress *to_cia, *cc_cia, *bcc_cia;
+		gint to_count, cc_count, bcc_count;
+
+		to_cia = camel_internet_address_new ();
+		to_count = camel_address_unformat (CAMEL_ADDRESS (to_cia), to);
+		cc_cia = camel_internet_address_new ();
+		cc_count = camel_address_unformat (CAMEL_ADDRESS (cc_cia), cc);
+		bcc_cia = camel_internet_address_new ();
+		bcc_count = camel_address_unformat (CAMEL_ADDRESS (bcc_cia), bcc);
+
+		if (to_count == -1 || cc_count == -1 || bcc_count == -1) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_SEND_PARSING_RECIPIENTS,
+				     _("Failed to parse recipients"));
+		} else if (is_sending && (to_count + cc_count + bcc_count == 0)) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_SEND_NO_RECIPIENTS,
+				     _("User didn't set recipients trying to send"));
+		} else {
+			camel_mime_message_set_recipients (message,
+							   CAMEL_RECIPIENT_TYPE_TO,
+							   to_cia);
+			camel_mime_message_set_recipients (message,
+							   CAMEL_RECIPIENT_TYPE_CC,
+							   cc_cia);
+			camel_mime_message_set_recipients (message,
+							   CAMEL_RECIPIENT_TYPE_BCC,
+							   bcc_cia);
+		}
+		g_object_unref (to_cia);
+		g_object_unref (cc_cia);
+		g_object_unref (bcc_cia);
+	}
+
+	if (_error) {
+		if (message)
+			g_object_unref (message);
+		g_propagate_error (error, _error);
+		return NULL;
+	}
+
+	return message;
+}
+
+static void
+composer_save_mail_op_cb (GObject *object,
+			  GAsyncResult *result,
+			  gpointer userdata)
+{
+	GError *_error = NULL;
+	ImJSCallContext *call_context = (ImJSCallContext *) userdata;
+	gchar *uid = NULL;
+
+	im_mail_op_composer_save_finish (CAMEL_FOLDER (object),
+					 result, &uid, &_error);
+	if (_error) {
+		g_propagate_error (&(call_context->error), _error);
+	} else if (uid) {
+		JSContextRef context = call_context->context;
+		JSObjectRef result_obj;
+
+		result_obj = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_string (context, result_obj,
+						       "messageUid", uid, NULL);
+		im_js_call_context_dump_result (call_context, result_obj);
+	}
+	g_free (uid);
+	finish_im_js_call_context (call_context);
+}
+
+/*
+ * composerSave (fields, isSending): fields is an object with the
+ * from, to, cc, bcc, subject and body strings, and the attachments
+ * array of uris. The body is passed as is, so it's never escaped
+ * in an iwk: request uri. Saving a draft, replaceUid is the uid of
+ * the previous version of the draft, replaced by the new one.
+ */
+static JSValueRef
+im_service_mgr_js_composer_save (JSContextRef context,
+				 JSObjectRef function,
+				 JSObjectRef this_object,
+				 size_t argument_count,
+				 const JSValueRef arguments[],
+				 JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	GError *_error = NULL;
+	JSObjectRef fields = NULL;
+	gchar *account_id = NULL, *to = NULL, *cc = NULL, *bcc = NULL;
+	gchar *subject = NULL, *body = NULL, *replace_uid = NULL;
+	GList *attachment_uris = NULL;
+	gboolean is_sending;
+	CamelMimeMessage *message = NULL;
+	CamelFolder *folder = NULL;
+	JSValueRef _exception = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 2 ||
+	    !JSValueIsObject (context, arguments[0]) ||
+	    !JSValueIsBoolean (context, arguments[1])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SEND_INVALID_PARAMETERS,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	is_sending = JSValueToBoolean (context, arguments[1]);
+	fields = JSValueToObject (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		account_id = get_string_member (context, fields, "from", &_exception);
+	if (_exception == NULL)
+		to = get_string_member (context, fields, "to", &_exception);
+	if (_exception == NULL)
+		cc = get_string_member (context, fields, "cc", &_exception);
+	if (_exception == NULL)
+		bcc = get_string_member (context, fields, "bcc", &_exception);
+	if (_exception == NULL)
+		subject = get_string_member (context, fields, "subject", &_exception);
+	if (_exception == NULL)
+		body = get_string_member (context, fields, "body", &_exception);
+	if (_exception == NULL)
+		attachment_uris = get_string_list_member (context, fields, "attachments", &_exception);
+	if (_exception == NULL && !is_sending)
+		replace_uid = get_string_member (context, fields, "replaceUid", &_exception);
+
+	if (_exception == NULL)
+		message = create_composer_message (account_id, to, cc, bcc, subject,
+						   is_sending, &_error);
+
+	if (message) {
+		if (is_sending)
+			folder = im_service_mgr_get_outbox (im_service_mgr_get_instance (),
+							    account_id,
+							    call_context->cancellable,
+							    &_error);
+		else
+			folder = im_service_mgr_get_drafts (im_service_mgr_get_instance (),
+							    call_context->cancellable,
+							    &_error);
+	}
+
+	if (_exception)
+		im_js_call_context_set_exception (call_context, _exception);
+	if (_error)
+		g_propagate_error (&(call_context->error), _error);
+
+finish:
+	if (folder)
+		im_mail_op_composer_save_async (folder, message,
+						body?body:"", attachment_uris,
+						replace_uid,
+						G_PRIORITY_DEFAULT_IDLE,
+						call_context->cancellable,
+						composer_save_mail_op_cb,
+						call_context);
+	else
+		finish_im_js_call_context (call_context);
+
+	if (message) g_object_unref (message);
+	if (folder) g_object_unref (folder);
+	g_list_free_full (attachment_uris, g_free);
+	g_free (account_id);
+	g_free (to);
+	g_free (cc);
+	g_free (bcc);
+	g_free (subject);
+	g_free (body);
+	g_free (replace_uid);
+
+	return call_context->result_obj;
+}
+
+static void
+dump_folder_data (JSContextRef context,
+		  JSObjectRef folders_hash,
+		  const gchar *full_name,
+		  const gchar *display_name,
+		  const gchar *parent_full_name,
+		  gboolean favourite,
+		  gboolean no_select,
+		  gboolean is_local,
+		  gboolean is_inbox,
+		  gboolean is_outbox,
+		  gboolean is_sent,
+		  gboolean is_trash,
+		  gboolean is_drafts,
+		  gint unread_count,
+		  gint total_count,
+		  JSValueRef *exception)
+{
+	JSObjectRef folder;
+	folder = JSObjectMake (context, NULL, NULL);
+	im_js_object_set_property_from_string (context, folder,
+					       "fullName", full_name,
+					       exception);
+	im_js_object_set_property_from_string (context, folder,
+					       "displayName", display_name,
+					       exception);
+	if (parent_full_name)
 		im_js_object_set_property_from_string (context, folder,
 						       "parentFullName", parent_full_name,
 						       exception);
@@ -827,13 +2030,24 @@ dump_folder_info (JSContextRef context,
 			is_inbox = (fi->flags & CAMEL_FOLDER_TYPE_MASK) == CAMEL_FOLDER_TYPE_INBOX;
 			is_local = FALSE;
 			parent_full_name = (fi->parent)?fi->parent->full_name:NULL;
-		} else {
+		} else if (fi->parent == NULL) {
 			full_name = "INBOX";
 			display_name = _("Inbox");
 			favourite = TRUE;
 			is_inbox = TRUE;
 			is_local = TRUE;
 			parent_full_name = NULL;
+		} else {
+			/* Folders of the account, under its local inbox */
+			full_name = strchr (fi->full_name, '/') + 1;
+			display_name = fi->display_name;
+			favourite = fi->flags & CAMEL_FOLDER_CHECK_FOR_NEW;
+			is_inbox = FALSE;
+			is_local = TRUE;
+			if (fi->parent->parent == NULL)
+				parent_full_name = "INBOX";
+			else
+				parent_full_name = strchr (fi->parent->full_name, '/') + 1;
 		}
 		unread = fi->unread;
 		count = fi->total;
@@ -869,7 +2083,9 @@ dump_folder_info (JSContextRef context,
 static void
 create_sync_account_result (ImJSCallContext *call_context,
 			    const gchar *account_id,
-			    CamelFolderInfo *fi)
+			    CamelFolderInfo *fi,
+			    guint duplicates,
+			    guint64 duplicates_size)
 {
 	ImServiceMgr *service_mgr;
 	CamelFolder *drafts;
@@ -914,6 +2130,20 @@ create_sync_account_result (ImJSCallContext *call_context,
 						      _exception);
 	}
 
+	/* Messages of POP accounts not stored, as they were already received */
+	if (_exception == NULL)
+		im_js_object_set_property_from_value (context,
+						      result,
+						      "duplicates",
+						      JSValueMakeNumber (context, duplicates),
+						      _exception);
+	if (_exception == NULL)
+		im_js_object_set_property_from_value (context,
+						      result,
+						      "duplicatesSize",
+						      JSValueMakeNumber (context, duplicates_size),
+						      _exception);
+
 	if (_exception == NULL) {
 		im_js_call_context_dump_result (call_context, result);
 	} else {
@@ -948,14 +2178,18 @@ sync_account_synchronize_store_cb (GObject *source_object,
 	CamelFolderInfo *fi;
 	GError *_error = NULL;
 	gchar *account_id;
+	guint duplicates = 0;
+	guint64 duplicates_size = 0;
 
 	account_id = im_account_mgr_get_server_parent_account_name 
 		(im_account_mgr_get_instance (),
 		 camel_service_get_uid (CAMEL_SERVICE (service_store)),
 		 IM_ACCOUNT_TYPE_STORE);
 	fi = im_mail_op_synchronize_store_finish (CAMEL_STORE (service_store),
-						  res, &_error);
-	create_sync_account_result (call_context, account_id, fi);
+						  res, &duplicates, &duplicates_size,
+						  &_error);
+	create_sync_account_result (call_context, account_id, fi,
+				    duplicates, duplicates_size);
 	if (fi) {
 		free_service_store_folder_info (account_id,
 						service_store,
@@ -1022,11 +2256,206 @@ im_service_mgr_js_sync_account (JSContextRef context,
 }
 
 
+static JSValueRef
+im_service_mgr_js_complete_address (JSContextRef context,
+				    JSObjectRef function,
+				    JSObjectRef this_object,
+				    size_t argument_count,
+				    const JSValueRef arguments[],
+				    JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	JSValueRef _exception = NULL;
+	GList *completions, *node;
+	JSValueRef *args;
+	size_t args_count;
+	JSObjectRef array;
+	char *prefix = NULL;
+	int count = 0;
+	int i;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 2 ||
+	    !JSValueIsString (context, arguments[0]) ||
+	    !JSValueIsNumber (context, arguments[1])) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_COMPLETE_ADDRESS_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	prefix = im_js_value_to_utf8 (context, arguments[0], &_exception);
+	if (_exception == NULL)
+		count = (int) JSValueToNumber (context, arguments[1], &_exception);
+	if (_exception) {
+		im_js_call_context_set_exception (call_context, _exception);
+		goto finish;
+	}
+
+	completions = im_address_index_complete (im_address_index_get_instance (),
+						 prefix, MAX (count, 0));
+	args_count = g_list_length (completions);
+	args = g_new0 (JSValueRef, args_count);
+	i = 0;
+	for (node = completions; node != NULL; node = g_list_next (node)) {
+		ImAddressCompletion *item = (ImAddressCompletion *) node->data;
+		JSObjectRef obj;
+
+		obj = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_string (context, obj,
+						       "name", item->name?item->name:"",
+						       exception);
+		im_js_object_set_property_from_string (context, obj,
+						       "address", item->address,
+						       exception);
+		im_js_object_set_property_from_value
+			(context, obj,
+			 "count",
+			 JSValueMakeNumber (context, item->count),
+			 exception);
+		args[i] = obj;
+		i++;
+	}
+	im_address_index_free_completions (completions);
+
+	array = JSObjectMakeArray (context, args_count,
+				   (args_count > 0)?args:NULL,
+				   exception);
+	g_free (args);
+	im_js_call_context_dump_result (call_context, array);
+
+finish:
+	g_free (prefix);
+	finish_im_js_call_context (call_context);
+	return call_context->result_obj;
+}
+
+static JSValueRef
+im_service_mgr_js_get_sync_schedule (JSContextRef context,
+				     JSObjectRef function,
+				     JSObjectRef this_object,
+				     size_t argument_count,
+				     const JSValueRef arguments[],
+				     JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	GList *schedule, *node;
+	JSValueRef *args;
+	size_t args_count;
+	JSObjectRef array;
+	int i;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 0) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_GET_SYNC_SCHEDULE_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	schedule = im_sync_scheduler_get_schedule (im_sync_scheduler_get_instance ());
+	args_count = g_list_length (schedule);
+	args = g_new0 (JSValueRef, args_count);
+	i = 0;
+	for (node = schedule; node != NULL; node = g_list_next (node)) {
+		ImSyncSchedule *item = (ImSyncSchedule *) node->data;
+		JSObjectRef obj;
+
+		/* Times are passed in milliseconds, as expected by Date */
+		obj = JSObjectMake (context, NULL, NULL);
+		im_js_object_set_property_from_string (context, obj,
+						       "accountId", item->account_id,
+						       exception);
+		im_js_object_set_property_from_value
+			(context, obj,
+			 "nextRun",
+			 item->next_run?JSValueMakeNumber (context, item->next_run * 1000.0):JSValueMakeNull (context),
+			 exception);
+		im_js_object_set_property_from_value
+			(context, obj,
+			 "lastUpdated",
+			 item->last_updated?JSValueMakeNumber (context, item->last_updated * 1000.0):JSValueMakeNull (context),
+			 exception);
+		im_js_object_set_property_from_value
+			(context, obj,
+			 "failures",
+			 JSValueMakeNumber (context, item->failures),
+			 exception);
+		im_js_object_set_property_from_value
+			(context, obj,
+			 "push",
+			 JSValueMakeBoolean (context, item->push),
+			 exception);
+		args[i] = obj;
+		i++;
+	}
+	im_sync_scheduler_free_schedule (schedule);
+
+	array = JSObjectMakeArray (context, args_count,
+				   (args_count > 0)?args:NULL,
+				   exception);
+	g_free (args);
+	im_js_call_context_dump_result (call_context, array);
+
+finish:
+	finish_im_js_call_context (call_context);
+	return call_context->result_obj;
+}
+
+static JSValueRef
+im_service_mgr_js_set_current_account (JSContextRef context,
+				       JSObjectRef function,
+				       JSObjectRef this_object,
+				       size_t argument_count,
+				       const JSValueRef arguments[],
+				       JSValueRef *exception)
+{
+	ImJSCallContext *call_context;
+	char *account_id = NULL;
+
+	call_context = im_js_call_context_new (context);
+
+	if (argument_count != 1 ||
+	    !(JSValueIsString (context, arguments[0]) || JSValueIsNull (context, arguments[0]))) {
+		g_set_error (&(call_context->error),
+			     IM_ERROR_DOMAIN,
+			     IM_ERROR_SERVICE_MGR_SET_CURRENT_ACCOUNT_FAILED,
+			     _("Invalid arguments"));
+		goto finish;
+	}
+
+	if (JSValueIsString (context, arguments[0]))
+		account_id = im_js_value_to_utf8 (context, arguments[0], exception);
+	im_service_mgr_set_current_account (im_service_mgr_get_instance (), account_id);
+
+finish:
+	g_free (account_id);
+	finish_im_js_call_context (call_context);
+	return call_context->result_obj;
+}
 
 static const JSStaticFunction im_service_mgr_class_staticfuncs[] =
 {
+{ "completeAddress", im_service_mgr_js_complete_address, kJSPropertyAttributeNone },
+{ "composerSave", im_service_mgr_js_composer_save, kJSPropertyAttributeNone },
+{ "copyMessages", im_service_mgr_js_copy_messages, kJSPropertyAttributeNone },
+{ "emptyFolder", im_service_mgr_js_empty_folder, kJSPropertyAttributeNone },
+{ "expungeFolder", im_service_mgr_js_expunge_folder, kJSPropertyAttributeNone },
 { "flagMessage", im_service_mgr_js_flag_message, kJSPropertyAttributeNone },
+{ "flagMessages", im_service_mgr_js_flag_messages, kJSPropertyAttributeNone },
 { "fetchMessages", im_service_mgr_js_fetch_messages, kJSPropertyAttributeNone },
+{ "fetchThreads", im_service_mgr_js_fetch_threads, kJSPropertyAttributeNone },
+{ "fetchUnifiedInbox", im_service_mgr_js_fetch_unified_inbox, kJSPropertyAttributeNone },
+{ "getSyncSchedule", im_service_mgr_js_get_sync_schedule, kJSPropertyAttributeNone },
+{ "markFolderRead", im_service_mgr_js_mark_folder_read, kJSPropertyAttributeNone },
+{ "moveMessages", im_service_mgr_js_move_messages, kJSPropertyAttributeNone },
+{ "removeMessage", im_service_mgr_js_remove_message, kJSPropertyAttributeNone },
+{ "search", im_service_mgr_js_search, kJSPropertyAttributeNone },
+{ "setCurrentAccount", im_service_mgr_js_set_current_account, kJSPropertyAttributeNone },
 { "syncAccount", im_service_mgr_js_sync_account, kJSPropertyAttributeNone },
 { NULL, NULL, 0 }
 };
@@ -1089,7 +2518,211 @@ im_account_mgr_setup_js_class (JSGlobalContextRef context)
 }
 
 
+/* Context the service manager events are delivered to. It's the
+ * main frame context, that is reset on each window object clear */
+static JSGlobalContextRef events_context = NULL;
+
+static JSObjectRef
+get_service_mgr_event_handler (JSContextRef context,
+			       const char *handler_name)
+{
+	JSValueRef iwk, service_mgr, handler;
+	JSObjectRef handler_obj;
+
+	iwk = im_js_object_get_property (context, JSContextGetGlobalObject (context),
+					 "iwk", NULL);
+	if (iwk == NULL || !JSValueIsObject (context, iwk))
+		return NULL;
+
+	service_mgr = im_js_object_get_property (context, JSValueToObject (context, iwk, NULL),
+						 "ServiceMgr", NULL);
+	if (service_mgr == NULL || !JSValueIsObject (context, service_mgr))
+		return NULL;
+
+	handler = im_js_object_get_property (context, JSValueToObject (context, service_mgr, NULL),
+					     handler_name, NULL);
+	if (handler == NULL || !JSValueIsObject (context, handler))
+		return NULL;
+
+	handler_obj = JSValueToObject (context, handler, NULL);
+	if (!JSObjectIsFunction (context, handler_obj))
+		return NULL;
+
+	return handler_obj;
+}
+
+static JSObjectRef
+make_uids_array (JSContextRef context,
+		 GPtrArray *uids)
+{
+	JSValueRef *values;
+	JSObjectRef array;
+	gint i;
+
+	values = g_new0 (JSValueRef, uids->len);
+	for (i = 0; i < uids->len; i++) {
+		JSStringRef uid_str;
+
+		uid_str = JSStringCreateWithUTF8CString ((char *) uids->pdata[i]);
+		values[i] = JSValueMakeString (context, uid_str);
+		JSStringRelease (uid_str);
+	}
+	array = JSObjectMakeArray (context, uids->len,
+				   (uids->len > 0)?values:NULL, NULL);
+	g_free (values);
+
+	return array;
+}
+
+static JSObjectRef
+make_changed_messages_hash (JSContextRef context,
+			    CamelFolder *folder,
+			    GPtrArray *uids)
+{
+	JSObjectRef messages;
+	gint i;
+
+	messages = JSObjectMake (context, NULL, NULL);
+	for (i = 0; i < uids->len; i++) {
+		const char *uid = (const char *) uids->pdata[i];
+		CamelMessageInfo *mi;
+
+		mi = camel_folder_get_message_info (folder, uid);
+		if (mi) {
+			im_js_object_set_property_from_value (context, messages, uid,
+							      im_js_wrap_camel_message_info (context, mi),
+							      NULL);
+			camel_folder_free_message_info (folder, mi);
+		}
+	}
+
+	return messages;
+}
+
+static void
+on_service_mgr_folder_changed (ImServiceMgr *service_mgr,
+			       ImFolderChanges *changes,
+			       gpointer userdata)
+{
+	JSGlobalContextRef context = events_context;
+	JSObjectRef handler, event;
+	JSValueRef args[1];
+
+	if (context == NULL)
+		return;
+
+	handler = get_service_mgr_event_handler (context, "onFolderChanged");
+	if (handler == NULL)
+		return;
+
+	event = JSObjectMake (context, NULL, NULL);
+	if (changes->account_id)
+		im_js_object_set_property_from_string (context, event,
+						       "accountId", changes->account_id, NULL);
+	else
+		im_js_object_set_property_from_value (context, event, "accountId",
+						      JSValueMakeNull (context), NULL);
+	im_js_object_set_property_from_string (context, event,
+					       "folderName", changes->folder_name, NULL);
+	im_js_object_set_property_from_value (context, event, "added",
+					      make_uids_array (context, changes->uids_added), NULL);
+	im_js_object_set_property_from_value (context, event, "removed",
+					      make_uids_array (context, changes->uids_removed), NULL);
+	im_js_object_set_property_from_value (context, event, "changed",
+					      make_uids_array (context, changes->uids_changed), NULL);
+	im_js_object_set_property_from_value (context, event, "changedMessages",
+					      make_changed_messages_hash (context, changes->folder,
+									  changes->uids_changed),
+					      NULL);
+	im_js_object_set_property_from_value (context, event, "unreadCount",
+					      JSValueMakeNumber (context, changes->unread_count), NULL);
+	im_js_object_set_property_from_value (context, event, "messageCount",
+					      JSValueMakeNumber (context, changes->message_count), NULL);
+
+	args[0] = event;
+	JSObjectCallAsFunction (context, handler, NULL, 1, args, NULL);
+}
+
+static const gchar *
+get_send_queue_state_name (ImSendQueueState state)
+{
+	switch (state) {
+	case IM_SEND_QUEUE_STATE_WAITING:
+		return "waiting";
+	case IM_SEND_QUEUE_STATE_RUNNING:
+		return "running";
+	default:
+		return "finished";
+	}
+}
+
+static void
+on_send_queue_mgr_progress (ImSendQueueMgr *send_queue_mgr,
+			    ImSendQueueProgress *progress,
+			    gpointer userdata)
+{
+	JSGlobalContextRef context = events_context;
+	JSObjectRef handler, event;
+	JSValueRef args[1];
+
+	if (context == NULL)
+		return;
+
+	handler = get_service_mgr_event_handler (context, "onSendQueueProgress");
+	if (handler == NULL)
+		return;
+
+	event = JSObjectMake (context, NULL, NULL);
+	im_js_object_set_property_from_string (context, event,
+					       "accountId", progress->account_id, NULL);
+	im_js_object_set_property_from_string (context, event,
+					       "state", get_send_queue_state_name (progress->state), NULL);
+	im_js_object_set_property_from_value (context, event, "queued",
+					      JSValueMakeNumber (context, progress->stats.queued), NULL);
+	im_js_object_set_property_from_value (context, event, "sent",
+					      JSValueMakeNumber (context, progress->stats.sent), NULL);
+	im_js_object_set_property_from_value (context, event, "retried",
+					      JSValueMakeNumber (context, progress->stats.retried), NULL);
+	im_js_object_set_property_from_value (context, event, "failed",
+					      JSValueMakeNumber (context, progress->stats.failed), NULL);
+	if (progress->stats.next_attempt > 0)
+		im_js_object_set_property_from_value (context, event, "nextAttempt",
+						      JSValueMakeNumber (context, progress->stats.next_attempt * 1000.0),
+						      NULL);
+	else
+		im_js_object_set_property_from_value (context, event, "nextAttempt",
+						      JSValueMakeNull (context), NULL);
+	if (progress->error)
+		im_js_object_set_property_from_string (context, event,
+						       "error", progress->error->message, NULL);
+	else
+		im_js_object_set_property_from_value (context, event, "error",
+						      JSValueMakeNull (context), NULL);
+
+	args[0] = event;
+	JSObjectCallAsFunction (context, handler, NULL, 1, args, NULL);
+}
+
+static void
+im_service_mgr_setup_js_events (JSGlobalContextRef context)
+{
+	static gboolean connected = FALSE;
+
+	if (events_context)
+		JSGlobalContextRelease (events_context);
+	events_context = JSGlobalContextRetain (context);
+
+	if (!connected) {
+		g_signal_connect (G_OBJECT (im_service_mgr_get_instance ()), "folder_changed",
+				  G_CALLBACK (on_service_mgr_folder_changed), NULL);
+		g_signal_connect (G_OBJECT (im_send_queue_mgr_get_instance ()), "progress",
+				  G_CALLBACK (on_send_queue_mgr_progress), NULL);
+		connected = TRUE;
+	}
+}
+
 void im_js_backend_setup_context (JSGlobalContextRef context)
 {
 	im_account_mgr_setup_js_class (context);
+	im_service_mgr_setup_js_events (context);
 }
@@ -38,8 +38,10 @@
 #include <im-js-gobject-wrapper.h>
 
 #include <im-js-utils.h>
+#include <im-mail-ops.h>
 
 #include <glib/gi18n.h>
+#include <stdlib.h>
 
 typedef struct _ImJSGObjectWrapperPrivate ImJSGObjectWrapperPrivate;
 struct _ImJSGObjectWrapperPrivate {
@@ -688,6 +690,7 @@ im_js_wrap_camel_message_info (JSContextRef context,
 {
 	CamelMessageFlags flags;
 	JSObjectRef result;
+	const char *send_status;
 
 	result = JSObjectMake (context, NULL, NULL);
 
@@ -731,5 +734,26 @@ im_js_wrap_camel_message_info (JSContextRef context,
 					      JSValueMakeBoolean (context, 
 								  camel_message_info_user_flag (mi,
 												"unblockImages")), NULL);
+
+	/* Outbox messages */
+	send_status = camel_message_info_user_tag (mi, IM_OUTBOX_SEND_STATUS);
+	if (send_status) {
+		const char *str;
+
+		im_js_object_set_property_from_string (context, result,
+						       "send_status", send_status, NULL);
+		str = camel_message_info_user_tag (mi, IM_OUTBOX_SEND_ATTEMPTS);
+		im_js_object_set_property_from_value (context, result,
+						      "send_attempts",
+						      JSValueMakeNumber (context, str?atoi (str):0), NULL);
+		str = camel_message_info_user_tag (mi, IM_OUTBOX_SEND_NEXT_ATTEMPT);
+		if (str && g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_RETRY) == 0)
+			im_js_object_set_property_from_value (context, result,
+							      "next_attempt",
+							      JSValueMakeNumber (context,
+										 g_ascii_strtoll (str, NULL, 10) * 1000.0),
+							      NULL);
+	}
+
 	return result;
 }
@@ -0,0 +1,501 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-local-compactor.c : Retention and compaction of the local inboxes */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-local-compactor.h"
+
+#include "im-account-mgr-helpers.h"
+#include "im-file-utils.h"
+#include "im-mail-ops.h"
+
+#include <glib/gi18n.h>
+
+typedef struct _ImLocalCompactorPrivate ImLocalCompactorPrivate;
+struct _ImLocalCompactorPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	guint timeout_id;
+	gboolean running;
+	/* monotonic time of the start of the last compaction, in seconds */
+	gint64 last_run;
+	GCancellable *cancellable;
+};
+
+#define IM_LOCAL_COMPACTOR_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+						IM_TYPE_LOCAL_COMPACTOR, \
+						ImLocalCompactorPrivate))
+
+/* Retention policy of an account, read in the main thread */
+typedef struct _CompactJob {
+	gchar *account_id;
+	guint days;
+	guint count;
+	guint64 size;
+} CompactJob;
+
+typedef struct _CompactEntry {
+	const gchar *uid;
+	time_t date;
+	guint32 size;
+	guint32 flags;
+} CompactEntry;
+
+G_DEFINE_TYPE (ImLocalCompactor, im_local_compactor, G_TYPE_OBJECT);
+
+static gint64
+now_seconds (void)
+{
+	return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+static void
+compact_job_free (CompactJob *job)
+{
+	g_free (job->account_id);
+	g_slice_free (CompactJob, job);
+}
+
+static void
+compact_jobs_free (GSList *jobs)
+{
+	g_slist_free_full (jobs, (GDestroyNotify) compact_job_free);
+}
+
+static gint
+compare_entries (gconstpointer a,
+		 gconstpointer b)
+{
+	const CompactEntry *entry_a = (const CompactEntry *) a;
+	const CompactEntry *entry_b = (const CompactEntry *) b;
+
+	/* Newest first */
+	if (entry_a->date != entry_b->date)
+		return entry_a->date < entry_b->date ? 1 : -1;
+
+	return 0;
+}
+
+/* Flags as deleted the messages of @folder over the limits of @job,
+ * and expunges all the deleted ones. Messages are kept from the
+ * newest. Flagged messages never expire, though they count on the
+ * limits. @store, the store of the account, stops taking the expired
+ * ones as already received */
+static gboolean
+compact_folder_sync (CamelStore *store,
+		     CamelFolder *folder,
+		     CompactJob *job,
+		     GCancellable *cancellable,
+		     GError **error)
+{
+	GError *_error = NULL;
+	GPtrArray *uids, *expired_uids;
+	GArray *entries;
+	guint i, kept_count = 0, expired = 0, expunged = 0;
+	guint64 kept_size = 0, reclaimed = 0;
+	time_t cutoff = 0;
+	gint64 start;
+
+	start = g_get_monotonic_time ();
+	if (job->days > 0)
+		cutoff = time (NULL) - (time_t) job->days * 24 * 60 * 60;
+
+	uids = camel_folder_get_uids (folder);
+	entries = g_array_sized_new (FALSE, FALSE, sizeof (CompactEntry), uids->len);
+	for (i = 0; i < uids->len; i++) {
+		CamelMessageInfo *mi;
+		CompactEntry entry;
+
+		mi = camel_folder_get_message_info (folder, uids->pdata[i]);
+		if (mi == NULL)
+			continue;
+
+		entry.uid = (const gchar *) uids->pdata[i];
+		entry.date = camel_message_info_date_received (mi);
+		if (entry.date <= 0)
+			entry.date = camel_message_info_date_sent (mi);
+		entry.size = camel_message_info_size (mi);
+		entry.flags = camel_message_info_flags (mi);
+		camel_folder_free_message_info (folder, mi);
+
+		g_array_append_val (entries, entry);
+	}
+	g_array_sort (entries, compare_entries);
+
+	expired_uids = g_ptr_array_new ();
+	camel_folder_freeze (folder);
+	for (i = 0; i < entries->len; i++) {
+		CompactEntry *entry = &g_array_index (entries, CompactEntry, i);
+		gboolean expire;
+
+		if (entry->flags & CAMEL_MESSAGE_DELETED) {
+			expunged++;
+			reclaimed += entry->size;
+			continue;
+		}
+
+		expire = !(entry->flags & CAMEL_MESSAGE_FLAGGED) &&
+			((cutoff > 0 && entry->date > 0 && entry->date < cutoff) ||
+			 (job->count > 0 && kept_count >= job->count) ||
+			 (job->size > 0 && kept_size + entry->size > job->size));
+
+		if (expire) {
+			camel_folder_set_message_flags (folder, entry->uid,
+							CAMEL_MESSAGE_DELETED,
+							CAMEL_MESSAGE_DELETED);
+			g_ptr_array_add (expired_uids, (gpointer) entry->uid);
+			expired++;
+			expunged++;
+			reclaimed += entry->size;
+		} else {
+			kept_count++;
+			kept_size += entry->size;
+		}
+	}
+	camel_folder_thaw (folder);
+
+	/* Before expunging, while their infos are there */
+	if (store && expired_uids->len > 0)
+		im_mail_op_forget_message_ids (store, folder, expired_uids);
+
+	g_ptr_array_unref (expired_uids);
+	g_array_free (entries, TRUE);
+	camel_folder_free_uids (folder, uids);
+
+	/* Expunging removes the files of the deleted messages and
+	 * rewrites the summary without them */
+	if (expunged > 0)
+		camel_folder_synchronize_sync (folder, TRUE, cancellable, &_error);
+
+	if (_error == NULL && expunged > 0)
+		g_debug ("%s: expunged %u messages of %s (%u expired) in %" G_GINT64_FORMAT
+			 " usec, %" G_GUINT64_FORMAT " bytes reclaimed, %u kept",
+			 __FUNCTION__, expunged, camel_folder_get_full_name (folder), expired,
+			 g_get_monotonic_time () - start, reclaimed, kept_count);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+compact_folder_infos_sync (CamelStore *store,
+			   CamelStore *local_store,
+			   CamelFolderInfo *fi,
+			   CompactJob *job,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	GError *_error = NULL;
+
+	while (fi && _error == NULL) {
+		if (!(fi->flags & CAMEL_FOLDER_NOSELECT)) {
+			CamelFolder *folder;
+
+			folder = camel_store_get_folder_sync (local_store, fi->full_name, 0,
+							      cancellable, &_error);
+			if (folder) {
+				compact_folder_sync (store, folder, job, cancellable, &_error);
+				g_object_unref (folder);
+			}
+		}
+		if (_error == NULL && fi->child)
+			compact_folder_infos_sync (store, local_store, fi->child, job,
+						   cancellable, &_error);
+		fi = fi->next;
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+}
+
+/* Compacts the local inbox of the account of @job, and the folders
+ * under it, i.e. the ones the filters move messages to. The limits
+ * apply to each folder on its own */
+static gboolean
+compact_account_sync (ImServiceMgr *service_mgr,
+		      CompactJob *job,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	GError *_error = NULL;
+	CamelService *store;
+	CamelStore *local_store;
+	CamelFolderInfo *fi;
+
+	if (!im_service_mgr_has_local_inbox (service_mgr, job->account_id))
+		return TRUE;
+
+	store = im_service_mgr_get_service (service_mgr, job->account_id, IM_ACCOUNT_TYPE_STORE);
+	local_store = im_service_mgr_get_local_store (service_mgr);
+	fi = camel_store_get_folder_info_sync (local_store, job->account_id,
+					       CAMEL_STORE_FOLDER_INFO_RECURSIVE,
+					       cancellable, &_error);
+	if (fi) {
+		compact_folder_infos_sync ((CamelStore *) store, local_store, fi, job,
+					   cancellable, &_error);
+		camel_store_free_folder_info (local_store, fi);
+	}
+	if (store)
+		g_object_unref (store);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+compact_thread (GSimpleAsyncResult *simple,
+		GObject *object,
+		GCancellable *cancellable)
+{
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (object);
+	GSList *jobs, *node;
+
+	jobs = (GSList *) g_simple_async_result_get_op_res_gpointer (simple);
+
+	for (node = jobs; node != NULL; node = g_slist_next (node)) {
+		CompactJob *job = (CompactJob *) node->data;
+		GError *_error = NULL;
+
+		if (g_cancellable_is_cancelled (cancellable))
+			break;
+
+		if (!compact_account_sync (priv->service_mgr, job, cancellable, &_error)) {
+			/* Retried on next compaction */
+			g_warning (_("%s: failed to compact %s: %s"), __FUNCTION__,
+				   job->account_id, _error->message);
+			g_error_free (_error);
+		}
+	}
+}
+
+static gboolean on_compact_timeout (gpointer userdata);
+
+static void
+schedule_compaction (ImLocalCompactor *self,
+		     gint delay)
+{
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+
+	if (priv->timeout_id)
+		g_source_remove (priv->timeout_id);
+
+	priv->timeout_id = g_timeout_add_seconds_full (G_PRIORITY_LOW, MAX (delay, 0),
+						       on_compact_timeout, self, NULL);
+}
+
+static void
+on_compaction_finished (GObject *source_object,
+			GAsyncResult *result,
+			gpointer userdata)
+{
+	ImLocalCompactor *self = IM_LOCAL_COMPACTOR (source_object);
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+
+	priv->running = FALSE;
+
+	/* A request to compact may have arrived meanwhile */
+	if (priv->timeout_id)
+		return;
+
+	if (im_local_compactor_has_low_space (self))
+		schedule_compaction (self, IM_LOCAL_COMPACTOR_LOW_SPACE_INTERVAL);
+	else
+		schedule_compaction (self, IM_LOCAL_COMPACTOR_INTERVAL);
+}
+
+static gboolean
+on_compact_timeout (gpointer userdata)
+{
+	ImLocalCompactor *self = IM_LOCAL_COMPACTOR (userdata);
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+	GSimpleAsyncResult *simple;
+	GSList *account_ids, *node;
+	GSList *jobs = NULL;
+
+	priv->timeout_id = 0;
+
+	/* Rescheduled when the running one finishes */
+	if (priv->running)
+		return FALSE;
+
+	account_ids = im_account_mgr_get_account_ids (priv->account_mgr, TRUE);
+	for (node = account_ids; node != NULL; node = g_slist_next (node)) {
+		const gchar *account_id = (const gchar *) node->data;
+		CompactJob *job;
+
+		job = g_slice_new0 (CompactJob);
+		job->account_id = g_strdup (account_id);
+		job->days = im_account_mgr_get_retention_days (priv->account_mgr, account_id);
+		job->count = im_account_mgr_get_retention_count (priv->account_mgr, account_id);
+		job->size = (guint64) im_account_mgr_get_retention_size (priv->account_mgr,
+									 account_id) * 1024;
+		jobs = g_slist_prepend (jobs, job);
+	}
+	im_account_mgr_free_account_ids (account_ids);
+
+	priv->running = TRUE;
+	priv->last_run = now_seconds ();
+
+	simple = g_simple_async_result_new (G_OBJECT (self),
+					    on_compaction_finished, NULL,
+					    on_compact_timeout);
+	g_simple_async_result_set_op_res_gpointer (simple, g_slist_reverse (jobs),
+						   (GDestroyNotify) compact_jobs_free);
+	g_simple_async_result_run_in_thread (simple, compact_thread,
+					     G_PRIORITY_LOW, priv->cancellable);
+	g_object_unref (simple);
+
+	return FALSE;
+}
+
+static gboolean
+on_compact_soon_idle (gpointer userdata)
+{
+	ImLocalCompactor *self = IM_LOCAL_COMPACTOR (userdata);
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+	gint64 delay;
+
+	if (priv->running)
+		return FALSE;
+
+	delay = priv->last_run + IM_LOCAL_COMPACTOR_LOW_SPACE_INTERVAL - now_seconds ();
+	if (priv->last_run == 0 || delay < 0)
+		delay = 0;
+
+	schedule_compaction (self, (gint) delay);
+
+	return FALSE;
+}
+
+static void
+im_local_compactor_init (ImLocalCompactor *self)
+{
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+
+	priv->cancellable = g_cancellable_new ();
+}
+
+static void
+im_local_compactor_finalize (GObject *object)
+{
+	ImLocalCompactorPrivate *priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (object);
+
+	if (priv->timeout_id)
+		g_source_remove (priv->timeout_id);
+	g_cancellable_cancel (priv->cancellable);
+	g_object_unref (priv->cancellable);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_local_compactor_parent_class)->finalize (object);
+}
+
+static void
+im_local_compactor_class_init (ImLocalCompactorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_local_compactor_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImLocalCompactorPrivate));
+}
+
+static ImLocalCompactor *
+im_local_compactor_new (ImServiceMgr *service_mgr,
+			ImAccountMgr *account_mgr)
+{
+	ImLocalCompactor *self;
+	ImLocalCompactorPrivate *priv;
+
+	self = g_object_new (IM_TYPE_LOCAL_COMPACTOR, NULL);
+	priv = IM_LOCAL_COMPACTOR_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	if (im_local_compactor_has_low_space (self))
+		schedule_compaction (self, 0);
+	else
+		schedule_compaction (self, IM_LOCAL_COMPACTOR_STARTUP_DELAY);
+
+	return self;
+}
+
+ImLocalCompactor *
+im_local_compactor_get_instance (void)
+{
+	static ImLocalCompactor *instance = 0;
+
+	if (instance == 0)
+		instance = im_local_compactor_new (im_service_mgr_get_instance (),
+						   im_account_mgr_get_instance ());
+
+	return instance;
+}
+
+gboolean
+im_local_compactor_has_low_space (ImLocalCompactor *self)
+{
+	guint64 available;
+
+	g_return_val_if_fail (IM_IS_LOCAL_COMPACTOR (self), FALSE);
+
+	/* If the space can't be obtained, retrieval goes on and the
+	 * write errors are reported instead */
+	if (!im_file_utils_get_available_space (im_service_mgr_get_user_data_dir (),
+						&available))
+		return FALSE;
+
+	return available < IM_LOCAL_COMPACTOR_LOW_SPACE;
+}
+
+void
+im_local_compactor_compact_soon (ImLocalCompactor *self)
+{
+	g_return_if_fail (IM_IS_LOCAL_COMPACTOR (self));
+
+	g_idle_add_full (G_PRIORITY_LOW, on_compact_soon_idle,
+			 g_object_ref (self), g_object_unref);
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-local-compactor.h : Retention and compaction of the local inboxes */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_LOCAL_COMPACTOR_H__
+#define __IM_LOCAL_COMPACTOR_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_LOCAL_COMPACTOR             (im_local_compactor_get_type())
+#define IM_LOCAL_COMPACTOR(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_LOCAL_COMPACTOR,ImLocalCompactor))
+#define IM_LOCAL_COMPACTOR_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_LOCAL_COMPACTOR,ImLocalCompactorClass))
+#define IM_IS_LOCAL_COMPACTOR(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_LOCAL_COMPACTOR))
+#define IM_IS_LOCAL_COMPACTOR_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_LOCAL_COMPACTOR))
+#define IM_LOCAL_COMPACTOR_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_LOCAL_COMPACTOR,ImLocalCompactorClass))
+
+typedef struct _ImLocalCompactor      ImLocalCompactor;
+typedef struct _ImLocalCompactorClass ImLocalCompactorClass;
+
+struct _ImLocalCompactor {
+	GObject parent;
+};
+
+struct _ImLocalCompactorClass {
+	GObjectClass parent_class;
+};
+
+/* Delay of the first compaction after startup, in seconds */
+#define IM_LOCAL_COMPACTOR_STARTUP_DELAY (5 * 60)
+/* Delay between compactions, in seconds */
+#define IM_LOCAL_COMPACTOR_INTERVAL (6 * 60 * 60)
+/* Delay between compactions while disk space is low, in seconds */
+#define IM_LOCAL_COMPACTOR_LOW_SPACE_INTERVAL (10 * 60)
+/* Available disk space below which no more messages are retrieved, in bytes */
+#define IM_LOCAL_COMPACTOR_LOW_SPACE (50 * 1024 * 1024)
+/* Messages retrieved between checks of the available disk space */
+#define IM_LOCAL_COMPACTOR_SPACE_CHECK_MESSAGES 25
+
+/**
+ * im_local_compactor_get_type:
+ *
+ * Returns: GType of the local compactor
+ */
+GType  im_local_compactor_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_local_compactor_get_instance:
+ *
+ * obtains the singleton #ImLocalCompactor. On first call it starts
+ * compacting periodically, in a low priority thread, the local inboxes
+ * of the enabled accounts and the folders under them: messages over
+ * the retention limits of the account, applied to each folder (see im_account_mgr_get_retention_days(),
+ * im_account_mgr_get_retention_count() and
+ * im_account_mgr_get_retention_size()) are flagged as deleted, and
+ * deleted messages are expunged from disk.
+ *
+ * Returns: (transfer none): an #ImLocalCompactor
+ */
+ImLocalCompactor*   im_local_compactor_get_instance (void);
+
+/**
+ * im_local_compactor_has_low_space:
+ * @self: a #ImLocalCompactor
+ *
+ * Checks if the disk space available for the user data is below
+ * %IM_LOCAL_COMPACTOR_LOW_SPACE. Retrieval of messages should stop
+ * then. It can be called from any thread.
+ *
+ * Returns: %TRUE if disk space is low, %FALSE if it's not or it
+ * could not be obtained
+ */
+gboolean            im_local_compactor_has_low_space (ImLocalCompactor *self);
+
+/**
+ * im_local_compactor_compact_soon:
+ * @self: a #ImLocalCompactor
+ *
+ * Requests a compaction as soon as possible, i.e. because disk space
+ * is low. Compactions requested this way are run at most every
+ * %IM_LOCAL_COMPACTOR_LOW_SPACE_INTERVAL seconds. It can be called
+ * from any thread.
+ */
+void                im_local_compactor_compact_soon (ImLocalCompactor *self);
+
+G_END_DECLS
+
+#endif /* __IM_LOCAL_COMPACTOR_H__ */
@@ -0,0 +1,105 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-mail-ops-priv.h : Private mail operations */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IM_MAIL_OPS_PRIV_H__
+#define __IM_MAIL_OPS_PRIV_H__
+
+#include <im-mail-ops.h>
+
+/*
+ * private functions, only for use in im-mail-ops and its benchmarks,
+ * to run operations without the services of the accounts
+ */
+
+G_BEGIN_DECLS
+
+/**
+ * _im_mail_op_run_send_queue_with_transport_sync:
+ * @outbox: an outbox #CamelFolder
+ * @transport: (allow-none): the #CamelTransport to send the messages
+ * with, or %NULL to use the one of the account of @outbox
+ * @policy: (allow-none): the rate limit and retry policy, or %NULL for the defaults
+ * @progress_func: (allow-none): function called as in
+ * im_mail_op_run_send_queue_sync(), or %NULL
+ * @progress_data: data passed to @progress_func
+ * @stats: (out) (allow-none): return location for the statistics of the run, or %NULL.
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Runs send queue for @outbox as im_mail_op_run_send_queue_sync(),
+ * sending the messages with @transport.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean            _im_mail_op_run_send_queue_with_transport_sync (CamelFolder *outbox,
+								    CamelTransport *transport,
+								    const ImSendQueuePolicy *policy,
+								    ImSendQueueProgressFunc progress_func,
+								    gpointer progress_data,
+								    ImSendQueueStats *stats,
+								    GCancellable *cancellable,
+								    GError **error);
+
+/**
+ * _im_mail_op_search_folder_sync:
+ * @folder: a #CamelFolder
+ * @query: the words to search
+ * @oldest_uid: (allow-none): the oldest message of the previous page,
+ * or %NULL for the first page
+ * @count: the maximum number of messages of the page
+ * @uids: (out) (allow-none) (element-type utf8): the uids of the page,
+ * sorted from newest to oldest by date received
+ * @total: (out) (allow-none): the number of matching messages
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Searches @folder as im_mail_op_search_sync() does.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean            _im_mail_op_search_folder_sync (CamelFolder *folder,
+						    const gchar *query,
+						    const gchar *oldest_uid,
+						    guint count,
+						    GPtrArray **uids,
+						    guint *total,
+						    GCancellable *cancellable,
+						    GError **error);
+
+G_END_DECLS
+
+#endif /* __IM_MAIL_OPS_PRIV_H__ */
@@ -41,173 +41,531 @@
 
 #include "im-account-mgr-helpers.h"
 #include "im-error.h"
+#include "im-filter-rules.h"
+#include "im-local-compactor.h"
 #include "im-mail-ops.h"
+#include "im-mail-ops-priv.h"
+#include "im-op-journal.h"
+#include "im-thread-index.h"
+#include "im-uid-log.h"
 
+#include <errno.h>
+#include <gio/gunixoutputstream.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <libsoup/soup.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* State of a send queue run, shared by the batches */
+typedef struct _SendQueueRun {
+	ImSendQueueStats stats;
+	ImSendQueuePolicy policy;
+	gint64 now;
+	gint64 next_send;
+	ImSendQueueProgressFunc progress_func;
+	gpointer progress_data;
+} SendQueueRun;
 
-#define IM_OUTBOX_SEND_STATUS "iwk-send-status"
-#define IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX "copying-to-sentbox"
-#define IM_OUTBOX_SEND_STATUS_FAILED "failed"
-#define IM_OUTBOX_SEND_STATUS_RETRY "retry"
-#define IM_OUTBOX_SEND_STATUS_SEND "send"
-#define IM_OUTBOX_SEND_STATUS_SENDING "sending"
-#define IM_OUTBOX_SEND_STATUS_SENT "sent"
-#define IM_OUTBOX_SEND_ATTEMPTS "iwk-send-attempts"
+static void
+init_send_queue_run (SendQueueRun *run,
+		     const ImSendQueuePolicy *policy,
+		     ImSendQueueProgressFunc progress_func,
+		     gpointer progress_data)
+{
+	memset (run, 0, sizeof (SendQueueRun));
+	if (policy) {
+		run->policy = *policy;
+	} else {
+		run->policy.retry_delay = IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_DELAY;
+		run->policy.retry_max_delay = IM_ACCOUNT_MGR_DEFAULT_SEND_RETRY_MAX_DELAY;
+		run->policy.max_attempts = IM_ACCOUNT_MGR_DEFAULT_SEND_MAX_ATTEMPTS;
+	}
+	run->next_send = run->policy.next_send;
+	run->progress_func = progress_func;
+	run->progress_data = progress_data;
+}
+
+/* Start of this process, in seconds since the epoch. Claims older than
+ * it were left by a previous instance */
+static gint64
+get_process_start (void)
+{
+	static gsize start = 0;
+
+	if (g_once_init_enter (&start)) {
+		gsize now = (gsize) (g_get_real_time () / G_USEC_PER_SEC);
+
+		g_once_init_leave (&start, MAX (now, 1));
+	}
+
+	return (gint64) start;
+}
+
+/* A message claimed by a run that didn't finish, because the application
+ * crashed or was killed, is still marked as being sent. We consider it
+ * abandoned if it was claimed before this process started, or too long ago */
+static gboolean
+is_stale_claim (CamelFolder *outbox,
+		const gchar *uid,
+		SendQueueRun *run)
+{
+	const char *claimed_str;
+	gint64 claimed;
+
+	claimed_str = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_CLAIMED);
+	claimed = claimed_str?g_ascii_strtoll (claimed_str, NULL, 10):0;
+
+	return claimed < get_process_start () ||
+		claimed + IM_SEND_QUEUE_CLAIM_TIMEOUT < run->now;
+}
+
+/* Annotates @next_attempt as the earliest retry, if it's before the current one */
+static void
+update_next_attempt (ImSendQueueStats *stats,
+		     gint64 next_attempt)
+{
+	if (stats->next_attempt == 0 || next_attempt < stats->next_attempt)
+		stats->next_attempt = next_attempt;
+}
+
+/* Whether @uid is still in @outbox. Sent messages are expunged by
+ * im_mail_op_transfer_sent_sync() while runs may still hold their uids */
+static gboolean
+is_outbox_message (CamelFolder *outbox,
+		   const gchar *uid)
+{
+	CamelMessageInfo *mi;
+	gboolean result;
+
+	mi = camel_folder_get_message_info (outbox, uid);
+	if (mi == NULL)
+		return FALSE;
+	result = !(camel_message_info_flags (mi) & CAMEL_MESSAGE_DELETED);
+	camel_folder_free_message_info (outbox, mi);
+
+	return result;
+}
+
+static gboolean
+is_queued_message (CamelFolder *outbox,
+		   const gchar *uid,
+		   SendQueueRun *run)
+{
+	const char *send_status;
+	const char *next_attempt_str;
+	gint64 next_attempt;
+
+	/* Expunged meanwhile, so there's no status to read */
+	if (!is_outbox_message (outbox, uid))
+		return FALSE;
+
+	send_status = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_STATUS);
+
+	/* Messages being sent or copied to sentbox are being operated
+	 * now, and the failed ones are not retried. Stale claims are
+	 * queued again: the message may have been delivered right before
+	 * the crash, but sending twice is better than never */
+	if (send_status == NULL)
+		return TRUE;
+	if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENDING) == 0)
+		return is_stale_claim (outbox, uid, run);
+	if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_RETRY) != 0)
+		return FALSE;
+
+	/* Retries wait until they're due */
+	next_attempt_str = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_NEXT_ATTEMPT);
+	next_attempt = next_attempt_str?g_ascii_strtoll (next_attempt_str, NULL, 10):0;
+	if (next_attempt > run->now) {
+		update_next_attempt (&run->stats, next_attempt);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Claims @uid for this run if it's waiting to be sent. The status is only
+ * changed in the summary, and it's flushed with the rest of the batch. The
+ * claim time lets next runs recover it if this one never finishes */
+static gboolean
+claim_send_queue_message (CamelFolder *outbox,
+			  const gchar *uid,
+			  SendQueueRun *run)
+{
+	const char *send_status;
+
+	send_status = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_STATUS);
+	if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENT) == 0) {
+		/* It's sent, im_mail_op_transfer_sent_sync() moves it to sentbox */
+		return FALSE;
+	} else if (is_queued_message (outbox, uid, run)) {
+		gchar *str;
+
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_STATUS,
+						   IM_OUTBOX_SEND_STATUS_SENDING);
+		str = g_strdup_printf ("%" G_GINT64_FORMAT, run->now);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_CLAIMED,
+						   str);
+		g_free (str);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Whether the rate limit of the run allows sending a message now */
+static gboolean
+is_send_slot_ready (SendQueueRun *run)
+{
+	return run->policy.rate_limit == 0 ||
+		g_get_monotonic_time () >= run->next_send;
+}
+
+/* Takes the send slot if it's ready. Otherwise the run is marked as
+ * throttled, so it stops and the caller runs it again at @next_send,
+ * instead of blocking the thread while waiting */
+static gboolean
+take_send_slot (SendQueueRun *run)
+{
+	if (!is_send_slot_ready (run)) {
+		run->stats.throttled = TRUE;
+		return FALSE;
+	}
+
+	if (run->policy.rate_limit > 0)
+		run->next_send = g_get_monotonic_time () + 60 * G_USEC_PER_SEC / run->policy.rate_limit;
+
+	return TRUE;
+}
 
+/* Schedules next attempt of a message that failed to be sent, or
+ * marks it as failed if it was the last one */
+static void
+retry_send_queue_message (CamelFolder *outbox,
+			  const gchar *uid,
+			  SendQueueRun *run)
+{
+	const char *attempt_str;
+	gint attempt;
+
+	attempt_str = camel_folder_get_message_user_tag (outbox, uid,
+							 IM_OUTBOX_SEND_ATTEMPTS);
+	attempt = (attempt_str?atoi (attempt_str):0) + 1;
+	if (attempt >= run->policy.max_attempts || attempt <= 0) {
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_STATUS,
+						   IM_OUTBOX_SEND_STATUS_FAILED);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_NEXT_ATTEMPT,
+						   NULL);
+		run->stats.failed++;
+	} else {
+		gchar *str;
+		gint64 delay, next_attempt;
+
+		delay = MIN ((gint64) run->policy.retry_delay << MIN (attempt - 1, 16),
+			     (gint64) run->policy.retry_max_delay);
+		next_attempt = g_get_real_time () / G_USEC_PER_SEC + MAX (delay, 1);
+
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_STATUS,
+						   IM_OUTBOX_SEND_STATUS_RETRY);
+		str = g_strdup_printf ("%d", attempt);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_ATTEMPTS,
+						   str);
+		g_free (str);
+		str = g_strdup_printf ("%" G_GINT64_FORMAT, next_attempt);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_NEXT_ATTEMPT,
+						   str);
+		g_free (str);
+		update_next_attempt (&run->stats, next_attempt);
+		run->stats.retried++;
+	}
+}
+
+/* Sends a claimed message. Status changes are flushed by the caller,
+ * once per batch */
 static gboolean
 run_send_queue_message_sync (CamelFolder *outbox,
 			     CamelTransport *transport,
 			     const gchar *uid,
+			     SendQueueRun *run,
 			     GCancellable *cancellable,
 			     GError **error)
 {
 	GError *_error = NULL;
-	const char *send_status;
+	CamelMimeMessage *message = NULL;
+	CamelInternetAddress *recipients;
+
+	message = camel_folder_get_message_sync (outbox, uid,
+						 cancellable, &_error);
+	if (_error && !is_outbox_message (outbox, uid)) {
+		/* Removed after we claimed it, so there's nothing to send */
+		g_clear_error (&_error);
+		return TRUE;
+	} else if (_error) {
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_STATUS,
+						   IM_OUTBOX_SEND_STATUS_RETRY);
+		g_propagate_error (error, _error);
+		return FALSE;
+	}
 
-	send_status = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_STATUS);
-	if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENDING) == 0 ||
-	    g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX) == 0) {
-		/* we ignore it, it's being operated now */
-	} else if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENT) == 0) {
-		/* TODO: it's sent, but transfer to sent folder failed, we reschedule it */
-	} else if (send_status == NULL || g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_RETRY) == 0){
-		CamelMimeMessage *message = NULL;
+	recipients = camel_internet_address_new ();
+	camel_address_cat (CAMEL_ADDRESS (recipients),
+			   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_TO)));
+	camel_address_cat (CAMEL_ADDRESS (recipients),
+			   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_CC)));
+	camel_address_cat (CAMEL_ADDRESS (recipients),
+			   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_BCC)));
+
+	if (!camel_transport_send_to_sync (transport,
+					   message, CAMEL_ADDRESS (camel_mime_message_get_from (message)),
+					   CAMEL_ADDRESS (recipients),
+					   cancellable, &_error)) {
+		retry_send_queue_message (outbox, uid, run);
+	} else {
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_ATTEMPTS,
+						   "0");
 		camel_folder_set_message_user_tag (outbox, uid,
 						   IM_OUTBOX_SEND_STATUS,
-						   IM_OUTBOX_SEND_STATUS_SENDING);
-		camel_folder_synchronize_sync (outbox, FALSE, cancellable, &_error);
-		if (_error == NULL) {
-			message = camel_folder_get_message_sync (outbox, uid,
-								 cancellable, &_error);
-		}
-		if (_error == NULL)
-			camel_service_connect_sync (CAMEL_SERVICE (transport),
-						    &_error);
-		if (_error) {
+						   IM_OUTBOX_SEND_STATUS_SENT);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_NEXT_ATTEMPT,
+						   NULL);
+		camel_folder_set_message_user_tag (outbox, uid,
+						   IM_OUTBOX_SEND_CLAIMED,
+						   NULL);
+		run->stats.sent++;
+		run->stats.to_sentbox++;
+	}
+	g_object_unref (recipients);
+	g_object_unref (message);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+run_send_queue_batch_sync (CamelFolder *outbox,
+			   CamelTransport *transport,
+			   GPtrArray *batch,
+			   SendQueueRun *run,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	GError *_error = NULL;
+	gint i;
+
+	/* Persist the claims before sending, so other runs skip them.
+	 * If we crash before flushing the results of the batch, next runs
+	 * recover its messages as stale claims */
+	camel_folder_synchronize_sync (outbox, FALSE, cancellable, &_error);
+
+	/* Transport connection is reused for the whole run */
+	if (_error == NULL &&
+	    camel_service_get_connection_status (CAMEL_SERVICE (transport)) != CAMEL_SERVICE_CONNECTED)
+		camel_service_connect_sync (CAMEL_SERVICE (transport), &_error);
+
+	for (i = 0; i < batch->len; i++) {
+		const char *uid = (const char *) batch->pdata[i];
+
+		if (_error == NULL && !run->stats.throttled && take_send_slot (run)) {
+			run_send_queue_message_sync (outbox, transport, uid, run,
+						     cancellable, &_error);
+			if (run->progress_func)
+				run->progress_func (outbox, &run->stats, run->progress_data);
+		} else {
+			/* Not attempted, so we release it for next run */
 			camel_folder_set_message_user_tag (outbox, uid,
 							   IM_OUTBOX_SEND_STATUS,
 							   IM_OUTBOX_SEND_STATUS_RETRY);
-			camel_folder_synchronize_sync (outbox, FALSE, NULL, NULL);
-		}
-		if (_error == NULL) {
-			CamelInternetAddress *recipients;
-			recipients = camel_internet_address_new ();
-			camel_address_cat (CAMEL_ADDRESS (recipients),
-					   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_TO)));
-			camel_address_cat (CAMEL_ADDRESS (recipients),
-					   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_CC)));
-			camel_address_cat (CAMEL_ADDRESS (recipients),
-					   CAMEL_ADDRESS (camel_mime_message_get_recipients (message, CAMEL_RECIPIENT_TYPE_BCC)));
-		
-			if (!camel_transport_send_to_sync (transport,
-							   message, CAMEL_ADDRESS (camel_mime_message_get_from (message)),
-							   CAMEL_ADDRESS (recipients),
-							   cancellable, &_error)) {
-				const char *attempt_str;
-				int attempt;
-				
-				attempt_str = camel_folder_get_message_user_tag (outbox, uid,
-										 IM_OUTBOX_SEND_ATTEMPTS);
-				attempt = attempt_str?atoi (attempt_str):0;
-				if (attempt > 3 || attempt < 0) {
-					camel_folder_set_message_user_tag (outbox, uid,
-									   IM_OUTBOX_SEND_STATUS,
-									   IM_OUTBOX_SEND_STATUS_FAILED);
-				} else {
-					char *new_attempt;
-					camel_folder_set_message_user_tag (outbox, uid,
-									   IM_OUTBOX_SEND_STATUS,
-									   IM_OUTBOX_SEND_STATUS_RETRY);
-					new_attempt = g_strdup_printf ("%d", attempt + 1);
-					camel_folder_set_message_user_tag (outbox, uid,
-									   IM_OUTBOX_SEND_ATTEMPTS,
-									   new_attempt);
-					g_free (new_attempt);
-				}
-			} else {
-				camel_folder_set_message_user_tag (outbox, uid,
-								   IM_OUTBOX_SEND_ATTEMPTS,
-								   "0");
-				camel_folder_set_message_user_tag (outbox, uid,
-								   IM_OUTBOX_SEND_STATUS,
-								   IM_OUTBOX_SEND_STATUS_SENT);
-			}
-			camel_folder_synchronize_sync (outbox, FALSE, NULL, NULL);
-			g_object_unref (recipients);
 		}
 	}
 
+	camel_folder_synchronize_sync (outbox, FALSE, NULL, NULL);
+
 	if (_error)
 		g_propagate_error (error, _error);
-
-	return _error == NULL;
 }
 
 /**
  * im_mail_op_run_send_queue_sync:
  * @outbox: an outbox #CamelFolder
+ * @policy: (allow-none): the rate limit and retry policy, or %NULL for the defaults
+ * @progress_func: (allow-none): function called, in the running thread, when
+ * the queue is counted and after each message is processed, or %NULL
+ * @progress_data: data passed to @progress_func
+ * @stats: (out) (allow-none): return location for the statistics of the run, or %NULL.
  * @cancellable: optional #GCancellable object, or %NULL,
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
  *
- * Runs send queue for @outbox.
+ * Runs send queue for @outbox. Messages are claimed in batches of
+ * #IM_SEND_QUEUE_BATCH_SIZE, flushing the outbox before sending each
+ * batch and again with the results of the batch. Claims left by a run
+ * that never finished are queued again once they're older than this
+ * process or #IM_SEND_QUEUE_CLAIM_TIMEOUT, so the messages of a batch
+ * interrupted by a crash may be sent twice.
+ *
+ * Messages that fail to be sent are retried after an exponential backoff,
+ * and skipped until then. The earliest retry is returned in @stats.
+ *
+ * If @policy has a rate limit, the run does not wait for it: it stops as
+ * soon as next message is not allowed yet, flagging @stats as throttled.
  *
  * Returns: %TRUE if successful, %FALSE otherwise.
  */
 gboolean
 im_mail_op_run_send_queue_sync (CamelFolder *outbox,
+				const ImSendQueuePolicy *policy,
+				ImSendQueueProgressFunc progress_func,
+				gpointer progress_data,
+				ImSendQueueStats *stats,
 				GCancellable *cancellable,
 				GError **error)
+{
+	return _im_mail_op_run_send_queue_with_transport_sync (outbox, NULL, policy,
+							       progress_func, progress_data,
+							       stats, cancellable, error);
+}
+
+gboolean
+_im_mail_op_run_send_queue_with_transport_sync (CamelFolder *outbox,
+						CamelTransport *transport,
+						const ImSendQueuePolicy *policy,
+						ImSendQueueProgressFunc progress_func,
+						gpointer progress_data,
+						ImSendQueueStats *stats,
+						GCancellable *cancellable,
+						GError **error)
 {
 	GError *_error = NULL;
+	SendQueueRun run;
+	ImSendQueueStats _stats;
+	gint64 start;
+
+	init_send_queue_run (&run, policy, progress_func, progress_data);
+	run.now = g_get_real_time () / G_USEC_PER_SEC;
+	start = g_get_monotonic_time ();
 
 	camel_folder_synchronize_sync (outbox, TRUE,
 				       cancellable, &_error);
 	if (_error == NULL && camel_folder_get_message_count (outbox) > 0) {
-		CamelTransport *transport;
-
-		/* Get transport */
-		transport = (CamelTransport *)
-			im_service_mgr_get_service (im_service_mgr_get_instance (),
-						    camel_folder_get_full_name (outbox),
-						    IM_ACCOUNT_TYPE_TRANSPORT);
-
+		/* Get transport, unless it was given */
 		if (transport == NULL) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_INTERNAL,
-				     _("No transport for an outbox"));
+			transport = (CamelTransport *)
+				im_service_mgr_get_service (im_service_mgr_get_instance (),
+							    camel_folder_get_full_name (outbox),
+							    IM_ACCOUNT_TYPE_TRANSPORT);
+
+			if (transport == NULL) {
+				g_set_error (&_error, IM_ERROR_DOMAIN,
+					     IM_ERROR_INTERNAL,
+					     _("No transport for an outbox"));
+			} else {
+				im_service_mgr_wait_for_service (im_service_mgr_get_instance (),
+								 CAMEL_SERVICE (transport),
+								 cancellable, &_error);
+			}
 		}
 
 		if (_error == NULL) {
 			GPtrArray *uids;
+			GPtrArray *batch;
+			guint batch_size;
 			gint i;
 
+			/* With a rate limit only one message is sent until
+			 * the run is throttled, so we don't claim more */
+			batch_size = run.policy.rate_limit > 0 ? 1 : IM_SEND_QUEUE_BATCH_SIZE;
 			uids = camel_folder_get_uids (outbox);
+			batch = g_ptr_array_new ();
 
 			for (i = 0; i < uids->len; i++) {
 				const char *uid = (const char *) uids->pdata[i];
-				if (_error == NULL) {
-					run_send_queue_message_sync (outbox, transport, uid, cancellable, &_error);
+				const char *send_status;
+
+				send_status = camel_folder_get_message_user_tag (outbox, uid,
+										 IM_OUTBOX_SEND_STATUS);
+				if (is_queued_message (outbox, uid, &run))
+					run.stats.queued++;
+				else if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENT) == 0 ||
+					 g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX) == 0)
+					run.stats.to_sentbox++;
+			}
+			if (progress_func)
+				progress_func (outbox, &run.stats, progress_data);
+
+			for (i = 0; i < uids->len && _error == NULL && !run.stats.throttled; i++) {
+				const char *uid = (const char *) uids->pdata[i];
+
+				if (batch->len == 0 && !is_send_slot_ready (&run) &&
+				    is_queued_message (outbox, uid, &run)) {
+					run.stats.throttled = TRUE;
+					break;
+				}
+
+				if (claim_send_queue_message (outbox, uid, &run))
+					g_ptr_array_add (batch, (gpointer) uid);
+
+				if (batch->len == batch_size || i == uids->len - 1) {
+					if (batch->len > 0)
+						run_send_queue_batch_sync (outbox, transport, batch, &run,
+									   cancellable, &_error);
+					g_ptr_array_set_size (batch, 0);
 				}
 			}
+
+			g_ptr_array_free (batch, TRUE);
 			camel_folder_free_uids (outbox, uids);
 		}
 	}
 
+	run.stats.elapsed = g_get_monotonic_time () - start;
+	run.stats.next_send = run.next_send;
+	_stats = run.stats;
+	if (_stats.sent > 0) {
+		g_debug ("%s: %s sent %u messages in %.2f s (%.2f messages/s)", __FUNCTION__,
+			 camel_folder_get_full_name (outbox), _stats.sent,
+			 (gdouble) _stats.elapsed / G_USEC_PER_SEC,
+			 _stats.sent * (gdouble) G_USEC_PER_SEC / MAX (_stats.elapsed, 1));
+	}
+	if (stats)
+		*stats = _stats;
+
 	if (_error) g_propagate_error (error, _error);
 
 	return _error == NULL;
 }
 
+static void
+send_queue_run_free (SendQueueRun *run)
+{
+	g_slice_free (SendQueueRun, run);
+}
+
 static void
 im_mail_op_run_send_queue_thread (GSimpleAsyncResult *simple,
 				  GObject *object,
 				  GCancellable *cancellable)
 {
 	GError *_error = NULL;
+	SendQueueRun *run;
 
+	run = (SendQueueRun *) g_simple_async_result_get_op_res_gpointer (simple);
 	im_mail_op_run_send_queue_sync (CAMEL_FOLDER (object),
+					&run->policy,
+					run->progress_func,
+					run->progress_data,
+					&run->stats,
 					cancellable,
 					&_error);
 
@@ -218,6 +576,10 @@ im_mail_op_run_send_queue_thread (GSimpleAsyncResult *simple,
 /**
  * im_mail_op_run_send_queue_async:
  * @outbox: an outbox #CamelFolder
+ * @policy: (allow-none): the rate limit and retry policy, or %NULL for the defaults
+ * @progress_func: (allow-none): function called, in the running thread, when
+ * the queue is counted and after each message is processed, or %NULL
+ * @progress_data: data passed to @progress_func
  * @io_priority: the I/O priority of the request
  * @cancellable: optional #GCancellable object, or %NULL,
  * @callback: a #GAsyncReadyCallback to call when the request is finished
@@ -230,16 +592,24 @@ im_mail_op_run_send_queue_thread (GSimpleAsyncResult *simple,
  */
 void
 im_mail_op_run_send_queue_async (CamelFolder *outbox,
+				 const ImSendQueuePolicy *policy,
+				 ImSendQueueProgressFunc progress_func,
+				 gpointer progress_data,
 				 int io_priority,
 				 GCancellable *cancellable,
 				 GAsyncReadyCallback callback,
 				 gpointer userdata)
 {
 	GSimpleAsyncResult *simple;
+	SendQueueRun *run;
 	
 	simple = g_simple_async_result_new (G_OBJECT (outbox),
 					    callback, userdata,
 					    im_mail_op_run_send_queue_async);
+	run = g_slice_new0 (SendQueueRun);
+	init_send_queue_run (run, policy, progress_func, progress_data);
+	g_simple_async_result_set_op_res_gpointer (simple, run,
+						   (GDestroyNotify) send_queue_run_free);
 
 	g_simple_async_result_run_in_thread (simple,
 					     im_mail_op_run_send_queue_thread,
@@ -252,6 +622,7 @@ im_mail_op_run_send_queue_async (CamelFolder *outbox,
  * im_mail_op_run_send_queue_finish:
  * @outbox: a #CamelFolder
  * @result: a #GAsyncResult
+ * @stats: (out) (allow-none): return location for the statistics of the run, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL
  *
  * Finishes the operation started with im_mail_op_run_send_queue_async().
@@ -261,6 +632,7 @@ im_mail_op_run_send_queue_async (CamelFolder *outbox,
 gboolean
 im_mail_op_run_send_queue_finish (CamelFolder *outbox,
 				  GAsyncResult *result,
+				  ImSendQueueStats *stats,
 				  GError **error)
 {
 	GSimpleAsyncResult *simple;
@@ -271,129 +643,728 @@ im_mail_op_run_send_queue_finish (CamelFolder *outbox,
 
 
 	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (stats)
+		*stats = ((SendQueueRun *) g_simple_async_result_get_op_res_gpointer (simple))->stats;
 	return !g_simple_async_result_propagate_error (simple, error);
 }
 
-static gboolean
-update_non_storage_uids_sync (CamelFolder *remote_inbox,
-			      CamelFolder *local_inbox,
-			      GCancellable *cancellable,
-			      GError **error)
+/* Obtains the ids of the messages in @sent, to find the messages
+ * already copied when resuming an interrupted transfer */
+static GHashTable *
+get_message_ids (CamelFolder *folder)
 {
-	GError *_error = NULL;
-	const gchar *store_data_dir;
-	gchar *uid_cache_path;
-	CamelUIDCache *uid_cache;
-	CamelStore *remote_store;
+	GHashTable *message_ids;
+	GPtrArray *uids;
+	gint i;
 
-	remote_store = camel_folder_get_parent_store (remote_inbox);
+	message_ids = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len; i++) {
+		CamelMessageInfo *mi;
+		const CamelSummaryMessageID *message_id;
+
+		mi = camel_folder_get_message_info (folder, (const char *) uids->pdata[i]);
+		if (mi == NULL)
+			continue;
+		message_id = camel_message_info_message_id (mi);
+		if (message_id && message_id->id.id != 0) {
+			gint64 *id = g_new (gint64, 1);
+			*id = (gint64) message_id->id.id;
+			g_hash_table_add (message_ids, id);
+		}
+		camel_folder_free_message_info (folder, mi);
+	}
+	camel_folder_free_uids (folder, uids);
 
-	store_data_dir = camel_service_get_user_data_dir (CAMEL_SERVICE (remote_store));
-	uid_cache_path = g_build_filename (store_data_dir, "remote-uid.cache", NULL);
-	uid_cache = camel_uid_cache_new (uid_cache_path);
-	g_free (uid_cache_path);
+	return message_ids;
+}
 
-	if (uid_cache) {
-		GPtrArray *remote_uids;
-		GPtrArray *new_uids;
+static gboolean
+is_in_message_ids (CamelFolder *folder,
+		   const gchar *uid,
+		   GHashTable *message_ids)
+{
+	CamelMessageInfo *mi;
+	const CamelSummaryMessageID *message_id;
+	gboolean result = FALSE;
+
+	mi = camel_folder_get_message_info (folder, uid);
+	if (mi == NULL)
+		return FALSE;
+
+	message_id = camel_message_info_message_id (mi);
+	if (message_id && message_id->id.id != 0) {
+		gint64 id = (gint64) message_id->id.id;
+		result = g_hash_table_contains (message_ids, &id);
+	}
+	camel_folder_free_message_info (folder, mi);
 
-		remote_uids = camel_folder_get_uids (remote_inbox);
-		new_uids = camel_uid_cache_get_new_uids (uid_cache, remote_uids);
+	return result;
+}
 
-		if (new_uids) {
-			CamelFilterDriver *driver;
+static void
+transfer_sent_batch_sync (CamelFolder *outbox,
+			  CamelFolder *sent,
+			  GPtrArray *batch,
+			  GHashTable **message_ids,
+			  guint *transferred,
+			  GCancellable *cancellable,
+			  GError **error)
+{
+	GError *_error = NULL;
+	gint i;
 
-			driver = camel_filter_driver_new (CAMEL_SESSION (im_service_mgr_get_instance ()));
-			camel_filter_driver_set_default_folder (driver,
-								local_inbox);
-			camel_filter_driver_filter_folder (driver, remote_inbox, 
-							   uid_cache, new_uids, FALSE,
-							   cancellable, &_error);
-			camel_filter_driver_flush (driver, &_error);
-			camel_uid_cache_save (uid_cache);
+	for (i = 0; i < batch->len && _error == NULL; i++) {
+		const char *uid = (const char *) batch->pdata[i];
+		const char *send_status;
+		CamelMimeMessage *message;
+		CamelMessageInfo *mi;
 
-			camel_uid_cache_free_uids (new_uids);
-			g_object_unref (driver);
+		/* It was being copied when we were interrupted, so it may
+		 * already be in sentbox */
+		send_status = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_STATUS);
+		if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX) == 0) {
+			if (*message_ids == NULL)
+				*message_ids = get_message_ids (sent);
+			if (is_in_message_ids (outbox, uid, *message_ids)) {
+				camel_folder_set_message_flags (outbox, uid,
+								CAMEL_MESSAGE_DELETED,
+								CAMEL_MESSAGE_DELETED);
+				(*transferred)++;
+				continue;
+			}
 		}
 
-		camel_folder_free_uids (remote_inbox, remote_uids);
-		camel_uid_cache_destroy (uid_cache);
+		message = camel_folder_get_message_sync (outbox, uid, cancellable, &_error);
+		if (message == NULL)
+			break;
+
+		mi = camel_message_info_new (NULL);
+		camel_message_info_set_flags (mi, CAMEL_MESSAGE_SEEN, CAMEL_MESSAGE_SEEN);
+		if (camel_folder_append_message_sync (sent, message, mi, NULL,
+						      cancellable, &_error)) {
+			camel_folder_set_message_flags (outbox, uid,
+							CAMEL_MESSAGE_DELETED,
+							CAMEL_MESSAGE_DELETED);
+			(*transferred)++;
+		}
+		camel_message_info_free (mi);
+		g_object_unref (message);
 	}
 
-	if (_error) g_propagate_error (error, _error);
-	return (_error != NULL);
+	/* Copied messages are expunged. The rest stay copying-to-sentbox, and
+	 * they're checked against sentbox on next transfer */
+	camel_folder_synchronize_sync (sent, FALSE, NULL, NULL);
+	camel_folder_synchronize_sync (outbox, TRUE, NULL, NULL);
+
+	if (_error)
+		g_propagate_error (error, _error);
 }
 
-static CamelFolderInfo *
-synchronize_nonstorage_store_sync (CamelStore *store,
-				   GCancellable *cancellable,
-				   GError **error)
+/* Moves the messages of @outbox already sent to @sent, in batches of
+ * #IM_SEND_QUEUE_BATCH_SIZE */
+static gboolean
+transfer_sent_sync (CamelFolder *outbox,
+		    CamelFolder *sent,
+		    guint *transferred,
+		    GCancellable *cancellable,
+		    GError **error)
 {
 	GError *_error = NULL;
-	CamelFolder *remote_inbox = NULL;
-	CamelFolder *local_inbox = NULL;
-	gchar *account_id = NULL;
-	CamelFolderInfo *fi = NULL;
+	GHashTable *message_ids = NULL;
+	GPtrArray *uids;
+	GPtrArray *batch;
+	guint _transferred = 0;
+	gint i;
 
-	camel_store_lock (CAMEL_STORE (store), CAMEL_STORE_FOLDER_LOCK);
-	remote_inbox = camel_store_get_inbox_folder_sync (store,
-							  cancellable,
-							  &_error);
+	uids = camel_folder_get_uids (outbox);
+	batch = g_ptr_array_new ();
 
-	if (_error == NULL) {
-		if (camel_service_get_connection_status (CAMEL_SERVICE (store)) ==
-		    CAMEL_SERVICE_CONNECTED ||
-		    camel_service_connect_sync (CAMEL_SERVICE (store), &_error)) {
-			camel_folder_refresh_info_sync (remote_inbox,
-							cancellable,
-							&_error);
-		} else {
-			g_clear_error (&_error);
+	for (i = 0; i < uids->len && _error == NULL; i++) {
+		const char *uid = (const char *) uids->pdata[i];
+		const char *send_status;
+
+		send_status = camel_folder_get_message_user_tag (outbox, uid, IM_OUTBOX_SEND_STATUS);
+		if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_SENT) == 0) {
+			camel_folder_set_message_user_tag (outbox, uid,
+							   IM_OUTBOX_SEND_STATUS,
+							   IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX);
+			g_ptr_array_add (batch, (gpointer) uid);
+		} else if (g_strcmp0 (send_status, IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX) == 0 &&
+			   !(camel_folder_get_message_flags (outbox, uid) & CAMEL_MESSAGE_DELETED)) {
+			g_ptr_array_add (batch, (gpointer) uid);
 		}
-	}
 
-	if (_error == NULL) {
-		account_id = im_account_mgr_get_server_parent_account_name (im_account_mgr_get_instance (),
-									    camel_service_get_uid (CAMEL_SERVICE (store)),
-									    IM_ACCOUNT_TYPE_STORE);
-		if (account_id == NULL) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_INTERNAL,
-				     _("Could not find account of store"));
+		if (batch->len > 0 &&
+		    (batch->len == IM_SEND_QUEUE_BATCH_SIZE || i == uids->len - 1)) {
+			/* Persist the state before copying */
+			if (camel_folder_synchronize_sync (outbox, FALSE, cancellable, &_error))
+				transfer_sent_batch_sync (outbox, sent, batch, &message_ids,
+							  &_transferred, cancellable, &_error);
+			g_ptr_array_set_size (batch, 0);
 		}
 	}
 
-	if (_error == NULL) {
-		local_inbox = im_service_mgr_get_local_inbox (im_service_mgr_get_instance (),
-							      account_id,
-							      cancellable,
-							      &_error);
-	}
+	g_ptr_array_free (batch, TRUE);
+	camel_folder_free_uids (outbox, uids);
+	if (message_ids)
+		g_hash_table_unref (message_ids);
 
-	if (_error == NULL) {
-		update_non_storage_uids_sync (remote_inbox, local_inbox,
-					      cancellable, &_error);
-	}
+	if (_transferred > 0)
+		g_debug ("%s: moved %u messages from %s to %s", __FUNCTION__, _transferred,
+			 camel_folder_get_full_name (outbox), camel_folder_get_full_name (sent));
+	if (transferred)
+		*transferred = _transferred;
 
-	camel_store_unlock (store, CAMEL_STORE_FOLDER_LOCK);
+	if (_error) g_propagate_error (error, _error);
 
-	if (_error == NULL) {
-		CamelStore *local_store;
+	return _error == NULL;
+}
 
-		local_store = im_service_mgr_get_local_store (im_service_mgr_get_instance ());
-		fi = camel_store_get_folder_info_sync (local_store, account_id, 0,
-						       cancellable, &_error);
-	}
+/**
+ * im_mail_op_transfer_sent_sync:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @transferred: (out) (allow-none): return location for the number of
+ * messages moved to the sent folder, or %NULL
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Moves the messages already sent from the outbox of @account_id to its
+ * sent folder (see im_service_mgr_get_sent()). Messages are marked as
+ * copying-to-sentbox before being appended, and expunged from the outbox
+ * after it, so an interrupted transfer is resumed without copying them twice.
+ * Accounts without sent folder keep the messages in the outbox.
+ *
+ * It does not use the transport, so it can run while the send queue
+ * of the account is running.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_transfer_sent_sync (ImServiceMgr *mgr,
+			       const gchar *account_id,
+			       guint *transferred,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *outbox;
+	CamelFolder *sent = NULL;
+	guint _transferred = 0;
 
-	g_free (account_id);
-	if (local_inbox) g_object_unref (local_inbox);
-	if (remote_inbox) g_object_unref (remote_inbox);
+	outbox = im_service_mgr_get_outbox (mgr, account_id, cancellable, &_error);
+	if (outbox)
+		sent = im_service_mgr_get_sent (mgr, account_id, cancellable, &_error);
 
-	return fi;
-}
+	if (sent)
+		transfer_sent_sync (outbox, sent, &_transferred, cancellable, &_error);
 
-static CamelFolderInfo *
-synchronize_storage_store_sync (CamelStore *store,
+	if (sent) g_object_unref (sent);
+	if (outbox) g_object_unref (outbox);
+
+	if (transferred)
+		*transferred = _transferred;
+
+	if (_error) g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+typedef struct _TransferSentAsyncContext {
+	gchar *account_id;
+	guint transferred;
+} TransferSentAsyncContext;
+
+static void
+transfer_sent_async_context_free (TransferSentAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_slice_free (TransferSentAsyncContext, context);
+}
+
+static void
+im_mail_op_transfer_sent_thread (GSimpleAsyncResult *simple,
+				 GObject *object,
+				 GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	TransferSentAsyncContext *context;
+
+	context = (TransferSentAsyncContext *) g_simple_async_result_get_op_res_gpointer (simple);
+	im_mail_op_transfer_sent_sync (IM_SERVICE_MGR (object), context->account_id,
+				       &context->transferred, cancellable, &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_transfer_sent_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Moves the messages already sent from the outbox of @account_id to
+ * its sent folder.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_transfer_sent_finish() to get the result of the operation.
+ */
+void
+im_mail_op_transfer_sent_async (ImServiceMgr *mgr,
+				const gchar *account_id,
+				int io_priority,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	TransferSentAsyncContext *context;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_transfer_sent_async);
+	context = g_slice_new0 (TransferSentAsyncContext);
+	context->account_id = g_strdup (account_id);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) transfer_sent_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_transfer_sent_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_transfer_sent_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @transferred: (out) (allow-none): return location for the number of
+ * messages moved, or %NULL
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_transfer_sent_async().
+ *
+ * Returns: %TRUE if successfull, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_transfer_sent_finish (ImServiceMgr *mgr,
+				 GAsyncResult *result,
+				 guint *transferred,
+				 GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_transfer_sent_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return FALSE;
+
+	if (transferred)
+		*transferred = ((TransferSentAsyncContext *)
+				g_simple_async_result_get_op_res_gpointer (simple))->transferred;
+	return TRUE;
+}
+
+static GHashTable *
+get_uids_set (CamelFolder *folder)
+{
+	GHashTable *result;
+	GPtrArray *uids;
+	guint i;
+
+	result = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len; i++)
+		g_hash_table_add (result, g_strdup (uids->pdata[i]));
+	camel_folder_free_uids (folder, uids);
+
+	return result;
+}
+
+static GPtrArray *
+get_new_uids (CamelFolder *folder,
+	      GHashTable *known_uids)
+{
+	GPtrArray *result;
+	GPtrArray *uids;
+	guint i;
+
+	result = g_ptr_array_new_with_free_func (g_free);
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len; i++) {
+		if (!g_hash_table_contains (known_uids, uids->pdata[i]))
+			g_ptr_array_add (result, g_strdup (uids->pdata[i]));
+	}
+	camel_folder_free_uids (folder, uids);
+
+	return result;
+}
+
+static void filter_new_messages_sync (ImServiceMgr *service_mgr,
+				      const gchar *account_id,
+				      CamelFolder *inbox,
+				      GPtrArray *new_uids,
+				      GCancellable *cancellable);
+
+/* Hash of the Message-ID of @message, as stored in the summaries, or
+ * 0 if it has none */
+static guint64
+get_message_id_hash (CamelMimeMessage *message)
+{
+	CamelSummaryMessageID message_id;
+	const gchar *msgid;
+	GChecksum *checksum;
+	guint8 digest[16];
+	gsize length = sizeof (digest);
+
+	msgid = camel_mime_message_get_message_id (message);
+	if (msgid == NULL || *msgid == '\0')
+		return 0;
+
+	checksum = g_checksum_new (G_CHECKSUM_MD5);
+	g_checksum_update (checksum, (const guchar *) msgid, -1);
+	g_checksum_get_digest (checksum, digest, &length);
+	g_checksum_free (checksum);
+	memcpy (message_id.id.hash, digest, sizeof (message_id.id.hash));
+
+	return message_id.id.id;
+}
+
+static gchar *
+get_message_id_key (guint64 id)
+{
+	return g_strdup_printf ("%016" G_GINT64_MODIFIER "x", id);
+}
+
+/* Size of the message @uid of @remote_inbox as the server sent it,
+ * without writing the message again. POP folders have no summary, but
+ * keep the message retrieved in their cache */
+static gsize
+get_remote_message_size (CamelFolder *remote_inbox,
+			 const gchar *uid)
+{
+	gsize result = 0;
+
+	if (remote_inbox->summary) {
+		CamelMessageInfo *mi;
+
+		mi = camel_folder_get_message_info (remote_inbox, uid);
+		if (mi) {
+			result = camel_message_info_size (mi);
+			camel_folder_free_message_info (remote_inbox, mi);
+		}
+	}
+
+	if (result == 0) {
+		gchar *filename;
+		GStatBuf st;
+
+		filename = camel_folder_get_filename (remote_inbox, uid, NULL);
+		if (filename && g_stat (filename, &st) == 0)
+			result = st.st_size;
+		g_free (filename);
+	}
+
+	return result;
+}
+
+/* Index of the Message-ID hashes of the messages received by the POP
+ * store @remote_store, kept with it. Hashes are added as messages are
+ * received, and removed as the compactor expunges them, so it's never
+ * rebuilt from the folders. The first time, it's filled from the
+ * summary of @local_inbox, and if that's %NULL, there's no index yet
+ * and %NULL is returned */
+static ImUidLog *
+get_message_id_log (CamelStore *remote_store,
+		    CamelFolder *local_inbox)
+{
+	ImUidLog *id_log = NULL;
+	gchar *path;
+
+	id_log = g_object_get_data (G_OBJECT (remote_store), "im-message-id-log");
+	if (id_log)
+		return id_log;
+
+	path = g_build_filename (camel_service_get_user_data_dir (CAMEL_SERVICE (remote_store)),
+				 "message-ids.log", NULL);
+	if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+		id_log = im_uid_log_open (path, NULL);
+	} else if (local_inbox) {
+		GHashTable *message_ids;
+		GHashTableIter iter;
+		gpointer key;
+
+		id_log = im_uid_log_open (path, NULL);
+		message_ids = get_message_ids (local_inbox);
+		g_hash_table_iter_init (&iter, message_ids);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			gchar *id_key = get_message_id_key (*((guint64 *) key));
+			im_uid_log_add (id_log, id_key);
+			g_free (id_key);
+		}
+		g_hash_table_destroy (message_ids);
+		im_uid_log_sync (id_log, NULL);
+	}
+	if (id_log)
+		g_object_set_data_full (G_OBJECT (remote_store), "im-message-id-log",
+					id_log, (GDestroyNotify) im_uid_log_free);
+	g_free (path);
+
+	return id_log;
+}
+
+/**
+ * im_mail_op_forget_message_ids:
+ * @store: the #CamelStore of an account
+ * @folder: a local #CamelFolder of the account
+ * @uids: (element-type utf8): uids of messages of @folder about to be expunged
+ *
+ * Removes the Message-ID of the messages @uids from the index of the
+ * messages received by @store, so a POP message is skipped as a
+ * duplicate only while the account keeps it. Messages the filters move
+ * to other folders, or the user deletes, keep their Message-ID in the
+ * index. It does nothing if @store is not a POP store.
+ */
+void
+im_mail_op_forget_message_ids (CamelStore *store,
+			       CamelFolder *folder,
+			       GPtrArray *uids)
+{
+	ImUidLog *id_log;
+	guint i;
+
+	camel_store_lock (store, CAMEL_STORE_FOLDER_LOCK);
+	id_log = get_message_id_log (store, NULL);
+	if (id_log) {
+		for (i = 0; i < uids->len; i++) {
+			CamelMessageInfo *mi;
+			const CamelSummaryMessageID *message_id;
+
+			mi = camel_folder_get_message_info (folder, (const gchar *) uids->pdata[i]);
+			if (mi == NULL)
+				continue;
+			message_id = camel_message_info_message_id (mi);
+			if (message_id && message_id->id.id != 0) {
+				gchar *id_key = get_message_id_key (message_id->id.id);
+				im_uid_log_remove (id_log, id_key);
+				g_free (id_key);
+			}
+			camel_folder_free_message_info (folder, mi);
+		}
+		im_uid_log_sync (id_log, NULL);
+	}
+	camel_store_unlock (store, CAMEL_STORE_FOLDER_LOCK);
+}
+
+static gboolean
+update_non_storage_uids_sync (CamelFolder *remote_inbox,
+			      CamelFolder *local_inbox,
+			      ImLocalCompactor *compactor,
+			      guint *duplicates,
+			      guint64 *duplicates_size,
+			      GCancellable *cancellable,
+			      GError **error)
+{
+	GError *_error = NULL;
+	ImUidLog *uid_log;
+	CamelStore *remote_store;
+	const gchar *store_data_dir;
+	GPtrArray *remote_uids;
+	GPtrArray *new_uids;
+
+	remote_store = camel_folder_get_parent_store (remote_inbox);
+	store_data_dir = camel_service_get_user_data_dir (CAMEL_SERVICE (remote_store));
+
+	/* The uids already retrieved are kept with the store, so each
+	 * sync only looks up the uids in the server */
+	uid_log = g_object_get_data (G_OBJECT (remote_store), "im-uid-log");
+	if (uid_log == NULL) {
+		gchar *log_path, *cache_path;
+
+		log_path = g_build_filename (store_data_dir, "remote-uid.log", NULL);
+		cache_path = g_build_filename (store_data_dir, "remote-uid.cache", NULL);
+		uid_log = im_uid_log_open (log_path, cache_path);
+		g_object_set_data_full (G_OBJECT (remote_store), "im-uid-log",
+					uid_log, (GDestroyNotify) im_uid_log_free);
+		g_free (log_path);
+		g_free (cache_path);
+	}
+
+	remote_uids = camel_folder_get_uids (remote_inbox);
+	new_uids = im_uid_log_get_new_uids (uid_log, remote_uids);
+
+	if (new_uids->len > 0) {
+		ImUidLog *id_log;
+		guint i;
+
+		id_log = get_message_id_log (remote_store, local_inbox);
+
+		/* One by one, so each uid is logged as soon as its
+		 * message is stored. Messages already received by this
+		 * account, i.e. with a new uid after a server side
+		 * change, are not stored again */
+		for (i = 0; i < new_uids->len && _error == NULL; i++) {
+			const gchar *uid = (const gchar *) new_uids->pdata[i];
+			CamelMimeMessage *message;
+			gchar *id_key = NULL;
+			guint64 id;
+
+			/* The rest are retrieved on next sync, once the
+			 * compactor has made room */
+			if (compactor && i % IM_LOCAL_COMPACTOR_SPACE_CHECK_MESSAGES == 0 &&
+			    im_local_compactor_has_low_space (compactor)) {
+				g_set_error (&_error, IM_ERROR_DOMAIN,
+					     IM_ERROR_SERVICE_MGR_LOW_DISK_SPACE,
+					     _("Not enough disk space to retrieve new messages"));
+				im_local_compactor_compact_soon (compactor);
+				break;
+			}
+
+			message = camel_folder_get_message_sync (remote_inbox, uid,
+								 cancellable, &_error);
+			if (message == NULL)
+				break;
+
+			id = get_message_id_hash (message);
+			if (id != 0)
+				id_key = get_message_id_key (id);
+
+			if (id_key && im_uid_log_contains (id_log, id_key)) {
+				(*duplicates)++;
+				*duplicates_size += get_remote_message_size (remote_inbox, uid);
+				im_uid_log_add (uid_log, uid);
+			} else if (camel_folder_append_message_sync (local_inbox, message, NULL, NULL,
+								     cancellable, &_error)) {
+				if (id_key)
+					im_uid_log_add (id_log, id_key);
+				im_uid_log_add (uid_log, uid);
+			}
+
+			g_free (id_key);
+			g_object_unref (message);
+		}
+		im_uid_log_sync (id_log, NULL);
+
+		if (_error == NULL)
+			camel_folder_synchronize_sync (local_inbox, FALSE,
+						       cancellable, &_error);
+
+		if (*duplicates > 0)
+			g_debug ("%s: skipped %u duplicated messages of %u, %" G_GUINT64_FORMAT " bytes",
+				 __FUNCTION__, *duplicates, new_uids->len, *duplicates_size);
+	}
+	im_uid_log_sync (uid_log, remote_uids);
+
+	g_ptr_array_unref (new_uids);
+	camel_folder_free_uids (remote_inbox, remote_uids);
+
+	if (_error) {
+		g_propagate_error (error, _error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static CamelFolderInfo *
+synchronize_nonstorage_store_sync (CamelStore *store,
+				   ImLocalCompactor *compactor,
+				   guint *duplicates,
+				   guint64 *duplicates_size,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *remote_inbox = NULL;
+	CamelFolder *local_inbox = NULL;
+	GHashTable *known_uids = NULL;
+	gchar *account_id = NULL;
+	CamelFolderInfo *fi = NULL;
+
+	camel_store_lock (CAMEL_STORE (store), CAMEL_STORE_FOLDER_LOCK);
+	remote_inbox = camel_store_get_inbox_folder_sync (store,
+							  cancellable,
+							  &_error);
+
+	if (_error == NULL) {
+		if (camel_service_get_connection_status (CAMEL_SERVICE (store)) ==
+		    CAMEL_SERVICE_CONNECTED ||
+		    camel_service_connect_sync (CAMEL_SERVICE (store), &_error)) {
+			camel_folder_refresh_info_sync (remote_inbox,
+							cancellable,
+							&_error);
+		} else {
+			g_clear_error (&_error);
+		}
+	}
+
+	if (_error == NULL) {
+		account_id = im_account_mgr_get_server_parent_account_name (im_account_mgr_get_instance (),
+									    camel_service_get_uid (CAMEL_SERVICE (store)),
+									    IM_ACCOUNT_TYPE_STORE);
+		if (account_id == NULL) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_INTERNAL,
+				     _("Could not find account of store"));
+		}
+	}
+
+	if (_error == NULL) {
+		local_inbox = im_service_mgr_get_local_inbox (im_service_mgr_get_instance (),
+							      account_id,
+							      cancellable,
+							      &_error);
+	}
+
+	if (_error == NULL) {
+		known_uids = get_uids_set (local_inbox);
+		update_non_storage_uids_sync (remote_inbox, local_inbox, compactor,
+					      duplicates, duplicates_size,
+					      cancellable, &_error);
+	}
+
+	camel_store_unlock (store, CAMEL_STORE_FOLDER_LOCK);
+
+	if (known_uids) {
+		GPtrArray *new_uids;
+
+		new_uids = get_new_uids (local_inbox, known_uids);
+		filter_new_messages_sync (im_service_mgr_get_instance (), account_id,
+					  local_inbox, new_uids, cancellable);
+		g_ptr_array_unref (new_uids);
+		g_hash_table_destroy (known_uids);
+	}
+
+	if (_error == NULL) {
+		CamelStore *local_store;
+
+		/* The folders of the account are under its inbox */
+		local_store = im_service_mgr_get_local_store (im_service_mgr_get_instance ());
+		fi = camel_store_get_folder_info_sync (local_store, account_id,
+						       CAMEL_STORE_FOLDER_INFO_RECURSIVE,
+						       cancellable, &_error);
+	}
+
+	g_free (account_id);
+	if (local_inbox) g_object_unref (local_inbox);
+	if (remote_inbox) g_object_unref (remote_inbox);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return fi;
+}
+
+static CamelFolderInfo *
+synchronize_storage_store_sync (CamelStore *store,
 				GCancellable *cancellable,
 				GError **error)
 {
@@ -423,6 +1394,8 @@ synchronize_storage_store_sync (CamelStore *store,
 		if (camel_service_get_connection_status (CAMEL_SERVICE (store)) ==
 		    CAMEL_SERVICE_CONNECTED ||
 		    camel_service_connect_sync (CAMEL_SERVICE (store), &_error)) {
+			/* The new messages of the inbox are filtered from
+			 * the folder changes, see im_push_mgr */
 			camel_folder_refresh_info_sync (folder,
 							cancellable,
 							&_error);
@@ -445,6 +1418,11 @@ synchronize_storage_store_sync (CamelStore *store,
 /**
  * im_mail_op_synchronize_store_sync:
  * @store: a #CamelStore
+ * @compactor: (allow-none): the #ImLocalCompactor to check the disk
+ * space with while retrieving messages of a POP @store, or %NULL
+ * @duplicates: (out) (allow-none): messages retrieved from a POP
+ * @store, but not stored because they had been received already
+ * @duplicates_size: (out) (allow-none): size of the @duplicates, in bytes
  * @cancellable: optional #GCancellable object, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
  *
@@ -454,17 +1432,50 @@ synchronize_storage_store_sync (CamelStore *store,
  */
 CamelFolderInfo *
 im_mail_op_synchronize_store_sync (CamelStore *store,
+				   ImLocalCompactor *compactor,
+				   guint *duplicates,
+				   guint64 *duplicates_size,
 				   GCancellable *cancellable,
 				   GError **error)
 {
 	CamelProvider *provider;
+	guint _duplicates = 0;
+	guint64 _duplicates_size = 0;
+	CamelFolderInfo *fi;
+
+	if (!im_service_mgr_wait_for_service (im_service_mgr_get_instance (),
+					      CAMEL_SERVICE (store),
+					      cancellable, error))
+		return NULL;
 
 	provider = camel_service_get_provider (CAMEL_SERVICE (store));
 	if (provider->flags & CAMEL_PROVIDER_IS_STORAGE)
-		return synchronize_storage_store_sync (store, cancellable, error);
+		fi = synchronize_storage_store_sync (store, cancellable, error);
 	else
-		return synchronize_nonstorage_store_sync (store, cancellable, error);
+		fi = synchronize_nonstorage_store_sync (store, compactor,
+							&_duplicates, &_duplicates_size,
+							cancellable, error);
+
+	if (duplicates)
+		*duplicates = _duplicates;
+	if (duplicates_size)
+		*duplicates_size = _duplicates_size;
+
+	return fi;
+}
+
+typedef struct _SynchronizeStoreAsyncContext {
+	ImLocalCompactor *compactor;
+	CamelFolderInfo *fi;
+	guint duplicates;
+	guint64 duplicates_size;
+} SynchronizeStoreAsyncContext;
 
+static void
+synchronize_store_async_context_free (SynchronizeStoreAsyncContext *context)
+{
+	g_object_unref (context->compactor);
+	g_free (context);
 }
 
 static void
@@ -473,18 +1484,26 @@ im_mail_op_synchronize_store_thread (GSimpleAsyncResult *simple,
 				     GCancellable *cancellable)
 {
 	GError *_error = NULL;
-	CamelFolderInfo *fi;
-
-	fi = im_mail_op_synchronize_store_sync (CAMEL_STORE (object),
-						cancellable,
-						&_error);
+	SynchronizeStoreAsyncContext *context;
 
-	g_simple_async_result_set_op_res_gpointer (simple,
-						   fi,
-						   NULL);
-	
-	if (_error != NULL)
+	context = (SynchronizeStoreAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+	context->fi = im_mail_op_synchronize_store_sync (CAMEL_STORE (object),
+							 context->compactor,
+							 &context->duplicates,
+							 &context->duplicates_size,
+							 cancellable,
+							 &_error);
+
+	if (_error != NULL) {
+		/* The folders of a storage store may have been obtained
+		 * before failing */
+		if (context->fi) {
+			camel_store_free_folder_info (CAMEL_STORE (object), context->fi);
+			context->fi = NULL;
+		}
 		g_simple_async_result_take_error (simple, _error);
+	}
 }
 
 /**
@@ -509,10 +1528,17 @@ im_mail_op_synchronize_store_async (CamelStore *store,
 				    gpointer userdata)
 {
 	GSimpleAsyncResult *simple;
+	SynchronizeStoreAsyncContext *context;
 	
 	simple = g_simple_async_result_new (G_OBJECT (store),
 					    callback, userdata,
 					    im_mail_op_synchronize_store_async);
+	/* The compactor singleton is not thread safe, so it's obtained
+	 * here and passed to the thread */
+	context = g_new0 (SynchronizeStoreAsyncContext, 1);
+	context->compactor = g_object_ref (im_local_compactor_get_instance ());
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) synchronize_store_async_context_free);
 
 	g_simple_async_result_run_in_thread (simple,
 					     im_mail_op_synchronize_store_thread,
@@ -525,456 +1551,3738 @@ im_mail_op_synchronize_store_async (CamelStore *store,
  * im_mail_op_synchronize_store_finish:
  * @store: a #CamelStore
  * @result: a #GAsyncResult
+ * @duplicates: (out) (allow-none): messages retrieved from a POP
+ * @store, but not stored because they had been received already
+ * @duplicates_size: (out) (allow-none): size of the @duplicates, in bytes
  * @error: (out) (allow-none): return location for a #GError, or %NULL
  *
  * Finishes the operation started with im_mail_op_synchronize_store_async().
+ * The @duplicates are reported even if it failed, as they are counted
+ * until the failure.
  *
  * Returns: a #CamelFolderInfo on success which should be freed with
  * camel_store_free_folder_info(), %NULL otherwise.
  */
-CamelFolderInfo *
-im_mail_op_synchronize_store_finish (CamelStore *store,
-				     GAsyncResult *result,
-				     GError **error)
+CamelFolderInfo *
+im_mail_op_synchronize_store_finish (CamelStore *store,
+				     GAsyncResult *result,
+				     guint *duplicates,
+				     guint64 *duplicates_size,
+				     GError **error)
+{
+	GSimpleAsyncResult *simple;
+	SynchronizeStoreAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (store), im_mail_op_synchronize_store_async), FALSE);
+
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (SynchronizeStoreAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (duplicates)
+		*duplicates = context->duplicates;
+	if (duplicates_size)
+		*duplicates_size = context->duplicates_size;
+
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	return context->fi;
+}
+
+typedef struct _RefreshFolderInfoAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	CamelFolder *folder;
+} RefreshFolderInfoAsyncContext;
+
+static void
+refresh_folder_info_async_context_free (RefreshFolderInfoAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	if (context->folder) g_object_unref (context->folder);
+	g_free (context);
+}
+
+/**
+ * im_mail_op_refresh_folder_info_sync:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @folder: (out) (allow-none): the refreshed #CamelFolder
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Refreshes the summary of folder @folder_name in account @account_id.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_refresh_folder_info_sync (ImServiceMgr *mgr,
+				     const gchar *account_id,
+				     const gchar *folder_name,
+				     CamelFolder **folder,
+				     GCancellable *cancellable,
+				     GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *_folder;
+
+	_folder = im_service_mgr_get_folder (mgr, account_id,
+					    folder_name, cancellable, &_error);
+
+	if (_error == NULL) {
+		camel_folder_refresh_info_sync (_folder,
+						cancellable, &_error);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (folder)
+		*folder = _folder;
+	else
+		g_object_unref (_folder);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_refresh_folder_info_thread (GSimpleAsyncResult *simple,
+				       GObject *object,
+				       GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	RefreshFolderInfoAsyncContext *context;
+
+	context = (RefreshFolderInfoAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_refresh_folder_info_sync (IM_SERVICE_MGR (object),
+					     context->account_id,
+					     context->folder_name,
+					     &(context->folder),
+					     cancellable,
+					     &_error);
+	
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_refresh_folder_info_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously refreshes the summary of folder @folder_name in account
+ * @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_refresh_folder_info_finish() to get the result of the operation.
+ */
+void
+im_mail_op_refresh_folder_info_async (ImServiceMgr *mgr,
+				      const gchar *account_id,
+				      const gchar *folder_name,
+				      int io_priority,
+				      GCancellable *cancellable,
+				      GAsyncReadyCallback callback,
+				      gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	RefreshFolderInfoAsyncContext *context;
+
+	context = g_new0 (RefreshFolderInfoAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_refresh_folder_info_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context, 
+						   (GDestroyNotify) refresh_folder_info_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_refresh_folder_info_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_refresh_folder_info_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @folder: (out) (allow-none) (transfer full): refreshed #CamelFolder
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_refresh_folder_info_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_refresh_folder_info_finish (ImServiceMgr *mgr,
+				       GAsyncResult *result,
+				       CamelFolder **folder,
+				       GError **error)
+{
+	GSimpleAsyncResult *simple;
+	RefreshFolderInfoAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_refresh_folder_info_async), FALSE);
+
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (RefreshFolderInfoAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (folder && context->folder)
+		*folder = g_object_ref (context->folder);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _SearchAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	gchar *query;
+	gchar *oldest_uid;
+	guint count;
+	CamelFolder *folder;
+	GPtrArray *uids;
+	guint total;
+} SearchAsyncContext;
+
+static void
+search_async_context_free (SearchAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context->query);
+	g_free (context->oldest_uid);
+	if (context->folder) g_object_unref (context->folder);
+	if (context->uids) g_ptr_array_unref (context->uids);
+	g_free (context);
+}
+
+/* Matches of the last search in a folder, sorted from oldest to
+ * newest by date received, so next pages don't run the search again.
+ * Each folder keeps its own, so searches in several folders don't
+ * drop each other's. It's marked as stale when the folder changes, so
+ * next page searches again */
+typedef struct _SearchCache {
+	gchar *query;
+	gboolean stale;
+	GPtrArray *uids;
+	GArray *dates;
+} SearchCache;
+
+#define SEARCH_CACHE_KEY "im-search-cache"
+
+/* Protects the search caches of all the folders */
+static GMutex search_cache_lock;
+
+static void
+search_cache_free (SearchCache *cache)
+{
+	g_free (cache->query);
+	g_ptr_array_unref (cache->uids);
+	g_array_unref (cache->dates);
+	g_slice_free (SearchCache, cache);
+}
+
+static void
+on_search_folder_changed (CamelFolder *folder,
+			  CamelFolderChangeInfo *info,
+			  gpointer userdata)
+{
+	SearchCache *cache;
+
+	g_mutex_lock (&search_cache_lock);
+	cache = g_object_get_data (G_OBJECT (folder), SEARCH_CACHE_KEY);
+	if (cache)
+		cache->stale = TRUE;
+	g_mutex_unlock (&search_cache_lock);
+}
+
+/* Replaces the cached search of @folder with the matches of @query.
+ * The cache goes away with the folder */
+static void
+set_search_cache (CamelFolder *folder,
+		  const gchar *query,
+		  GPtrArray *uids,
+		  GArray *dates)
+{
+	SearchCache *cache;
+
+	cache = g_slice_new0 (SearchCache);
+	cache->query = g_strdup (query);
+	cache->uids = g_ptr_array_ref (uids);
+	cache->dates = g_array_ref (dates);
+
+	g_mutex_lock (&search_cache_lock);
+	if (g_object_get_data (G_OBJECT (folder), SEARCH_CACHE_KEY) == NULL)
+		g_signal_connect (G_OBJECT (folder), "changed",
+				  G_CALLBACK (on_search_folder_changed), NULL);
+	g_object_set_data_full (G_OBJECT (folder), SEARCH_CACHE_KEY,
+				cache, (GDestroyNotify) search_cache_free);
+	g_mutex_unlock (&search_cache_lock);
+}
+
+/* Gets the date received of @uid in the cached search, if it's there */
+static gboolean
+lookup_search_cache_date (SearchCache *cache,
+			  const gchar *uid,
+			  gint64 *date)
+{
+	guint i;
+
+	for (i = 0; i < cache->uids->len; i++) {
+		if (g_strcmp0 (cache->uids->pdata[i], uid) == 0) {
+			*date = g_array_index (cache->dates, gint64, i);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+typedef struct _SearchMatch {
+	const gchar *uid;
+	gint64 date;
+} SearchMatch;
+
+/* Orders matches by date received, and by uid if they're the same */
+static gint
+compare_search_matches (gconstpointer a,
+			gconstpointer b,
+			gpointer userdata)
+{
+	const SearchMatch *match_a = (const SearchMatch *) a;
+	const SearchMatch *match_b = (const SearchMatch *) b;
+
+	if (match_a->date != match_b->date)
+		return match_a->date < match_b->date ? -1 : 1;
+
+	return camel_folder_cmp_uids (CAMEL_FOLDER (userdata), match_a->uid, match_b->uid);
+}
+
+/* Headers matched by a search, besides the body */
+static const gchar *search_headers[] = { "subject", "from", "to", "cc", NULL };
+
+/* Builds a Camel search expression matching the messages that contain
+ * all the words of @query, in any of the search headers or the body */
+static gchar *
+build_search_expression (const gchar *query)
+{
+	GString *expression;
+	gchar **words, **node;
+	const gchar **header;
+
+	expression = g_string_new ("(and (not (system-flag \"deleted\"))");
+
+	words = g_strsplit_set (query, " \t\n", 0);
+	for (node = words; *node != NULL; node++) {
+		if (**node == '\0')
+			continue;
+
+		g_string_append (expression, " (or");
+		for (header = search_headers; *header != NULL; header++) {
+			g_string_append_printf (expression, " (header-contains \"%s\" ", *header);
+			camel_sexp_encode_string (expression, *node);
+			g_string_append_c (expression, ')');
+		}
+		g_string_append (expression, " (body-contains ");
+		camel_sexp_encode_string (expression, *node);
+		g_string_append (expression, "))");
+	}
+	g_strfreev (words);
+
+	g_string_append_c (expression, ')');
+
+	return g_string_free (expression, FALSE);
+}
+
+/* Runs the search of @query in @folder, getting the matches sorted
+ * from oldest to newest by date received, with their dates */
+static gboolean
+search_matches_sync (CamelFolder *folder,
+		     const gchar *query,
+		     GPtrArray **uids,
+		     GArray **dates,
+		     GError **error)
+{
+	GError *_error = NULL;
+	GPtrArray *result;
+	gchar *expression;
+	gint64 start;
+
+	expression = build_search_expression (query);
+	start = g_get_monotonic_time ();
+	result = camel_folder_search_by_expression (folder, expression, &_error);
+	g_free (expression);
+
+	if (result) {
+		GArray *matches;
+		guint i;
+
+		g_debug ("%s: %u matches of \"%s\" in %s, %" G_GINT64_FORMAT " usec",
+			 __FUNCTION__, result->len, query, camel_folder_get_full_name (folder),
+			 g_get_monotonic_time () - start);
+
+		matches = g_array_sized_new (FALSE, FALSE, sizeof (SearchMatch), result->len);
+		for (i = 0; i < result->len; i++) {
+			CamelMessageInfo *mi;
+			SearchMatch match;
+
+			mi = camel_folder_get_message_info (folder, result->pdata[i]);
+			if (mi == NULL)
+				continue;
+			match.uid = camel_pstring_strdup (result->pdata[i]);
+			match.date = camel_message_info_date_received (mi);
+			camel_folder_free_message_info (folder, mi);
+			g_array_append_val (matches, match);
+		}
+		camel_folder_search_free (folder, result);
+		g_qsort_with_data (matches->data, matches->len, sizeof (SearchMatch),
+				   compare_search_matches, folder);
+
+		*uids = g_ptr_array_new_full (matches->len, (GDestroyNotify) camel_pstring_free);
+		*dates = g_array_sized_new (FALSE, FALSE, sizeof (gint64), matches->len);
+		for (i = 0; i < matches->len; i++) {
+			SearchMatch *match = &g_array_index (matches, SearchMatch, i);
+
+			g_ptr_array_add (*uids, (gpointer) match->uid);
+			g_array_append_val (*dates, match->date);
+		}
+		g_array_free (matches, TRUE);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/* Index of the newest match older than the cursor message, which
+ * may not be in the matches anymore, or -1 if there's none */
+static gint
+find_search_page_start (CamelFolder *folder,
+			GPtrArray *uids,
+			GArray *dates,
+			const gchar *oldest_uid,
+			gint64 oldest_date)
+{
+	SearchMatch cursor;
+	guint low, high;
+
+	cursor.uid = oldest_uid;
+	cursor.date = oldest_date;
+
+	/* First match not older than the cursor */
+	low = 0;
+	high = uids->len;
+	while (low < high) {
+		guint middle = (low + high) / 2;
+		SearchMatch match;
+
+		match.uid = uids->pdata[middle];
+		match.date = g_array_index (dates, gint64, middle);
+		if (compare_search_matches (&match, &cursor, folder) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (gint) low - 1;
+}
+
+/**
+ * im_mail_op_search_sync:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @query: the words to search
+ * @oldest_uid: (allow-none): the oldest message of the previous page,
+ * or %NULL for the first page
+ * @count: the maximum number of messages of the page
+ * @folder: (out) (allow-none): the searched #CamelFolder
+ * @uids: (out) (allow-none) (element-type utf8): the uids of the page,
+ * sorted from newest to oldest by date received
+ * @total: (out) (allow-none): the number of matching messages
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Searches the messages of folder @folder_name in account @account_id
+ * containing all the words in @query, in the subject, the sender and
+ * recipients, or the body, and gets a page of @count of them, older
+ * than @oldest_uid.
+ *
+ * Folders are opened with %CAMEL_STORE_FOLDER_BODY_INDEX, so local
+ * folders add each message to the body index as it's appended, and
+ * body searches use the index. Remote folders search in the server.
+ *
+ * The matches of the last search of each folder are kept, so next
+ * pages don't run it again unless the folder changed. Pages continue
+ * from the date of @oldest_uid, so they don't break if it goes away
+ * meanwhile, and messages removed after the search are skipped. A
+ * @query without words matches no message.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_search_sync (ImServiceMgr *mgr,
+			const gchar *account_id,
+			const gchar *folder_name,
+			const gchar *query,
+			const gchar *oldest_uid,
+			guint count,
+			CamelFolder **folder,
+			GPtrArray **uids,
+			guint *total,
+			GCancellable *cancellable,
+			GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *_folder;
+
+	_folder = im_service_mgr_get_folder (mgr, account_id,
+					     folder_name, cancellable, &_error);
+
+	if (_error == NULL)
+		_im_mail_op_search_folder_sync (_folder, query, oldest_uid, count,
+						uids, total, cancellable, &_error);
+	else {
+		if (uids)
+			*uids = NULL;
+		if (total)
+			*total = 0;
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (folder)
+		*folder = _folder;
+	else if (_folder)
+		g_object_unref (_folder);
+
+	return _error == NULL;
+}
+
+/* TRUE if @query has no words to search */
+static gboolean
+is_blank_query (const gchar *query)
+{
+	for (; query && *query; query++) {
+		if (!g_ascii_isspace (*query))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+_im_mail_op_search_folder_sync (CamelFolder *folder,
+				const gchar *query,
+				const gchar *oldest_uid,
+				guint count,
+				GPtrArray **uids,
+				guint *total,
+				GCancellable *cancellable,
+				GError **error)
+{
+	GError *_error = NULL;
+	GPtrArray *page = NULL;
+	guint _total = 0;
+
+	if (is_blank_query (query)) {
+		page = g_ptr_array_new_with_free_func ((GDestroyNotify) camel_pstring_free);
+	} else {
+		GPtrArray *matches = NULL;
+		GArray *dates = NULL;
+		gint64 oldest_date = 0;
+		gboolean has_cursor = FALSE;
+		SearchCache *cache;
+
+		g_mutex_lock (&search_cache_lock);
+		cache = g_object_get_data (G_OBJECT (folder), SEARCH_CACHE_KEY);
+		if (oldest_uid && cache && g_strcmp0 (cache->query, query) == 0) {
+			has_cursor = lookup_search_cache_date (cache, oldest_uid, &oldest_date);
+			if (!cache->stale) {
+				matches = g_ptr_array_ref (cache->uids);
+				dates = g_array_ref (cache->dates);
+			}
+		}
+		g_mutex_unlock (&search_cache_lock);
+
+		if (matches == NULL &&
+		    search_matches_sync (folder, query, &matches, &dates, &_error))
+			set_search_cache (folder, query, matches, dates);
+
+		if (_error == NULL && oldest_uid && !has_cursor) {
+			CamelMessageInfo *mi;
+
+			mi = camel_folder_get_message_info (folder, oldest_uid);
+			if (mi) {
+				oldest_date = camel_message_info_date_received (mi);
+				has_cursor = TRUE;
+				camel_folder_free_message_info (folder, mi);
+			}
+		}
+
+		if (_error == NULL) {
+			gint i;
+
+			/* Pages go from newest to oldest, as in fetchMessages */
+			if (oldest_uid == NULL)
+				i = matches->len - 1;
+			else if (has_cursor)
+				i = find_search_page_start (folder, matches, dates,
+							    oldest_uid, oldest_date);
+			else
+				i = -1;
+
+			page = g_ptr_array_new_with_free_func ((GDestroyNotify) camel_pstring_free);
+			for (; i >= 0 && page->len < count; i--) {
+				CamelMessageInfo *mi;
+
+				/* Removed after the search */
+				mi = camel_folder_get_message_info (folder, matches->pdata[i]);
+				if (mi == NULL)
+					continue;
+				camel_folder_free_message_info (folder, mi);
+				g_ptr_array_add (page, (gpointer) camel_pstring_strdup (matches->pdata[i]));
+			}
+			_total = matches->len;
+		}
+
+		if (matches)
+			g_ptr_array_unref (matches);
+		if (dates)
+			g_array_unref (dates);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (uids)
+		*uids = page;
+	else if (page)
+		g_ptr_array_unref (page);
+	if (total)
+		*total = _total;
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_search_thread (GSimpleAsyncResult *simple,
+			  GObject *object,
+			  GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	SearchAsyncContext *context;
+
+	context = (SearchAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_search_sync (IM_SERVICE_MGR (object),
+				context->account_id,
+				context->folder_name,
+				context->query,
+				context->oldest_uid,
+				context->count,
+				&(context->folder),
+				&(context->uids),
+				&(context->total),
+				cancellable,
+				&_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_search_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @query: the words to search
+ * @oldest_uid: (allow-none): the oldest message of the previous page,
+ * or %NULL for the first page
+ * @count: the maximum number of messages of the page
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously searches the messages of folder @folder_name in account
+ * @account_id containing all the words in @query, and gets a page of
+ * @count of them, older than @oldest_uid.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_search_finish() to get the result of the operation.
+ */
+void
+im_mail_op_search_async (ImServiceMgr *mgr,
+			 const gchar *account_id,
+			 const gchar *folder_name,
+			 const gchar *query,
+			 const gchar *oldest_uid,
+			 guint count,
+			 int io_priority,
+			 GCancellable *cancellable,
+			 GAsyncReadyCallback callback,
+			 gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	SearchAsyncContext *context;
+
+	context = g_new0 (SearchAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->query = g_strdup (query);
+	context->oldest_uid = g_strdup (oldest_uid);
+	context->count = count;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_search_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) search_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_search_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_search_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @folder: (out) (allow-none) (transfer full): the searched #CamelFolder
+ * @uids: (out) (allow-none) (transfer full) (element-type utf8): the
+ * uids of the page, sorted from newest to oldest by date received
+ * @total: (out) (allow-none): the number of matching messages
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_search_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_search_finish (ImServiceMgr *mgr,
+			  GAsyncResult *result,
+			  CamelFolder **folder,
+			  GPtrArray **uids,
+			  guint *total,
+			  GError **error)
+{
+	GSimpleAsyncResult *simple;
+	SearchAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_search_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (SearchAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (folder && context->folder)
+		*folder = g_object_ref (context->folder);
+	if (uids && context->uids)
+		*uids = g_ptr_array_ref (context->uids);
+	if (total)
+		*total = context->total;
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+/* The inbox of an account */
+typedef struct _InboxSource {
+	gchar *account_id;
+	CamelFolder *folder;
+} InboxSource;
+
+/* Position of an inbox in a page cursor */
+typedef struct _InboxPosition {
+	gchar *uid;
+	gint64 date;
+} InboxPosition;
+
+/* Uids an inbox cursor takes from the sort index at a time */
+#define INBOX_CURSOR_CHUNK 32
+
+/* Iterator over the messages of an inbox being merged, newest first.
+ * It takes the uids from the sort index a chunk at a time, going on
+ * from the last message loaded, and stops at @limit if it's set */
+typedef struct _InboxCursor {
+	InboxSource *source;
+	InboxPosition *last;
+	InboxPosition *limit;
+	GPtrArray *uids;
+	guint next;
+	gboolean exhausted;
+	/* Uids after @last that are no longer in the folder, they come
+	 * again with the next chunk */
+	GHashTable *skipped;
+	CamelMessageInfo *head;
+	time_t head_date;
+} InboxCursor;
+
+static void
+inbox_source_free (InboxSource *source)
+{
+	g_free (source->account_id);
+	g_object_unref (source->folder);
+	g_free (source);
+}
+
+static InboxPosition *
+inbox_position_new (const gchar *uid,
+		    gint64 date)
+{
+	InboxPosition *position;
+
+	position = g_slice_new (InboxPosition);
+	position->uid = g_strdup (uid);
+	position->date = date;
+
+	return position;
+}
+
+static void
+inbox_position_free (InboxPosition *position)
+{
+	g_free (position->uid);
+	g_slice_free (InboxPosition, position);
+}
+
+/* TRUE if the message @uid received at @date goes before @position,
+ * in the order of the sort index */
+static gboolean
+inbox_position_is_newer (const gchar *uid,
+			 gint64 date,
+			 const InboxPosition *position)
+{
+	if (date != position->date)
+		return date > position->date;
+
+	return strcmp (uid, position->uid) > 0;
+}
+
+/* The cursor goes on after @start, or from the newest message if it's
+ * %NULL, and stops before @limit, or at the oldest if it's %NULL */
+static InboxCursor *
+inbox_cursor_new (InboxSource *source,
+		  const InboxPosition *start,
+		  const InboxPosition *limit)
+{
+	InboxCursor *cursor;
+
+	cursor = g_new0 (InboxCursor, 1);
+	cursor->source = source;
+	if (start)
+		cursor->last = inbox_position_new (start->uid, start->date);
+	if (limit)
+		cursor->limit = inbox_position_new (limit->uid, limit->date);
+	cursor->uids = g_ptr_array_new_with_free_func (g_free);
+	cursor->skipped = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	return cursor;
+}
+
+static void
+inbox_cursor_free (InboxCursor *cursor)
+{
+	if (cursor->last)
+		inbox_position_free (cursor->last);
+	if (cursor->limit)
+		inbox_position_free (cursor->limit);
+	g_ptr_array_unref (cursor->uids);
+	g_hash_table_destroy (cursor->skipped);
+	g_free (cursor);
+}
+
+/* Replaces the chunk of @cursor with the uids following its last
+ * message. The inbox is taken as empty if it was dropped from the sort
+ * index meanwhile */
+static void
+inbox_cursor_fetch (InboxCursor *cursor)
+{
+	ImSortIndex *sort_index = im_sort_index_get_instance ();
+	guint count = INBOX_CURSOR_CHUNK + g_hash_table_size (cursor->skipped);
+	GPtrArray *uids;
+
+	if (cursor->last)
+		uids = im_sort_index_get_uids_by_date (sort_index, cursor->source->account_id, "INBOX",
+						       cursor->last->uid, cursor->last->date,
+						       FALSE, count);
+	else
+		uids = im_sort_index_get_uids (sort_index, cursor->source->account_id, "INBOX",
+					       IM_SORT_KEY_DATE_RECEIVED, NULL, count);
+
+	g_ptr_array_unref (cursor->uids);
+	cursor->uids = uids ? uids : g_ptr_array_new_with_free_func (g_free);
+	cursor->next = 0;
+	cursor->exhausted = cursor->uids->len < count;
+}
+
+static void
+unified_inbox_message_free (ImUnifiedInboxMessage *message)
+{
+	g_free (message->account_id);
+	camel_folder_free_message_info (message->folder, message->info);
+	g_object_unref (message->folder);
+	g_free (message);
+}
+
+/**
+ * im_unified_inbox_page_free:
+ * @page: a #ImUnifiedInboxPage
+ *
+ * Frees @page and the messages in it.
+ */
+void
+im_unified_inbox_page_free (ImUnifiedInboxPage *page)
+{
+	if (page == NULL)
+		return;
+
+	g_ptr_array_unref (page->new_messages);
+	g_ptr_array_unref (page->messages);
+	g_free (page->newest_cursor);
+	g_free (page->oldest_cursor);
+	g_free (page);
+}
+
+/* Cursors are lines of escaped "account_id\tuid\tdate" fields, the
+ * position of each inbox in the date order */
+static GHashTable *
+parse_unified_inbox_cursor (const gchar *cursor)
+{
+	GHashTable *result;
+	gchar **lines, **node;
+
+	result = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify) inbox_position_free);
+	if (cursor == NULL)
+		return result;
+
+	lines = g_strsplit (cursor, "\n", 0);
+	for (node = lines; *node != NULL; node++) {
+		gchar **fields = g_strsplit (*node, "\t", 3);
+
+		if (g_strv_length (fields) == 3) {
+			gchar *uid = g_strcompress (fields[1]);
+
+			g_hash_table_insert (result,
+					     g_strcompress (fields[0]),
+					     inbox_position_new (uid, g_ascii_strtoll (fields[2], NULL, 10)));
+			g_free (uid);
+		}
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+
+	return result;
+}
+
+static gchar *
+dump_unified_inbox_cursor (GHashTable *cursor)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *result;
+
+	result = g_string_new (NULL);
+	g_hash_table_iter_init (&iter, cursor);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		InboxPosition *position = (InboxPosition *) value;
+		gchar *account_id = g_strescape ((gchar *) key, NULL);
+		gchar *uid = g_strescape (position->uid, NULL);
+
+		if (result->len > 0)
+			g_string_append_c (result, '\n');
+		g_string_append_printf (result, "%s\t%s\t%" G_GINT64_FORMAT,
+					account_id, uid, position->date);
+		g_free (account_id);
+		g_free (uid);
+	}
+
+	return g_string_free (result, FALSE);
+}
+
+/* Loads the info of the next message of @cursor, fetching the next
+ * chunk of uids when needed and skipping the messages removed
+ * meanwhile. Returns %FALSE if there are no more messages */
+static gboolean
+inbox_cursor_load_head (InboxCursor *cursor)
+{
+	const gchar *uid = NULL;
+
+	cursor->head = NULL;
+	while (cursor->head == NULL) {
+		if (cursor->next >= cursor->uids->len) {
+			if (cursor->exhausted)
+				return FALSE;
+			inbox_cursor_fetch (cursor);
+			continue;
+		}
+
+		uid = cursor->uids->pdata[cursor->next];
+		if (!g_hash_table_contains (cursor->skipped, uid)) {
+			cursor->head = camel_folder_get_message_info (cursor->source->folder, uid);
+			if (cursor->head == NULL)
+				g_hash_table_add (cursor->skipped, g_strdup (uid));
+		}
+		if (cursor->head == NULL)
+			cursor->next++;
+	}
+
+	/* Same date the sort index orders the inbox by */
+	cursor->head_date = camel_message_info_date_received (cursor->head);
+
+	if (cursor->limit && !inbox_position_is_newer (uid, cursor->head_date, cursor->limit)) {
+		camel_folder_free_message_info (cursor->source->folder, cursor->head);
+		cursor->head = NULL;
+		cursor->exhausted = TRUE;
+		cursor->next = cursor->uids->len;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Moves @cursor past its head, the next chunk goes on from it */
+static void
+inbox_cursor_take_head (InboxCursor *cursor)
+{
+	if (cursor->last)
+		inbox_position_free (cursor->last);
+	cursor->last = inbox_position_new (cursor->uids->pdata[cursor->next],
+					   cursor->head_date);
+	g_hash_table_remove_all (cursor->skipped);
+	cursor->head = NULL;
+	cursor->next++;
+}
+
+/* TRUE if the head of @a goes before the head of @b */
+static gboolean
+inbox_cursor_is_newer (InboxCursor *a,
+		       InboxCursor *b)
+{
+	if (a->head_date != b->head_date)
+		return a->head_date > b->head_date;
+
+	return g_strcmp0 (a->source->account_id, b->source->account_id) < 0;
+}
+
+static void
+inbox_heap_sift_down (InboxCursor **heap,
+		      guint len,
+		      guint i)
+{
+	while (TRUE) {
+		guint newest = i, left = 2 * i + 1, right = 2 * i + 2;
+		InboxCursor *tmp;
+
+		if (left < len && inbox_cursor_is_newer (heap[left], heap[newest]))
+			newest = left;
+		if (right < len && inbox_cursor_is_newer (heap[right], heap[newest]))
+			newest = right;
+		if (newest == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[newest];
+		heap[newest] = tmp;
+		i = newest;
+	}
+}
+
+/* K-way merge of @cursors by date, newest first. The cursors take their
+ * uids from the sort index on demand, and only their heads are loaded,
+ * so a page of n messages of k inboxes reads at most n + k chunks of
+ * uids and n + k message infos, whatever the size of the inboxes. It
+ * takes up to
+ * @count messages (all of them if @count is -1), and records the
+ * position of the last message taken from each account in @positions */
+static void
+merge_inbox_cursors (GPtrArray *cursors,
+		     gint count,
+		     GPtrArray *result,
+		     GHashTable *positions)
+{
+	InboxCursor **heap;
+	guint len = 0, i;
+
+	heap = g_new0 (InboxCursor *, cursors->len + 1);
+	for (i = 0; i < cursors->len; i++) {
+		InboxCursor *cursor = (InboxCursor *) cursors->pdata[i];
+
+		if (inbox_cursor_load_head (cursor))
+			heap[len++] = cursor;
+	}
+	for (i = len; i > 0; i--)
+		inbox_heap_sift_down (heap, len, i - 1);
+
+	while (len > 0 && count != 0) {
+		InboxCursor *cursor = heap[0];
+		ImUnifiedInboxMessage *message;
+
+		message = g_new0 (ImUnifiedInboxMessage, 1);
+		message->account_id = g_strdup (cursor->source->account_id);
+		message->folder = g_object_ref (cursor->source->folder);
+		message->info = cursor->head;
+		g_ptr_array_add (result, message);
+		inbox_cursor_take_head (cursor);
+		if (positions)
+			g_hash_table_insert (positions,
+					     g_strdup (cursor->source->account_id),
+					     inbox_position_new (cursor->last->uid, cursor->last->date));
+		if (count > 0)
+			count--;
+
+		if (!inbox_cursor_load_head (cursor))
+			heap[0] = heap[--len];
+		inbox_heap_sift_down (heap, len, 0);
+	}
+
+	/* Heads loaded but not taken */
+	for (i = 0; i < len; i++)
+		camel_folder_free_message_info (heap[i]->source->folder, heap[i]->head);
+	g_free (heap);
+}
+
+typedef struct _FetchUnifiedInboxAsyncContext {
+	gchar *newest_cursor;
+	gchar *oldest_cursor;
+	guint count;
+	ImUnifiedInboxPage *page;
+} FetchUnifiedInboxAsyncContext;
+
+static void
+fetch_unified_inbox_async_context_free (FetchUnifiedInboxAsyncContext *context)
+{
+	g_free (context->newest_cursor);
+	g_free (context->oldest_cursor);
+	im_unified_inbox_page_free (context->page);
+	g_free (context);
+}
+
+/* Gets the newest message of @source in the sort index as a position,
+ * or %NULL if the inbox is empty */
+static InboxPosition *
+get_newest_inbox_position (InboxSource *source)
+{
+	InboxPosition *position = NULL;
+	GPtrArray *uids;
+
+	uids = im_sort_index_get_uids (im_sort_index_get_instance (),
+				       source->account_id, "INBOX",
+				       IM_SORT_KEY_DATE_RECEIVED, NULL, 1);
+	if (uids && uids->len > 0) {
+		CamelMessageInfo *mi;
+
+		mi = camel_folder_get_message_info (source->folder, uids->pdata[0]);
+		if (mi) {
+			position = inbox_position_new (uids->pdata[0],
+						       camel_message_info_date_received (mi));
+			camel_folder_free_message_info (source->folder, mi);
+		}
+	}
+	if (uids)
+		g_ptr_array_unref (uids);
+
+	return position;
+}
+
+/**
+ * im_mail_op_fetch_unified_inbox_sync:
+ * @mgr: a #ImServiceMgr
+ * @newest_cursor: (allow-none): the newest cursor of a previous page, or %NULL
+ * @oldest_cursor: (allow-none): the oldest cursor of a previous page, or %NULL
+ * @count: maximum number of messages older than @oldest_cursor to get
+ * @page: (out) (transfer full): the page obtained
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Obtains a page of the unified inbox, the inboxes of all the enabled
+ * accounts merged by date received. The page has all the messages newer
+ * than @newest_cursor, and @count messages older than @oldest_cursor.
+ * Without cursors, it obtains the @count newest messages. Cursors keep
+ * the date of each inbox position, so they work even if the message
+ * they point to is removed.
+ *
+ * An inbox that was empty when @newest_cursor was obtained has all its
+ * messages new. One that is not in @newest_cursor at all, as its
+ * account was enabled later, is taken from the newest message it has
+ * now: those are paged as old messages.
+ *
+ * Each inbox is kept sorted by date in the #ImSortIndex, so pages don't
+ * read nor sort all the uids of the inboxes. The inboxes are merged
+ * lazily, each one giving its uids in small chunks as the page takes
+ * them, so only the messages in the page, and the next one of each
+ * inbox, are loaded. Inboxes are not refreshed here, that's left to the
+ * #ImSyncScheduler. Inboxes that can't be opened are skipped.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_unified_inbox_sync (ImServiceMgr *mgr,
+				     const gchar *newest_cursor,
+				     const gchar *oldest_cursor,
+				     guint count,
+				     ImUnifiedInboxPage **page,
+				     GCancellable *cancellable,
+				     GError **error)
+{
+	GError *_error = NULL;
+	GHashTable *newest_positions, *oldest_positions;
+	GSList *account_ids, *node;
+	GPtrArray *sources, *new_cursors, *old_cursors;
+	ImUnifiedInboxPage *_page = NULL;
+	ImSortIndex *sort_index;
+
+	sort_index = im_sort_index_get_instance ();
+	newest_positions = parse_unified_inbox_cursor (newest_cursor);
+	oldest_positions = parse_unified_inbox_cursor (oldest_cursor);
+	sources = g_ptr_array_new_with_free_func ((GDestroyNotify) inbox_source_free);
+	new_cursors = g_ptr_array_new_with_free_func ((GDestroyNotify) inbox_cursor_free);
+	old_cursors = g_ptr_array_new_with_free_func ((GDestroyNotify) inbox_cursor_free);
+
+	account_ids = im_account_mgr_get_account_ids (im_account_mgr_get_instance (), TRUE);
+	for (node = account_ids; node != NULL; node = g_slist_next (node)) {
+		const gchar *account_id = (const gchar *) node->data;
+		GError *folder_error = NULL;
+		InboxSource *source;
+		InboxPosition *position, *newest;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, &_error))
+			break;
+
+		source = g_new0 (InboxSource, 1);
+		source->folder = im_service_mgr_get_folder (mgr, account_id, "INBOX",
+							    cancellable, &folder_error);
+		/* Sorted once, and kept up to date with the folder changes */
+		if (source->folder)
+			im_sort_index_load_sync (sort_index, account_id, "INBOX", source->folder,
+						 IM_SORT_KEY_DATE_RECEIVED, cancellable, &folder_error);
+		if (folder_error) {
+			g_debug ("%s: skipping inbox of %s: %s", __FUNCTION__,
+				 account_id, folder_error->message);
+			g_clear_error (&folder_error);
+			if (source->folder)
+				g_object_unref (source->folder);
+			g_free (source);
+			continue;
+		}
+
+		source->account_id = g_strdup (account_id);
+		g_ptr_array_add (sources, source);
+
+		/* An empty inbox is positioned before any message, so all
+		 * the ones arriving later are new, and none is old */
+		newest = get_newest_inbox_position (source);
+		if (newest == NULL) {
+			newest = inbox_position_new ("", 0);
+			if (!g_hash_table_contains (oldest_positions, account_id))
+				g_hash_table_insert (oldest_positions, g_strdup (account_id),
+						     inbox_position_new ("", 0));
+		}
+
+		/* Inboxes missing in @newest_cursor start at their head */
+		position = g_hash_table_lookup (newest_positions, account_id);
+		if (position)
+			g_ptr_array_add (new_cursors, inbox_cursor_new (source, NULL, position));
+
+		position = g_hash_table_lookup (oldest_positions, account_id);
+		g_ptr_array_add (old_cursors, inbox_cursor_new (source, position, NULL));
+
+		g_hash_table_insert (newest_positions, g_strdup (account_id), newest);
+	}
+	im_account_mgr_free_account_ids (account_ids);
+
+	if (_error == NULL) {
+		gint64 start = g_get_monotonic_time ();
+
+		_page = g_new0 (ImUnifiedInboxPage, 1);
+		_page->new_messages = g_ptr_array_new_with_free_func ((GDestroyNotify) unified_inbox_message_free);
+		_page->messages = g_ptr_array_new_with_free_func ((GDestroyNotify) unified_inbox_message_free);
+
+		merge_inbox_cursors (new_cursors, -1, _page->new_messages, NULL);
+		merge_inbox_cursors (old_cursors, count, _page->messages, oldest_positions);
+
+		_page->newest_cursor = dump_unified_inbox_cursor (newest_positions);
+		_page->oldest_cursor = dump_unified_inbox_cursor (oldest_positions);
+
+		g_debug ("%s: merged %u inboxes, %u new and %u old messages, %" G_GINT64_FORMAT " usec",
+			 __FUNCTION__, sources->len, _page->new_messages->len, _page->messages->len,
+			 g_get_monotonic_time () - start);
+	}
+
+	g_ptr_array_unref (new_cursors);
+	g_ptr_array_unref (old_cursors);
+	g_ptr_array_unref (sources);
+	g_hash_table_destroy (newest_positions);
+	g_hash_table_destroy (oldest_positions);
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (page)
+		*page = _page;
+	else
+		im_unified_inbox_page_free (_page);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_fetch_unified_inbox_thread (GSimpleAsyncResult *simple,
+				       GObject *object,
+				       GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FetchUnifiedInboxAsyncContext *context;
+
+	context = (FetchUnifiedInboxAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_fetch_unified_inbox_sync (IM_SERVICE_MGR (object),
+					     context->newest_cursor,
+					     context->oldest_cursor,
+					     context->count,
+					     &(context->page),
+					     cancellable,
+					     &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_fetch_unified_inbox_async:
+ * @mgr: a #ImServiceMgr
+ * @newest_cursor: (allow-none): the newest cursor of a previous page, or %NULL
+ * @oldest_cursor: (allow-none): the oldest cursor of a previous page, or %NULL
+ * @count: maximum number of messages older than @oldest_cursor to get
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously obtains a page of the unified inbox.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_fetch_unified_inbox_finish() to get the result of the operation.
+ */
+void
+im_mail_op_fetch_unified_inbox_async (ImServiceMgr *mgr,
+				      const gchar *newest_cursor,
+				      const gchar *oldest_cursor,
+				      guint count,
+				      int io_priority,
+				      GCancellable *cancellable,
+				      GAsyncReadyCallback callback,
+				      gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FetchUnifiedInboxAsyncContext *context;
+
+	context = g_new0 (FetchUnifiedInboxAsyncContext, 1);
+	context->newest_cursor = g_strdup (newest_cursor);
+	context->oldest_cursor = g_strdup (oldest_cursor);
+	context->count = count;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_fetch_unified_inbox_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) fetch_unified_inbox_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_fetch_unified_inbox_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_fetch_unified_inbox_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @page: (out) (allow-none) (transfer full): the page obtained
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_fetch_unified_inbox_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_unified_inbox_finish (ImServiceMgr *mgr,
+				       GAsyncResult *result,
+				       ImUnifiedInboxPage **page,
+				       GError **error)
+{
+	GSimpleAsyncResult *simple;
+	FetchUnifiedInboxAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_fetch_unified_inbox_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (FetchUnifiedInboxAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (page) {
+		*page = context->page;
+		context->page = NULL;
+	}
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _FetchThreadsAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	gchar *oldest_cursor;
+	guint count;
+	CamelFolder *folder;
+	GPtrArray *threads;
+} FetchThreadsAsyncContext;
+
+static void
+fetch_threads_async_context_free (FetchThreadsAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context->oldest_cursor);
+	if (context->folder) g_object_unref (context->folder);
+	if (context->threads) g_ptr_array_unref (context->threads);
+	g_free (context);
+}
+
+/**
+ * im_mail_op_fetch_threads_sync:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @oldest_cursor: (allow-none): cursor of the last thread of the previous
+ * page, or %NULL for the first page
+ * @count: maximum number of threads
+ * @folder: (out) (allow-none): the #CamelFolder of the threads
+ * @threads: (out) (allow-none) (element-type ImMessageThread): the threads
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Obtains a page of the conversation threads of folder @folder_name in
+ * account @account_id, the ones with the newest messages first. The
+ * threads of the folder are loaded from the #ImThreadIndex, threading
+ * only the messages that changed since they were stored.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_threads_sync (ImServiceMgr *mgr,
+			       const gchar *account_id,
+			       const gchar *folder_name,
+			       const gchar *oldest_cursor,
+			       guint count,
+			       CamelFolder **folder,
+			       GPtrArray **threads,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *_folder;
+	GPtrArray *result = NULL;
+
+	_folder = im_service_mgr_get_folder (mgr, account_id,
+					     folder_name, cancellable, &_error);
+
+	if (_error == NULL &&
+	    im_thread_index_load_sync (im_thread_index_get_instance (),
+				       account_id, folder_name, _folder,
+				       cancellable, &_error)) {
+		result = im_thread_index_get_threads (im_thread_index_get_instance (),
+						      account_id, folder_name,
+						      oldest_cursor, count);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (threads)
+		*threads = result;
+	else if (result)
+		g_ptr_array_unref (result);
+	if (folder)
+		*folder = _folder;
+	else if (_folder)
+		g_object_unref (_folder);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_fetch_threads_thread (GSimpleAsyncResult *simple,
+				 GObject *object,
+				 GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FetchThreadsAsyncContext *context;
+
+	context = (FetchThreadsAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_fetch_threads_sync (IM_SERVICE_MGR (object),
+				       context->account_id,
+				       context->folder_name,
+				       context->oldest_cursor,
+				       context->count,
+				       &(context->folder),
+				       &(context->threads),
+				       cancellable,
+				       &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_fetch_threads_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @oldest_cursor: (allow-none): cursor of the last thread of the previous
+ * page, or %NULL for the first page
+ * @count: maximum number of threads
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously obtains a page of the conversation threads of folder
+ * @folder_name in account @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_fetch_threads_finish() to get the result of the operation.
+ */
+void
+im_mail_op_fetch_threads_async (ImServiceMgr *mgr,
+				const gchar *account_id,
+				const gchar *folder_name,
+				const gchar *oldest_cursor,
+				guint count,
+				int io_priority,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FetchThreadsAsyncContext *context;
+
+	context = g_new0 (FetchThreadsAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->oldest_cursor = g_strdup (oldest_cursor);
+	context->count = count;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_fetch_threads_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) fetch_threads_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_fetch_threads_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_fetch_threads_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @folder: (out) (allow-none) (transfer full): the #CamelFolder of the threads
+ * @threads: (out) (allow-none) (transfer full) (element-type ImMessageThread):
+ * the threads
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_fetch_threads_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_threads_finish (ImServiceMgr *mgr,
+				 GAsyncResult *result,
+				 CamelFolder **folder,
+				 GPtrArray **threads,
+				 GError **error)
+{
+	GSimpleAsyncResult *simple;
+	FetchThreadsAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_fetch_threads_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (FetchThreadsAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (folder && context->folder)
+		*folder = g_object_ref (context->folder);
+	if (threads && context->threads)
+		*threads = g_ptr_array_ref (context->threads);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _FetchSortedMessagesAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	ImSortKey sort_key;
+	gchar *newest_uid;
+	gchar *oldest_uid;
+	guint count;
+	CamelFolder *folder;
+	GPtrArray *new_uids;
+	GPtrArray *uids;
+} FetchSortedMessagesAsyncContext;
+
+static void
+fetch_sorted_messages_async_context_free (FetchSortedMessagesAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context->newest_uid);
+	g_free (context->oldest_uid);
+	if (context->folder) g_object_unref (context->folder);
+	if (context->new_uids) g_ptr_array_unref (context->new_uids);
+	if (context->uids) g_ptr_array_unref (context->uids);
+	g_free (context);
+}
+
+static GPtrArray *
+get_uids_newer_than (CamelFolder *folder,
+		     const gchar *newest_uid)
+{
+	GPtrArray *uids, *newer, *result;
+	guint i;
+
+	newer = g_ptr_array_new ();
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len; i++) {
+		if (camel_folder_cmp_uids (folder, uids->pdata[i], newest_uid) > 0)
+			g_ptr_array_add (newer, uids->pdata[i]);
+	}
+	camel_folder_sort_uids (folder, newer);
+
+	result = g_ptr_array_new_full (newer->len, g_free);
+	for (i = newer->len; i > 0; i--)
+		g_ptr_array_add (result, g_strdup (newer->pdata[i - 1]));
+	g_ptr_array_free (newer, TRUE);
+	camel_folder_free_uids (folder, uids);
+
+	return result;
+}
+
+/**
+ * im_mail_op_fetch_sorted_messages_sync:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @sort_key: a #ImSortKey other than %IM_SORT_KEY_UID
+ * @newest_uid: (allow-none): the newest uid already fetched, or %NULL
+ * @oldest_uid: (allow-none): the last uid of the previous page, or %NULL
+ * for the first page
+ * @count: maximum number of uids in the page
+ * @folder: (out) (allow-none): the #CamelFolder of the messages
+ * @new_uids: (out) (allow-none) (element-type utf8): the uids that arrived
+ * after @newest_uid, newest first, or %NULL if @newest_uid is %NULL
+ * @uids: (out) (allow-none) (element-type utf8): the page of uids
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Refreshes folder @folder_name in account @account_id, and obtains a
+ * page of its messages in @sort_key order. The order is kept by the
+ * #ImSortIndex, so only the first request of a sort key in a folder
+ * sorts its messages.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_sorted_messages_sync (ImServiceMgr *mgr,
+				       const gchar *account_id,
+				       const gchar *folder_name,
+				       ImSortKey sort_key,
+				       const gchar *newest_uid,
+				       const gchar *oldest_uid,
+				       guint count,
+				       CamelFolder **folder,
+				       GPtrArray **new_uids,
+				       GPtrArray **uids,
+				       GCancellable *cancellable,
+				       GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *_folder = NULL;
+	GPtrArray *new_result = NULL;
+	GPtrArray *result = NULL;
+
+	if (im_mail_op_refresh_folder_info_sync (mgr, account_id, folder_name,
+						 &_folder, cancellable, &_error) &&
+	    im_sort_index_load_sync (im_sort_index_get_instance (),
+				     account_id, folder_name, _folder, sort_key,
+				     cancellable, &_error)) {
+		if (newest_uid)
+			new_result = get_uids_newer_than (_folder, newest_uid);
+		result = im_sort_index_get_uids (im_sort_index_get_instance (),
+						 account_id, folder_name, sort_key,
+						 oldest_uid, count);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (new_uids)
+		*new_uids = new_result;
+	else if (new_result)
+		g_ptr_array_unref (new_result);
+	if (uids)
+		*uids = result;
+	else if (result)
+		g_ptr_array_unref (result);
+	if (folder)
+		*folder = _folder;
+	else if (_folder)
+		g_object_unref (_folder);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_fetch_sorted_messages_thread (GSimpleAsyncResult *simple,
+					 GObject *object,
+					 GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FetchSortedMessagesAsyncContext *context;
+
+	context = (FetchSortedMessagesAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_fetch_sorted_messages_sync (IM_SERVICE_MGR (object),
+					       context->account_id,
+					       context->folder_name,
+					       context->sort_key,
+					       context->newest_uid,
+					       context->oldest_uid,
+					       context->count,
+					       &(context->folder),
+					       &(context->new_uids),
+					       &(context->uids),
+					       cancellable,
+					       &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_fetch_sorted_messages_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @sort_key: a #ImSortKey other than %IM_SORT_KEY_UID
+ * @newest_uid: (allow-none): the newest uid already fetched, or %NULL
+ * @oldest_uid: (allow-none): the last uid of the previous page, or %NULL
+ * for the first page
+ * @count: maximum number of uids in the page
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously obtains a page of the messages of folder @folder_name
+ * in account @account_id, in @sort_key order.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_fetch_sorted_messages_finish() to get the result of the operation.
+ */
+void
+im_mail_op_fetch_sorted_messages_async (ImServiceMgr *mgr,
+					const gchar *account_id,
+					const gchar *folder_name,
+					ImSortKey sort_key,
+					const gchar *newest_uid,
+					const gchar *oldest_uid,
+					guint count,
+					int io_priority,
+					GCancellable *cancellable,
+					GAsyncReadyCallback callback,
+					gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FetchSortedMessagesAsyncContext *context;
+
+	context = g_new0 (FetchSortedMessagesAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->sort_key = sort_key;
+	context->newest_uid = g_strdup (newest_uid);
+	context->oldest_uid = g_strdup (oldest_uid);
+	context->count = count;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_fetch_sorted_messages_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) fetch_sorted_messages_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_fetch_sorted_messages_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_fetch_sorted_messages_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @folder: (out) (allow-none) (transfer full): the #CamelFolder of the messages
+ * @new_uids: (out) (allow-none) (transfer full) (element-type utf8): the
+ * uids that arrived after the newest uid
+ * @uids: (out) (allow-none) (transfer full) (element-type utf8): the page
+ * of uids
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_fetch_sorted_messages_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_fetch_sorted_messages_finish (ImServiceMgr *mgr,
+					 GAsyncResult *result,
+					 CamelFolder **folder,
+					 GPtrArray **new_uids,
+					 GPtrArray **uids,
+					 GError **error)
+{
+	GSimpleAsyncResult *simple;
+	FetchSortedMessagesAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_fetch_sorted_messages_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (FetchSortedMessagesAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (folder && context->folder)
+		*folder = g_object_ref (context->folder);
+	if (new_uids && context->new_uids)
+		*new_uids = g_ptr_array_ref (context->new_uids);
+	if (uids && context->uids)
+		*uids = g_ptr_array_ref (context->uids);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _GetMessageAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	gchar *message_uid;
+	CamelMimeMessage *message;
+} GetMessageAsyncContext;
+
+static void
+get_message_async_context_free (GetMessageAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context->message_uid);
+	if (context->message) g_object_unref (context->message);
+	g_free (context);
+}
+
+/**
+ * im_mail_op_get_message_sync:
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Obtains the message with @message_uid from folder @folder_name
+ * in account @account_id.
+ *
+ * Returns: (transfer full): a #CamelMimeMessage if successful, %NULL otherwise.
+ */
+CamelMimeMessage *
+im_mail_op_get_message_sync (ImServiceMgr *service_mgr,
+			     const gchar *account_id,
+			     const gchar *folder_name,
+			     const gchar *message_uid,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+	CamelMimeMessage *message = NULL;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+
+	if (_error == NULL) {
+		message = camel_folder_get_message_sync (folder, message_uid,
+							 cancellable, &_error);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+	if (folder) g_object_unref (folder);
+
+	return message;
+}
+
+static void
+im_mail_op_get_message_thread (GSimpleAsyncResult *simple,
+			       GObject *object,
+			       GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	GetMessageAsyncContext *context;
+
+	context = (GetMessageAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	context->message = im_mail_op_get_message_sync (IM_SERVICE_MGR (object),
+							context->account_id,
+							context->folder_name,
+							context->message_uid,
+							cancellable,
+							&_error);
+	
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_get_message_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously obtains the message with @message_uid from folder @folder_name
+ * in account @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_get_message_finish() to get the result of the operation.
+ */
+void
+im_mail_op_get_message_async (ImServiceMgr *mgr,
+			       const gchar *account_id,
+			       const gchar *folder_name,
+			       const gchar *message_uid,
+			       int io_priority,
+			       GCancellable *cancellable,
+			       GAsyncReadyCallback callback,
+			       gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	GetMessageAsyncContext *context;
+
+	context = g_new0 (GetMessageAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->message_uid = g_strdup (message_uid);
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_get_message_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context, 
+						   (GDestroyNotify) get_message_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_get_message_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_get_message_finish:
+ * @folder: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_composer_get_message_async().
+ *
+ * Returns: (transfer full): a #CamelMimeMessage on success, %NULL otherwise.
+ */
+CamelMimeMessage *
+im_mail_op_get_message_finish (ImServiceMgr *mgr,
+			       GAsyncResult *result,
+			       GError **error)
+{
+	GSimpleAsyncResult *simple;
+	GetMessageAsyncContext *context;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_get_message_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = g_simple_async_result_get_op_res_gpointer (simple);
+
+	g_simple_async_result_propagate_error (simple, error);
+	return context->message?g_object_ref (context->message):NULL;
+}
+
+
+typedef struct _MessageFlagAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	gchar *message_uid;
+	gchar *set_flags;
+	gchar *unset_flags;
+} FlagMessageAsyncContext;
+
+static void
+flag_message_async_context_free (FlagMessageAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context->message_uid);
+	g_free (context->set_flags);
+	g_free (context->unset_flags);
+	g_free (context);
+}
+
+static CamelMessageFlags
+parse_flags (const char *flags_list, GList **user_flags)
+{
+	gchar **flags, **node;
+	CamelMessageFlags result = 0;
+
+	*user_flags = NULL;
+	if (flags_list == NULL)
+		return 0;
+
+	flags = g_strsplit (flags_list, ",", 0);
+	for (node = flags; *node != NULL; node++) {
+		if (g_strstr_len (*node, -1, "seen"))
+			result |= CAMEL_MESSAGE_SEEN;
+		else if (g_strstr_len (*node, -1, "deleted"))
+			result |= CAMEL_MESSAGE_DELETED;
+		else
+			*user_flags = g_list_append (*user_flags, g_strdup (*node));
+	}
+
+	g_strfreev (flags);
+
+	return result;
+}
+
+static gboolean flag_messages_sync (ImServiceMgr *service_mgr,
+				    const gchar *account_id,
+				    const gchar *folder_name,
+				    GPtrArray *message_uids,
+				    const gchar *set_flags,
+				    const gchar *unset_flags,
+				    gboolean journal,
+				    GCancellable *cancellable,
+				    GError **error);
+
+/* TRUE if changes in @folder can't reach the server now, and should
+ * be journaled to replay them later */
+static gboolean
+is_folder_offline (CamelFolder *folder)
+{
+	CamelStore *store;
+	CamelSession *session;
+
+	store = camel_folder_get_parent_store (folder);
+	if (!CAMEL_IS_OFFLINE_STORE (store))
+		return FALSE;
+
+	session = camel_service_get_session (CAMEL_SERVICE (store));
+	return !camel_session_get_online (session) ||
+		!camel_offline_store_get_online (CAMEL_OFFLINE_STORE (store));
+}
+
+/* TRUE if @error means the server could not be reached. Other errors,
+ * like a missing folder or a rejected command, would fail again when
+ * replaying, so they're not journaled */
+static gboolean
+is_connection_error (GError *error)
+{
+	if (error == NULL)
+		return FALSE;
+
+	return g_error_matches (error, CAMEL_SERVICE_ERROR, CAMEL_SERVICE_ERROR_UNAVAILABLE) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_HOST_NOT_FOUND) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_HOST_UNREACHABLE) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE) ||
+		g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED);
+}
+
+/* TRUE if @account_id has operations waiting in the journal. New ones
+ * are journaled too then, so the server gets them in order */
+static gboolean
+has_pending_journal (const gchar *account_id)
+{
+	return im_op_journal_get_pending (im_op_journal_get_instance (), account_id) > 0;
+}
+
+static void
+apply_message_flags (CamelFolder *folder,
+		     const gchar *message_uid,
+		     CamelMessageFlags camel_set_flags,
+		     CamelMessageFlags camel_unset_flags,
+		     GList *set_user_flags,
+		     GList *unset_user_flags)
+{
+	GList *node;
+
+	if (camel_unset_flags)
+		camel_folder_set_message_flags (folder, message_uid, camel_unset_flags, 0);
+	if (camel_set_flags)
+		camel_folder_set_message_flags (folder, message_uid, camel_set_flags, camel_set_flags);
+
+	for (node = unset_user_flags; node != NULL; node = g_list_next (node)) {
+		camel_folder_set_message_user_flag (folder, message_uid,
+						    (char *) node->data, FALSE);
+	}
+
+	for (node = set_user_flags; node != NULL; node = g_list_next (node)) {
+		camel_folder_set_message_user_flag (folder, message_uid,
+						    (char *) node->data, TRUE);
+	}
+}
+
+/**
+ * im_mail_op_flag_message_sync:
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @set_flags: a string with the list of flags to set
+ * @unset_flags: a string with the list of flags to unset
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Modifies the flags and user flags of the message with @message_uid 
+ * from folder @folder_name in account @account_id.
+ *
+ * Returns: %TRUE if successful, %NULL otherwise.
+ */
+gboolean
+im_mail_op_flag_message_sync (ImServiceMgr *service_mgr,
+			      const gchar *account_id,
+			      const gchar *folder_name,
+			      const gchar *message_uid,
+			      const gchar *set_flags,
+			      const gchar *unset_flags,
+			      GCancellable *cancellable,
+			      GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+
+	if (_error == NULL && (is_folder_offline (folder) || has_pending_journal (account_id))) {
+		GPtrArray *message_uids;
+
+		g_object_unref (folder);
+		message_uids = g_ptr_array_new ();
+		g_ptr_array_add (message_uids, (gpointer) message_uid);
+		flag_messages_sync (service_mgr, account_id, folder_name, message_uids,
+				    set_flags, unset_flags, TRUE, cancellable, &_error);
+		g_ptr_array_free (message_uids, TRUE);
+	} else if (_error == NULL) {
+		CamelMessageFlags camel_set_flags, camel_unset_flags;
+		GList *unset_user_flags, *set_user_flags;
+
+		camel_set_flags = parse_flags (set_flags, &set_user_flags);
+		camel_unset_flags = parse_flags (unset_flags, &unset_user_flags);
+
+		apply_message_flags (folder, message_uid,
+				     camel_set_flags, camel_unset_flags,
+				     set_user_flags, unset_user_flags);
+		g_list_free_full (unset_user_flags, g_free);
+		g_list_free_full (set_user_flags, g_free);
+
+		/* We don't wait for result */
+		camel_folder_synchronize_message (folder, message_uid,
+						  G_PRIORITY_DEFAULT_IDLE, NULL,
+						  NULL, NULL);
+		g_object_unref (folder);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_flag_message_thread (GSimpleAsyncResult *simple,
+				GObject *object,
+				GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FlagMessageAsyncContext *context;
+
+	context = (FlagMessageAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_flag_message_sync (IM_SERVICE_MGR (object),
+				      context->account_id,
+				      context->folder_name,
+				      context->message_uid,
+				      context->set_flags,
+				      context->unset_flags,
+				      cancellable,
+				      &_error);
+	
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_flag_message_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @set_flags: a string with the list of flags to set
+ * @unset_flags: a string with the list of flags to unset
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously modifies the flags and user flags of the message with @message_uid 
+ * from folder @folder_name in account @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_flag_message_finish() to get the result of the operation.
+ */
+void
+im_mail_op_flag_message_async (ImServiceMgr *mgr,
+			       const gchar *account_id,
+			       const gchar *folder_name,
+			       const gchar *message_uid,
+			       const gchar *set_flags,
+			       const gchar *unset_flags,
+			       int io_priority,
+			       GCancellable *cancellable,
+			       GAsyncReadyCallback callback,
+			       gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FlagMessageAsyncContext *context;
+
+	context = g_new0 (FlagMessageAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->message_uid = g_strdup (message_uid);
+	context->set_flags = g_strdup (set_flags);
+	context->unset_flags = g_strdup (unset_flags);
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_flag_message_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context, 
+						   (GDestroyNotify) flag_message_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_flag_message_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_flag_message_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_flag_message_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_flag_message_finish (ImServiceMgr *mgr,
+				GAsyncResult *result,
+				GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_flag_message_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+/* Removes the message @uid of the maildir @folder on its own: its
+ * file, and then its summary entry */
+static gboolean
+expunge_maildir_message_sync (CamelFolder *folder,
+			      const gchar *uid,
+			      GError **error)
+{
+	GError *_error = NULL;
+	gchar *filename;
+
+	filename = camel_folder_get_filename (folder, uid, &_error);
+	if (filename && g_unlink (filename) != 0 && errno != ENOENT) {
+		gint saved_errno = errno;
+
+		g_set_error (&_error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+			     _("Could not remove message %s: %s"), uid, g_strerror (saved_errno));
+	}
+	g_free (filename);
+
+	if (_error == NULL) {
+		CamelFolderChangeInfo *changes;
+
+		camel_folder_summary_remove_uid (folder->summary, uid);
+		camel_folder_summary_save_to_db (folder->summary, &_error);
+
+		changes = camel_folder_change_info_new ();
+		camel_folder_change_info_remove_uid (changes, uid);
+		camel_folder_changed (folder, changes);
+		camel_folder_change_info_free (changes);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/* Removes the message @uid from @folder, without touching the other
+ * messages marked as deleted. Local folders are maildirs, so the
+ * message is removed directly. Camel only expunges all the deleted
+ * messages of a remote folder at once, so there the message is marked
+ * as deleted, and only expunged if no other one is: otherwise it's
+ * left for the next expunge of the folder */
+static gboolean
+expunge_message_sync (CamelFolder *folder,
+		      const gchar *uid,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	CamelProvider *provider;
+	GPtrArray *uids;
+	gboolean others_deleted = FALSE;
+	guint i;
+
+	provider = camel_service_get_provider (CAMEL_SERVICE (camel_folder_get_parent_store (folder)));
+	if (provider && g_strcmp0 (provider->protocol, "maildir") == 0)
+		return expunge_maildir_message_sync (folder, uid, error);
+
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len && !others_deleted; i++) {
+		const gchar *other = (const gchar *) uids->pdata[i];
+
+		others_deleted = g_strcmp0 (other, uid) != 0 &&
+			(camel_folder_get_message_flags (folder, other) & CAMEL_MESSAGE_DELETED);
+	}
+	camel_folder_free_uids (folder, uids);
+
+	camel_folder_set_message_flags (folder, uid,
+					CAMEL_MESSAGE_DELETED, CAMEL_MESSAGE_DELETED);
+
+	return camel_folder_synchronize_sync (folder, !others_deleted, cancellable, error);
+}
+
+/**
+ * im_mail_op_remove_message_sync:
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Removes the message with @message_uid from folder @folder_name in
+ * account @account_id, without expunging other messages marked as
+ * deleted in the folder. If there are some in a remote folder, the
+ * message is marked as deleted, and expunged with them later.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_remove_message_sync (ImServiceMgr *service_mgr,
+				const gchar *account_id,
+				const gchar *folder_name,
+				const gchar *message_uid,
+				GCancellable *cancellable,
+				GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+	if (_error == NULL) {
+		expunge_message_sync (folder, message_uid, cancellable, &_error);
+		g_object_unref (folder);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_remove_message_thread (GSimpleAsyncResult *simple,
+				  GObject *object,
+				  GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FlagMessageAsyncContext *context;
+
+	context = (FlagMessageAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_remove_message_sync (IM_SERVICE_MGR (object),
+					context->account_id,
+					context->folder_name,
+					context->message_uid,
+					cancellable,
+					&_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_remove_message_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uid: a message uid
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously removes the message with @message_uid from folder
+ * @folder_name in account @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_remove_message_finish() to get the result of the operation.
+ */
+void
+im_mail_op_remove_message_async (ImServiceMgr *mgr,
+				 const gchar *account_id,
+				 const gchar *folder_name,
+				 const gchar *message_uid,
+				 int io_priority,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FlagMessageAsyncContext *context;
+
+	context = g_new0 (FlagMessageAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->message_uid = g_strdup (message_uid);
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_remove_message_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context, 
+						   (GDestroyNotify) flag_message_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_remove_message_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_remove_message_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_remove_message_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_remove_message_finish (ImServiceMgr *mgr,
+				  GAsyncResult *result,
+				  GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_remove_message_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _FlagMessagesAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	GPtrArray *message_uids;
+	gchar *set_flags;
+	gchar *unset_flags;
+} FlagMessagesAsyncContext;
+
+static void
+flag_messages_async_context_free (FlagMessagesAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_ptr_array_unref (context->message_uids);
+	g_free (context->set_flags);
+	g_free (context->unset_flags);
+	g_free (context);
+}
+
+/* Applies the flags locally and synchronizes them. If @journal is
+ * %TRUE and the server can't be reached, or the journal of the account
+ * is not empty, the change is kept in the journal to replay it later,
+ * instead of failing */
+static gboolean
+flag_messages_sync (ImServiceMgr *service_mgr,
+		    const gchar *account_id,
+		    const gchar *folder_name,
+		    GPtrArray *message_uids,
+		    const gchar *set_flags,
+		    const gchar *unset_flags,
+		    gboolean journal,
+		    GCancellable *cancellable,
+		    GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+	gboolean queue = FALSE;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+
+	if (_error == NULL) {
+		CamelMessageFlags camel_set_flags, camel_unset_flags;
+		GList *unset_user_flags, *set_user_flags;
+		guint i;
+
+		camel_set_flags = parse_flags (set_flags, &set_user_flags);
+		camel_unset_flags = parse_flags (unset_flags, &unset_user_flags);
+
+		camel_folder_freeze (folder);
+		for (i = 0; i < message_uids->len; i++) {
+			apply_message_flags (folder, (gchar *) message_uids->pdata[i],
+					     camel_set_flags, camel_unset_flags,
+					     set_user_flags, unset_user_flags);
+		}
+		camel_folder_thaw (folder);
+		g_list_free_full (unset_user_flags, g_free);
+		g_list_free_full (set_user_flags, g_free);
+
+		queue = journal && (is_folder_offline (folder) || has_pending_journal (account_id));
+		if (!queue)
+			camel_folder_synchronize_sync (folder, FALSE, cancellable, &_error);
+		g_object_unref (folder);
+	}
+
+	if (journal && (queue || is_connection_error (_error))) {
+		g_clear_error (&_error);
+		im_op_journal_add_flags (im_op_journal_get_instance (),
+					 account_id, folder_name, message_uids,
+					 set_flags, unset_flags);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/**
+ * im_mail_op_flag_messages_sync:
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @set_flags: a string with the list of flags to set
+ * @unset_flags: a string with the list of flags to unset
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Modifies the flags and user flags of the messages with @message_uids
+ * from folder @folder_name in account @account_id.
+ *
+ * Changes are applied with the folder frozen, and synchronized once
+ * at the end, so the provider can store the flags of all the messages
+ * with a single request to the server. If the account is offline, or
+ * the server can't be reached, changes are only applied locally, and
+ * kept in the #ImOpJournal to replay them later.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_flag_messages_sync (ImServiceMgr *service_mgr,
+			       const gchar *account_id,
+			       const gchar *folder_name,
+			       GPtrArray *message_uids,
+			       const gchar *set_flags,
+			       const gchar *unset_flags,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	return flag_messages_sync (service_mgr, account_id, folder_name, message_uids,
+				   set_flags, unset_flags, TRUE, cancellable, error);
+}
+
+static void
+im_mail_op_flag_messages_thread (GSimpleAsyncResult *simple,
+				 GObject *object,
+				 GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FlagMessagesAsyncContext *context;
+
+	context = (FlagMessagesAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_flag_messages_sync (IM_SERVICE_MGR (object),
+				       context->account_id,
+				       context->folder_name,
+				       context->message_uids,
+				       context->set_flags,
+				       context->unset_flags,
+				       cancellable,
+				       &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_flag_messages_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @set_flags: a string with the list of flags to set
+ * @unset_flags: a string with the list of flags to unset
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously modifies the flags and user flags of the messages with
+ * @message_uids from folder @folder_name in account @account_id.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_flag_messages_finish() to get the result of the operation.
+ */
+void
+im_mail_op_flag_messages_async (ImServiceMgr *mgr,
+				const gchar *account_id,
+				const gchar *folder_name,
+				GPtrArray *message_uids,
+				const gchar *set_flags,
+				const gchar *unset_flags,
+				int io_priority,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FlagMessagesAsyncContext *context;
+	guint i;
+
+	context = g_new0 (FlagMessagesAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->message_uids = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < message_uids->len; i++)
+		g_ptr_array_add (context->message_uids, g_strdup (message_uids->pdata[i]));
+	context->set_flags = g_strdup (set_flags);
+	context->unset_flags = g_strdup (unset_flags);
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_flag_messages_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) flag_messages_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_flag_messages_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_flag_messages_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_flag_messages_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_flag_messages_finish (ImServiceMgr *mgr,
+				 GAsyncResult *result,
+				 GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (mgr), im_mail_op_flag_messages_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+typedef struct _FolderOperationAsyncContext {
+	gchar *account_id;
+	gchar *folder_name;
+	ImFolderOperation operation;
+	ImFolderOperationProgressFunc progress_func;
+	gpointer progress_data;
+} FolderOperationAsyncContext;
+
+static void
+folder_operation_async_context_free (FolderOperationAsyncContext *context)
+{
+	g_free (context->account_id);
+	g_free (context->folder_name);
+	g_free (context);
+}
+
+/* Sets @flags in all the messages of @folder that don't have them, in
+ * chunks of #IM_FOLDER_OPERATION_CHUNK_SIZE messages. Each chunk is
+ * applied with the folder frozen, and synchronized before the next
+ * one, so changes are stored with a few server requests, and the
+ * operation can be cancelled between chunks */
+static gboolean
+set_folder_flags_sync (CamelFolder *folder,
+		       CamelMessageFlags flags,
+		       ImFolderOperationProgressFunc progress_func,
+		       gpointer progress_data,
+		       GCancellable *cancellable,
+		       GError **error)
+{
+	GError *_error = NULL;
+	GPtrArray *uids;
+	guint i;
+
+	uids = camel_folder_get_uids (folder);
+	if (progress_func)
+		progress_func (folder, 0, uids->len, progress_data);
+
+	for (i = 0; _error == NULL && i < uids->len;) {
+		guint chunk_end;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, &_error))
+			break;
+
+		chunk_end = MIN (i + IM_FOLDER_OPERATION_CHUNK_SIZE, uids->len);
+		camel_folder_freeze (folder);
+		for (; i < chunk_end; i++) {
+			const gchar *uid = (const gchar *) uids->pdata[i];
+
+			if ((camel_folder_get_message_flags (folder, uid) & flags) != flags)
+				camel_folder_set_message_flags (folder, uid, flags, flags);
+		}
+		camel_folder_thaw (folder);
+
+		camel_folder_synchronize_sync (folder, FALSE, cancellable, &_error);
+		if (_error == NULL && progress_func)
+			progress_func (folder, i, uids->len, progress_data);
+	}
+	camel_folder_free_uids (folder, uids);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/**
+ * im_mail_op_folder_operation_sync:
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @operation: the #ImFolderOperation
+ * @progress_func: (allow-none): function to report progress, or %NULL
+ * @progress_data: data passed to @progress_func
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Runs @operation on all the messages of folder @folder_name in
+ * account @account_id.
+ *
+ * Expunging is a single request to the server. Marking as read and
+ * emptying change the flags in chunks of
+ * #IM_FOLDER_OPERATION_CHUNK_SIZE messages, reporting progress after
+ * each one, so huge folders don't block the provider for long, and
+ * the operation can be cancelled.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_folder_operation_sync (ImServiceMgr *service_mgr,
+				  const gchar *account_id,
+				  const gchar *folder_name,
+				  ImFolderOperation operation,
+				  ImFolderOperationProgressFunc progress_func,
+				  gpointer progress_data,
+				  GCancellable *cancellable,
+				  GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+
+	if (_error == NULL) {
+		switch (operation) {
+		case IM_FOLDER_OPERATION_MARK_READ:
+			set_folder_flags_sync (folder, CAMEL_MESSAGE_SEEN,
+					       progress_func, progress_data,
+					       cancellable, &_error);
+			break;
+		case IM_FOLDER_OPERATION_EMPTY:
+			if (set_folder_flags_sync (folder, CAMEL_MESSAGE_DELETED,
+						   progress_func, progress_data,
+						   cancellable, &_error))
+				camel_folder_expunge_sync (folder, cancellable, &_error);
+			break;
+		case IM_FOLDER_OPERATION_EXPUNGE:
+			camel_folder_expunge_sync (folder, cancellable, &_error);
+			if (_error == NULL && progress_func)
+				progress_func (folder, 1, 1, progress_data);
+			break;
+		}
+		g_object_unref (folder);
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+im_mail_op_folder_operation_thread (GSimpleAsyncResult *simple,
+				    GObject *object,
+				    GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	FolderOperationAsyncContext *context;
+
+	context = (FolderOperationAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	im_mail_op_folder_operation_sync (IM_SERVICE_MGR (object),
+					  context->account_id,
+					  context->folder_name,
+					  context->operation,
+					  context->progress_func,
+					  context->progress_data,
+					  cancellable,
+					  &_error);
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+/**
+ * im_mail_op_folder_operation_async:
+ * @mgr: a #ImServiceMgr
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @operation: the #ImFolderOperation
+ * @progress_func: (allow-none): function to report progress, or %NULL
+ * @progress_data: data passed to @progress_func
+ * @io_priority: the I/O priority of the request
+ * @cancellable: optional #GCancellable object, or %NULL,
+ * @callback: a #GAsyncReadyCallback to call when the request is finished
+ * @userdata: data to pass to callback
+ *
+ * Asynchronously runs @operation on all the messages of folder
+ * @folder_name in account @account_id. @progress_func is called
+ * in the thread running the operation.
+ *
+ * When the operation is finished, @callback is called. The you should call
+ * im_mail_op_folder_operation_finish() to get the result of the operation.
+ */
+void
+im_mail_op_folder_operation_async (ImServiceMgr *mgr,
+				   const gchar *account_id,
+				   const gchar *folder_name,
+				   ImFolderOperation operation,
+				   ImFolderOperationProgressFunc progress_func,
+				   gpointer progress_data,
+				   int io_priority,
+				   GCancellable *cancellable,
+				   GAsyncReadyCallback callback,
+				   gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+	FolderOperationAsyncContext *context;
+
+	context = g_new0 (FolderOperationAsyncContext, 1);
+	context->account_id = g_strdup (account_id);
+	context->folder_name = g_strdup (folder_name);
+	context->operation = operation;
+	context->progress_func = progress_func;
+	context->progress_data = progress_data;
+
+	simple = g_simple_async_result_new (G_OBJECT (mgr),
+					    callback, userdata,
+					    im_mail_op_folder_operation_async);
+
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) folder_operation_async_context_free);
+
+	g_simple_async_result_run_in_thread (simple,
+					     im_mail_op_folder_operation_thread,
+					     io_priority, cancellable);
+	g_object_unref (simple);
+}
+
+/**
+ * im_mail_op_folder_operation_finish:
+ * @mgr: a #ImServiceMgr
+ * @result: a #GAsyncResult
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_mail_op_folder_operation_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+im_mail_op_folder_operation_finish (ImServiceMgr *mgr,
+				    GAsyncResult *result,
+				    GError **error)
 {
 	GSimpleAsyncResult *simple;
-	CamelFolderInfo *fi;
 
 	g_return_val_if_fail (
 		g_simple_async_result_is_valid (
-		result, G_OBJECT (store), im_mail_op_synchronize_store_async), FALSE);
-
+		result, G_OBJECT (mgr), im_mail_op_folder_operation_async), FALSE);
 
 	simple = G_SIMPLE_ASYNC_RESULT (result);
-	fi = (CamelFolderInfo *)
-		g_simple_async_result_get_op_res_gpointer (simple);
 
-	return fi;
+	return !g_simple_async_result_propagate_error (simple, error);
 }
 
-typedef struct _RefreshFolderInfoAsyncContext {
+typedef struct _TransferMessagesAsyncContext {
 	gchar *account_id;
 	gchar *folder_name;
-	CamelFolder *folder;
-} RefreshFolderInfoAsyncContext;
+	GPtrArray *message_uids;
+	gchar *dest_account_id;
+	gchar *dest_folder_name;
+	gboolean delete_originals;
+	ImFolderOperationProgressFunc progress_func;
+	gpointer progress_data;
+} TransferMessagesAsyncContext;
 
 static void
-refresh_folder_info_async_context_free (RefreshFolderInfoAsyncContext *context)
+transfer_messages_async_context_free (TransferMessagesAsyncContext *context)
 {
 	g_free (context->account_id);
 	g_free (context->folder_name);
-	if (context->folder) g_object_unref (context->folder);
+	g_ptr_array_unref (context->message_uids);
+	g_free (context->dest_account_id);
+	g_free (context->dest_folder_name);
 	g_free (context);
 }
 
+/* Copies the messages one by one, so only one of them is in memory
+ * at a time */
+static gboolean
+stream_messages_sync (CamelFolder *source,
+		      GPtrArray *message_uids,
+		      CamelFolder *destination,
+		      gboolean delete_originals,
+		      ImFolderOperationProgressFunc progress_func,
+		      gpointer progress_data,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	GError *_error = NULL;
+	guint i;
+
+	for (i = 0; _error == NULL && i < message_uids->len; i++) {
+		const gchar *uid = (const gchar *) message_uids->pdata[i];
+		CamelMimeMessage *message;
+		CamelMessageInfo *mi;
+
+		message = camel_folder_get_message_sync (source, uid, cancellable, &_error);
+		if (message == NULL)
+			break;
+
+		mi = camel_message_info_new (NULL);
+		camel_message_info_set_flags (mi, ~0,
+					      camel_folder_get_message_flags (source, uid) & ~CAMEL_MESSAGE_DELETED);
+		camel_folder_append_message_sync (destination, message, mi, NULL,
+						  cancellable, &_error);
+		camel_message_info_free (mi);
+		g_object_unref (message);
+
+		if (_error == NULL && delete_originals)
+			camel_folder_set_message_flags (source, uid,
+							CAMEL_MESSAGE_DELETED, CAMEL_MESSAGE_DELETED);
+
+		if (_error == NULL && progress_func &&
+		    ((i + 1) % IM_FOLDER_OPERATION_CHUNK_SIZE == 0 || i + 1 == message_uids->len))
+			progress_func (source, i + 1, message_uids->len, progress_data);
+	}
+
+	/* Messages already copied are flagged even on errors */
+	if (delete_originals)
+		camel_folder_synchronize_sync (source, FALSE, cancellable, _error?NULL:&_error);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/* Transfers the messages in chunks of #IM_FOLDER_OPERATION_CHUNK_SIZE,
+ * so the store can copy them in the server, with a request per chunk */
+static gboolean
+transfer_messages_in_store_sync (CamelFolder *source,
+				 GPtrArray *message_uids,
+				 CamelFolder *destination,
+				 gboolean delete_originals,
+				 ImFolderOperationProgressFunc progress_func,
+				 gpointer progress_data,
+				 GCancellable *cancellable,
+				 GError **error)
+{
+	GError *_error = NULL;
+	GPtrArray *chunk;
+	guint i;
+
+	chunk = g_ptr_array_sized_new (IM_FOLDER_OPERATION_CHUNK_SIZE);
+	for (i = 0; _error == NULL && i < message_uids->len;) {
+		g_ptr_array_set_size (chunk, 0);
+		for (; i < message_uids->len && chunk->len < IM_FOLDER_OPERATION_CHUNK_SIZE; i++)
+			g_ptr_array_add (chunk, message_uids->pdata[i]);
+
+		if (camel_folder_transfer_messages_to_sync (source, chunk, destination,
+							    delete_originals, NULL,
+							    cancellable, &_error) &&
+		    progress_func)
+			progress_func (source, i, message_uids->len, progress_data);
+	}
+	g_ptr_array_free (chunk, TRUE);
+
+	if (_error == NULL && delete_originals)
+		camel_folder_synchronize_sync (source, FALSE, cancellable, &_error);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/* Transfers the messages. If @journal is %TRUE and any of the folders
+ * is offline, or can't be reached, or the journal of the account is not
+ * empty, the transfer is kept in the journal to replay it later. Moved
+ * messages are only flagged as deleted in the source meanwhile, they
+ * don't show up in the destination until the transfer is replayed */
+static gboolean
+transfer_messages_sync (ImServiceMgr *service_mgr,
+			const gchar *account_id,
+			const gchar *folder_name,
+			GPtrArray *message_uids,
+			const gchar *dest_account_id,
+			const gchar *dest_folder_name,
+			gboolean delete_originals,
+			ImFolderOperationProgressFunc progress_func,
+			gpointer progress_data,
+			gboolean journal,
+			GCancellable *cancellable,
+			GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *source, *destination = NULL;
+	gboolean offline = FALSE;
+
+	source = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+	if (_error == NULL)
+		destination = im_service_mgr_get_folder (service_mgr, dest_account_id,
+							 dest_folder_name, cancellable, &_error);
+
+	if (_error == NULL && journal)
+		offline = is_folder_offline (source) || is_folder_offline (destination) ||
+			has_pending_journal (account_id);
+	else if (journal)
+		offline = is_connection_error (_error);
+
+	if (offline) {
+		g_clear_error (&_error);
+		if (source && delete_originals) {
+			guint i;
+
+			camel_folder_freeze (source);
+			for (i = 0; i < message_uids->len; i++)
+				camel_folder_set_message_flags (source, (gchar *) message_uids->pdata[i],
+								CAMEL_MESSAGE_DELETED, CAMEL_MESSAGE_DELETED);
+			camel_folder_thaw (source);
+		}
+		im_op_journal_add_transfer (im_op_journal_get_instance (),
+					    account_id, folder_name, message_uids,
+					    dest_account_id, dest_folder_name,
+					    delete_originals);
+	} else if (_error == NULL) {
+		if (progress_func)
+			progress_func (source, 0, message_uids->len, progress_data);
+
+		if (camel_folder_get_parent_store (source) == camel_folder_get_parent_store (destination))
+			transfer_messages_in_store_sync (source, message_uids, destination,
+							 delete_originals,
+							 progress_func, progress_data,
+							 cancellable, &_error);
+		else
+			stream_messages_sync (source, message_uids, destination,
+					      delete_originals,
+					      progress_func, progress_data,
+					      cancellable, &_error);
+	}
+
+	if (source)
+		g_object_unref (source);
+	if (destination)
+		g_object_unref (destination);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+typedef struct _FilterBatch {
+	const ImFilterRule *rule;
+	GPtrArray *uids;
+} FilterBatch;
+
+static void
+filter_batch_free (FilterBatch *batch)
+{
+	g_ptr_array_unref (batch->uids);
+	g_free (batch);
+}
+
+/* POP accounts keep their folders in the local store, under their
+ * inbox, so the messages are moved there */
+static gboolean
+move_to_local_folder_sync (CamelFolder *inbox,
+			   const gchar *account_id,
+			   const gchar *folder_name,
+			   GPtrArray *message_uids,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *destination;
+	gchar *full_name;
+
+	full_name = g_strconcat (account_id, "/", folder_name, NULL);
+	destination = camel_store_get_folder_sync (camel_folder_get_parent_store (inbox),
+						   full_name, CAMEL_STORE_FOLDER_CREATE,
+						   cancellable, &_error);
+	if (destination) {
+		transfer_messages_in_store_sync (inbox, message_uids, destination, TRUE,
+						 NULL, NULL, cancellable, &_error);
+		g_object_unref (destination);
+	}
+	g_free (full_name);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+/* Applies the filter rules of the account to the messages @new_uids
+ * of @inbox. Messages with the same action are moved or flagged
+ * together. */
+static void
+filter_new_messages_sync (ImServiceMgr *service_mgr,
+			  const gchar *account_id,
+			  CamelFolder *inbox,
+			  GPtrArray *new_uids,
+			  GCancellable *cancellable)
+{
+	ImFilterMatcher *matcher;
+	GHashTable *batches;
+	GHashTableIter iter;
+	gpointer value;
+	gboolean local;
+	guint i, new_count = 0;
+	gint64 start;
+
+	matcher = im_filter_matcher_get_for_account (im_account_mgr_get_instance (), account_id);
+	if (matcher == NULL)
+		return;
+
+	/* action and argument -> FilterBatch */
+	batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, (GDestroyNotify) filter_batch_free);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < new_uids->len; i++) {
+		const ImFilterRule *rule;
+		CamelMessageInfo *mi;
+		FilterBatch *batch;
+		gchar *key;
+
+		mi = camel_folder_get_message_info (inbox, new_uids->pdata[i]);
+		if (mi == NULL)
+			continue;
+		new_count++;
+		rule = im_filter_matcher_match (matcher, mi);
+		camel_folder_free_message_info (inbox, mi);
+		if (rule == NULL)
+			continue;
+
+		key = g_strdup_printf ("%d\t%s", rule->action, rule->argument);
+		batch = g_hash_table_lookup (batches, key);
+		if (batch == NULL) {
+			batch = g_new0 (FilterBatch, 1);
+			batch->rule = rule;
+			batch->uids = g_ptr_array_new ();
+			g_hash_table_insert (batches, key, batch);
+		} else {
+			g_free (key);
+		}
+		g_ptr_array_add (batch->uids, new_uids->pdata[i]);
+	}
+	g_debug ("%s: matched %u new messages of %s against %u rules in %" G_GINT64_FORMAT " usec",
+		 __FUNCTION__, new_count, account_id, im_filter_matcher_get_rules_count (matcher),
+		 g_get_monotonic_time () - start);
+
+	local = camel_folder_get_parent_store (inbox) == im_service_mgr_get_local_store (service_mgr);
+	g_hash_table_iter_init (&iter, batches);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		FilterBatch *batch = (FilterBatch *) value;
+		GError *_error = NULL;
+
+		switch (batch->rule->action) {
+		case IM_FILTER_ACTION_MOVE:
+			if (local)
+				move_to_local_folder_sync (inbox, account_id, batch->rule->argument,
+							   batch->uids, cancellable, &_error);
+			else
+				transfer_messages_sync (service_mgr, account_id, "INBOX", batch->uids,
+							account_id, batch->rule->argument, TRUE,
+							NULL, NULL, FALSE, cancellable, &_error);
+			break;
+		case IM_FILTER_ACTION_FLAG:
+			flag_messages_sync (service_mgr, account_id, "INBOX", batch->uids,
+					    batch->rule->argument, NULL, FALSE,
+					    cancellable, &_error);
+			break;
+		case IM_FILTER_ACTION_DELETE:
+			flag_messages_sync (service_mgr, account_id, "INBOX", batch->uids,
+					    "seen,deleted", NULL, FALSE,
+					    cancellable, &_error);
+			break;
+		}
+
+		if (_error) {
+			g_warning ("%s: failed to filter %u messages of %s: %s", __FUNCTION__,
+				   batch->uids->len, account_id, _error->message);
+			g_error_free (_error);
+		}
+	}
+
+	g_hash_table_destroy (batches);
+	im_filter_matcher_unref (matcher);
+}
+
 /**
- * im_mail_op_refresh_folder_info_sync:
- * @mgr: a #ImServiceMgr
+ * im_mail_op_filter_new_messages_sync:
  * @account_id: an account id
- * @folder_name: a folder name
- * @folder: (out) (allow-none): the refreshed #CamelFolder
+ * @message_uids: (element-type utf8): the uids of the new messages
  * @cancellable: optional #GCancellable object, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
  *
- * Refreshes the summary of folder @folder_name in account @account_id.
+ * Applies the filter rules of account @account_id to the messages
+ * @message_uids of its inbox. The messages of POP accounts are
+ * filtered while they are retrieved, so this is for the messages
+ * IMAP accounts get on refresh or push. Failures of the actions
+ * are not reported.
  *
  * Returns: %TRUE if successful, %FALSE otherwise.
  */
 gboolean
-im_mail_op_refresh_folder_info_sync (ImServiceMgr *mgr,
+im_mail_op_filter_new_messages_sync (ImServiceMgr *service_mgr,
 				     const gchar *account_id,
-				     const gchar *folder_name,
-				     CamelFolder **folder,
+				     GPtrArray *message_uids,
 				     GCancellable *cancellable,
 				     GError **error)
 {
 	GError *_error = NULL;
-	CamelFolder *_folder;
-
-	_folder = im_service_mgr_get_folder (mgr, account_id,
-					    folder_name, cancellable, &_error);
+	CamelFolder *inbox;
 
+	inbox = im_service_mgr_get_folder (service_mgr, account_id, "INBOX",
+					   cancellable, &_error);
 	if (_error == NULL) {
-		camel_folder_refresh_info_sync (_folder,
-						cancellable, &_error);
+		filter_new_messages_sync (service_mgr, account_id, inbox,
+					  message_uids, cancellable);
+		g_object_unref (inbox);
 	}
 
 	if (_error)
 		g_propagate_error (error, _error);
-	if (folder)
-		*folder = _folder;
-	else
-		g_object_unref (_folder);
 
 	return _error == NULL;
 }
 
 static void
-im_mail_op_refresh_folder_info_thread (GSimpleAsyncResult *simple,
+im_mail_op_filter_new_messages_thread (GSimpleAsyncResult *simple,
 				       GObject *object,
 				       GCancellable *cancellable)
 {
 	GError *_error = NULL;
-	RefreshFolderInfoAsyncContext *context;
+	FlagMessagesAsyncContext *context;
 
-	context = (RefreshFolderInfoAsyncContext *)
+	context = (FlagMessagesAsyncContext *)
 		g_simple_async_result_get_op_res_gpointer (simple);
 
-	im_mail_op_refresh_folder_info_sync (IM_SERVICE_MGR (object),
+	im_mail_op_filter_new_messages_sync (IM_SERVICE_MGR (object),
 					     context->account_id,
-					     context->folder_name,
-					     &(context->folder),
+					     context->message_uids,
 					     cancellable,
 					     &_error);
-	
+
 	if (_error != NULL)
 		g_simple_async_result_take_error (simple, _error);
 }
 
 /**
- * im_mail_op_refresh_folder_info_async:
+ * im_mail_op_filter_new_messages_async:
  * @mgr: a #ImServiceMgr
  * @account_id: an account id
- * @folder_name: a folder name
+ * @message_uids: (element-type utf8): the uids of the new messages
  * @io_priority: the I/O priority of the request
  * @cancellable: optional #GCancellable object, or %NULL,
  * @callback: a #GAsyncReadyCallback to call when the request is finished
  * @userdata: data to pass to callback
  *
- * Asynchronously refreshes the summary of folder @folder_name in account
- * @account_id.
+ * Asynchronously applies the filter rules of account @account_id to
+ * the messages @message_uids of its inbox.
  *
  * When the operation is finished, @callback is called. The you should call
- * im_mail_op_refresh_folder_info_finish() to get the result of the operation.
+ * im_mail_op_filter_new_messages_finish() to get the result of the operation.
  */
 void
-im_mail_op_refresh_folder_info_async (ImServiceMgr *mgr,
+im_mail_op_filter_new_messages_async (ImServiceMgr *mgr,
 				      const gchar *account_id,
-				      const gchar *folder_name,
+				      GPtrArray *message_uids,
 				      int io_priority,
 				      GCancellable *cancellable,
 				      GAsyncReadyCallback callback,
 				      gpointer userdata)
 {
 	GSimpleAsyncResult *simple;
-	RefreshFolderInfoAsyncContext *context;
+	FlagMessagesAsyncContext *context;
+	guint i;
 
-	context = g_new0 (RefreshFolderInfoAsyncContext, 1);
+	context = g_new0 (FlagMessagesAsyncContext, 1);
 	context->account_id = g_strdup (account_id);
-	context->folder_name = g_strdup (folder_name);
+	context->folder_name = g_strdup ("INBOX");
+	context->message_uids = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < message_uids->len; i++)
+		g_ptr_array_add (context->message_uids, g_strdup (message_uids->pdata[i]));
 
 	simple = g_simple_async_result_new (G_OBJECT (mgr),
 					    callback, userdata,
-					    im_mail_op_refresh_folder_info_async);
+					    im_mail_op_filter_new_messages_async);
 
-	g_simple_async_result_set_op_res_gpointer (simple, context, 
-						   (GDestroyNotify) refresh_folder_info_async_context_free);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) flag_messages_async_context_free);
 
 	g_simple_async_result_run_in_thread (simple,
-					     im_mail_op_refresh_folder_info_thread,
+					     im_mail_op_filter_new_messages_thread,
 					     io_priority, cancellable);
 	g_object_unref (simple);
 }
 
 /**
- * im_mail_op_refresh_folder_info_finish:
+ * im_mail_op_filter_new_messages_finish:
  * @mgr: a #ImServiceMgr
  * @result: a #GAsyncResult
- * @folder: (out) (allow-none) (transfer full): refreshed #CamelFolder
  * @error: (out) (allow-none): return location for a #GError, or %NULL
  *
- * Finishes the operation started with im_mail_op_refresh_folder_info_async().
+ * Finishes the operation started with im_mail_op_filter_new_messages_async().
  *
  * Returns: %TRUE on success, %FALSE otherwise.
  */
 gboolean
-im_mail_op_refresh_folder_info_finish (ImServiceMgr *mgr,
+im_mail_op_filter_new_messages_finish (ImServiceMgr *mgr,
 				       GAsyncResult *result,
-				       CamelFolder **folder,
 				       GError **error)
 {
 	GSimpleAsyncResult *simple;
-	RefreshFolderInfoAsyncContext *context;
 
 	g_return_val_if_fail (
 		g_simple_async_result_is_valid (
-		result, G_OBJECT (mgr), im_mail_op_refresh_folder_info_async), FALSE);
-
+		result, G_OBJECT (mgr), im_mail_op_filter_new_messages_async), FALSE);
 
 	simple = G_SIMPLE_ASYNC_RESULT (result);
-	context = (RefreshFolderInfoAsyncContext *)
-		g_simple_async_result_get_op_res_gpointer (simple);
-
-	if (folder && context->folder)
-		*folder = g_object_ref (context->folder);
 
 	return !g_simple_async_result_propagate_error (simple, error);
 }
 
-typedef struct _GetMessageAsyncContext {
-	gchar *account_id;
-	gchar *folder_name;
-	gchar *message_uid;
-	CamelMimeMessage *message;
-} GetMessageAsyncContext;
-
-static void
-get_message_async_context_free (GetMessageAsyncContext *context)
-{
-	g_free (context->account_id);
-	g_free (context->folder_name);
-	g_free (context->message_uid);
-	if (context->message) g_object_unref (context->message);
-	g_free (context);
-}
-
 /**
- * im_mail_op_get_message_sync:
- * @account_id: an account id
- * @folder_name: a folder name
- * @message_uid: a message uid
+ * im_mail_op_transfer_messages_sync:
+ * @account_id: the source account id
+ * @folder_name: the source folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @dest_account_id: the destination account id
+ * @dest_folder_name: the destination folder name
+ * @delete_originals: %TRUE to move the messages, %FALSE to copy them
+ * @progress_func: (allow-none): function to report progress, or %NULL
+ * @progress_data: data passed to @progress_func
  * @cancellable: optional #GCancellable object, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
  *
- * Obtains the message with @message_uid from folder @folder_name
- * in account @account_id.
+ * Copies or moves the messages with @message_uids from folder
+ * @folder_name in account @account_id to folder @dest_folder_name
+ * in account @dest_account_id.
  *
- * Returns: (transfer full): a #CamelMimeMessage if successful, %NULL otherwise.
+ * If both folders are in the same store, the store transfers the
+ * messages, in the server if it supports it. Otherwise the messages
+ * are retrieved and appended one by one. If any of the accounts is
+ * offline, the transfer is kept in the #ImOpJournal to replay it
+ * later.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
  */
-CamelMimeMessage *
-im_mail_op_get_message_sync (ImServiceMgr *service_mgr,
-			     const gchar *account_id,
-			     const gchar *folder_name,
-			     const gchar *message_uid,
-			     GCancellable *cancellable,
-			     GError **error)
+gboolean
+im_mail_op_transfer_messages_sync (ImServiceMgr *service_mgr,
+				   const gchar *account_id,
+				   const gchar *folder_name,
+				   GPtrArray *message_uids,
+				   const gchar *dest_account_id,
+				   const gchar *dest_folder_name,
+				   gboolean delete_originals,
+				   ImFolderOperationProgressFunc progress_func,
+				   gpointer progress_data,
+				   GCancellable *cancellable,
+				   GError **error)
 {
-	GError *_error = NULL;
-	CamelFolder *folder;
-	CamelMimeMessage *message = NULL;
-
-	folder = im_service_mgr_get_folder (service_mgr, account_id,
-					    folder_name, cancellable, &_error);
-
-	if (_error == NULL) {
-		message = camel_folder_get_message_sync (folder, message_uid,
-							 cancellable, &_error);
-	}
-
-	if (_error)
-		g_propagate_error (error, _error);
-	if (folder) g_object_unref (folder);
-
-	return message;
+	return transfer_messages_sync (service_mgr, account_id, folder_name, message_uids,
+				       dest_account_id, dest_folder_name, delete_originals,
+				       progress_func, progress_data, TRUE,
+				       cancellable, error);
 }
 
 static void
-im_mail_op_get_message_thread (GSimpleAsyncResult *simple,
-			       GObject *object,
-			       GCancellable *cancellable)
+im_mail_op_transfer_messages_thread (GSimpleAsyncResult *simple,
+				     GObject *object,
+				     GCancellable *cancellable)
 {
 	GError *_error = NULL;
-	GetMessageAsyncContext *context;
+	TransferMessagesAsyncContext *context;
 
-	context = (GetMessageAsyncContext *)
+	context = (TransferMessagesAsyncContext *)
 		g_simple_async_result_get_op_res_gpointer (simple);
 
-	context->message = im_mail_op_get_message_sync (IM_SERVICE_MGR (object),
-							context->account_id,
-							context->folder_name,
-							context->message_uid,
-							cancellable,
-							&_error);
-	
+	im_mail_op_transfer_messages_sync (IM_SERVICE_MGR (object),
+					   context->account_id,
+					   context->folder_name,
+					   context->message_uids,
+					   context->dest_account_id,
+					   context->dest_folder_name,
+					   context->delete_originals,
+					   context->progress_func,
+					   context->progress_data,
+					   cancellable,
+					   &_error);
+
 	if (_error != NULL)
 		g_simple_async_result_take_error (simple, _error);
 }
 
 /**
- * im_mail_op_get_message_async:
+ * im_mail_op_transfer_messages_async:
  * @mgr: a #ImServiceMgr
- * @account_id: an account id
- * @folder_name: a folder name
- * @message_uid: a message uid
+ * @account_id: the source account id
+ * @folder_name: the source folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @dest_account_id: the destination account id
+ * @dest_folder_name: the destination folder name
+ * @delete_originals: %TRUE to move the messages, %FALSE to copy them
+ * @progress_func: (allow-none): function to report progress, or %NULL
+ * @progress_data: data passed to @progress_func
  * @io_priority: the I/O priority of the request
  * @cancellable: optional #GCancellable object, or %NULL,
  * @callback: a #GAsyncReadyCallback to call when the request is finished
  * @userdata: data to pass to callback
  *
- * Asynchronously obtains the message with @message_uid from folder @folder_name
- * in account @account_id.
+ * Asynchronously copies or moves the messages with @message_uids from
+ * folder @folder_name in account @account_id to folder @dest_folder_name
+ * in account @dest_account_id. @progress_func is called in the thread
+ * running the operation.
  *
  * When the operation is finished, @callback is called. The you should call
- * im_mail_op_get_message_finish() to get the result of the operation.
+ * im_mail_op_transfer_messages_finish() to get the result of the operation.
  */
 void
-im_mail_op_get_message_async (ImServiceMgr *mgr,
-			       const gchar *account_id,
-			       const gchar *folder_name,
-			       const gchar *message_uid,
-			       int io_priority,
-			       GCancellable *cancellable,
-			       GAsyncReadyCallback callback,
-			       gpointer userdata)
+im_mail_op_transfer_messages_async (ImServiceMgr *mgr,
+				    const gchar *account_id,
+				    const gchar *folder_name,
+				    GPtrArray *message_uids,
+				    const gchar *dest_account_id,
+				    const gchar *dest_folder_name,
+				    gboolean delete_originals,
+				    ImFolderOperationProgressFunc progress_func,
+				    gpointer progress_data,
+				    int io_priority,
+				    GCancellable *cancellable,
+				    GAsyncReadyCallback callback,
+				    gpointer userdata)
 {
 	GSimpleAsyncResult *simple;
-	GetMessageAsyncContext *context;
+	TransferMessagesAsyncContext *context;
+	guint i;
 
-	context = g_new0 (GetMessageAsyncContext, 1);
+	context = g_new0 (TransferMessagesAsyncContext, 1);
 	context->account_id = g_strdup (account_id);
 	context->folder_name = g_strdup (folder_name);
-	context->message_uid = g_strdup (message_uid);
+	context->message_uids = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < message_uids->len; i++)
+		g_ptr_array_add (context->message_uids, g_strdup (message_uids->pdata[i]));
+	context->dest_account_id = g_strdup (dest_account_id);
+	context->dest_folder_name = g_strdup (dest_folder_name);
+	context->delete_originals = delete_originals;
+	context->progress_func = progress_func;
+	context->progress_data = progress_data;
 
 	simple = g_simple_async_result_new (G_OBJECT (mgr),
 					    callback, userdata,
-					    im_mail_op_get_message_async);
+					    im_mail_op_transfer_messages_async);
 
-	g_simple_async_result_set_op_res_gpointer (simple, context, 
-						   (GDestroyNotify) get_message_async_context_free);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) transfer_messages_async_context_free);
 
 	g_simple_async_result_run_in_thread (simple,
-					     im_mail_op_get_message_thread,
+					     im_mail_op_transfer_messages_thread,
 					     io_priority, cancellable);
 	g_object_unref (simple);
 }
 
 /**
- * im_mail_op_get_message_finish:
- * @folder: a #ImServiceMgr
+ * im_mail_op_transfer_messages_finish:
+ * @mgr: a #ImServiceMgr
  * @result: a #GAsyncResult
  * @error: (out) (allow-none): return location for a #GError, or %NULL
  *
- * Finishes the operation started with im_mail_op_composer_get_message_async().
+ * Finishes the operation started with im_mail_op_transfer_messages_async().
  *
- * Returns: (transfer full): a #CamelMimeMessage on success, %NULL otherwise.
+ * Returns: %TRUE on success, %FALSE otherwise.
  */
-CamelMimeMessage *
-im_mail_op_get_message_finish (ImServiceMgr *mgr,
-			       GAsyncResult *result,
-			       GError **error)
+gboolean
+im_mail_op_transfer_messages_finish (ImServiceMgr *mgr,
+				     GAsyncResult *result,
+				     GError **error)
 {
 	GSimpleAsyncResult *simple;
-	GetMessageAsyncContext *context;
 
 	g_return_val_if_fail (
 		g_simple_async_result_is_valid (
-		result, G_OBJECT (mgr), im_mail_op_get_message_async), FALSE);
+		result, G_OBJECT (mgr), im_mail_op_transfer_messages_async), FALSE);
 
 	simple = G_SIMPLE_ASYNC_RESULT (result);
-	context = g_simple_async_result_get_op_res_gpointer (simple);
 
-	g_simple_async_result_propagate_error (simple, error);
-	return context->message?g_object_ref (context->message):NULL;
+	return !g_simple_async_result_propagate_error (simple, error);
 }
 
-
-typedef struct _MessageFlagAsyncContext {
+typedef struct _ReplayJournalAsyncContext {
 	gchar *account_id;
-	gchar *folder_name;
-	gchar *message_uid;
-	gchar *set_flags;
-	gchar *unset_flags;
-} FlagMessageAsyncContext;
+	guint replayed;
+} ReplayJournalAsyncContext;
 
 static void
-flag_message_async_context_free (FlagMessageAsyncContext *context)
+replay_journal_async_context_free (ReplayJournalAsyncContext *context)
 {
 	g_free (context->account_id);
-	g_free (context->folder_name);
-	g_free (context->message_uid);
-	g_free (context->set_flags);
-	g_free (context->unset_flags);
 	g_free (context);
 }
 
-static CamelMessageFlags
-parse_flags (const char *flags_list, GList **user_flags)
+/* TRUE if @entry can be replayed in the same operation as @first */
+static gboolean
+is_same_journal_batch (ImOpJournalEntry *first,
+		       ImOpJournalEntry *entry)
 {
-	gchar **flags, **node;
-	CamelMessageFlags result = 0;
+	if (first->type != entry->type ||
+	    g_strcmp0 (first->folder_name, entry->folder_name) != 0)
+		return FALSE;
 
-	*user_flags = NULL;
-	if (flags_list == NULL)
-		return 0;
+	if (first->type == IM_OP_JOURNAL_ENTRY_FLAGS)
+		return g_strcmp0 (first->set_flags, entry->set_flags) == 0 &&
+			g_strcmp0 (first->unset_flags, entry->unset_flags) == 0;
+	else
+		return first->delete_originals == entry->delete_originals &&
+			g_strcmp0 (first->dest_account_id, entry->dest_account_id) == 0 &&
+			g_strcmp0 (first->dest_folder_name, entry->dest_folder_name) == 0;
+}
 
-	flags = g_strsplit (flags_list, ",", 0);
-	for (node = flags; *node != NULL; node++) {
-		if (g_strstr_len (*node, -1, "seen"))
-			result |= CAMEL_MESSAGE_SEEN;
-		else if (g_strstr_len (*node, -1, "deleted"))
-			result |= CAMEL_MESSAGE_DELETED;
-		else
-			*user_flags = g_list_append (*user_flags, g_strdup (*node));
+/* Moves journaled offline only flagged the messages as deleted, so
+ * the flag is removed before doing the real transfer */
+static gboolean
+restore_moved_messages_sync (ImServiceMgr *service_mgr,
+			     const gchar *account_id,
+			     const gchar *folder_name,
+			     GPtrArray *message_uids,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	GError *_error = NULL;
+	CamelFolder *folder;
+	guint i;
+
+	folder = im_service_mgr_get_folder (service_mgr, account_id,
+					    folder_name, cancellable, &_error);
+	if (_error == NULL) {
+		camel_folder_freeze (folder);
+		for (i = 0; i < message_uids->len; i++)
+			camel_folder_set_message_flags (folder, (gchar *) message_uids->pdata[i],
+							CAMEL_MESSAGE_DELETED, 0);
+		camel_folder_thaw (folder);
+		g_object_unref (folder);
 	}
 
-	g_strfreev (flags);
+	if (_error)
+		g_propagate_error (error, _error);
 
-	return result;
+	return _error == NULL;
 }
 
 /**
- * im_mail_op_flag_message_sync:
+ * im_mail_op_replay_journal_sync:
  * @account_id: an account id
- * @folder_name: a folder name
- * @message_uid: a message uid
- * @set_flags: a string with the list of flags to set
- * @unset_flags: a string with the list of flags to unset
+ * @replayed: (out) (allow-none): return location for the number of
+ * operations replayed, or %NULL
  * @cancellable: optional #GCancellable object, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
  *
- * Modifies the flags and user flags of the message with @message_uid 
- * from folder @folder_name in account @account_id.
+ * Replays in the server the operations kept in the #ImOpJournal of
+ * account @account_id while it was offline. Consecutive operations
+ * on the same folder are batched in a single request, and removed
+ * from the journal once done. It stops when the server can't be
+ * reached, leaving the remaining operations in the journal. Operations
+ * failing for any other reason would never succeed, so they're dropped
+ * with a warning, and moved messages are kept in the source folder.
  *
- * Returns: %TRUE if successful, %NULL otherwise.
+ * Returns: %TRUE if successful, %FALSE otherwise.
  */
 gboolean
-im_mail_op_flag_message_sync (ImServiceMgr *service_mgr,
-			      const gchar *account_id,
-			      const gchar *folder_name,
-			      const gchar *message_uid,
-			      const gchar *set_flags,
-			      const gchar *unset_flags,
-			      GCancellable *cancellable,
-			      GError **error)
+im_mail_op_replay_journal_sync (ImServiceMgr *service_mgr,
+				const gchar *account_id,
+				guint *replayed,
+				GCancellable *cancellable,
+				GError **error)
 {
 	GError *_error = NULL;
-	CamelFolder *folder;
-
-	folder = im_service_mgr_get_folder (service_mgr, account_id,
-					    folder_name, cancellable, &_error);
-
-	if (_error == NULL) {
-		CamelMessageFlags camel_set_flags, camel_unset_flags;
-		GList *unset_user_flags, *set_user_flags, *node;
-
-		camel_set_flags = parse_flags (set_flags, &set_user_flags);
-		camel_unset_flags = parse_flags (unset_flags, &unset_user_flags);
-
-		if (camel_unset_flags)
-			camel_folder_set_message_flags (folder, message_uid, 0, camel_unset_flags);
-		if (camel_set_flags)
-			camel_folder_set_message_flags (folder, message_uid, camel_set_flags, camel_set_flags);
-
-		for (node = unset_user_flags; node != NULL; node = g_list_next (node)) {
-			camel_folder_set_message_user_flag (folder, message_uid,
-							    (char *) node->data, FALSE);
-			g_free (node->data);
+	ImOpJournal *journal;
+	GList *entries, *node;
+	GPtrArray *message_uids;
+	guint count = 0;
+
+	journal = im_op_journal_get_instance ();
+	entries = im_op_journal_peek (journal, account_id);
+	message_uids = g_ptr_array_new ();
+
+	node = entries;
+	while (_error == NULL && node != NULL) {
+		ImOpJournalEntry *first = (ImOpJournalEntry *) node->data;
+
+		g_ptr_array_set_size (message_uids, 0);
+		for (; node != NULL && is_same_journal_batch (first, node->data);
+		     node = g_list_next (node))
+			g_ptr_array_add (message_uids, ((ImOpJournalEntry *) node->data)->message_uid);
+
+		if (first->type == IM_OP_JOURNAL_ENTRY_FLAGS) {
+			flag_messages_sync (service_mgr, account_id, first->folder_name,
+					    message_uids, first->set_flags, first->unset_flags,
+					    FALSE, cancellable, &_error);
+		} else if (!first->delete_originals ||
+			   restore_moved_messages_sync (service_mgr, account_id, first->folder_name,
+							message_uids, cancellable, &_error)) {
+			transfer_messages_sync (service_mgr, account_id, first->folder_name,
+						message_uids, first->dest_account_id,
+						first->dest_folder_name, first->delete_originals,
+						NULL, NULL, FALSE, cancellable, &_error);
 		}
-		g_list_free (unset_user_flags);
-		
-		for (node = set_user_flags; node != NULL; node = g_list_next (node)) {
-			camel_folder_set_message_user_flag (folder, message_uid,
-							    (char *) node->data, TRUE);
-			g_free (node->data);
+
+		if (_error && !is_connection_error (_error) &&
+		    !g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning ("%s: dropping %u journaled operations on %s of %s: %s",
+				   __FUNCTION__, message_uids->len, first->folder_name,
+				   account_id, _error->message);
+			g_clear_error (&_error);
+			im_op_journal_remove_head (journal, account_id, message_uids->len);
+		} else if (_error == NULL) {
+			im_op_journal_remove_head (journal, account_id, message_uids->len);
+			count += message_uids->len;
 		}
-		g_list_free (set_user_flags);
-		
-		/* We don't wait for result */
-		camel_folder_synchronize_message (folder, message_uid,
-						  G_PRIORITY_DEFAULT_IDLE, NULL,
-						  NULL, NULL);
 	}
 
+	g_ptr_array_free (message_uids, TRUE);
+	im_op_journal_free_entries (entries);
+
+	if (replayed)
+		*replayed = count;
+
 	if (_error)
 		g_propagate_error (error, _error);
 
@@ -982,105 +5290,101 @@ im_mail_op_flag_message_sync (ImServiceMgr *service_mgr,
 }
 
 static void
-im_mail_op_flag_message_thread (GSimpleAsyncResult *simple,
-				GObject *object,
-				GCancellable *cancellable)
+im_mail_op_replay_journal_thread (GSimpleAsyncResult *simple,
+				  GObject *object,
+				  GCancellable *cancellable)
 {
 	GError *_error = NULL;
-	FlagMessageAsyncContext *context;
+	ReplayJournalAsyncContext *context;
 
-	context = (FlagMessageAsyncContext *)
+	context = (ReplayJournalAsyncContext *)
 		g_simple_async_result_get_op_res_gpointer (simple);
 
-	im_mail_op_flag_message_sync (IM_SERVICE_MGR (object),
-				      context->account_id,
-				      context->folder_name,
-				      context->message_uid,
-				      context->set_flags,
-				      context->unset_flags,
-				      cancellable,
-				      &_error);
-	
+	im_mail_op_replay_journal_sync (IM_SERVICE_MGR (object),
+					context->account_id,
+					&context->replayed,
+					cancellable,
+					&_error);
+
 	if (_error != NULL)
 		g_simple_async_result_take_error (simple, _error);
 }
 
 /**
- * im_mail_op_flag_message_async:
+ * im_mail_op_replay_journal_async:
  * @mgr: a #ImServiceMgr
  * @account_id: an account id
- * @folder_name: a folder name
- * @message_uid: a message uid
- * @set_flags: a string with the list of flags to set
- * @unset_flags: a string with the list of flags to unset
  * @io_priority: the I/O priority of the request
  * @cancellable: optional #GCancellable object, or %NULL,
  * @callback: a #GAsyncReadyCallback to call when the request is finished
  * @userdata: data to pass to callback
  *
- * Asynchronously modifies the flags and user flags of the message with @message_uid 
- * from folder @folder_name in account @account_id.
+ * Asynchronously replays the operations kept in the #ImOpJournal of
+ * account @account_id.
  *
  * When the operation is finished, @callback is called. The you should call
- * im_mail_op_flag_message_finish() to get the result of the operation.
+ * im_mail_op_replay_journal_finish() to get the result of the operation.
  */
 void
-im_mail_op_flag_message_async (ImServiceMgr *mgr,
-			       const gchar *account_id,
-			       const gchar *folder_name,
-			       const gchar *message_uid,
-			       const gchar *set_flags,
-			       const gchar *unset_flags,
-			       int io_priority,
-			       GCancellable *cancellable,
-			       GAsyncReadyCallback callback,
-			       gpointer userdata)
+im_mail_op_replay_journal_async (ImServiceMgr *mgr,
+				 const gchar *account_id,
+				 int io_priority,
+				 GCancellable *cancellable,
+				 GAsyncReadyCallback callback,
+				 gpointer userdata)
 {
 	GSimpleAsyncResult *simple;
-	FlagMessageAsyncContext *context;
+	ReplayJournalAsyncContext *context;
 
-	context = g_new0 (FlagMessageAsyncContext, 1);
+	context = g_new0 (ReplayJournalAsyncContext, 1);
 	context->account_id = g_strdup (account_id);
-	context->folder_name = g_strdup (folder_name);
-	context->message_uid = g_strdup (message_uid);
-	context->set_flags = g_strdup (set_flags);
-	context->unset_flags = g_strdup (unset_flags);
 
 	simple = g_simple_async_result_new (G_OBJECT (mgr),
 					    callback, userdata,
-					    im_mail_op_flag_message_async);
+					    im_mail_op_replay_journal_async);
 
-	g_simple_async_result_set_op_res_gpointer (simple, context, 
-						   (GDestroyNotify) flag_message_async_context_free);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) replay_journal_async_context_free);
 
 	g_simple_async_result_run_in_thread (simple,
-					     im_mail_op_flag_message_thread,
+					     im_mail_op_replay_journal_thread,
 					     io_priority, cancellable);
 	g_object_unref (simple);
 }
 
 /**
- * im_mail_op_flag_message_finish:
+ * im_mail_op_replay_journal_finish:
  * @mgr: a #ImServiceMgr
  * @result: a #GAsyncResult
+ * @replayed: (out) (allow-none): return location for the number of
+ * operations replayed, or %NULL
  * @error: (out) (allow-none): return location for a #GError, or %NULL
  *
- * Finishes the operation started with im_mail_op_flag_message_async().
+ * Finishes the operation started with im_mail_op_replay_journal_async().
+ * @replayed is set even if the operation failed after replaying some
+ * of the operations.
  *
  * Returns: %TRUE on success, %FALSE otherwise.
  */
 gboolean
-im_mail_op_flag_message_finish (ImServiceMgr *mgr,
-				GAsyncResult *result,
-				GError **error)
+im_mail_op_replay_journal_finish (ImServiceMgr *mgr,
+				  GAsyncResult *result,
+				  guint *replayed,
+				  GError **error)
 {
 	GSimpleAsyncResult *simple;
+	ReplayJournalAsyncContext *context;
 
 	g_return_val_if_fail (
 		g_simple_async_result_is_valid (
-		result, G_OBJECT (mgr), im_mail_op_flag_message_async), FALSE);
+		result, G_OBJECT (mgr), im_mail_op_replay_journal_async), FALSE);
 
 	simple = G_SIMPLE_ASYNC_RESULT (result);
+	context = (ReplayJournalAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	if (replayed)
+		*replayed = context->replayed;
 
 	return !g_simple_async_result_propagate_error (simple, error);
 }
@@ -1089,6 +5393,7 @@ typedef struct _ComposerSaveAsyncContext {
 	CamelMimeMessage *message;
 	gchar *body;
 	GList *attachment_uris;
+	gchar *replace_uid;
 	gchar *uid;
 } ComposerSaveAsyncContext;
 
@@ -1099,16 +5404,343 @@ composer_save_async_context_free (ComposerSaveAsyncContext *context)
 	g_free (context->body);
 	g_list_foreach (context->attachment_uris, (GFunc) g_free, NULL);
 	g_list_free (context->attachment_uris);
+	g_free (context->replace_uid);
 	g_free (context->uid);
 	g_free (context);
 }
 
+/* Identifies the content of the attachment @attachment_uri, by its
+ * uri, size and modification time. It's hashed, as it's stored in the
+ * message and we don't want to disclose local paths */
+static gchar *
+get_attachment_source_key (const gchar *attachment_uri,
+			   GCancellable *cancellable)
+{
+	GFile *file;
+	GFileInfo *info;
+	gchar *key = NULL;
+
+	file = g_file_new_for_uri (attachment_uri);
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+				  G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+	if (info && g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)) {
+		gchar *source;
+
+		source = g_strdup_printf ("%s %" G_GINT64_FORMAT " %" G_GUINT64_FORMAT ".%06u",
+					  attachment_uri,
+					  (gint64) g_file_info_get_size (info),
+					  g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+					  g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+		key = g_compute_checksum_for_string (G_CHECKSUM_SHA256, source, -1);
+		g_free (source);
+	}
+	if (info)
+		g_object_unref (info);
+	g_object_unref (file);
+
+	return key;
+}
+
+/* An attachment encoded in base64 to an unlinked temporary file, so
+ * it's never fully loaded in memory */
+typedef struct _EncodedAttachment {
+	gchar *uri;
+	gint fd;
+	gchar *mime_type;
+	gchar *source_key;
+	GError *error;
+	GCancellable *cancellable;
+} EncodedAttachment;
+
+static void
+encoded_attachment_free (EncodedAttachment *attachment)
+{
+	if (attachment->fd != -1)
+		close (attachment->fd);
+	g_free (attachment->uri);
+	g_free (attachment->mime_type);
+	g_free (attachment->source_key);
+	if (attachment->error)
+		g_error_free (attachment->error);
+	g_slice_free (EncodedAttachment, attachment);
+}
+
+static glong
+get_peak_rss (void)
+{
+	struct rusage usage;
+
+	if (getrusage (RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	/* In KiB */
+	return usage.ru_maxrss;
+}
+
+static gboolean
+encode_attachment_sync (EncodedAttachment *attachment,
+			GCancellable *cancellable,
+			GError **error)
+{
+	GError *_error = NULL;
+	GFile *file;
+	GFileInputStream *input;
+	GOutputStream *output = NULL;
+	gchar *tmp_path = NULL;
+	guchar *in_buffer, *out_buffer;
+	gint state = 0, save = 0;
+	gsize out_len;
+
+	/* Taken before reading, so a change while we encode it does not
+	 * make next saves reuse stale content */
+	attachment->source_key = get_attachment_source_key (attachment->uri, cancellable);
+	file = g_file_new_for_uri (attachment->uri);
+	input = g_file_read (file, cancellable, &_error);
+	if (input) {
+		GFileInfo *info;
+
+		info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+					  G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+		if (info && g_file_info_get_content_type (info))
+			attachment->mime_type = g_content_type_get_mime_type (g_file_info_get_content_type (info));
+		if (info)
+			g_object_unref (info);
+
+		/* The file is unlinked right away, so it goes away with
+		 * the descriptor, even if we crash */
+		attachment->fd = g_file_open_tmp ("iwkmail-attachment-XXXXXX", &tmp_path, &_error);
+		if (attachment->fd != -1) {
+			g_unlink (tmp_path);
+			output = g_unix_output_stream_new (attachment->fd, FALSE);
+		}
+		g_free (tmp_path);
+	}
+
+	/* Room for a chunk encoded with line breaks, as documented in g_base64_encode_step() */
+	in_buffer = g_malloc (IM_ATTACHMENT_CHUNK_SIZE);
+	out_len = (IM_ATTACHMENT_CHUNK_SIZE / 3 + 1) * 4 + 4;
+	out_len += out_len / 72 + 1;
+	out_buffer = g_malloc (out_len);
+
+	while (_error == NULL) {
+		gssize read_bytes;
+		gsize encoded;
+
+		read_bytes = g_input_stream_read (G_INPUT_STREAM (input), in_buffer,
+						  IM_ATTACHMENT_CHUNK_SIZE,
+						  cancellable, &_error);
+		if (read_bytes <= 0)
+			break;
+
+		encoded = g_base64_encode_step (in_buffer, read_bytes, TRUE,
+						(gchar *) out_buffer, &state, &save);
+		g_output_stream_write_all (output, out_buffer, encoded, NULL,
+					   cancellable, &_error);
+	}
+
+	if (_error == NULL) {
+		gsize encoded;
+
+		encoded = g_base64_encode_close (TRUE, (gchar *) out_buffer, &state, &save);
+		g_output_stream_write_all (output, out_buffer, encoded, NULL,
+					   cancellable, &_error);
+	}
+
+	if (_error == NULL && lseek (attachment->fd, 0, SEEK_SET) == (off_t) -1) {
+		g_set_error (&_error, G_IO_ERROR, g_io_error_from_errno (errno),
+			     "%s", g_strerror (errno));
+	}
+
+	g_free (in_buffer);
+	g_free (out_buffer);
+	if (output)
+		g_object_unref (output);
+	if (input)
+		g_object_unref (input);
+	g_object_unref (file);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static void
+encode_attachment_func (gpointer data,
+			gpointer userdata)
+{
+	EncodedAttachment *attachment = (EncodedAttachment *) data;
+
+	encode_attachment_sync (attachment, attachment->cancellable, &attachment->error);
+}
+
+/* Encodes the attachments in parallel, in at most
+ * #IM_ATTACHMENT_ENCODE_THREADS threads */
+static GPtrArray *
+encode_attachments_sync (GList *attachment_uris,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	GPtrArray *attachments;
+	GThreadPool *pool;
+	GError *_error = NULL;
+	GList *node;
+	gint i;
+
+	attachments = g_ptr_array_new_with_free_func ((GDestroyNotify) encoded_attachment_free);
+	pool = g_thread_pool_new (encode_attachment_func, NULL,
+				  IM_ATTACHMENT_ENCODE_THREADS, FALSE, &_error);
+	for (node = attachment_uris; _error == NULL && node != NULL; node = g_list_next (node)) {
+		EncodedAttachment *attachment;
+
+		attachment = g_slice_new0 (EncodedAttachment);
+		attachment->uri = g_strdup ((gchar *) node->data);
+		attachment->fd = -1;
+		attachment->cancellable = cancellable;
+		g_ptr_array_add (attachments, attachment);
+		g_thread_pool_push (pool, attachment, &_error);
+	}
+	/* Waits for all the attachments */
+	if (pool)
+		g_thread_pool_free (pool, _error != NULL, TRUE);
+
+	for (i = 0; _error == NULL && i < attachments->len; i++) {
+		EncodedAttachment *attachment = (EncodedAttachment *) attachments->pdata[i];
+
+		if (attachment->error) {
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_SEND_INVALID_ATTACHMENT,
+				     _("Failed to get attachment data: %s"),
+				     attachment->error->message);
+		}
+	}
+
+	if (_error) {
+		g_ptr_array_unref (attachments);
+		g_propagate_error (error, _error);
+		return NULL;
+	}
+
+	return attachments;
+}
+
+static gchar *
+get_attachment_filename (const gchar *attachment_uri)
+{
+	SoupURI *uri;
+	gchar *filename = NULL;
+
+	uri = soup_uri_new (attachment_uri);
+	if (uri && soup_uri_get_path (uri))
+		filename = g_path_get_basename (soup_uri_get_path (uri));
+	if (uri)
+		soup_uri_free (uri);
+
+	return filename;
+}
+
+static CamelMimePart *
+create_attachment_part (EncodedAttachment *attachment)
+{
+	CamelMimePart *part;
+	CamelDataWrapper *content;
+	CamelStream *stream;
+	gchar *filename;
+
+	part = camel_mime_part_new ();
+	camel_mime_part_set_disposition (part, "attachment");
+	filename = get_attachment_filename (attachment->uri);
+	if (filename)
+		camel_mime_part_set_filename (part, filename);
+	g_free (filename);
+	if (attachment->source_key)
+		camel_medium_set_header (CAMEL_MEDIUM (part), IM_ATTACHMENT_SOURCE_HEADER,
+					 attachment->source_key);
+
+	/* Content is already encoded, so it's written as is, and
+	 * the stream takes the descriptor */
+	stream = camel_stream_fs_new_with_fd (attachment->fd);
+	attachment->fd = -1;
+	content = camel_data_wrapper_new ();
+	camel_data_wrapper_construct_from_stream_sync (content, stream, NULL, NULL);
+	content->encoding = CAMEL_TRANSFER_ENCODING_BASE64;
+	camel_data_wrapper_set_mime_type (content,
+					  attachment->mime_type?attachment->mime_type:"application/octet-stream");
+	camel_medium_set_content (CAMEL_MEDIUM (part), content);
+	camel_mime_part_set_encoding (part, CAMEL_TRANSFER_ENCODING_BASE64);
+	g_object_unref (content);
+	g_object_unref (stream);
+
+	return part;
+}
+
+static void
+free_part_queue (GQueue *queue)
+{
+	g_queue_foreach (queue, (GFunc) g_object_unref, NULL);
+	g_queue_free (queue);
+}
+
+/* Gets the attachment parts of the message @uid in @folder, by the
+ * source key of the file they were encoded from. They keep the encoded
+ * content, so they can be added to a new message without encoding the
+ * attachment again */
+static GHashTable *
+get_reusable_attachments (CamelFolder *folder,
+			  const gchar *uid,
+			  GCancellable *cancellable)
+{
+	GHashTable *result;
+	CamelMimeMessage *message;
+	CamelDataWrapper *content;
+
+	result = g_hash_table_new_full (g_str_hash, g_str_equal,
+					g_free, (GDestroyNotify) free_part_queue);
+
+	message = camel_folder_get_message_sync (folder, uid, cancellable, NULL);
+	if (message == NULL)
+		return result;
+
+	content = camel_medium_get_content (CAMEL_MEDIUM (message));
+	if (CAMEL_IS_MULTIPART (content)) {
+		guint i, count;
+
+		count = camel_multipart_get_number (CAMEL_MULTIPART (content));
+		for (i = 0; i < count; i++) {
+			CamelMimePart *part;
+			const gchar *key;
+			GQueue *queue;
+
+			part = camel_multipart_get_part (CAMEL_MULTIPART (content), i);
+			key = camel_medium_get_header (CAMEL_MEDIUM (part), IM_ATTACHMENT_SOURCE_HEADER);
+			if (g_strcmp0 (camel_mime_part_get_disposition (part), "attachment") != 0 ||
+			    key == NULL)
+				continue;
+
+			queue = g_hash_table_lookup (result, key);
+			if (queue == NULL) {
+				queue = g_queue_new ();
+				g_hash_table_insert (result, g_strdup (key), queue);
+			}
+			g_queue_push_tail (queue, g_object_ref (part));
+		}
+	}
+	g_object_unref (message);
+
+	return result;
+}
+
+
 /**
  * im_mail_op_composer_save_sync:
  * @folder: a #CamelFolder
  * @message: a #CamelMimeMessage
  * @body: a string with the plain text body
  * @attachment_uris: (element-type utf-8): list of attachment URIS
+ * @replace_uid: (allow-none): UID of a message in @folder replaced by @message, or %NULL
  * @uid: (out) (allow-none): the UID of the appended message.
  * @cancellable: optional #GCancellable object, or %NULL.
  * @error: (out) (allow-none): return location for a #GError, or %NULL.
@@ -1116,6 +5748,17 @@ composer_save_async_context_free (ComposerSaveAsyncContext *context)
  * Appends @message to @folder, creating its parts structure
  * from @body and @attachment_uris.
  *
+ * Attachments are read and encoded in parallel, in chunks of
+ * #IM_ATTACHMENT_CHUNK_SIZE, to temporary files, so they're never
+ * fully loaded in memory.
+ *
+ * If @replace_uid is set, attachments encoded from the same file as the
+ * ones in the replaced message, with the same uri, size and modification
+ * time, reuse its already encoded parts. The replaced message is removed
+ * once @message has been appended, so @folder never misses a copy of the
+ * message, and other messages of @folder are not expunged. This is used
+ * to autosave drafts.
+ *
  * Returns: %TRUE if successful, %FALSE otherwise.
  */
 gboolean
@@ -1123,16 +5766,24 @@ im_mail_op_composer_save_sync (CamelFolder *folder,
 			       CamelMimeMessage *message,
 			       const gchar *body,
 			       GList *attachment_uris,
+			       const gchar *replace_uid,
 			       gchar **uid,
 			       GCancellable *cancellable,
 			       GError **error)
 {
 	GError *_error = NULL;
+	gint64 start;
+	guint reused = 0;
+
+	start = g_get_monotonic_time ();
 
 	if (attachment_uris) {
 		CamelMultipart *multipart;
 		CamelMimePart *body_part;
-		GList *node;
+		GPtrArray *attachments, *parts;
+		GHashTable *reusable = NULL;
+		GList *node, *to_encode = NULL;
+		gint i, j;
 
 		multipart = camel_multipart_new ();
 		camel_data_wrapper_set_mime_type (CAMEL_DATA_WRAPPER (multipart), "multipart/mixed");
@@ -1142,45 +5793,53 @@ im_mail_op_composer_save_sync (CamelFolder *folder,
 		camel_mime_part_set_content (CAMEL_MIME_PART (body_part), body, strlen (body), "text/plain; charset=utf8");
 		camel_multipart_add_part (multipart, body_part);
 
-		for (node = attachment_uris; _error == NULL && node != NULL; node = g_list_next (node)) {
-			CamelMimePart *part = camel_mime_part_new ();
-			CamelStream *content_stream;
-			SoupURI *uri;
-			const char *path;
-
-			uri = soup_uri_new ((char *) node->data);
-			path = soup_uri_get_path (uri);
-			camel_mime_part_set_disposition (part, "attachment");
-			if (path) {
-				gchar *filename = g_path_get_basename (path);
-				camel_mime_part_set_filename (part, filename);
-				g_free (filename);
+		if (replace_uid)
+			reusable = get_reusable_attachments (folder, replace_uid, cancellable);
+
+		/* Parts reused from the replaced message, or NULL for
+		 * the attachments to encode */
+		parts = g_ptr_array_new ();
+		for (node = attachment_uris; node != NULL; node = g_list_next (node)) {
+			CamelMimePart *part = NULL;
+			gchar *key = NULL;
+
+			if (reusable && g_hash_table_size (reusable) > 0)
+				key = get_attachment_source_key ((gchar *) node->data, cancellable);
+			if (key) {
+				GQueue *queue = g_hash_table_lookup (reusable, key);
+				if (queue)
+					part = g_queue_pop_head (queue);
 			}
-			soup_uri_free (uri);
-
-			content_stream = camel_stream_vfs_new_with_uri ((gchar *) node->data, CAMEL_STREAM_VFS_READ);
-			if (content_stream) {
-				CamelDataWrapper *content;
-
-				content = camel_data_wrapper_new ();
-				if (camel_data_wrapper_construct_from_stream_sync (content, 
-										    content_stream, 
-										    cancellable,
-										    &_error)) {
-					camel_medium_set_content (CAMEL_MEDIUM (part), content);
-				}
+			g_free (key);
 
-				g_object_unref (content);
-			} else {
-				g_set_error (&_error, IM_ERROR_DOMAIN,
-					     IM_ERROR_SEND_INVALID_ATTACHMENT,
-					     _("Failed to get attachment data"));
-			}
+			if (part)
+				reused++;
+			else
+				to_encode = g_list_prepend (to_encode, node->data);
+			g_ptr_array_add (parts, part);
+		}
+		to_encode = g_list_reverse (to_encode);
+		if (reusable)
+			g_hash_table_destroy (reusable);
+
+		attachments = NULL;
+		if (to_encode)
+			attachments = encode_attachments_sync (to_encode, cancellable, &_error);
+		g_list_free (to_encode);
+
+		for (i = 0, j = 0; i < parts->len; i++) {
+			CamelMimePart *part = (CamelMimePart *) parts->pdata[i];
 
-			if (_error == NULL)
+			if (part == NULL && attachments != NULL)
+				part = create_attachment_part ((EncodedAttachment *) attachments->pdata[j++]);
+			if (part) {
 				camel_multipart_add_part (multipart, part);
-			g_object_unref (part);
+				g_object_unref (part);
+			}
 		}
+		g_ptr_array_free (parts, TRUE);
+		if (attachments)
+			g_ptr_array_unref (attachments);
 
 		camel_medium_set_content (CAMEL_MEDIUM (message), CAMEL_DATA_WRAPPER (multipart));
 		g_object_unref (multipart);
@@ -1197,6 +5856,25 @@ im_mail_op_composer_save_sync (CamelFolder *folder,
 						  cancellable, &_error);
 	}
 
+	/* The new message is already stored, so failing to remove the
+	 * old one is not fatal */
+	if (_error == NULL && replace_uid) {
+		GError *replace_error = NULL;
+
+		if (!expunge_message_sync (folder, replace_uid, cancellable, &replace_error)) {
+			g_warning ("Failed to remove replaced message %s: %s",
+				   replace_uid, replace_error->message);
+			g_error_free (replace_error);
+		}
+	}
+
+	if (attachment_uris) {
+		g_debug ("Saved message with %u attachments (%u reused) in %" G_GINT64_FORMAT " ms, peak RSS %ld KiB",
+			 g_list_length (attachment_uris), reused,
+			 (g_get_monotonic_time () - start) / 1000,
+			 get_peak_rss ());
+	}
+
 	if (_error)
 		g_propagate_error (error, _error);
 
@@ -1218,6 +5896,7 @@ im_mail_op_composer_save_thread (GSimpleAsyncResult *simple,
 				       context->message, 
 				       context->body,
 				       context->attachment_uris,
+				       context->replace_uid,
 				       &(context->uid),
 				       cancellable,
 				       &_error);
@@ -1233,6 +5912,7 @@ im_mail_op_composer_save_thread (GSimpleAsyncResult *simple,
  * @message: a #CamelMimeMessage
  * @body: a string with the plain text body
  * @attachment_uris: (element-type utf-8): list of attachment URIS
+ * @replace_uid: (allow-none): UID of a message in @folder replaced by @message, or %NULL
  * @io_priority: the I/O priority of the request
  * @cancellable: optional #GCancellable object, or %NULL,
  * @callback: a #GAsyncReadyCallback to call when the request is finished
@@ -1249,6 +5929,7 @@ im_mail_op_composer_save_async (CamelFolder *folder,
 				CamelMimeMessage *message,
 				const gchar *body,
 				GList *attachment_uris,
+				const gchar *replace_uid,
 				int io_priority,
 				GCancellable *cancellable,
 				GAsyncReadyCallback callback,
@@ -1267,6 +5948,7 @@ im_mail_op_composer_save_async (CamelFolder *folder,
 							   g_strdup (node->data));
 	}
 	context->attachment_uris = g_list_reverse (context->attachment_uris);
+	context->replace_uid = g_strdup (replace_uid);
 	context->uid = NULL;
 
 	simple = g_simple_async_result_new (G_OBJECT (folder),
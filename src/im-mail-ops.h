@@ -38,26 +38,218 @@
 #ifndef IM_MAIL_OPS_H
 #define IM_MAIL_OPS_H 1
 
+#include "im-local-compactor.h"
 #include "im-service-mgr.h"
+#include "im-sort-index.h"
 
 #include <camel/camel.h>
 #include <glib.h>
 
 G_BEGIN_DECLS
 
+/* Messages claimed and sent between outbox flushes */
+#define IM_SEND_QUEUE_BATCH_SIZE 20
+
+/* Attachments read and encoded at a time, and bytes read on each
+ * step. Chunk size is a multiple of 3, so base64 encoded chunks
+ * don't need padding */
+#define IM_ATTACHMENT_ENCODE_THREADS 4
+#define IM_ATTACHMENT_CHUNK_SIZE (48 * 1024)
+
+/* Header of the attachment parts of saved messages, identifying the
+ * file they were encoded from, so next saves can reuse them */
+#define IM_ATTACHMENT_SOURCE_HEADER "X-Iwk-Attachment-Source"
+
+/* Messages changed between folder flushes in folder operations */
+#define IM_FOLDER_OPERATION_CHUNK_SIZE 500
+
+/* User tags of outbox messages */
+#define IM_OUTBOX_SEND_STATUS "iwk-send-status"
+#define IM_OUTBOX_SEND_STATUS_COPYING_TO_SENTBOX "copying-to-sentbox"
+#define IM_OUTBOX_SEND_STATUS_FAILED "failed"
+#define IM_OUTBOX_SEND_STATUS_RETRY "retry"
+#define IM_OUTBOX_SEND_STATUS_SEND "send"
+#define IM_OUTBOX_SEND_STATUS_SENDING "sending"
+#define IM_OUTBOX_SEND_STATUS_SENT "sent"
+#define IM_OUTBOX_SEND_ATTEMPTS "iwk-send-attempts"
+#define IM_OUTBOX_SEND_NEXT_ATTEMPT "iwk-send-next-attempt" /* seconds since the epoch */
+#define IM_OUTBOX_SEND_CLAIMED "iwk-send-claimed" /* seconds since the epoch */
+
+/* Seconds after which a message still marked as being sent is considered
+ * abandoned by a crashed run, and queued again */
+#define IM_SEND_QUEUE_CLAIM_TIMEOUT (60 * 60)
+
+/**
+ * ImFolderOperation:
+ * @IM_FOLDER_OPERATION_MARK_READ: mark all the messages as read
+ * @IM_FOLDER_OPERATION_EXPUNGE: remove the messages marked as deleted
+ * @IM_FOLDER_OPERATION_EMPTY: remove all the messages
+ *
+ * Operations on all the messages of a folder.
+ */
+typedef enum {
+	IM_FOLDER_OPERATION_MARK_READ,
+	IM_FOLDER_OPERATION_EXPUNGE,
+	IM_FOLDER_OPERATION_EMPTY
+} ImFolderOperation;
+
+/**
+ * ImFolderOperationProgressFunc:
+ * @folder: the folder being processed
+ * @processed: messages processed so far
+ * @total: messages to process
+ * @userdata: data passed to the operation
+ *
+ * Reports progress of a folder operation. It's called in the thread
+ * running the operation.
+ */
+typedef void (*ImFolderOperationProgressFunc) (CamelFolder *folder,
+					       guint processed,
+					       guint total,
+					       gpointer userdata);
+
+typedef struct _ImSendQueueStats ImSendQueueStats;
+typedef struct _ImSendQueuePolicy ImSendQueuePolicy;
+
+/**
+ * ImSendQueueStats:
+ * @queued: messages waiting to be sent when the run started
+ * @sent: messages sent successfully
+ * @retried: messages that failed, and will be retried
+ * @failed: messages that failed too many times, and will not be retried
+ * @elapsed: duration of the run, in microseconds
+ * @to_sentbox: messages sent, waiting to be moved to the sent folder
+ * @next_attempt: earliest time a message should be retried, in seconds
+ * since the epoch, or 0 if there's nothing to retry
+ * @next_send: earliest monotonic time the rate limit allows sending next
+ * message, in microseconds. Pass it to next run in #ImSendQueuePolicy
+ * @throttled: the run stopped with messages waiting because of the rate
+ * limit. They should be sent in a new run at @next_send
+ *
+ * Statistics of a send queue run.
+ */
+struct _ImSendQueueStats {
+	guint queued;
+	guint sent;
+	guint retried;
+	guint failed;
+	gint64 elapsed;
+	guint to_sentbox;
+	gint64 next_attempt;
+	gint64 next_send;
+	gboolean throttled;
+};
+
+/**
+ * ImSendQueuePolicy:
+ * @rate_limit: maximum messages sent per minute, or 0 for no limit
+ * @retry_delay: delay before the first retry of a message, in seconds. It
+ * doubles on each failed attempt
+ * @retry_max_delay: maximum delay between retries, in seconds
+ * @max_attempts: attempts before a message is marked as failed
+ * @next_send: the @next_send of previous run of the queue, so the rate
+ * limit holds between runs, or 0
+ *
+ * How a send queue run sends and retries messages.
+ */
+struct _ImSendQueuePolicy {
+	guint rate_limit;
+	guint retry_delay;
+	guint retry_max_delay;
+	guint max_attempts;
+	gint64 next_send;
+};
+
+/**
+ * ImSendQueueProgressFunc:
+ * @outbox: the outbox being processed
+ * @stats: statistics of the run so far
+ * @userdata: data passed to the operation
+ *
+ * Reports progress of a send queue run. It's called in the thread
+ * running the queue.
+ */
+typedef void (*ImSendQueueProgressFunc) (CamelFolder *outbox,
+					 const ImSendQueueStats *stats,
+					 gpointer userdata);
+
+typedef struct _ImUnifiedInboxMessage ImUnifiedInboxMessage;
+typedef struct _ImUnifiedInboxPage ImUnifiedInboxPage;
+
+/**
+ * ImUnifiedInboxMessage:
+ * @account_id: the account of the message
+ * @folder: the inbox of the account
+ * @info: the #CamelMessageInfo of the message
+ *
+ * A message of the unified inbox.
+ */
+struct _ImUnifiedInboxMessage {
+	gchar *account_id;
+	CamelFolder *folder;
+	CamelMessageInfo *info;
+};
+
+/**
+ * ImUnifiedInboxPage:
+ * @new_messages: (element-type ImUnifiedInboxMessage): messages arrived
+ * after the newest cursor, from newest to oldest
+ * @messages: (element-type ImUnifiedInboxMessage): messages older than
+ * the oldest cursor, from newest to oldest
+ * @newest_cursor: cursor to pass to get the messages arriving later
+ * @oldest_cursor: cursor to pass to get the next page
+ *
+ * A page of the unified inbox. Free it with im_unified_inbox_page_free().
+ */
+struct _ImUnifiedInboxPage {
+	GPtrArray *new_messages;
+	GPtrArray *messages;
+	gchar *newest_cursor;
+	gchar *oldest_cursor;
+};
+
+void              im_unified_inbox_page_free              (ImUnifiedInboxPage *page);
+
 gboolean          im_mail_op_run_send_queue_sync          (CamelFolder *outbox,
+							   const ImSendQueuePolicy *policy,
+							   ImSendQueueProgressFunc progress_func,
+							   gpointer progress_data,
+							   ImSendQueueStats *stats,
 							   GCancellable *cancellable,
 							   GError **error);
 void              im_mail_op_run_send_queue_async         (CamelFolder *outbox,
+							   const ImSendQueuePolicy *policy,
+							   ImSendQueueProgressFunc progress_func,
+							   gpointer progress_data,
 							   int io_priority,
 							   GCancellable *cancellable,
 							   GAsyncReadyCallback callback,
 							   gpointer userdata);
 gboolean          im_mail_op_run_send_queue_finish        (CamelFolder *outbox,
 							   GAsyncResult *result,
+							   ImSendQueueStats *stats,
+							   GError **error);
+
+gboolean          im_mail_op_transfer_sent_sync           (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   guint *transferred,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_transfer_sent_async          (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_transfer_sent_finish         (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   guint *transferred,
 							   GError **error);
 
 CamelFolderInfo * im_mail_op_synchronize_store_sync       (CamelStore *store,
+							   ImLocalCompactor *compactor,
+							   guint *duplicates,
+							   guint64 *duplicates_size,
 							   GCancellable *cancellable,
 							   GError **error);
 void              im_mail_op_synchronize_store_async      (CamelStore *store,
@@ -67,7 +259,12 @@ void              im_mail_op_synchronize_store_async      (CamelStore *store,
 							   gpointer userdata);
 CamelFolderInfo * im_mail_op_synchronize_store_finish     (CamelStore *store,
 							   GAsyncResult *result,
+							   guint *duplicates,
+							   guint64 *duplicates_size,
 							   GError **error);
+void              im_mail_op_forget_message_ids           (CamelStore *store,
+							   CamelFolder *folder,
+							   GPtrArray *uids);
 
 gboolean          im_mail_op_refresh_folder_info_sync     (ImServiceMgr *mgr,
 							   const gchar *account_id,
@@ -87,6 +284,108 @@ gboolean          im_mail_op_refresh_folder_info_finish   (ImServiceMgr *mgr,
 							   CamelFolder **folder,
 							   GError **error);
 
+gboolean          im_mail_op_search_sync                  (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *query,
+							   const gchar *oldest_uid,
+							   guint count,
+							   CamelFolder **folder,
+							   GPtrArray **uids,
+							   guint *total,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_search_async                 (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *query,
+							   const gchar *oldest_uid,
+							   guint count,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_search_finish                (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   CamelFolder **folder,
+							   GPtrArray **uids,
+							   guint *total,
+							   GError **error);
+
+gboolean          im_mail_op_fetch_unified_inbox_sync     (ImServiceMgr *mgr,
+							   const gchar *newest_cursor,
+							   const gchar *oldest_cursor,
+							   guint count,
+							   ImUnifiedInboxPage **page,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_fetch_unified_inbox_async    (ImServiceMgr *mgr,
+							   const gchar *newest_cursor,
+							   const gchar *oldest_cursor,
+							   guint count,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_fetch_unified_inbox_finish   (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   ImUnifiedInboxPage **page,
+							   GError **error);
+
+gboolean          im_mail_op_fetch_threads_sync           (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *oldest_cursor,
+							   guint count,
+							   CamelFolder **folder,
+							   GPtrArray **threads,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_fetch_threads_async          (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *oldest_cursor,
+							   guint count,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_fetch_threads_finish         (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   CamelFolder **folder,
+							   GPtrArray **threads,
+							   GError **error);
+
+gboolean          im_mail_op_fetch_sorted_messages_sync   (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   ImSortKey sort_key,
+							   const gchar *newest_uid,
+							   const gchar *oldest_uid,
+							   guint count,
+							   CamelFolder **folder,
+							   GPtrArray **new_uids,
+							   GPtrArray **uids,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_fetch_sorted_messages_async  (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   ImSortKey sort_key,
+							   const gchar *newest_uid,
+							   const gchar *oldest_uid,
+							   guint count,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_fetch_sorted_messages_finish (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   CamelFolder **folder,
+							   GPtrArray **new_uids,
+							   GPtrArray **uids,
+							   GError **error);
+
 CamelMimeMessage *im_mail_op_get_message_sync             (ImServiceMgr *service_mgr,
 							   const gchar *account_id,
 							   const gchar *folder_name,
@@ -127,10 +426,133 @@ gboolean          im_mail_op_flag_message_finish          (ImServiceMgr *mgr,
 							   GAsyncResult *result,
 							   GError **error);
 
+gboolean          im_mail_op_remove_message_sync          (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *message_uid,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_remove_message_async         (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   const gchar *message_uid,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_remove_message_finish        (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   GError **error);
+
+gboolean          im_mail_op_flag_messages_sync           (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   GPtrArray *message_uids,
+							   const gchar *set_flags,
+							   const gchar *unset_flags,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_flag_messages_async          (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   GPtrArray *message_uids,
+							   const gchar *set_flags,
+							   const gchar *unset_flags,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_flag_messages_finish         (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   GError **error);
+
+gboolean          im_mail_op_folder_operation_sync        (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   ImFolderOperation operation,
+							   ImFolderOperationProgressFunc progress_func,
+							   gpointer progress_data,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_folder_operation_async       (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   ImFolderOperation operation,
+							   ImFolderOperationProgressFunc progress_func,
+							   gpointer progress_data,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_folder_operation_finish      (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   GError **error);
+
+gboolean          im_mail_op_transfer_messages_sync       (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   GPtrArray *message_uids,
+							   const gchar *dest_account_id,
+							   const gchar *dest_folder_name,
+							   gboolean delete_originals,
+							   ImFolderOperationProgressFunc progress_func,
+							   gpointer progress_data,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_transfer_messages_async      (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   const gchar *folder_name,
+							   GPtrArray *message_uids,
+							   const gchar *dest_account_id,
+							   const gchar *dest_folder_name,
+							   gboolean delete_originals,
+							   ImFolderOperationProgressFunc progress_func,
+							   gpointer progress_data,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_transfer_messages_finish     (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   GError **error);
+
+gboolean          im_mail_op_filter_new_messages_sync     (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   GPtrArray *message_uids,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_filter_new_messages_async    (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   GPtrArray *message_uids,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_filter_new_messages_finish   (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   GError **error);
+
+gboolean          im_mail_op_replay_journal_sync          (ImServiceMgr *service_mgr,
+							   const gchar *account_id,
+							   guint *replayed,
+							   GCancellable *cancellable,
+							   GError **error);
+void              im_mail_op_replay_journal_async         (ImServiceMgr *mgr,
+							   const gchar *account_id,
+							   int io_priority,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer userdata);
+gboolean          im_mail_op_replay_journal_finish        (ImServiceMgr *mgr,
+							   GAsyncResult *result,
+							   guint *replayed,
+							   GError **error);
+
 gboolean          im_mail_op_composer_save_sync           (CamelFolder *destination,
 							   CamelMimeMessage *message,
 							   const gchar *body,
 							   GList *attachment_uris,
+							   const gchar *replace_uid,
 							   gchar **uid,
 							   GCancellable *cancellable,
 							   GError **error);
@@ -138,6 +560,7 @@ void              im_mail_op_composer_save_async          (CamelFolder *folder,
 							   CamelMimeMessage *message,
 							   const gchar *body,
 							   GList *attachment_uris,
+							   const gchar *replace_uid,
 							   int io_priority,
 							   GCancellable *cancellable,
 							   GAsyncReadyCallback callback,
@@ -147,7 +570,6 @@ gboolean          im_mail_op_composer_save_finish         (CamelFolder *folder,
 							   gchar **uid,
 							   GError **error);
 
-
 G_END_DECLS
 
 #endif /* IM_MAIL_OPS_H */
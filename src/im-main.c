@@ -39,7 +39,15 @@
 
 #include <im-window.h>
 #include <im-service-mgr.h>
+#include <im-push-mgr.h>
+#include <im-address-index.h>
+#include <im-local-compactor.h>
+#include <im-op-journal.h>
+#include <im-send-queue-mgr.h>
+#include <im-sort-index.h>
 #include <im-soup-request.h>
+#include <im-sync-scheduler.h>
+#include <im-thread-index.h>
 #include <im-content-id-request.h>
 
 #include <camel/camel.h>
@@ -93,6 +101,14 @@ int main (int argc, char **argv)
   camel_init (im_service_mgr_get_user_data_dir (), TRUE);
   camel_provider_init ();
   im_service_mgr_get_instance ();
+  im_push_mgr_get_instance ();
+  im_op_journal_get_instance ();
+  im_send_queue_mgr_get_instance ();
+  im_sort_index_get_instance ();
+  im_sync_scheduler_get_instance ();
+  im_thread_index_get_instance ();
+  im_address_index_get_instance ();
+  im_local_compactor_get_instance ();
 
   status = g_application_run (G_APPLICATION (app), argc, argv);
 
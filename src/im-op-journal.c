@@ -0,0 +1,794 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-op-journal.c : Journal of operations done offline */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-op-journal.h"
+
+#include "im-account-mgr.h"
+#include "im-mail-ops.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct _ImOpJournalPrivate ImOpJournalPrivate;
+struct _ImOpJournalPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* Protects the entries of the journals, that are added from
+	 * the mail operation threads */
+	GMutex lock;
+	/* account id -> Journal */
+	GHashTable *journals;
+};
+
+#define IM_OP_JOURNAL_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					   IM_TYPE_OP_JOURNAL, \
+					   ImOpJournalPrivate))
+
+typedef struct _Journal {
+	ImOpJournal *self;
+	gchar *account_id;
+	gchar *path;
+	GQueue *entries;
+
+	/* Replay state, only used in main loop */
+	gboolean replaying;
+	guint retry_id;
+	GCancellable *cancellable;
+} Journal;
+
+G_DEFINE_TYPE (ImOpJournal, im_op_journal, G_TYPE_OBJECT);
+
+static void start_replay (Journal *journal);
+
+static void
+entry_free (ImOpJournalEntry *entry)
+{
+	g_free (entry->folder_name);
+	g_free (entry->message_uid);
+	g_free (entry->set_flags);
+	g_free (entry->unset_flags);
+	g_free (entry->dest_account_id);
+	g_free (entry->dest_folder_name);
+	g_slice_free (ImOpJournalEntry, entry);
+}
+
+static ImOpJournalEntry *
+entry_copy (ImOpJournalEntry *entry)
+{
+	ImOpJournalEntry *copy;
+
+	copy = g_slice_new0 (ImOpJournalEntry);
+	copy->type = entry->type;
+	copy->folder_name = g_strdup (entry->folder_name);
+	copy->message_uid = g_strdup (entry->message_uid);
+	copy->set_flags = g_strdup (entry->set_flags);
+	copy->unset_flags = g_strdup (entry->unset_flags);
+	copy->dest_account_id = g_strdup (entry->dest_account_id);
+	copy->dest_folder_name = g_strdup (entry->dest_folder_name);
+	copy->delete_originals = entry->delete_originals;
+
+	return copy;
+}
+
+static void
+journal_free (Journal *journal)
+{
+	if (journal->retry_id)
+		g_source_remove (journal->retry_id);
+	g_cancellable_cancel (journal->cancellable);
+	g_object_unref (journal->cancellable);
+	g_queue_foreach (journal->entries, (GFunc) entry_free, NULL);
+	g_queue_free (journal->entries);
+	g_free (journal->account_id);
+	g_free (journal->path);
+	g_slice_free (Journal, journal);
+}
+
+/* Journal lines are tab separated fields, escaped with g_strescape():
+ * "flags" folder uid set_flags unset_flags
+ * "copy"|"move" folder uid dest_account dest_folder */
+static gchar *
+entry_to_line (ImOpJournalEntry *entry)
+{
+	const gchar *fields[5];
+	GString *line;
+	gint i;
+
+	fields[0] = entry->folder_name;
+	fields[1] = entry->message_uid;
+	if (entry->type == IM_OP_JOURNAL_ENTRY_FLAGS) {
+		fields[2] = entry->set_flags;
+		fields[3] = entry->unset_flags;
+	} else {
+		fields[2] = entry->dest_account_id;
+		fields[3] = entry->dest_folder_name;
+	}
+	fields[4] = NULL;
+
+	line = g_string_new (entry->type == IM_OP_JOURNAL_ENTRY_FLAGS ? "flags" :
+			     entry->delete_originals ? "move" : "copy");
+	for (i = 0; i < 4; i++) {
+		gchar *escaped;
+
+		escaped = g_strescape (fields[i] ? fields[i] : "", NULL);
+		g_string_append_c (line, '\t');
+		g_string_append (line, escaped);
+		g_free (escaped);
+	}
+	g_string_append_c (line, '\n');
+
+	return g_string_free (line, FALSE);
+}
+
+static ImOpJournalEntry *
+entry_from_line (const gchar *line)
+{
+	ImOpJournalEntry *entry = NULL;
+	gchar **fields;
+
+	fields = g_strsplit (line, "\t", 0);
+	if (g_strv_length (fields) == 5) {
+		entry = g_slice_new0 (ImOpJournalEntry);
+		entry->folder_name = g_strcompress (fields[1]);
+		entry->message_uid = g_strcompress (fields[2]);
+		if (g_strcmp0 (fields[0], "flags") == 0) {
+			entry->type = IM_OP_JOURNAL_ENTRY_FLAGS;
+			entry->set_flags = g_strcompress (fields[3]);
+			entry->unset_flags = g_strcompress (fields[4]);
+		} else {
+			entry->type = IM_OP_JOURNAL_ENTRY_TRANSFER;
+			entry->delete_originals = g_strcmp0 (fields[0], "move") == 0;
+			entry->dest_account_id = g_strcompress (fields[3]);
+			entry->dest_folder_name = g_strcompress (fields[4]);
+		}
+	}
+	g_strfreev (fields);
+
+	return entry;
+}
+
+static void
+load_journal (Journal *journal)
+{
+	gchar *contents = NULL;
+	gchar **lines, **node;
+
+	if (!g_file_get_contents (journal->path, &contents, NULL, NULL))
+		return;
+
+	lines = g_strsplit (contents, "\n", 0);
+	for (node = lines; *node != NULL; node++) {
+		ImOpJournalEntry *entry;
+
+		if (**node == '\0')
+			continue;
+		entry = entry_from_line (*node);
+		if (entry)
+			g_queue_push_tail (journal->entries, entry);
+		else
+			g_warning ("%s: ignoring invalid journal line in %s", __FUNCTION__, journal->path);
+	}
+	g_strfreev (lines);
+	g_free (contents);
+}
+
+/* Appends and flushes @entries to disk, so they survive a crash */
+static void
+append_to_file (Journal *journal,
+		GList *entries)
+{
+	gchar *dir;
+	FILE *file;
+	GList *node;
+
+	dir = g_path_get_dirname (journal->path);
+	g_mkdir_with_parents (dir, 0700);
+	g_free (dir);
+
+	file = g_fopen (journal->path, "a");
+	if (file == NULL) {
+		g_warning ("%s: failed to open %s", __FUNCTION__, journal->path);
+		return;
+	}
+
+	for (node = entries; node != NULL; node = g_list_next (node)) {
+		gchar *line = entry_to_line ((ImOpJournalEntry *) node->data);
+		fputs (line, file);
+		g_free (line);
+	}
+	fflush (file);
+	fsync (fileno (file));
+	fclose (file);
+}
+
+/* Replaces the file with the current entries */
+static void
+rewrite_file (Journal *journal)
+{
+	GString *contents;
+	GList *node;
+	GError *_error = NULL;
+
+	if (g_queue_is_empty (journal->entries)) {
+		g_unlink (journal->path);
+		return;
+	}
+
+	contents = g_string_new (NULL);
+	for (node = journal->entries->head; node != NULL; node = g_list_next (node)) {
+		gchar *line = entry_to_line ((ImOpJournalEntry *) node->data);
+		g_string_append (contents, line);
+		g_free (line);
+	}
+
+	if (!g_file_set_contents (journal->path, contents->str, contents->len, &_error)) {
+		g_warning ("%s: failed to write %s: %s", __FUNCTION__,
+			   journal->path, _error->message);
+		g_error_free (_error);
+	}
+	g_string_free (contents, TRUE);
+}
+
+/* Requires the lock */
+static Journal *
+get_journal (ImOpJournal *self,
+	     const gchar *account_id)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+	Journal *journal;
+
+	journal = g_hash_table_lookup (priv->journals, account_id);
+	if (journal == NULL) {
+		journal = g_slice_new0 (Journal);
+		journal->self = self;
+		journal->account_id = g_strdup (account_id);
+		journal->path = g_build_filename (im_service_mgr_get_user_data_dir (),
+						  "journal", account_id, NULL);
+		journal->entries = g_queue_new ();
+		journal->cancellable = g_cancellable_new ();
+		load_journal (journal);
+		g_hash_table_insert (priv->journals, journal->account_id, journal);
+	}
+
+	return journal;
+}
+
+static gboolean
+flag_list_contains (GPtrArray *list,
+		    const gchar *flag)
+{
+	guint i;
+
+	for (i = 0; i < list->len; i++) {
+		if (g_strcmp0 ((gchar *) list->pdata[i], flag) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static GPtrArray *
+split_flag_list (const gchar *flags)
+{
+	GPtrArray *result;
+	gchar **flags_v, **node;
+
+	result = g_ptr_array_new_with_free_func (g_free);
+	flags_v = g_strsplit (flags ? flags : "", ",", 0);
+	for (node = flags_v; *node != NULL; node++) {
+		if (**node != '\0' && !flag_list_contains (result, *node))
+			g_ptr_array_add (result, g_strdup (*node));
+	}
+	g_strfreev (flags_v);
+
+	return result;
+}
+
+/* Returns @base without the flags in @removed, plus the ones in @added */
+static gchar *
+merge_flag_lists (const gchar *base,
+		  const gchar *removed,
+		  const gchar *added)
+{
+	GPtrArray *base_list, *removed_list, *added_list, *result;
+	gchar *joined;
+	guint i;
+
+	base_list = split_flag_list (base);
+	removed_list = split_flag_list (removed);
+	added_list = split_flag_list (added);
+
+	result = g_ptr_array_new ();
+	for (i = 0; i < base_list->len; i++) {
+		if (!flag_list_contains (removed_list, base_list->pdata[i]) &&
+		    !flag_list_contains (added_list, base_list->pdata[i]))
+			g_ptr_array_add (result, base_list->pdata[i]);
+	}
+	for (i = 0; i < added_list->len; i++)
+		g_ptr_array_add (result, added_list->pdata[i]);
+	g_ptr_array_add (result, NULL);
+
+	joined = g_strjoinv (",", (gchar **) result->pdata);
+
+	g_ptr_array_free (result, TRUE);
+	g_ptr_array_unref (base_list);
+	g_ptr_array_unref (removed_list);
+	g_ptr_array_unref (added_list);
+
+	return joined;
+}
+
+/* Merges the consecutive flag changes of each message, and drops the
+ * operations on messages already moved away. Requires the lock */
+static void
+coalesce_entries (Journal *journal)
+{
+	GHashTable *last_flags, *moved;
+	GList *node, *next;
+
+	/* "folder\nuid" -> link of the last flags entry of the message */
+	last_flags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	moved = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	for (node = journal->entries->head; node != NULL; node = next) {
+		ImOpJournalEntry *entry = (ImOpJournalEntry *) node->data;
+		gchar *key;
+
+		next = g_list_next (node);
+		key = g_strconcat (entry->folder_name, "\n", entry->message_uid, NULL);
+
+		if (g_hash_table_contains (moved, key)) {
+			entry_free (entry);
+			g_queue_delete_link (journal->entries, node);
+			g_free (key);
+		} else if (entry->type == IM_OP_JOURNAL_ENTRY_FLAGS) {
+			GList *previous = g_hash_table_lookup (last_flags, key);
+
+			if (previous) {
+				ImOpJournalEntry *previous_entry = (ImOpJournalEntry *) previous->data;
+				gchar *set_flags, *unset_flags;
+
+				set_flags = merge_flag_lists (previous_entry->set_flags,
+							      entry->unset_flags, entry->set_flags);
+				unset_flags = merge_flag_lists (previous_entry->unset_flags,
+								entry->set_flags, entry->unset_flags);
+				g_free (previous_entry->set_flags);
+				g_free (previous_entry->unset_flags);
+				previous_entry->set_flags = set_flags;
+				previous_entry->unset_flags = unset_flags;
+
+				entry_free (entry);
+				g_queue_delete_link (journal->entries, node);
+				g_free (key);
+			} else {
+				g_hash_table_insert (last_flags, key, node);
+			}
+		} else {
+			/* Flags changed after a copy can't be merged
+			 * with the ones before it */
+			g_hash_table_remove (last_flags, key);
+			if (entry->delete_originals)
+				g_hash_table_add (moved, key);
+			else
+				g_free (key);
+		}
+	}
+
+	g_hash_table_destroy (last_flags);
+	g_hash_table_destroy (moved);
+}
+
+typedef struct _ScheduleReplayData {
+	ImOpJournal *self;
+	gchar *account_id;
+} ScheduleReplayData;
+
+static gboolean
+on_retry_timeout (gpointer userdata)
+{
+	Journal *journal = (Journal *) userdata;
+
+	journal->retry_id = 0;
+	start_replay (journal);
+
+	return FALSE;
+}
+
+static void
+schedule_retry (Journal *journal)
+{
+	if (journal->retry_id == 0)
+		journal->retry_id = g_timeout_add_seconds (IM_OP_JOURNAL_RETRY_DELAY,
+							   on_retry_timeout, journal);
+}
+
+static gboolean
+schedule_replay_idle (gpointer userdata)
+{
+	ScheduleReplayData *data = (ScheduleReplayData *) userdata;
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (data->self);
+	Journal *journal;
+
+	journal = g_hash_table_lookup (priv->journals, data->account_id);
+	if (journal && camel_session_get_online (CAMEL_SESSION (priv->service_mgr)))
+		schedule_retry (journal);
+
+	g_free (data->account_id);
+	g_slice_free (ScheduleReplayData, data);
+
+	return FALSE;
+}
+
+static void
+add_entries (ImOpJournal *self,
+	     const gchar *account_id,
+	     GList *entries)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+	ScheduleReplayData *data;
+	Journal *journal;
+	GList *node;
+
+	g_mutex_lock (&priv->lock);
+	journal = get_journal (self, account_id);
+	append_to_file (journal, entries);
+	for (node = entries; node != NULL; node = g_list_next (node))
+		g_queue_push_tail (journal->entries, node->data);
+	g_mutex_unlock (&priv->lock);
+	g_list_free (entries);
+
+	/* Entries added while online come from failed server requests, so
+	 * they are replayed after a while */
+	data = g_slice_new (ScheduleReplayData);
+	data->self = self;
+	data->account_id = g_strdup (account_id);
+	g_idle_add (schedule_replay_idle, data);
+}
+
+void
+im_op_journal_add_flags (ImOpJournal *self,
+			 const gchar *account_id,
+			 const gchar *folder_name,
+			 GPtrArray *message_uids,
+			 const gchar *set_flags,
+			 const gchar *unset_flags)
+{
+	GList *entries = NULL;
+	guint i;
+
+	g_return_if_fail (IM_IS_OP_JOURNAL (self));
+
+	for (i = 0; i < message_uids->len; i++) {
+		ImOpJournalEntry *entry;
+
+		entry = g_slice_new0 (ImOpJournalEntry);
+		entry->type = IM_OP_JOURNAL_ENTRY_FLAGS;
+		entry->folder_name = g_strdup (folder_name);
+		entry->message_uid = g_strdup (message_uids->pdata[i]);
+		entry->set_flags = g_strdup (set_flags ? set_flags : "");
+		entry->unset_flags = g_strdup (unset_flags ? unset_flags : "");
+		entries = g_list_prepend (entries, entry);
+	}
+
+	add_entries (self, account_id, g_list_reverse (entries));
+}
+
+void
+im_op_journal_add_transfer (ImOpJournal *self,
+			    const gchar *account_id,
+			    const gchar *folder_name,
+			    GPtrArray *message_uids,
+			    const gchar *dest_account_id,
+			    const gchar *dest_folder_name,
+			    gboolean delete_originals)
+{
+	GList *entries = NULL;
+	guint i;
+
+	g_return_if_fail (IM_IS_OP_JOURNAL (self));
+
+	for (i = 0; i < message_uids->len; i++) {
+		ImOpJournalEntry *entry;
+
+		entry = g_slice_new0 (ImOpJournalEntry);
+		entry->type = IM_OP_JOURNAL_ENTRY_TRANSFER;
+		entry->folder_name = g_strdup (folder_name);
+		entry->message_uid = g_strdup (message_uids->pdata[i]);
+		entry->dest_account_id = g_strdup (dest_account_id);
+		entry->dest_folder_name = g_strdup (dest_folder_name);
+		entry->delete_originals = delete_originals;
+		entries = g_list_prepend (entries, entry);
+	}
+
+	add_entries (self, account_id, g_list_reverse (entries));
+}
+
+GList *
+im_op_journal_peek (ImOpJournal *self,
+		    const gchar *account_id)
+{
+	ImOpJournalPrivate *priv;
+	Journal *journal;
+	GList *result = NULL, *node;
+	guint length;
+
+	g_return_val_if_fail (IM_IS_OP_JOURNAL (self), NULL);
+
+	priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->lock);
+	journal = get_journal (self, account_id);
+	length = g_queue_get_length (journal->entries);
+	coalesce_entries (journal);
+	if (g_queue_get_length (journal->entries) != length)
+		rewrite_file (journal);
+	for (node = journal->entries->head; node != NULL; node = g_list_next (node))
+		result = g_list_prepend (result, entry_copy ((ImOpJournalEntry *) node->data));
+	g_mutex_unlock (&priv->lock);
+
+	return g_list_reverse (result);
+}
+
+void
+im_op_journal_remove_head (ImOpJournal *self,
+			   const gchar *account_id,
+			   guint count)
+{
+	ImOpJournalPrivate *priv;
+	Journal *journal;
+
+	g_return_if_fail (IM_IS_OP_JOURNAL (self));
+
+	priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->lock);
+	journal = get_journal (self, account_id);
+	for (; count > 0 && !g_queue_is_empty (journal->entries); count--)
+		entry_free ((ImOpJournalEntry *) g_queue_pop_head (journal->entries));
+	rewrite_file (journal);
+	g_mutex_unlock (&priv->lock);
+}
+
+guint
+im_op_journal_get_pending (ImOpJournal *self,
+			   const gchar *account_id)
+{
+	ImOpJournalPrivate *priv;
+	guint result;
+
+	g_return_val_if_fail (IM_IS_OP_JOURNAL (self), 0);
+
+	priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+
+	g_mutex_lock (&priv->lock);
+	result = g_queue_get_length (get_journal (self, account_id)->entries);
+	g_mutex_unlock (&priv->lock);
+
+	return result;
+}
+
+void
+im_op_journal_free_entries (GList *entries)
+{
+	g_list_free_full (entries, (GDestroyNotify) entry_free);
+}
+
+static void
+on_replay_finished (GObject *source_object,
+		    GAsyncResult *result,
+		    gpointer userdata)
+{
+	Journal *journal = (Journal *) userdata;
+	GError *_error = NULL;
+	guint replayed = 0;
+
+	im_mail_op_replay_journal_finish (IM_SERVICE_MGR (source_object),
+					  result, &replayed, &_error);
+	journal->replaying = FALSE;
+
+	if (g_cancellable_is_cancelled (journal->cancellable)) {
+		/* The account was removed while replaying */
+		journal_free (journal);
+		g_clear_error (&_error);
+	} else if (_error) {
+		/* Operations failing for other reasons than connection
+		 * errors are dropped while replaying, so this one means
+		 * the server could not be reached, and we retry later */
+		g_warning ("%s: failed to replay journal of %s: %s", __FUNCTION__,
+			   journal->account_id, _error->message);
+		schedule_retry (journal);
+		g_error_free (_error);
+	} else if (im_op_journal_get_pending (journal->self, journal->account_id) > 0) {
+		/* Entries added while replaying */
+		start_replay (journal);
+	}
+}
+
+static void
+start_replay (Journal *journal)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (journal->self);
+
+	if (journal->replaying ||
+	    !camel_session_get_online (CAMEL_SESSION (priv->service_mgr)) ||
+	    im_op_journal_get_pending (journal->self, journal->account_id) == 0)
+		return;
+
+	if (journal->retry_id) {
+		g_source_remove (journal->retry_id);
+		journal->retry_id = 0;
+	}
+
+	journal->replaying = TRUE;
+	im_mail_op_replay_journal_async (priv->service_mgr,
+					 journal->account_id,
+					 G_PRIORITY_DEFAULT_IDLE,
+					 journal->cancellable,
+					 on_replay_finished,
+					 journal);
+}
+
+static void
+replay_all (ImOpJournal *self)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+	GList *journals, *node;
+
+	journals = g_hash_table_get_values (priv->journals);
+	for (node = journals; node != NULL; node = g_list_next (node))
+		start_replay ((Journal *) node->data);
+	g_list_free (journals);
+}
+
+static void
+on_online_changed (GObject *object,
+		   GParamSpec *pspec,
+		   gpointer userdata)
+{
+	if (camel_session_get_online (CAMEL_SESSION (object)))
+		replay_all (IM_OP_JOURNAL (userdata));
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (userdata);
+	Journal *journal;
+
+	g_mutex_lock (&priv->lock);
+	journal = g_hash_table_lookup (priv->journals, account_id);
+	if (journal) {
+		g_unlink (journal->path);
+		/* A running replay keeps using it until it finishes */
+		if (journal->replaying) {
+			g_cancellable_cancel (journal->cancellable);
+			g_hash_table_steal (priv->journals, account_id);
+		} else {
+			g_hash_table_remove (priv->journals, account_id);
+		}
+	}
+	g_mutex_unlock (&priv->lock);
+}
+
+static void
+im_op_journal_init (ImOpJournal *self)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+
+	g_mutex_init (&priv->lock);
+	priv->journals = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, (GDestroyNotify) journal_free);
+}
+
+static void
+im_op_journal_finalize (GObject *object)
+{
+	ImOpJournalPrivate *priv = IM_OP_JOURNAL_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+	g_hash_table_unref (priv->journals);
+	g_mutex_clear (&priv->lock);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_op_journal_parent_class)->finalize (object);
+}
+
+static void
+im_op_journal_class_init (ImOpJournalClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_op_journal_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImOpJournalPrivate));
+}
+
+static ImOpJournal *
+im_op_journal_new (ImServiceMgr *service_mgr,
+		   ImAccountMgr *account_mgr)
+{
+	ImOpJournal *self;
+	ImOpJournalPrivate *priv;
+	GSList *account_ids, *node;
+
+	self = g_object_new (IM_TYPE_OP_JOURNAL, NULL);
+	priv = IM_OP_JOURNAL_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "notify::online",
+			  G_CALLBACK (on_online_changed), self);
+
+	account_ids = im_account_mgr_get_account_ids (account_mgr, FALSE);
+	g_mutex_lock (&priv->lock);
+	for (node = account_ids; node != NULL; node = g_slist_next (node))
+		get_journal (self, (const gchar *) node->data);
+	g_mutex_unlock (&priv->lock);
+	im_account_mgr_free_account_ids (account_ids);
+
+	if (camel_session_get_online (CAMEL_SESSION (service_mgr)))
+		replay_all (self);
+
+	return self;
+}
+
+ImOpJournal *
+im_op_journal_get_instance (void)
+{
+	static ImOpJournal *instance = 0;
+
+	if (instance == 0)
+		instance = im_op_journal_new (im_service_mgr_get_instance (),
+					      im_account_mgr_get_instance ());
+
+	return instance;
+}
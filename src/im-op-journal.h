@@ -0,0 +1,214 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-op-journal.h : Journal of operations done offline */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_OP_JOURNAL_H__
+#define __IM_OP_JOURNAL_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_OP_JOURNAL             (im_op_journal_get_type())
+#define IM_OP_JOURNAL(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_OP_JOURNAL,ImOpJournal))
+#define IM_OP_JOURNAL_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_OP_JOURNAL,ImOpJournalClass))
+#define IM_IS_OP_JOURNAL(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_OP_JOURNAL))
+#define IM_IS_OP_JOURNAL_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_OP_JOURNAL))
+#define IM_OP_JOURNAL_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_OP_JOURNAL,ImOpJournalClass))
+
+typedef struct _ImOpJournal      ImOpJournal;
+typedef struct _ImOpJournalClass ImOpJournalClass;
+typedef struct _ImOpJournalEntry ImOpJournalEntry;
+
+struct _ImOpJournal {
+	GObject parent;
+};
+
+struct _ImOpJournalClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImOpJournalEntryType:
+ * @IM_OP_JOURNAL_ENTRY_FLAGS: flags changed in a message
+ * @IM_OP_JOURNAL_ENTRY_TRANSFER: message copied or moved to another folder
+ *
+ * Operations stored in the journal.
+ */
+typedef enum {
+	IM_OP_JOURNAL_ENTRY_FLAGS,
+	IM_OP_JOURNAL_ENTRY_TRANSFER
+} ImOpJournalEntryType;
+
+/**
+ * ImOpJournalEntry:
+ * @type: the #ImOpJournalEntryType
+ * @folder_name: the folder of the message
+ * @message_uid: the uid of the message
+ * @set_flags: flags set, for %IM_OP_JOURNAL_ENTRY_FLAGS
+ * @unset_flags: flags unset, for %IM_OP_JOURNAL_ENTRY_FLAGS
+ * @dest_account_id: destination account, for %IM_OP_JOURNAL_ENTRY_TRANSFER
+ * @dest_folder_name: destination folder, for %IM_OP_JOURNAL_ENTRY_TRANSFER
+ * @delete_originals: %TRUE if the message was moved, for %IM_OP_JOURNAL_ENTRY_TRANSFER
+ *
+ * An operation on a message, waiting to be replayed in the server.
+ */
+struct _ImOpJournalEntry {
+	ImOpJournalEntryType type;
+	gchar *folder_name;
+	gchar *message_uid;
+	gchar *set_flags;
+	gchar *unset_flags;
+	gchar *dest_account_id;
+	gchar *dest_folder_name;
+	gboolean delete_originals;
+};
+
+/* Delay before replaying the journal of an account again after a
+ * failure, in seconds */
+#define IM_OP_JOURNAL_RETRY_DELAY 60
+
+/**
+ * im_op_journal_get_type:
+ *
+ * Returns: GType of the operation journal
+ */
+GType  im_op_journal_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_op_journal_get_instance:
+ *
+ * obtains the singleton #ImOpJournal. On first call it loads the
+ * journals stored on disk, and replays them if the session is online.
+ *
+ * Returns: (transfer none): an #ImOpJournal
+ */
+ImOpJournal*        im_op_journal_get_instance (void);
+
+/**
+ * im_op_journal_add_flags:
+ * @self: a #ImOpJournal
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @set_flags: (allow-none): a string with the list of flags to set
+ * @unset_flags: (allow-none): a string with the list of flags to unset
+ *
+ * Appends a flags change to the journal of @account_id. The caller is
+ * expected to have applied it to the local summary already. It can be
+ * called from any thread.
+ */
+void                im_op_journal_add_flags (ImOpJournal *self,
+					     const gchar *account_id,
+					     const gchar *folder_name,
+					     GPtrArray *message_uids,
+					     const gchar *set_flags,
+					     const gchar *unset_flags);
+
+/**
+ * im_op_journal_add_transfer:
+ * @self: a #ImOpJournal
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @message_uids: (element-type utf8): the uids of the messages
+ * @dest_account_id: the destination account id
+ * @dest_folder_name: the destination folder name
+ * @delete_originals: %TRUE if messages are moved
+ *
+ * Appends a copy or move of messages to the journal of @account_id. It
+ * can be called from any thread.
+ */
+void                im_op_journal_add_transfer (ImOpJournal *self,
+						const gchar *account_id,
+						const gchar *folder_name,
+						GPtrArray *message_uids,
+						const gchar *dest_account_id,
+						const gchar *dest_folder_name,
+						gboolean delete_originals);
+
+/**
+ * im_op_journal_peek:
+ * @self: a #ImOpJournal
+ * @account_id: an account id
+ *
+ * Obtains the operations pending in the journal of @account_id, in
+ * order. Redundant entries are coalesced first: consecutive flag
+ * changes of a message are merged, and the journal on disk is
+ * compacted. It can be called from any thread.
+ *
+ * Returns: (transfer full) (element-type ImOpJournalEntry): a list
+ * to free with im_op_journal_free_entries()
+ */
+GList *             im_op_journal_peek (ImOpJournal *self,
+					const gchar *account_id);
+
+/**
+ * im_op_journal_remove_head:
+ * @self: a #ImOpJournal
+ * @account_id: an account id
+ * @count: number of entries
+ *
+ * Removes the first @count entries of the journal of @account_id,
+ * once they have been replayed. It can be called from any thread.
+ */
+void                im_op_journal_remove_head (ImOpJournal *self,
+					       const gchar *account_id,
+					       guint count);
+
+/**
+ * im_op_journal_get_pending:
+ * @self: a #ImOpJournal
+ * @account_id: an account id
+ *
+ * Returns: number of operations waiting to be replayed for @account_id
+ */
+guint               im_op_journal_get_pending (ImOpJournal *self,
+					       const gchar *account_id);
+
+/**
+ * im_op_journal_free_entries:
+ * @entries: (element-type ImOpJournalEntry): a list returned by
+ * im_op_journal_peek()
+ *
+ * Frees @entries.
+ */
+void                im_op_journal_free_entries (GList *entries);
+
+G_END_DECLS
+
+#endif /* __IM_OP_JOURNAL_H__ */
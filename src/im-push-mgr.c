@@ -0,0 +1,688 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-push-mgr.c : Push (IMAP IDLE) and polling of new messages */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-push-mgr.h"
+#include "im-push-mgr-priv.h"
+
+#include "im-account-mgr-helpers.h"
+#include "im-mail-ops.h"
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+typedef struct _ImPushMgrPrivate ImPushMgrPrivate;
+struct _ImPushMgrPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* account id -> PushAccount */
+	GHashTable *accounts;
+};
+
+#define IM_PUSH_MGR_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					 IM_TYPE_PUSH_MGR, \
+					 ImPushMgrPrivate))
+
+typedef struct _PushAccount {
+	ImPushMgr *self;
+	gchar *account_id;
+	/* TRUE if the store is set up to use IDLE */
+	gboolean use_idle;
+	/* TRUE if the store uses IDLE and the server supports it */
+	gboolean push;
+	/* TRUE if the store is not a storage one (POP), so there
+	 * are no folders to keep open */
+	gboolean nonstorage;
+	/* Folders we keep open: inbox first, then favourites */
+	GPtrArray *folders;
+	/* Names of the folders whose first synchronization is done, so
+	 * their new messages are filtered */
+	GHashTable *synced_folders;
+	GCancellable *cancellable;
+	guint poll_id;
+} PushAccount;
+
+typedef struct _OpenFoldersAsyncContext {
+	gchar *account_id;
+	gboolean use_idle;
+	gboolean has_idle;
+	/* TRUE if the inbox had cached messages before the refresh */
+	gboolean inbox_cached;
+	GPtrArray *folders;
+} OpenFoldersAsyncContext;
+
+G_DEFINE_TYPE (ImPushMgr, im_push_mgr, G_TYPE_OBJECT);
+
+static void open_folders (PushAccount *account);
+
+static void
+push_account_free (PushAccount *account)
+{
+	g_cancellable_cancel (account->cancellable);
+	g_object_unref (account->cancellable);
+	if (account->poll_id)
+		g_source_remove (account->poll_id);
+	if (account->folders)
+		g_ptr_array_unref (account->folders);
+	g_hash_table_destroy (account->synced_folders);
+	g_free (account->account_id);
+	g_slice_free (PushAccount, account);
+}
+
+static void
+open_folders_async_context_free (OpenFoldersAsyncContext *context)
+{
+	g_free (context->account_id);
+	if (context->folders)
+		g_ptr_array_unref (context->folders);
+	g_slice_free (OpenFoldersAsyncContext, context);
+}
+
+static gboolean
+store_uses_idle (CamelService *service)
+{
+	CamelProvider *provider;
+	CamelSettings *settings;
+	gboolean use_idle = FALSE;
+
+	provider = camel_service_get_provider (service);
+	if (g_strcmp0 (provider->protocol, IM_SERVICE_MGR_PUSH_PROVIDER) != 0)
+		return FALSE;
+
+	settings = camel_service_get_settings (service);
+	if (g_object_class_find_property (G_OBJECT_GET_CLASS (settings), "use-idle"))
+		g_object_get (settings, "use-idle", &use_idle, NULL);
+
+	return use_idle;
+}
+
+static gboolean
+capability_has_idle (const gchar *line)
+{
+	gchar **tokens;
+	gboolean result = FALSE;
+	gint i;
+
+	tokens = g_strsplit_set (line, " []", -1);
+	for (i = 0; tokens[i] != NULL && !result; i++)
+		result = g_ascii_strcasecmp (tokens[i], "IDLE") == 0;
+	g_strfreev (tokens);
+
+	return result;
+}
+
+/* Camel does not expose the capabilities of the server, so we ask
+ * for them before relying on IDLE. The connection is made by the
+ * store, with its host, port and security method, so the certificate
+ * of the server is checked by the session as in the connection of the
+ * store. Servers announce IDLE before authentication, so no
+ * credentials are sent */
+gboolean
+_im_push_mgr_server_has_idle_sync (CamelService *store,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	GError *_error = NULL;
+	CamelStream *stream;
+	CamelStream *buffer;
+	gchar *line;
+	gboolean has_idle = FALSE, done = FALSE;
+
+	if (!CAMEL_IS_NETWORK_SERVICE (store))
+		return FALSE;
+
+	stream = camel_network_service_connect_sync (CAMEL_NETWORK_SERVICE (store),
+						     cancellable, &_error);
+	if (stream == NULL)
+		goto finish;
+
+	buffer = camel_stream_buffer_new (stream, CAMEL_STREAM_BUFFER_READ);
+
+	/* The greeting usually comes with the capabilities */
+	line = camel_stream_buffer_read_line (CAMEL_STREAM_BUFFER (buffer), cancellable, &_error);
+	if (line && strstr (line, "[CAPABILITY ")) {
+		has_idle = capability_has_idle (line);
+		done = TRUE;
+	}
+	g_free (line);
+
+	if (_error == NULL && !done &&
+	    camel_stream_write_string (stream, "A1 CAPABILITY\r\n", cancellable, &_error) != -1) {
+		while (!done &&
+		       (line = camel_stream_buffer_read_line (CAMEL_STREAM_BUFFER (buffer),
+							      cancellable, &_error)) != NULL) {
+			if (g_str_has_prefix (line, "* CAPABILITY "))
+				has_idle = capability_has_idle (line);
+			done = g_str_has_prefix (line, "A1 ");
+			g_free (line);
+		}
+	}
+
+	if (_error == NULL && !done)
+		g_set_error (&_error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     _("Connection closed while checking capabilities"));
+
+	camel_stream_write_string (stream, "A2 LOGOUT\r\n", NULL, NULL);
+	camel_stream_close (stream, NULL, NULL);
+	g_object_unref (buffer);
+	g_object_unref (stream);
+
+finish:
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return has_idle;
+}
+
+static void
+add_favourite_folders (ImServiceMgr *mgr,
+		       const gchar *account_id,
+		       CamelFolderInfo *fi,
+		       GPtrArray *folders,
+		       GCancellable *cancellable,
+		       GError **error)
+{
+	GError *_error = NULL;
+
+	while (fi && _error == NULL) {
+		if ((fi->flags & CAMEL_FOLDER_CHECK_FOR_NEW) &&
+		    !(fi->flags & CAMEL_FOLDER_NOSELECT) &&
+		    g_ascii_strcasecmp (fi->full_name, "INBOX") != 0) {
+			CamelFolder *folder;
+
+			folder = im_service_mgr_get_folder (mgr, account_id, fi->full_name,
+							    cancellable, &_error);
+			if (folder)
+				g_ptr_array_add (folders, folder);
+		}
+		if (_error == NULL && fi->child)
+			add_favourite_folders (mgr, account_id, fi->child, folders,
+					       cancellable, &_error);
+		fi = fi->next;
+	}
+
+	if (_error)
+		g_propagate_error (error, _error);
+}
+
+/* Opens inbox and favourite folders of a storage account. Refreshing
+ * the inbox selects it, so an IDLE capable store starts idling on it */
+static GPtrArray *
+open_folders_sync (ImServiceMgr *mgr,
+		   const gchar *account_id,
+		   gboolean *inbox_cached,
+		   GCancellable *cancellable,
+		   GError **error)
+{
+	GError *_error = NULL;
+	CamelService *store;
+	CamelFolder *inbox;
+	CamelFolderInfo *fi;
+	GPtrArray *folders;
+
+	folders = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	store = im_service_mgr_get_service (mgr, account_id, IM_ACCOUNT_TYPE_STORE);
+
+	inbox = im_service_mgr_get_folder (mgr, account_id, "INBOX", cancellable, &_error);
+	if (inbox) {
+		g_ptr_array_add (folders, inbox);
+		*inbox_cached = camel_folder_get_message_count (inbox) > 0;
+		camel_folder_refresh_info_sync (inbox, cancellable, &_error);
+	}
+
+	if (_error == NULL) {
+		fi = camel_store_get_folder_info_sync (CAMEL_STORE (store), NULL,
+						       CAMEL_STORE_FOLDER_INFO_RECURSIVE |
+						       CAMEL_STORE_FOLDER_INFO_SUBSCRIBED,
+						       cancellable, &_error);
+		if (fi) {
+			add_favourite_folders (mgr, account_id, fi, folders,
+					       cancellable, &_error);
+			camel_store_free_folder_info (CAMEL_STORE (store), fi);
+		}
+	}
+
+	if (_error) {
+		g_propagate_error (error, _error);
+		g_ptr_array_unref (folders);
+		return NULL;
+	}
+
+	return folders;
+}
+
+static void
+open_folders_thread (GSimpleAsyncResult *simple,
+		     GObject *object,
+		     GCancellable *cancellable)
+{
+	GError *_error = NULL;
+	OpenFoldersAsyncContext *context;
+
+	context = (OpenFoldersAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	context->folders = open_folders_sync (IM_PUSH_MGR_GET_PRIVATE (object)->service_mgr,
+					      context->account_id,
+					      &context->inbox_cached,
+					      cancellable,
+					      &_error);
+
+	/* Without IDLE the server does not notify of new messages,
+	 * so the account falls back to polling */
+	if (_error == NULL && context->use_idle) {
+		CamelService *store;
+
+		store = im_service_mgr_get_service (IM_PUSH_MGR_GET_PRIVATE (object)->service_mgr,
+						    context->account_id, IM_ACCOUNT_TYPE_STORE);
+		context->has_idle = store && _im_push_mgr_server_has_idle_sync (store, cancellable, &_error);
+		if (store)
+			g_object_unref (store);
+		if (_error) {
+			g_warning (_("%s: failed to check IDLE support of %s: %s"), __FUNCTION__,
+				   context->account_id, _error->message);
+			g_clear_error (&_error);
+		}
+	}
+
+	if (_error != NULL)
+		g_simple_async_result_take_error (simple, _error);
+}
+
+static void
+on_poll_refresh_folder_info (GObject *source_object,
+			     GAsyncResult *result,
+			     gpointer userdata)
+{
+	GError *_error = NULL;
+
+	im_mail_op_refresh_folder_info_finish (IM_SERVICE_MGR (source_object),
+					       result, NULL, &_error);
+
+	if (_error) {
+		if (!g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning (_("%s: failed to refresh folder: %s"), __FUNCTION__,
+				   _error->message);
+		g_error_free (_error);
+	}
+}
+
+static gboolean
+on_poll_timeout (gpointer userdata)
+{
+	PushAccount *account = (PushAccount *) userdata;
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (account->self);
+	guint i;
+
+	if (!camel_session_get_online (CAMEL_SESSION (priv->service_mgr)))
+		return TRUE;
+
+	/* We could not open the folders last time, so we retry now */
+	if (account->folders == NULL) {
+		open_folders (account);
+		return TRUE;
+	}
+
+	/* Inbox is updated by the server in push mode, or by the sync
+	 * scheduler otherwise, so we only poll the favourite folders */
+	for (i = 1; i < account->folders->len; i++) {
+		CamelFolder *folder = g_ptr_array_index (account->folders, i);
+
+		im_mail_op_refresh_folder_info_async (priv->service_mgr,
+						      account->account_id,
+						      camel_folder_get_full_name (folder),
+						      G_PRIORITY_LOW,
+						      account->cancellable,
+						      on_poll_refresh_folder_info,
+						      NULL);
+	}
+
+	return TRUE;
+}
+
+static void
+schedule_poll (PushAccount *account)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (account->self);
+
+	if (account->poll_id) {
+		g_source_remove (account->poll_id);
+		account->poll_id = 0;
+	}
+
+	/* Nothing to poll if there are no favourite folders */
+	if (account->folders && account->folders->len <= 1)
+		return;
+
+	account->poll_id = g_timeout_add_seconds (im_account_mgr_get_update_interval (priv->account_mgr) * 60,
+						  on_poll_timeout, account);
+}
+
+static void
+on_folders_opened (GObject *source_object,
+		   GAsyncResult *result,
+		   gpointer userdata)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (source_object);
+	GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+	OpenFoldersAsyncContext *context;
+	PushAccount *account;
+	GError *_error = NULL;
+
+	context = (OpenFoldersAsyncContext *)
+		g_simple_async_result_get_op_res_gpointer (simple);
+
+	/* The account may have been removed meanwhile */
+	account = g_hash_table_lookup (priv->accounts, context->account_id);
+	if (account == NULL)
+		return;
+
+	if (g_simple_async_result_propagate_error (simple, &_error)) {
+		if (!g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning (_("%s: failed to open folders of %s: %s"), __FUNCTION__,
+				   context->account_id, _error->message);
+		g_error_free (_error);
+	} else {
+		if (account->folders)
+			g_ptr_array_unref (account->folders);
+		account->folders = g_ptr_array_ref (context->folders);
+		account->push = context->has_idle;
+
+		/* The first synchronization of the inbox is done if it
+		 * was cached, or if it brought no messages. Otherwise its
+		 * changes are still to come, and mark it on arrival */
+		if (context->inbox_cached ||
+		    camel_folder_get_message_count (account->folders->pdata[0]) == 0)
+			g_hash_table_add (account->synced_folders, g_strdup ("INBOX"));
+	}
+
+	/* We keep polling even if we failed, so we retry on next interval */
+	schedule_poll (account);
+}
+
+static void
+open_folders (PushAccount *account)
+{
+	GSimpleAsyncResult *simple;
+	OpenFoldersAsyncContext *context;
+
+	context = g_slice_new0 (OpenFoldersAsyncContext);
+	context->account_id = g_strdup (account->account_id);
+	context->use_idle = account->use_idle;
+
+	simple = g_simple_async_result_new (G_OBJECT (account->self), on_folders_opened,
+					    NULL, open_folders);
+	g_simple_async_result_set_op_res_gpointer (simple, context,
+						   (GDestroyNotify) open_folders_async_context_free);
+	g_simple_async_result_run_in_thread (simple, open_folders_thread,
+					     G_PRIORITY_DEFAULT, account->cancellable);
+	g_object_unref (simple);
+}
+
+static void
+watch_account (ImPushMgr *self,
+	       const gchar *account_id)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (self);
+	CamelService *store;
+	PushAccount *account;
+
+	store = im_service_mgr_get_service (priv->service_mgr, account_id,
+					    IM_ACCOUNT_TYPE_STORE);
+	if (!CAMEL_IS_STORE (store))
+		return;
+
+	account = g_slice_new0 (PushAccount);
+	account->self = self;
+	account->account_id = g_strdup (account_id);
+	account->cancellable = g_cancellable_new ();
+	account->synced_folders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	account->nonstorage = !(camel_service_get_provider (store)->flags & CAMEL_PROVIDER_IS_STORAGE);
+	account->use_idle = !account->nonstorage && store_uses_idle (store);
+	/* Until the server confirms IDLE support, the account is polled */
+	account->push = FALSE;
+	g_hash_table_replace (priv->accounts, g_strdup (account_id), account);
+
+	if (!account->nonstorage &&
+	    camel_session_get_online (CAMEL_SESSION (priv->service_mgr)))
+		open_folders (account);
+}
+
+static void
+on_account_inserted (ImAccountMgr *account_mgr,
+		     const gchar *account_id,
+		     gpointer userdata)
+{
+	if (im_account_mgr_get_enabled (account_mgr, account_id))
+		watch_account (IM_PUSH_MGR (userdata), account_id);
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (userdata);
+
+	g_hash_table_remove (priv->accounts, account_id);
+}
+
+static void
+on_account_changed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    ImAccountType account_type,
+		    gpointer userdata)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (userdata);
+
+	if (account_type != IM_ACCOUNT_TYPE_STORE)
+		return;
+
+	/* The store may have been replaced, i.e. if push mode was
+	 * toggled, so we start watching it again */
+	g_hash_table_remove (priv->accounts, account_id);
+	if (im_account_mgr_get_enabled (account_mgr, account_id))
+		watch_account (IM_PUSH_MGR (userdata), account_id);
+}
+
+static void
+on_filter_new_messages (GObject *source_object,
+			GAsyncResult *result,
+			gpointer userdata)
+{
+	GError *_error = NULL;
+
+	im_mail_op_filter_new_messages_finish (IM_SERVICE_MGR (source_object),
+					       result, &_error);
+
+	if (_error) {
+		if (!g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning (_("%s: failed to filter new messages: %s"), __FUNCTION__,
+				   _error->message);
+		g_error_free (_error);
+	}
+}
+
+static void
+on_folder_changed (ImServiceMgr *service_mgr,
+		   ImFolderChanges *changes,
+		   gpointer userdata)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (userdata);
+	PushAccount *account;
+
+	if (changes->account_id == NULL || changes->uids_added->len == 0 ||
+	    g_ascii_strcasecmp (changes->folder_name, "INBOX") != 0)
+		return;
+
+	/* POP messages are filtered as they are retrieved */
+	account = g_hash_table_lookup (priv->accounts, changes->account_id);
+	if (account == NULL || account->nonstorage)
+		return;
+
+	/* The first synchronization of a folder brings all of its
+	 * messages, which are not filtered */
+	if (!g_hash_table_contains (account->synced_folders, changes->folder_name)) {
+		g_hash_table_add (account->synced_folders, g_strdup (changes->folder_name));
+		return;
+	}
+
+	im_mail_op_filter_new_messages_async (service_mgr, account->account_id,
+					      changes->uids_added, G_PRIORITY_DEFAULT,
+					      account->cancellable,
+					      on_filter_new_messages, NULL);
+}
+
+static void
+on_online_changed (GObject *object,
+		   GParamSpec *pspec,
+		   gpointer userdata)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (userdata);
+	GHashTableIter iter;
+	PushAccount *account;
+
+	if (!camel_session_get_online (CAMEL_SESSION (object)))
+		return;
+
+	/* Connections were dropped while offline, so we open the folders
+	 * again to restart IDLE and catch up with the changes */
+	g_hash_table_iter_init (&iter, priv->accounts);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &account)) {
+		if (!account->nonstorage)
+			open_folders (account);
+	}
+}
+
+static void
+im_push_mgr_init (ImPushMgr *self)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (self);
+
+	priv->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+						g_free, (GDestroyNotify) push_account_free);
+}
+
+static void
+im_push_mgr_finalize (GObject *object)
+{
+	ImPushMgrPrivate *priv = IM_PUSH_MGR_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+	g_hash_table_unref (priv->accounts);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_push_mgr_parent_class)->finalize (object);
+}
+
+static void
+im_push_mgr_class_init (ImPushMgrClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_push_mgr_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImPushMgrPrivate));
+}
+
+static ImPushMgr *
+im_push_mgr_new (ImServiceMgr *service_mgr,
+		 ImAccountMgr *account_mgr)
+{
+	ImPushMgr *self;
+	ImPushMgrPrivate *priv;
+	GSList *account_ids, *node;
+
+	self = g_object_new (IM_TYPE_PUSH_MGR, NULL);
+	priv = IM_PUSH_MGR_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_inserted",
+			  G_CALLBACK (on_account_inserted), self);
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (account_mgr), "account_changed",
+			  G_CALLBACK (on_account_changed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "notify::online",
+			  G_CALLBACK (on_online_changed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "folder_changed",
+			  G_CALLBACK (on_folder_changed), self);
+
+	account_ids = im_account_mgr_get_account_ids (account_mgr, TRUE);
+	for (node = account_ids; node != NULL; node = g_slist_next (node))
+		watch_account (self, (const gchar *) node->data);
+	im_account_mgr_free_account_ids (account_ids);
+
+	return self;
+}
+
+ImPushMgr *
+im_push_mgr_get_instance (void)
+{
+	static ImPushMgr *instance = 0;
+
+	if (instance == 0)
+		instance = im_push_mgr_new (im_service_mgr_get_instance (),
+					    im_account_mgr_get_instance ());
+
+	return instance;
+}
+
+gboolean
+im_push_mgr_is_push_active (ImPushMgr *self,
+			    const gchar *account_id)
+{
+	ImPushMgrPrivate *priv;
+	PushAccount *account;
+
+	g_return_val_if_fail (IM_IS_PUSH_MGR (self), FALSE);
+	g_return_val_if_fail (account_id, FALSE);
+
+	priv = IM_PUSH_MGR_GET_PRIVATE (self);
+	account = g_hash_table_lookup (priv->accounts, account_id);
+
+	return account && account->push;
+}
@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-push-mgr.h : Push (IMAP IDLE) and polling of new messages */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_PUSH_MGR_H__
+#define __IM_PUSH_MGR_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_PUSH_MGR             (im_push_mgr_get_type())
+#define IM_PUSH_MGR(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_PUSH_MGR,ImPushMgr))
+#define IM_PUSH_MGR_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_PUSH_MGR,ImPushMgrClass))
+#define IM_IS_PUSH_MGR(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_PUSH_MGR))
+#define IM_IS_PUSH_MGR_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_PUSH_MGR))
+#define IM_PUSH_MGR_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_PUSH_MGR,ImPushMgrClass))
+
+typedef struct _ImPushMgr      ImPushMgr;
+typedef struct _ImPushMgrClass ImPushMgrClass;
+
+struct _ImPushMgr {
+	GObject parent;
+};
+
+struct _ImPushMgrClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * im_push_mgr_get_type:
+ *
+ * Returns: GType of the push manager
+ */
+GType  im_push_mgr_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_push_mgr_get_instance:
+ *
+ * obtains the singleton #ImPushMgr. On first call it starts
+ * watching the inbox and favourite folders of all the enabled
+ * accounts. Accounts in push mode keep those folders open, so the
+ * server notifies of new messages through IDLE, and changes are
+ * reported through #ImServiceMgr::folder_changed. Favourite
+ * folders are refreshed every im_account_mgr_get_update_interval()
+ * minutes, and the inbox of accounts not using push is updated by
+ * #ImSyncScheduler.
+ *
+ * Returns: (transfer none): an #ImPushMgr
+ */
+ImPushMgr*    im_push_mgr_get_instance (void);
+
+/**
+ * im_push_mgr_is_push_active:
+ * @self: a #ImPushMgr
+ * @account_id: an account id
+ *
+ * Checks if the account is getting new messages through IDLE,
+ * instead of polling. It requires push mode enabled in the account
+ * and a server announcing IDLE support.
+ *
+ * Returns: %TRUE if push is active for @account_id
+ */
+gboolean      im_push_mgr_is_push_active (ImPushMgr *self,
+					  const gchar *account_id);
+
+G_END_DECLS
+
+#endif /* __IM_PUSH_MGR_H__ */
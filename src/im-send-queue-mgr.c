@@ -0,0 +1,709 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-send-queue-mgr.c : Parallel send queues of the accounts */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-send-queue-mgr.h"
+
+#include "im-account-mgr-helpers.h"
+#include "im-error.h"
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+/* signals */
+enum {
+	PROGRESS_SIGNAL,
+	LAST_SIGNAL
+};
+
+typedef struct _ImSendQueueMgrPrivate ImSendQueueMgrPrivate;
+struct _ImSendQueueMgrPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* account id -> SendQueue */
+	GHashTable *queues;
+	/* SMTP host -> number of queues running against it */
+	GHashTable *host_connections;
+	/* SendQueue waiting for a free connection to their host */
+	GQueue *waiting;
+};
+
+#define IM_SEND_QUEUE_MGR_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					       IM_TYPE_SEND_QUEUE_MGR, \
+					       ImSendQueueMgrPrivate))
+
+typedef struct _SendQueue {
+	ImSendQueueMgr *self;
+	gchar *account_id;
+	gchar *host;
+	ImSendQueueState state;
+	GCancellable *cancellable;
+
+	/* GSimpleAsyncResult completed when current run finishes */
+	GSList *results;
+	/* Requested while running, so another run is needed */
+	gboolean rerun;
+	GSList *rerun_results;
+
+	/* Wakes the queue up when next retry is due, or when the rate
+	 * limit allows sending again */
+	guint retry_id;
+	/* Earliest monotonic time the rate limit allows sending, kept
+	 * between runs */
+	gint64 next_send;
+
+	/* Sent messages are moved to sentbox apart from sending, so the
+	 * transfer never holds the next message */
+	gboolean transferring;
+	gboolean retransfer;
+	guint transfer_retry_id;
+} SendQueue;
+
+/* A running queue. Progress is reported from the thread running it, so
+ * it's coalesced under the lock and emitted on the main loop */
+typedef struct _RunContext {
+	ImSendQueueMgr *self;
+	gchar *account_id;
+	gchar *host;
+	GMutex lock;
+	ImSendQueueStats stats;
+	guint idle_id;
+} RunContext;
+
+typedef struct _TransferContext {
+	ImSendQueueMgr *self;
+	gchar *account_id;
+} TransferContext;
+
+static guint signals[LAST_SIGNAL] = {0};
+
+G_DEFINE_TYPE (ImSendQueueMgr, im_send_queue_mgr, G_TYPE_OBJECT);
+
+static void
+emit_progress (ImSendQueueMgr *self,
+	       const gchar *account_id,
+	       ImSendQueueState state,
+	       const ImSendQueueStats *stats,
+	       GError *error)
+{
+	ImSendQueueProgress progress = { 0, };
+
+	progress.account_id = (gchar *) account_id;
+	progress.state = state;
+	if (stats)
+		progress.stats = *stats;
+	progress.error = error;
+
+	g_signal_emit (self, signals[PROGRESS_SIGNAL], 0, &progress);
+}
+
+static void
+im_send_queue_stats_free (ImSendQueueStats *stats)
+{
+	g_slice_free (ImSendQueueStats, stats);
+}
+
+static void
+complete_results (GSList *results,
+		  const ImSendQueueStats *stats,
+		  GError *error)
+{
+	GSList *node;
+
+	for (node = results; node != NULL; node = g_slist_next (node)) {
+		GSimpleAsyncResult *simple = (GSimpleAsyncResult *) node->data;
+
+		if (error)
+			g_simple_async_result_set_from_error (simple, error);
+		if (stats)
+			g_simple_async_result_set_op_res_gpointer (simple,
+								   g_slice_dup (ImSendQueueStats, stats),
+								   (GDestroyNotify) im_send_queue_stats_free);
+		g_simple_async_result_complete_in_idle (simple);
+		g_object_unref (simple);
+	}
+	g_slist_free (results);
+}
+
+static void
+send_queue_free (SendQueue *queue)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (queue->self);
+	GError *_error = NULL;
+
+	g_cancellable_cancel (queue->cancellable);
+	g_object_unref (queue->cancellable);
+	g_queue_remove (priv->waiting, queue);
+	if (queue->retry_id)
+		g_source_remove (queue->retry_id);
+	if (queue->transfer_retry_id)
+		g_source_remove (queue->transfer_retry_id);
+
+	g_set_error (&_error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+		     _("Account %s was removed"), queue->account_id);
+	complete_results (queue->results, NULL, _error);
+	complete_results (queue->rerun_results, NULL, _error);
+	g_error_free (_error);
+
+	g_free (queue->account_id);
+	g_free (queue->host);
+	g_slice_free (SendQueue, queue);
+}
+
+/* Queues without a known host are never limited */
+static gchar *
+get_transport_host (ImSendQueueMgr *self,
+		    const gchar *account_id)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+	gchar *server_account_name;
+	gchar *hostname = NULL;
+	gchar *result;
+
+	server_account_name = im_account_mgr_get_server_account_name (priv->account_mgr, account_id,
+								      IM_ACCOUNT_TYPE_TRANSPORT);
+	if (server_account_name) {
+		hostname = im_account_mgr_get_server_account_hostname (priv->account_mgr,
+								       server_account_name);
+		g_free (server_account_name);
+	}
+
+	result = g_ascii_strdown (hostname?hostname:"", -1);
+	g_free (hostname);
+
+	return result;
+}
+
+static gboolean
+host_has_free_connection (ImSendQueueMgr *self,
+			  const gchar *host)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+
+	if (host[0] == '\0')
+		return TRUE;
+
+	return GPOINTER_TO_UINT (g_hash_table_lookup (priv->host_connections, host)) <
+		IM_SEND_QUEUE_MGR_MAX_HOST_CONNECTIONS;
+}
+
+static void
+host_add_connection (ImSendQueueMgr *self,
+		     const gchar *host,
+		     gint delta)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+	gint connections;
+
+	connections = GPOINTER_TO_UINT (g_hash_table_lookup (priv->host_connections, host)) + delta;
+	if (connections > 0)
+		g_hash_table_replace (priv->host_connections, g_strdup (host),
+				      GUINT_TO_POINTER (connections));
+	else
+		g_hash_table_remove (priv->host_connections, host);
+}
+
+static void start_queue (SendQueue *queue);
+static void start_transfer (SendQueue *queue);
+
+static gboolean
+on_transfer_retry_timeout (gpointer userdata)
+{
+	SendQueue *queue = (SendQueue *) userdata;
+
+	queue->transfer_retry_id = 0;
+	start_transfer (queue);
+
+	return FALSE;
+}
+
+static void
+on_transfer_finished (GObject *source_object,
+		      GAsyncResult *result,
+		      gpointer userdata)
+{
+	TransferContext *context = (TransferContext *) userdata;
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (context->self);
+	GError *_error = NULL;
+	SendQueue *queue;
+
+	im_mail_op_transfer_sent_finish (IM_SERVICE_MGR (source_object), result,
+					 NULL, &_error);
+
+	/* The account may have been removed meanwhile */
+	queue = g_hash_table_lookup (priv->queues, context->account_id);
+	if (queue && queue->transferring) {
+		queue->transferring = FALSE;
+		if (queue->retransfer) {
+			queue->retransfer = FALSE;
+			start_transfer (queue);
+		} else if (_error && !g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning (_("%s: failed to move %s sent messages: %s"), __FUNCTION__,
+				   context->account_id, _error->message);
+			queue->transfer_retry_id =
+				g_timeout_add_seconds (IM_SEND_QUEUE_MGR_TRANSFER_RETRY_DELAY,
+						       on_transfer_retry_timeout, queue);
+		}
+	}
+
+	if (_error)
+		g_error_free (_error);
+	g_free (context->account_id);
+	g_slice_free (TransferContext, context);
+}
+
+static void
+start_transfer (SendQueue *queue)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (queue->self);
+	TransferContext *context;
+
+	if (queue->transferring) {
+		queue->retransfer = TRUE;
+		return;
+	}
+
+	if (queue->transfer_retry_id) {
+		g_source_remove (queue->transfer_retry_id);
+		queue->transfer_retry_id = 0;
+	}
+
+	context = g_slice_new0 (TransferContext);
+	context->self = queue->self;
+	context->account_id = g_strdup (queue->account_id);
+
+	queue->transferring = TRUE;
+	im_mail_op_transfer_sent_async (priv->service_mgr, queue->account_id,
+					G_PRIORITY_LOW,
+					queue->cancellable,
+					on_transfer_finished,
+					context);
+}
+
+static void
+dispatch_waiting (ImSendQueueMgr *self)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+	GList *node, *next;
+
+	for (node = priv->waiting->head; node != NULL; node = next) {
+		SendQueue *queue = (SendQueue *) node->data;
+
+		next = node->next;
+		if (host_has_free_connection (self, queue->host)) {
+			g_queue_delete_link (priv->waiting, node);
+			start_queue (queue);
+		}
+	}
+}
+
+static void
+enqueue (SendQueue *queue)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (queue->self);
+
+	if (queue->retry_id) {
+		g_source_remove (queue->retry_id);
+		queue->retry_id = 0;
+	}
+
+	/* Host is read on each run, as account may have been edited */
+	g_free (queue->host);
+	queue->host = get_transport_host (queue->self, queue->account_id);
+	queue->state = IM_SEND_QUEUE_STATE_WAITING;
+	g_queue_push_tail (priv->waiting, queue);
+	emit_progress (queue->self, queue->account_id, queue->state, NULL, NULL);
+}
+
+static gboolean
+on_retry_timeout (gpointer userdata)
+{
+	SendQueue *queue = (SendQueue *) userdata;
+
+	queue->retry_id = 0;
+	im_send_queue_mgr_run_async (queue->self, queue->account_id, NULL, NULL);
+
+	return FALSE;
+}
+
+/* Finishes current run of @queue, starting next one if requested
+ * meanwhile, when the rate limit allows sending again, or when the
+ * earliest retry is due */
+static void
+finish_queue (SendQueue *queue,
+	      const ImSendQueueStats *stats,
+	      GError *error)
+{
+	GSList *results;
+
+	results = queue->results;
+	queue->results = NULL;
+	queue->state = IM_SEND_QUEUE_STATE_FINISHED;
+	emit_progress (queue->self, queue->account_id, queue->state, stats, error);
+	complete_results (results, stats, error);
+
+	if (queue->rerun) {
+		queue->rerun = FALSE;
+		queue->results = queue->rerun_results;
+		queue->rerun_results = NULL;
+		enqueue (queue);
+	} else if (stats && stats->throttled) {
+		gint64 delay;
+
+		delay = (stats->next_send - g_get_monotonic_time ()) / 1000;
+		queue->retry_id = g_timeout_add ((guint) CLAMP (delay, 1, G_MAXINT),
+						 on_retry_timeout, queue);
+	} else if (stats && stats->next_attempt > 0) {
+		gint64 delay;
+
+		delay = stats->next_attempt - g_get_real_time () / G_USEC_PER_SEC;
+		queue->retry_id = g_timeout_add_seconds ((guint) CLAMP (delay, 1, G_MAXINT),
+							 on_retry_timeout, queue);
+	}
+}
+
+static gboolean
+on_run_progress_idle (gpointer userdata)
+{
+	RunContext *context = (RunContext *) userdata;
+	ImSendQueueStats stats;
+
+	g_mutex_lock (&context->lock);
+	stats = context->stats;
+	context->idle_id = 0;
+	g_mutex_unlock (&context->lock);
+
+	emit_progress (context->self, context->account_id,
+		       IM_SEND_QUEUE_STATE_RUNNING, &stats, NULL);
+
+	return FALSE;
+}
+
+static void
+on_run_progress (CamelFolder *outbox,
+		 const ImSendQueueStats *stats,
+		 gpointer userdata)
+{
+	RunContext *context = (RunContext *) userdata;
+
+	g_mutex_lock (&context->lock);
+	context->stats = *stats;
+	if (context->idle_id == 0)
+		context->idle_id = g_idle_add (on_run_progress_idle, context);
+	g_mutex_unlock (&context->lock);
+}
+
+static void
+on_run_finished (GObject *source_object,
+		 GAsyncResult *result,
+		 gpointer userdata)
+{
+	RunContext *context = (RunContext *) userdata;
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (context->self);
+	ImSendQueueStats stats;
+	GError *_error = NULL;
+	SendQueue *queue;
+
+	im_mail_op_run_send_queue_finish (CAMEL_FOLDER (source_object), result,
+					  &stats, &_error);
+	if (_error)
+		g_warning (_("%s: failed to run %s send queue: %s"), __FUNCTION__,
+			   context->account_id, _error->message);
+
+	/* Thread is over, so no more progress will be reported */
+	g_mutex_lock (&context->lock);
+	if (context->idle_id)
+		g_source_remove (context->idle_id);
+	context->idle_id = 0;
+	g_mutex_unlock (&context->lock);
+
+	host_add_connection (context->self, context->host, -1);
+
+	/* The account may have been removed meanwhile */
+	queue = g_hash_table_lookup (priv->queues, context->account_id);
+	if (queue && queue->state == IM_SEND_QUEUE_STATE_RUNNING) {
+		queue->next_send = stats.next_send;
+		if (stats.to_sentbox > 0)
+			start_transfer (queue);
+		finish_queue (queue, &stats, _error);
+	}
+
+	dispatch_waiting (context->self);
+
+	if (_error)
+		g_error_free (_error);
+	g_mutex_clear (&context->lock);
+	g_free (context->account_id);
+	g_free (context->host);
+	g_slice_free (RunContext, context);
+}
+
+static void
+start_queue (SendQueue *queue)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (queue->self);
+	GError *_error = NULL;
+	CamelFolder *outbox;
+	RunContext *context;
+	ImSendQueuePolicy policy;
+
+	outbox = im_service_mgr_get_outbox (priv->service_mgr, queue->account_id,
+					    queue->cancellable, &_error);
+	if (outbox == NULL) {
+		if (_error == NULL)
+			g_set_error (&_error, IM_ERROR_DOMAIN,
+				     IM_ERROR_INTERNAL,
+				     _("Could not find account %s outbox"), queue->account_id);
+		finish_queue (queue, NULL, _error);
+		g_error_free (_error);
+		return;
+	}
+
+	context = g_slice_new0 (RunContext);
+	context->self = queue->self;
+	context->account_id = g_strdup (queue->account_id);
+	context->host = g_strdup (queue->host);
+	g_mutex_init (&context->lock);
+
+	host_add_connection (queue->self, queue->host, 1);
+	queue->state = IM_SEND_QUEUE_STATE_RUNNING;
+	emit_progress (queue->self, queue->account_id, queue->state, NULL, NULL);
+
+	policy.rate_limit = im_account_mgr_get_send_rate_limit (priv->account_mgr,
+								 queue->account_id);
+	policy.retry_delay = im_account_mgr_get_send_retry_delay (priv->account_mgr);
+	policy.retry_max_delay = im_account_mgr_get_send_retry_max_delay (priv->account_mgr);
+	policy.max_attempts = im_account_mgr_get_send_max_attempts (priv->account_mgr);
+	policy.next_send = queue->next_send;
+
+	im_mail_op_run_send_queue_async (outbox, &policy,
+					 on_run_progress, context,
+					 G_PRIORITY_DEFAULT_IDLE,
+					 queue->cancellable,
+					 on_run_finished,
+					 context);
+	g_object_unref (outbox);
+}
+
+static SendQueue *
+get_queue (ImSendQueueMgr *self,
+	   const gchar *account_id)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+	SendQueue *queue;
+
+	queue = g_hash_table_lookup (priv->queues, account_id);
+	if (queue == NULL) {
+		queue = g_slice_new0 (SendQueue);
+		queue->self = self;
+		queue->account_id = g_strdup (account_id);
+		queue->state = IM_SEND_QUEUE_STATE_FINISHED;
+		queue->cancellable = g_cancellable_new ();
+		g_hash_table_insert (priv->queues, g_strdup (account_id), queue);
+	}
+
+	return queue;
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (userdata);
+
+	g_hash_table_remove (priv->queues, account_id);
+}
+
+static void
+im_send_queue_mgr_init (ImSendQueueMgr *self)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+
+	priv->queues = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      g_free, (GDestroyNotify) send_queue_free);
+	priv->host_connections = g_hash_table_new_full (g_str_hash, g_str_equal,
+							g_free, NULL);
+	priv->waiting = g_queue_new ();
+}
+
+static void
+im_send_queue_mgr_finalize (GObject *object)
+{
+	ImSendQueueMgrPrivate *priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_hash_table_unref (priv->queues);
+	g_hash_table_unref (priv->host_connections);
+	g_queue_free (priv->waiting);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_send_queue_mgr_parent_class)->finalize (object);
+}
+
+static void
+im_send_queue_mgr_class_init (ImSendQueueMgrClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_send_queue_mgr_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImSendQueueMgrPrivate));
+
+	signals[PROGRESS_SIGNAL] =
+		g_signal_new ("progress",
+			      IM_TYPE_SEND_QUEUE_MGR,
+			      G_SIGNAL_RUN_FIRST,
+			      G_STRUCT_OFFSET (ImSendQueueMgrClass, progress),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__POINTER,
+			      G_TYPE_NONE, 1, G_TYPE_POINTER);
+}
+
+static ImSendQueueMgr *
+im_send_queue_mgr_new (ImServiceMgr *service_mgr,
+		       ImAccountMgr *account_mgr)
+{
+	ImSendQueueMgr *self;
+	ImSendQueueMgrPrivate *priv;
+
+	self = g_object_new (IM_TYPE_SEND_QUEUE_MGR, NULL);
+	priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+
+	return self;
+}
+
+ImSendQueueMgr *
+im_send_queue_mgr_get_instance (void)
+{
+	static ImSendQueueMgr *instance = 0;
+
+	if (instance == 0)
+		instance = im_send_queue_mgr_new (im_service_mgr_get_instance (),
+						  im_account_mgr_get_instance ());
+
+	return instance;
+}
+
+void
+im_send_queue_mgr_run_async (ImSendQueueMgr *self,
+			     const gchar *account_id,
+			     GAsyncReadyCallback callback,
+			     gpointer userdata)
+{
+	GSimpleAsyncResult *simple = NULL;
+	SendQueue *queue;
+
+	g_return_if_fail (IM_IS_SEND_QUEUE_MGR (self));
+	g_return_if_fail (account_id != NULL);
+
+	if (callback)
+		simple = g_simple_async_result_new (G_OBJECT (self),
+						    callback, userdata,
+						    im_send_queue_mgr_run_async);
+
+	queue = get_queue (self, account_id);
+	switch (queue->state) {
+	case IM_SEND_QUEUE_STATE_WAITING:
+		if (simple)
+			queue->results = g_slist_append (queue->results, simple);
+		break;
+	case IM_SEND_QUEUE_STATE_RUNNING:
+		queue->rerun = TRUE;
+		if (simple)
+			queue->rerun_results = g_slist_append (queue->rerun_results, simple);
+		break;
+	case IM_SEND_QUEUE_STATE_FINISHED:
+		if (simple)
+			queue->results = g_slist_append (queue->results, simple);
+		enqueue (queue);
+		dispatch_waiting (self);
+		break;
+	}
+}
+
+gboolean
+im_send_queue_mgr_run_finish (ImSendQueueMgr *self,
+			      GAsyncResult *result,
+			      ImSendQueueStats *stats,
+			      GError **error)
+{
+	GSimpleAsyncResult *simple;
+	ImSendQueueStats *result_stats;
+
+	g_return_val_if_fail (
+		g_simple_async_result_is_valid (
+		result, G_OBJECT (self), im_send_queue_mgr_run_async), FALSE);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	result_stats = (ImSendQueueStats *) g_simple_async_result_get_op_res_gpointer (simple);
+	if (stats) {
+		if (result_stats)
+			*stats = *result_stats;
+		else
+			memset (stats, 0, sizeof (ImSendQueueStats));
+	}
+
+	return !g_simple_async_result_propagate_error (simple, error);
+}
+
+void
+im_send_queue_mgr_run_all (ImSendQueueMgr *self)
+{
+	ImSendQueueMgrPrivate *priv;
+	GSList *account_ids, *node;
+
+	g_return_if_fail (IM_IS_SEND_QUEUE_MGR (self));
+
+	priv = IM_SEND_QUEUE_MGR_GET_PRIVATE (self);
+
+	account_ids = im_account_mgr_get_account_ids (priv->account_mgr, TRUE);
+	for (node = account_ids; node != NULL; node = g_slist_next (node))
+		im_send_queue_mgr_run_async (self, (const gchar *) node->data, NULL, NULL);
+	im_account_mgr_free_account_ids (account_ids);
+}
@@ -0,0 +1,164 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-send-queue-mgr.h : Parallel send queues of the accounts */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IM_SEND_QUEUE_MGR_H__
+#define __IM_SEND_QUEUE_MGR_H__
+
+#include <im-mail-ops.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_SEND_QUEUE_MGR             (im_send_queue_mgr_get_type())
+#define IM_SEND_QUEUE_MGR(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_SEND_QUEUE_MGR,ImSendQueueMgr))
+#define IM_SEND_QUEUE_MGR_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_SEND_QUEUE_MGR,ImSendQueueMgrClass))
+#define IM_IS_SEND_QUEUE_MGR(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_SEND_QUEUE_MGR))
+#define IM_IS_SEND_QUEUE_MGR_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_SEND_QUEUE_MGR))
+#define IM_SEND_QUEUE_MGR_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_SEND_QUEUE_MGR,ImSendQueueMgrClass))
+
+typedef struct _ImSendQueueMgr      ImSendQueueMgr;
+typedef struct _ImSendQueueMgrClass ImSendQueueMgrClass;
+typedef struct _ImSendQueueProgress ImSendQueueProgress;
+
+typedef enum {
+	IM_SEND_QUEUE_STATE_WAITING,
+	IM_SEND_QUEUE_STATE_RUNNING,
+	IM_SEND_QUEUE_STATE_FINISHED
+} ImSendQueueState;
+
+/**
+ * ImSendQueueProgress:
+ * @account_id: the account id
+ * @state: the state of the account send queue
+ * @stats: statistics of the current (or just finished) run
+ * @error: the error that stopped the run, or %NULL
+ *
+ * Progress of an account send queue, passed on #ImSendQueueMgr::progress.
+ */
+struct _ImSendQueueProgress {
+	gchar *account_id;
+	ImSendQueueState state;
+	ImSendQueueStats stats;
+	GError *error;
+};
+
+struct _ImSendQueueMgr {
+	GObject parent;
+};
+
+struct _ImSendQueueMgrClass {
+	GObjectClass parent_class;
+
+	/* Signals */
+	void (*progress) (ImSendQueueMgr *self, ImSendQueueProgress *progress);
+};
+
+/* Maximum number of queues sending through the same SMTP host at the same time */
+#define IM_SEND_QUEUE_MGR_MAX_HOST_CONNECTIONS 2
+/* Delay before retrying to move sent messages to the sent folder, in seconds */
+#define IM_SEND_QUEUE_MGR_TRANSFER_RETRY_DELAY (5 * 60)
+
+/**
+ * im_send_queue_mgr_get_type:
+ *
+ * Returns: GType of the send queue manager
+ */
+GType  im_send_queue_mgr_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_send_queue_mgr_get_instance:
+ *
+ * obtains the singleton #ImSendQueueMgr. It runs the send queues of
+ * different accounts in parallel, but never more than
+ * #IM_SEND_QUEUE_MGR_MAX_HOST_CONNECTIONS at the same time against
+ * the same SMTP host.
+ *
+ * Returns: (transfer none): an #ImSendQueueMgr
+ */
+ImSendQueueMgr*     im_send_queue_mgr_get_instance (void);
+
+/**
+ * im_send_queue_mgr_run_async:
+ * @self: a #ImSendQueueMgr
+ * @account_id: the account id
+ * @callback: (allow-none): a #GAsyncReadyCallback to call when the run is finished
+ * @userdata: data to pass to callback
+ *
+ * Requests a run of the send queue of @account_id. If the queue is already
+ * running, a new run is started when it finishes, so messages added meanwhile
+ * are also sent. Requests done while a run is waiting are merged with it.
+ * If there are messages waiting to be retried, the queue runs again when
+ * the earliest is due.
+ *
+ * Sent messages are moved to the sent folder of the account in the
+ * background, while the queue goes on sending.
+ *
+ * When the run is finished, @callback is called. Then you should call
+ * im_send_queue_mgr_run_finish() to get the result of the operation.
+ */
+void                im_send_queue_mgr_run_async    (ImSendQueueMgr *self,
+						    const gchar *account_id,
+						    GAsyncReadyCallback callback,
+						    gpointer userdata);
+
+/**
+ * im_send_queue_mgr_run_finish:
+ * @self: a #ImSendQueueMgr
+ * @result: a #GAsyncResult
+ * @stats: (out) (allow-none): return location for the statistics of the run, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Finishes the operation started with im_send_queue_mgr_run_async().
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean            im_send_queue_mgr_run_finish   (ImSendQueueMgr *self,
+						    GAsyncResult *result,
+						    ImSendQueueStats *stats,
+						    GError **error);
+
+/**
+ * im_send_queue_mgr_run_all:
+ * @self: a #ImSendQueueMgr
+ *
+ * Requests a run of the send queues of all the enabled accounts.
+ */
+void                im_send_queue_mgr_run_all      (ImSendQueueMgr *self);
+
+G_END_DECLS
+
+#endif /* __IM_SEND_QUEUE_MGR_H__ */
@@ -54,11 +54,11 @@
 #include <im-service-mgr.h>
 
 #include <im-account-mgr-helpers.h>
+#include <im-credential-mgr.h>
 #include <im-error.h>
 
 #include <string.h>
 #include <glib/gi18n.h>
-#include <gnome-keyring.h>
 #include <gtk/gtk.h>
 
 #define IM_OUTBOX_STORE_NAME "outboxes"
@@ -96,6 +96,10 @@ static gboolean remove_local_inbox          (ImServiceMgr *self,
 static gboolean init_local_store            (ImServiceMgr *self,
 					     GError **error);
 
+static CamelService *create_service        (ImServiceMgr *self,
+					    const gchar *name,
+					    ImAccountType type,
+					    gboolean notify);
 static void    insert_account              (ImServiceMgr *self,
 					    const gchar *account,
 					    gboolean is_new);
@@ -118,10 +122,8 @@ static gboolean forget_password	           (CamelSession *session,
 					    CamelService *service,
 					    const gchar *item,
 					    GError **error);
-static gchar * get_keyring_password        (CamelService *service,
-					    guint32 flags);
-static gboolean set_keyring_password       (CamelService *service,
-					    const char *password);
+static gchar * prompt_password             (CamelService *service,
+					    const gchar *current_password);
 static gint    alert_user                  (CamelSession *session,
 					    CamelSessionAlertType type,
 					    const gchar *prompt,
@@ -134,12 +136,15 @@ static gboolean forward_to                 (CamelSession *session,
 					    CamelMimeMessage *message,
 					    const gchar *address,
 					    GError **error);
+static void     watch_store                (ImServiceMgr *self,
+					    CamelStore *store);
 
 /* list my signals */
 enum {
 	SERVICE_CHANGED_SIGNAL,
 	SERVICE_INSERTED_SIGNAL,
 	SERVICE_REMOVED_SIGNAL,
+	FOLDER_CHANGED_SIGNAL,
 
 	LAST_SIGNAL
 };
@@ -157,6 +162,28 @@ struct _ImServiceMgrPrivate {
 
 	/* Local (drafts, sentbox, non storage inboxes) */
 	CamelStore          *local_store;
+
+	/* Folder changes pending to be notified. They're
+	 * accumulated from any thread, so we protect them */
+	GMutex               changes_lock;
+	GHashTable          *pending_changes;
+	guint                changes_timeout_id;
+
+	/* Services whose connection is being checked after a network
+	 * change, with the generation of the last check started on
+	 * them. Operations on them wait on reconnect_cond until that
+	 * check finishes */
+	GMutex               reconnect_lock;
+	GCond                reconnect_cond;
+	GHashTable          *reconnecting;
+	guint                reconnect_generation;
+	/* Serializes password prompts from worker threads */
+	GMutex               prompt_lock;
+	/* Services connected when we went offline, to warm them up
+	 * on return */
+	GHashTable          *warm_up;
+	guint                offline_timeout_id;
+	gchar               *current_account;
 };
 
 #define IM_SERVICE_MGR_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
@@ -229,6 +256,15 @@ im_service_mgr_base_init (gpointer g_class)
 				      g_cclosure_marshal_VOID__OBJECT,
 				      G_TYPE_NONE, 1, CAMEL_TYPE_SERVICE);
 
+		signals[FOLDER_CHANGED_SIGNAL] =
+			g_signal_new ("folder_changed",
+				      IM_TYPE_SERVICE_MGR,
+				      G_SIGNAL_RUN_FIRST,
+				      G_STRUCT_OFFSET (ImServiceMgrClass, folder_changed),
+				      NULL, NULL,
+				      g_cclosure_marshal_VOID__POINTER,
+				      G_TYPE_NONE, 1, G_TYPE_POINTER);
+
 		initialized = TRUE;
 	}
 }
@@ -270,6 +306,40 @@ im_service_mgr_instance_init (ImServiceMgr *obj)
 
 	priv->account_mgr            = NULL;
 
+	g_mutex_init (&priv->changes_lock);
+	priv->pending_changes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						       g_object_unref,
+						       (GDestroyNotify) camel_folder_change_info_free);
+	priv->changes_timeout_id = 0;
+
+	g_mutex_init (&priv->reconnect_lock);
+	g_cond_init (&priv->reconnect_cond);
+	g_mutex_init (&priv->prompt_lock);
+	priv->reconnecting = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						    g_object_unref, NULL);
+	priv->warm_up = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					       g_object_unref, NULL);
+	priv->offline_timeout_id = 0;
+	priv->current_account = NULL;
+}
+
+static gboolean
+store_needs_new_provider (ImServiceMgr *self,
+			  const gchar *account_id,
+			  CamelService *store)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	CamelProvider *provider;
+	gboolean push_mode;
+
+	provider = camel_service_get_provider (store);
+	push_mode = im_account_mgr_get_push_mode (priv->account_mgr, account_id);
+
+	if (g_strcmp0 (provider->protocol, IM_SERVICE_MGR_PUSH_PROVIDER) == 0)
+		return !push_mode;
+
+	return push_mode && g_strcmp0 (provider->protocol, "imap") == 0 &&
+		camel_provider_get (IM_SERVICE_MGR_PUSH_PROVIDER, NULL) != NULL;
 }
 
 static void
@@ -290,6 +360,22 @@ on_account_changed (ImAccountMgr *acc_mgr,
 
 	service = (CamelService *) g_hash_table_lookup (account_hash, (char *) account_id);
 
+	/* Push mode is only available in the imapx provider, so
+	 * toggling it replaces the store with one of the other
+	 * provider */
+	if (service && account_type == IM_ACCOUNT_TYPE_STORE &&
+	    store_needs_new_provider (self, account_id, service)) {
+		camel_service_disconnect_sync (service, TRUE, NULL);
+		camel_session_remove_service (CAMEL_SESSION (self), service);
+		g_hash_table_remove (account_hash, account_id);
+
+		service = create_service (self, account_id, IM_ACCOUNT_TYPE_STORE, TRUE);
+		if (CAMEL_IS_STORE (service))
+			g_hash_table_insert (account_hash, g_strdup (account_id), service);
+		else
+			g_warning (_("%s: failed to create store account"), __FUNCTION__);
+	}
+
 	if (service) {
 		/* TODO */
 		/*modest_tny_account_update_from_account (tny_account, get_password, forget_password);*/
@@ -297,143 +383,108 @@ on_account_changed (ImAccountMgr *acc_mgr,
 	}
 }
 
+/* Asks the user for the password of @service. It must be run in the
+ * main loop */
 static gchar *
-get_keyring_password (CamelService *service, guint32 flags)
+prompt_password (CamelService *service,
+		 const gchar *current_password)
 {
 	CamelSettings *settings;
+	CamelProvider *provider;
+	GtkWidget *dialog;
+	GtkWidget *password_entry;
 	gchar *password = NULL;
 
 	settings = camel_service_get_settings (service);
-	if (CAMEL_IS_NETWORK_SETTINGS (settings)) {
-		CamelNetworkSettings *network = (CamelNetworkSettings *) settings;
-		CamelProvider *provider;
-		GList *results = NULL;
-
-		provider = camel_service_get_provider (service);
-		if (GNOME_KEYRING_RESULT_OK == 
-		    gnome_keyring_find_network_password_sync
-		    (camel_network_settings_get_user (network),
-		     NULL,
-		     camel_network_settings_get_host (network),
-		     NULL,
-		     provider->protocol,
-		     NULL,
-		     camel_network_settings_get_port (network),
-		     &results)) {
-			if (results != NULL) {
-				GnomeKeyringNetworkPasswordData *data = 
-					(GnomeKeyringNetworkPasswordData *) results->data;
-
-				password = g_strdup (data->password);
-				gnome_keyring_network_password_list_free (results);
-			}
-		}
-
-		if (password == NULL || flags & CAMEL_SESSION_PASSWORD_REPROMPT) {
-			GtkWidget *dialog;
-			GtkWidget *password_entry;
-
-			dialog = gtk_message_dialog_new_with_markup
-				(NULL, GTK_DIALOG_MODAL,
-				 GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL,
-				 _("<b>Need password</b>\nPassword needed for %s server at %s"),
-				 provider->protocol,
-				 camel_network_settings_get_host (network));
-
-			password_entry = gtk_entry_new ();
-			if (password) gtk_entry_set_text (GTK_ENTRY (password_entry), password);
-			gtk_entry_set_visibility (GTK_ENTRY (password_entry), FALSE);
-			gtk_container_add (GTK_CONTAINER (gtk_message_dialog_get_message_area (GTK_MESSAGE_DIALOG (dialog))),
-					   password_entry);
-			gtk_widget_show (password_entry);
-			g_free (password);
-			password = NULL;
-
-			if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
-				password = g_strdup (gtk_entry_get_text (GTK_ENTRY (password_entry)));
-				set_keyring_password (service, password);
-			}
-			gtk_widget_destroy (dialog);
-		}
-	} else {
-		g_return_val_if_reached (NULL);
+	g_return_val_if_fail (CAMEL_IS_NETWORK_SETTINGS (settings), NULL);
+	provider = camel_service_get_provider (service);
+
+	dialog = gtk_message_dialog_new_with_markup
+		(NULL, GTK_DIALOG_MODAL,
+		 GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL,
+		 _("<b>Need password</b>\nPassword needed for %s server at %s"),
+		 provider->protocol,
+		 camel_network_settings_get_host (CAMEL_NETWORK_SETTINGS (settings)));
+
+	password_entry = gtk_entry_new ();
+	if (current_password) gtk_entry_set_text (GTK_ENTRY (password_entry), current_password);
+	gtk_entry_set_visibility (GTK_ENTRY (password_entry), FALSE);
+	gtk_container_add (GTK_CONTAINER (gtk_message_dialog_get_message_area (GTK_MESSAGE_DIALOG (dialog))),
+			   password_entry);
+	gtk_widget_show (password_entry);
+
+	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_OK) {
+		password = g_strdup (gtk_entry_get_text (GTK_ENTRY (password_entry)));
 	}
+	gtk_widget_destroy (dialog);
 
 	return password;
 }
 
-static gboolean
-set_keyring_password (CamelService *service, const char *password)
-{
-	CamelSettings *settings;
-
-	settings = camel_service_get_settings (service);
-	if (CAMEL_IS_NETWORK_SETTINGS (settings)) {
-		CamelNetworkSettings *network = (CamelNetworkSettings *) settings;
-		CamelProvider *provider;
-		GList *results = NULL;
-
-		provider = camel_service_get_provider (service);
-		if (password != NULL) {
-			guint32 item_id;
-			gnome_keyring_set_network_password_sync
-				(NULL,
-				 camel_network_settings_get_user (network),
-				 NULL,
-				 camel_network_settings_get_host (network),
-				 NULL,
-				 provider->protocol,
-				 NULL,
-				 camel_network_settings_get_port (network),
-				 password,
-				 &item_id);
-		} else {
-			if (GNOME_KEYRING_RESULT_OK == 
-			    gnome_keyring_find_network_password_sync
-			    (camel_network_settings_get_user (network),
-			     NULL,
-			     camel_network_settings_get_host (network),
-			     NULL,
-			     provider->protocol,
-			     NULL,
-			     camel_network_settings_get_port (network),
-			     &results)) {
-				if (results != NULL) {
-					GList *node;
-					for (node = results; node != NULL; node = g_list_next (node)) {
-						GnomeKeyringNetworkPasswordData *data = 
-							(GnomeKeyringNetworkPasswordData *) node->data;
-						gnome_keyring_item_delete_sync (data->keyring, data->item_id);
-					}
-					gnome_keyring_network_password_list_free (results);
-				}
-			}
-		}
-	} else {
-		g_return_val_if_reached (FALSE);
-	}
-	return TRUE;
-}
-
-typedef struct _IdleGetPasswordData {
+typedef struct _IdlePromptPasswordData {
 	CamelService *service;
-	guint32 flags;
+	const gchar *current_password;
 	gchar *password;
+	gboolean done;
 	GMutex mutex;
 	GCond cond;
-} IdleGetPasswordData;
+} IdlePromptPasswordData;
 
 static gboolean
-idle_get_password (gpointer userdata)
+idle_prompt_password (gpointer userdata)
 {
-	IdleGetPasswordData *data = (IdleGetPasswordData *) userdata;
+	IdlePromptPasswordData *data = (IdlePromptPasswordData *) userdata;
+	gchar *password;
+
+	password = prompt_password (data->service, data->current_password);
+
 	g_mutex_lock (&data->mutex);
-	data->password = get_keyring_password (data->service, data->flags);
+	data->password = password;
+	data->done = TRUE;
 	g_cond_signal (&data->cond);
 	g_mutex_unlock (&data->mutex);
 	return FALSE;
 }
 
+static void
+on_password_looked_up (GObject *source_object,
+		       GAsyncResult *result,
+		       gpointer userdata)
+{
+	*((GAsyncResult **) userdata) = g_object_ref (result);
+}
+
+/* Looks up the password of @service in a worker thread of the
+ * credential manager, waiting for it in a main context of our own, so
+ * the lookups of all the services share its thread pool and its
+ * coalescing of backend queries */
+static gchar *
+lookup_password (ImCredentialMgr *credential_mgr,
+		 CamelService *service,
+		 GError **error)
+{
+	GMainContext *context;
+	GAsyncResult *result = NULL;
+	gchar *password;
+
+	context = g_main_context_new ();
+	g_main_context_push_thread_default (context);
+	im_credential_mgr_lookup_async (credential_mgr, service, G_PRIORITY_DEFAULT,
+					NULL, on_password_looked_up, &result);
+	while (result == NULL)
+		g_main_context_iteration (context, TRUE);
+	g_main_context_pop_thread_default (context);
+	g_main_context_unref (context);
+
+	password = im_credential_mgr_lookup_finish (credential_mgr, result, error);
+	g_object_unref (result);
+
+	return password;
+}
+
+/* Passwords are obtained from the credential manager. Only the password
+ * dialog, if needed, is run in the main loop. A password the server
+ * rejected is removed before prompting, so other lookups don't get it */
 static 	gchar *
 get_password (CamelSession *session,
 	      CamelService *service,
@@ -442,25 +493,79 @@ get_password (CamelSession *session,
 	      guint32 flags,
 	      GError **error)
 {
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (session);
+	ImCredentialMgr *credential_mgr;
+	GError *_error = NULL;
 	gchar *password;
+	gchar *new_password;
+	gboolean locked = FALSE;
 
-	if (g_main_context_is_owner (g_main_context_default ())) {
-		password = get_keyring_password (service, flags);
-	} else {
-		IdleGetPasswordData *data = g_new0 (IdleGetPasswordData, 1);
+	credential_mgr = im_credential_mgr_get_instance ();
+	password = lookup_password (credential_mgr, service, &_error);
+	if (_error) {
+		g_warning (_("%s: failed to get stored password: %s"), __FUNCTION__,
+			   _error->message);
+		g_clear_error (&_error);
+	}
 
-		data->service = service;
-		data->flags = flags;
+	if (password != NULL && !(flags & CAMEL_SESSION_PASSWORD_REPROMPT))
+		return password;
 
-		g_mutex_lock (&data->mutex);
-		gdk_threads_add_idle (idle_get_password, data);
-		g_cond_wait (&data->cond, &data->mutex);
-	
-		password = data->password;
-		g_free (data);
+	if (password != NULL &&
+	    !im_credential_mgr_reject_sync (credential_mgr, service, password, &_error)) {
+		g_warning (_("%s: failed to remove rejected password: %s"), __FUNCTION__,
+			   _error->message);
+		g_clear_error (&_error);
 	}
 
-	return password;
+	if (g_main_context_is_owner (g_main_context_default ())) {
+		new_password = prompt_password (service, password);
+	} else {
+		IdlePromptPasswordData data = { 0, };
+		gchar *stored;
+
+		/* Only one prompt at a time. If another thread got a new
+		 * password for this service while we waited, we use it */
+		g_mutex_lock (&priv->prompt_lock);
+		locked = TRUE;
+		stored = lookup_password (credential_mgr, service, NULL);
+		if (stored && g_strcmp0 (stored, password) != 0) {
+			g_mutex_unlock (&priv->prompt_lock);
+			g_free (password);
+			return stored;
+		}
+		g_free (stored);
+
+		data.service = service;
+		data.current_password = password;
+		g_mutex_init (&data.mutex);
+		g_cond_init (&data.cond);
+
+		g_mutex_lock (&data.mutex);
+		gdk_threads_add_idle (idle_prompt_password, &data);
+		while (!data.done)
+			g_cond_wait (&data.cond, &data.mutex);
+		g_mutex_unlock (&data.mutex);
+
+		g_mutex_clear (&data.mutex);
+		g_cond_clear (&data.cond);
+		new_password = data.password;
+	}
+	g_free (password);
+
+	if (new_password) {
+		im_credential_mgr_store_sync (credential_mgr, service, new_password, &_error);
+		if (_error) {
+			g_warning (_("%s: failed to store password: %s"), __FUNCTION__,
+				   _error->message);
+			g_error_free (_error);
+		}
+	}
+
+	if (locked)
+		g_mutex_unlock (&priv->prompt_lock);
+
+	return new_password;
 }
 
 static gboolean
@@ -469,13 +574,8 @@ forget_password	(CamelSession *session,
 		 const gchar *item,
 		 GError **error)
 {
-	gboolean result;
-
-	gdk_threads_enter ();
-	result = set_keyring_password (service, NULL);
-	gdk_threads_leave ();
-
-	return result;
+	return im_credential_mgr_forget_sync (im_credential_mgr_get_instance (),
+					      service, error);
 }
 
 static gboolean
@@ -489,6 +589,7 @@ authenticate_sync (CamelSession *session,
 	CamelAuthenticationResult auth_result;
 	CamelServiceAuthType *auth_type = NULL;
 	guint32 password_flags;
+	gint64 start = g_get_monotonic_time ();
 
 	if (mechanism != NULL) {
 		auth_type = camel_sasl_authtype (mechanism);
@@ -570,6 +671,8 @@ authenticate_sync (CamelSession *session,
 	}
 
  finish:
+	g_debug ("%s: authentication of %s took %" G_GINT64_FORMAT " us", __FUNCTION__,
+		 camel_service_get_uid (service), g_get_monotonic_time () - start);
 	if (_error) {
 		g_propagate_error (error, _error);
 		return FALSE;
@@ -628,9 +731,184 @@ im_service_mgr_finalize (GObject *obj)
 		priv->transport_services = NULL;
 	}
 
+	if (priv->changes_timeout_id) {
+		g_source_remove (priv->changes_timeout_id);
+		priv->changes_timeout_id = 0;
+	}
+	g_hash_table_destroy (priv->pending_changes);
+	g_mutex_clear (&priv->changes_lock);
+
+	if (priv->offline_timeout_id) {
+		g_source_remove (priv->offline_timeout_id);
+		priv->offline_timeout_id = 0;
+	}
+	g_hash_table_destroy (priv->reconnecting);
+	g_hash_table_destroy (priv->warm_up);
+	g_mutex_clear (&priv->reconnect_lock);
+	g_cond_clear (&priv->reconnect_cond);
+	g_mutex_clear (&priv->prompt_lock);
+	g_free (priv->current_account);
+
 	G_OBJECT_CLASS(parent_class)->finalize (obj);
 }
 
+static void
+folder_changes_free (ImFolderChanges *changes)
+{
+	g_object_unref (changes->folder);
+	g_free (changes->account_id);
+	g_free (changes->folder_name);
+	g_ptr_array_unref (changes->uids_added);
+	g_ptr_array_unref (changes->uids_removed);
+	g_ptr_array_unref (changes->uids_changed);
+	g_slice_free (ImFolderChanges, changes);
+}
+
+static GPtrArray *
+copy_uids_array (GPtrArray *uids)
+{
+	GPtrArray *result;
+	gint i;
+
+	result = g_ptr_array_new_full (uids->len, g_free);
+	for (i = 0; i < uids->len; i++)
+		g_ptr_array_add (result, g_strdup (uids->pdata[i]));
+
+	return result;
+}
+
+static ImFolderChanges *
+folder_changes_new (ImServiceMgr *self,
+		    CamelFolder *folder,
+		    CamelFolderChangeInfo *info)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	ImFolderChanges *changes;
+	CamelStore *store;
+	const gchar *full_name;
+
+	store = camel_folder_get_parent_store (folder);
+	full_name = camel_folder_get_full_name (folder);
+
+	changes = g_slice_new0 (ImFolderChanges);
+	changes->folder = g_object_ref (folder);
+
+	if (store == priv->local_store) {
+		if (g_strcmp0 (full_name, IM_LOCAL_DRAFTS_NAME) == 0) {
+			changes->account_id = NULL;
+			changes->folder_name = g_strdup (IM_LOCAL_DRAFTS_TAG);
+		} else if (strchr (full_name, '/')) {
+			/* Folders of non storage accounts, under their inbox */
+			const gchar *separator = strchr (full_name, '/');
+
+			changes->account_id = g_strndup (full_name, separator - full_name);
+			changes->folder_name = g_strdup (separator + 1);
+		} else {
+			/* Local inboxes are named as their account */
+			changes->account_id = g_strdup (full_name);
+			changes->folder_name = g_strdup ("INBOX");
+		}
+	} else if (store == priv->outbox_store) {
+		changes->account_id = g_strdup (full_name);
+		changes->folder_name = g_strdup (IM_LOCAL_OUTBOX_TAG);
+	} else {
+		changes->account_id = im_account_mgr_get_server_parent_account_name
+			(priv->account_mgr,
+			 camel_service_get_uid (CAMEL_SERVICE (store)),
+			 IM_ACCOUNT_TYPE_STORE);
+		changes->folder_name = g_strdup (full_name);
+	}
+
+	changes->uids_added = copy_uids_array (info->uid_added);
+	changes->uids_removed = copy_uids_array (info->uid_removed);
+	changes->uids_changed = copy_uids_array (info->uid_changed);
+	changes->unread_count = camel_folder_get_unread_message_count (folder);
+	changes->message_count = camel_folder_get_message_count (folder);
+
+	return changes;
+}
+
+static gboolean
+emit_folder_changes (gpointer userdata)
+{
+	ImServiceMgr *self = (ImServiceMgr *) userdata;
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	GHashTable *pending;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_mutex_lock (&priv->changes_lock);
+	pending = priv->pending_changes;
+	priv->pending_changes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						       g_object_unref,
+						       (GDestroyNotify) camel_folder_change_info_free);
+	priv->changes_timeout_id = 0;
+	g_mutex_unlock (&priv->changes_lock);
+
+	g_hash_table_iter_init (&iter, pending);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		ImFolderChanges *changes;
+
+		changes = folder_changes_new (self, CAMEL_FOLDER (key),
+					      (CamelFolderChangeInfo *) value);
+		/* Changes of a folder whose account was removed are dropped */
+		if (changes->account_id != NULL ||
+		    g_strcmp0 (changes->folder_name, IM_LOCAL_DRAFTS_TAG) == 0)
+			g_signal_emit (self, signals[FOLDER_CHANGED_SIGNAL], 0, changes);
+		folder_changes_free (changes);
+	}
+	g_hash_table_destroy (pending);
+
+	return FALSE;
+}
+
+static void
+on_folder_changed (CamelFolder *folder,
+		   CamelFolderChangeInfo *info,
+		   gpointer userdata)
+{
+	ImServiceMgr *self = (ImServiceMgr *) userdata;
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	CamelFolderChangeInfo *pending;
+
+	if (!camel_folder_change_info_changed (info))
+		return;
+
+	g_mutex_lock (&priv->changes_lock);
+	pending = g_hash_table_lookup (priv->pending_changes, folder);
+	if (pending == NULL) {
+		pending = camel_folder_change_info_new ();
+		g_hash_table_insert (priv->pending_changes, g_object_ref (folder), pending);
+	}
+	camel_folder_change_info_cat (pending, info);
+
+	if (priv->changes_timeout_id == 0)
+		priv->changes_timeout_id = g_timeout_add (IM_SERVICE_MGR_FOLDER_CHANGED_DELAY,
+							  emit_folder_changes, self);
+	g_mutex_unlock (&priv->changes_lock);
+}
+
+static void
+on_folder_opened (CamelStore *store,
+		  CamelFolder *folder,
+		  gpointer userdata)
+{
+	if (g_object_get_data (G_OBJECT (folder), "im-service-mgr-watched"))
+		return;
+
+	g_object_set_data (G_OBJECT (folder), "im-service-mgr-watched", GINT_TO_POINTER (TRUE));
+	g_signal_connect (G_OBJECT (folder), "changed",
+			  G_CALLBACK (on_folder_changed), userdata);
+}
+
+static void
+watch_store (ImServiceMgr *self,
+	     CamelStore *store)
+{
+	g_signal_connect (G_OBJECT (store), "folder-opened",
+			  G_CALLBACK (on_folder_opened), self);
+}
+
 static void
 disconnect_service (gpointer key,
 		    gpointer value,
@@ -656,19 +934,314 @@ disconnect_all (ImServiceMgr *self)
 			      NULL);
 }
 
+typedef struct _RouteCheck {
+	ImServiceMgr *self;
+	CamelService *service;
+	gboolean warm_up;
+	/* Generation set in reconnecting when the check started */
+	guint generation;
+	/* Route checks started once this one finishes */
+	GList *next_checks;
+} RouteCheck;
+
+static void start_route_check (RouteCheck *check);
+
+static void
+route_check_free (RouteCheck *check)
+{
+	g_object_unref (check->service);
+	g_list_free (check->next_checks);
+	g_slice_free (RouteCheck, check);
+}
+
+/* Marks @service as reconnecting, returning the generation of the
+ * mark. Checks may overlap if the network changes again, so only the
+ * latest one started on the service clears it */
+static guint
+set_reconnecting (ImServiceMgr *self,
+		  CamelService *service)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	guint generation;
+
+	g_mutex_lock (&priv->reconnect_lock);
+	generation = ++priv->reconnect_generation;
+	g_hash_table_replace (priv->reconnecting, g_object_ref (service),
+			      GUINT_TO_POINTER (generation));
+	g_mutex_unlock (&priv->reconnect_lock);
+
+	return generation;
+}
+
+static void
+unset_reconnecting (ImServiceMgr *self,
+		    CamelService *service,
+		    guint generation)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	gpointer current;
+
+	g_mutex_lock (&priv->reconnect_lock);
+	if (g_hash_table_lookup_extended (priv->reconnecting, service, NULL, &current) &&
+	    GPOINTER_TO_UINT (current) == generation) {
+		g_hash_table_remove (priv->reconnecting, service);
+		g_cond_broadcast (&priv->reconnect_cond);
+	}
+	g_mutex_unlock (&priv->reconnect_lock);
+}
+
+static void
+route_check_done (RouteCheck *check)
+{
+	GList *node;
+
+	unset_reconnecting (check->self, check->service, check->generation);
+
+	for (node = check->next_checks; node != NULL; node = g_list_next (node))
+		start_route_check ((RouteCheck *) node->data);
+
+	route_check_free (check);
+}
+
+static void
+on_route_check_connected (GObject *source_object,
+			  GAsyncResult *result,
+			  gpointer userdata)
+{
+	GError *_error = NULL;
+
+	if (!camel_service_connect_finish (CAMEL_SERVICE (source_object), result, &_error)) {
+		g_warning (_("%s: failed to reconnect %s: %s"), __FUNCTION__,
+			   camel_service_get_uid (CAMEL_SERVICE (source_object)),
+			   _error->message);
+		g_error_free (_error);
+	}
+
+	route_check_done ((RouteCheck *) userdata);
+}
+
+static void
+on_route_check_disconnected (GObject *source_object,
+			     GAsyncResult *result,
+			     gpointer userdata)
+{
+	camel_service_disconnect_finish (CAMEL_SERVICE (source_object), result, NULL);
+
+	route_check_done ((RouteCheck *) userdata);
+}
+
+static void
+on_route_check_can_reach (GObject *source_object,
+			  GAsyncResult *result,
+			  gpointer userdata)
+{
+	RouteCheck *check = (RouteCheck *) userdata;
+	CamelServiceConnectionStatus status;
+	gboolean reachable;
+
+	reachable = g_network_monitor_can_reach_finish (G_NETWORK_MONITOR (source_object),
+							result, NULL);
+	status = camel_service_get_connection_status (check->service);
+
+	if (!reachable) {
+		/* The route to the server went away, so the connection
+		 * is not usable anymore */
+		if (status != CAMEL_SERVICE_DISCONNECTED) {
+			camel_service_disconnect (check->service, FALSE,
+						  G_PRIORITY_DEFAULT, NULL,
+						  on_route_check_disconnected, check);
+			return;
+		}
+	} else if (check->warm_up && status == CAMEL_SERVICE_DISCONNECTED) {
+		camel_service_connect (check->service,
+				       check->next_checks ? G_PRIORITY_HIGH : G_PRIORITY_DEFAULT,
+				       NULL,
+				       on_route_check_connected, check);
+		return;
+	}
+
+	route_check_done (check);
+}
+
+static void
+start_route_check (RouteCheck *check)
+{
+	CamelSettings *settings;
+	const gchar *host = NULL;
+	guint16 port = 0;
+	GSocketConnectable *connectable;
+
+	settings = camel_service_get_settings (check->service);
+	if (CAMEL_IS_NETWORK_SETTINGS (settings)) {
+		host = camel_network_settings_get_host (CAMEL_NETWORK_SETTINGS (settings));
+		port = camel_network_settings_get_port (CAMEL_NETWORK_SETTINGS (settings));
+	}
+
+	/* Nothing to check in local services */
+	if (host == NULL || host[0] == '\0') {
+		route_check_done (check);
+		return;
+	}
+
+	connectable = g_network_address_new (host, port);
+	g_network_monitor_can_reach_async (g_network_monitor_get_default (),
+					   connectable, NULL,
+					   on_route_check_can_reach, check);
+	g_object_unref (connectable);
+}
+
+static RouteCheck *
+route_check_new (ImServiceMgr *self,
+		 CamelService *service)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	RouteCheck *check;
+
+	check = g_slice_new0 (RouteCheck);
+	check->self = self;
+	check->service = g_object_ref (service);
+	check->warm_up = CAMEL_IS_STORE (service) &&
+		(camel_service_get_connection_status (service) == CAMEL_SERVICE_CONNECTED ||
+		 g_hash_table_lookup_extended (priv->warm_up, service, NULL, NULL));
+	check->generation = set_reconnecting (self, service);
+
+	return check;
+}
+
+/* Checks the route to all the services after a network change, keeping
+ * the connections still reachable. Services of the current account are
+ * checked (and warmed up) first, and the rest after them */
+static void
+check_routes (ImServiceMgr *self)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	GHashTableIter iter;
+	CamelService *service;
+	const gchar *account_id;
+	GList *first = NULL, *rest = NULL, *node;
+	GHashTable *tables[2];
+	gint i;
+
+	tables[0] = priv->store_services;
+	tables[1] = priv->transport_services;
+	for (i = 0; i < 2; i++) {
+		g_hash_table_iter_init (&iter, tables[i]);
+		while (g_hash_table_iter_next (&iter, (gpointer *) &account_id, (gpointer *) &service)) {
+			RouteCheck *check = route_check_new (self, service);
+
+			if (g_strcmp0 (account_id, priv->current_account) == 0)
+				first = g_list_prepend (first, check);
+			else
+				rest = g_list_prepend (rest, check);
+		}
+	}
+	g_hash_table_remove_all (priv->warm_up);
+
+	if (first == NULL) {
+		for (node = rest; node != NULL; node = g_list_next (node))
+			start_route_check ((RouteCheck *) node->data);
+		g_list_free (rest);
+		return;
+	}
+
+	/* The current account store (it's the last one prepended) starts
+	 * the rest when finished */
+	for (node = first; node != NULL; node = g_list_next (node)) {
+		RouteCheck *check = (RouteCheck *) node->data;
+
+		if (CAMEL_IS_STORE (check->service)) {
+			check->next_checks = rest;
+			rest = NULL;
+		}
+		start_route_check (check);
+	}
+	g_list_free (first);
+
+	/* No store in current account */
+	for (node = rest; node != NULL; node = g_list_next (node))
+		start_route_check ((RouteCheck *) node->data);
+	g_list_free (rest);
+}
+
+static void
+add_warm_up_service (gpointer key,
+		     gpointer value,
+		     gpointer userdata)
+{
+	CamelService *service = (CamelService *) value;
+
+	if (camel_service_get_connection_status (service) == CAMEL_SERVICE_CONNECTED)
+		g_hash_table_replace ((GHashTable *) userdata, g_object_ref (service), NULL);
+}
+
+static gboolean
+on_offline_timeout (gpointer userdata)
+{
+	ImServiceMgr *self = (ImServiceMgr *) userdata;
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+
+	priv->offline_timeout_id = 0;
+
+	/* Network did not come back, so we really go offline. Operations
+	 * waiting for reconnection are released, and they will fail */
+	g_hash_table_foreach (priv->store_services, add_warm_up_service, priv->warm_up);
+	g_mutex_lock (&priv->reconnect_lock);
+	g_hash_table_remove_all (priv->reconnecting);
+	g_cond_broadcast (&priv->reconnect_cond);
+	g_mutex_unlock (&priv->reconnect_lock);
+
+	camel_session_set_online (CAMEL_SESSION (self), FALSE);
+	disconnect_all (self);
+
+	return FALSE;
+}
+
+static void
+mark_all_reconnecting (ImServiceMgr *self)
+{
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	GHashTableIter iter;
+	CamelService *service;
+
+	g_hash_table_iter_init (&iter, priv->store_services);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &service))
+		set_reconnecting (self, service);
+	g_hash_table_iter_init (&iter, priv->transport_services);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &service))
+		set_reconnecting (self, service);
+}
+
 static void
 on_network_changed (GNetworkMonitor *monitor,
 		    gboolean available,
 		    gpointer userdata)
 {
 	ImServiceMgr *self = (ImServiceMgr *) userdata;
-
-	camel_session_set_online (CAMEL_SESSION (self),
-				  available);
+	ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
 
 	if (!available) {
-		disconnect_all (self);
+		/* We give some time to the network to come back before
+		 * dropping connections, and operations wait for it */
+		if (camel_session_get_online (CAMEL_SESSION (self)) &&
+		    priv->offline_timeout_id == 0) {
+			mark_all_reconnecting (self);
+			priv->offline_timeout_id = g_timeout_add_seconds (IM_SERVICE_MGR_OFFLINE_GRACE,
+									  on_offline_timeout, self);
+		}
+		return;
+	}
+
+	if (priv->offline_timeout_id) {
+		g_source_remove (priv->offline_timeout_id);
+		priv->offline_timeout_id = 0;
 	}
+
+	if (!camel_session_get_online (CAMEL_SESSION (self)))
+		camel_session_set_online (CAMEL_SESSION (self), TRUE);
+
+	/* Routes may have changed, so we only drop the connections to the
+	 * servers not reachable anymore */
+	check_routes (self);
 }
 
 static ImServiceMgr*
@@ -768,6 +1341,63 @@ im_service_mgr_get_service (ImServiceMgr *self,
 	return retval;
 }
 
+gboolean
+im_service_mgr_wait_for_service (ImServiceMgr *self,
+				 CamelService *service,
+				 GCancellable *cancellable,
+				 GError **error)
+{
+	ImServiceMgrPrivate *priv;
+	GError *_error = NULL;
+	gint64 end_time;
+
+	g_return_val_if_fail (IM_IS_SERVICE_MGR (self), FALSE);
+	g_return_val_if_fail (CAMEL_IS_SERVICE (service), FALSE);
+
+	/* Never block the main loop, as it's the one doing the checks */
+	if (g_main_context_is_owner (g_main_context_default ()))
+		return TRUE;
+
+	priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	end_time = g_get_monotonic_time () + IM_SERVICE_MGR_RECONNECT_TIMEOUT * G_TIME_SPAN_SECOND;
+
+	g_mutex_lock (&priv->reconnect_lock);
+	while (g_hash_table_lookup_extended (priv->reconnecting, service, NULL, NULL)) {
+		gint64 now = g_get_monotonic_time ();
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, &_error))
+			break;
+		/* We let the operation go on, it will fail by itself
+		 * if the connection is not back */
+		if (now >= end_time)
+			break;
+		/* We wake up periodically to check cancellation */
+		g_cond_wait_until (&priv->reconnect_cond, &priv->reconnect_lock,
+				   MIN (end_time, now + G_TIME_SPAN_SECOND));
+	}
+	g_mutex_unlock (&priv->reconnect_lock);
+
+	if (_error) {
+		g_propagate_error (error, _error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+im_service_mgr_set_current_account (ImServiceMgr *self,
+				    const gchar *account_id)
+{
+	ImServiceMgrPrivate *priv;
+
+	g_return_if_fail (IM_IS_SERVICE_MGR (self));
+
+	priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+	g_free (priv->current_account);
+	priv->current_account = g_strdup (account_id);
+}
+
 /*********************************************************************************/
 static void
 add_existing_accounts (ImServiceMgr *self)
@@ -852,6 +1482,7 @@ init_outbox (ImServiceMgr *self, GError **error)
 		g_object_set (priv->outbox_store,
 			      "need-summary-check", TRUE,
 			      NULL);
+		watch_store (self, priv->outbox_store);
 
 		settings = camel_service_get_settings (CAMEL_SERVICE (priv->outbox_store));
 		if (CAMEL_IS_LOCAL_SETTINGS (settings)) {
@@ -983,6 +1614,7 @@ init_local_store (ImServiceMgr *self, GError **error)
 		g_object_set (priv->local_store,
 			      "need-summary-check", TRUE,
 			      NULL);
+		watch_store (self, priv->local_store);
 
 		settings = camel_service_get_settings (CAMEL_SERVICE (priv->local_store));
 		if (CAMEL_IS_LOCAL_SETTINGS (settings)) {
@@ -1117,6 +1749,96 @@ im_service_mgr_get_drafts (ImServiceMgr *self,
 					    cancellable, error);
 }
 
+static const gchar *
+find_sent_folder (CamelFolderInfo *fi)
+{
+	for (; fi != NULL; fi = fi->next) {
+		const gchar *full_name;
+
+		if ((fi->flags & CAMEL_FOLDER_TYPE_MASK) == CAMEL_FOLDER_TYPE_SENT)
+			return fi->full_name;
+		full_name = find_sent_folder (fi->child);
+		if (full_name)
+			return full_name;
+	}
+
+	return NULL;
+}
+
+static const gchar *
+find_sent_folder_by_name (CamelFolderInfo *fi)
+{
+	const gchar *names[] = IM_SERVICE_MGR_SENT_NAMES;
+	gint i;
+
+	/* Only top level and INBOX children are checked */
+	for (i = 0; names[i] != NULL; i++) {
+		CamelFolderInfo *node;
+
+		for (node = fi; node != NULL; node = node->next) {
+			CamelFolderInfo *child;
+
+			if (g_ascii_strcasecmp (node->display_name, names[i]) == 0)
+				return node->full_name;
+			if (g_ascii_strcasecmp (node->full_name, "INBOX") != 0)
+				continue;
+			for (child = node->child; child != NULL; child = child->next) {
+				if (g_ascii_strcasecmp (child->display_name, names[i]) == 0)
+					return child->full_name;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+CamelFolder *
+im_service_mgr_get_sent (ImServiceMgr *self,
+			 const char *account_name,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	CamelService *store;
+	CamelFolderInfo *fi;
+	CamelFolder *folder;
+	const gchar *full_name;
+	gchar *sent_name;
+	GError *_error = NULL;
+
+	store = im_service_mgr_get_service (self, account_name, IM_ACCOUNT_TYPE_STORE);
+	if (!CAMEL_IS_STORE (store) ||
+	    !(camel_service_get_provider (store)->flags & CAMEL_PROVIDER_IS_STORAGE))
+		return NULL;
+
+	if (!im_service_mgr_wait_for_service (self, store, cancellable, error))
+		return NULL;
+
+	fi = camel_store_get_folder_info_sync (CAMEL_STORE (store), NULL,
+					       CAMEL_STORE_FOLDER_INFO_RECURSIVE,
+					       cancellable, &_error);
+	if (_error) {
+		g_propagate_error (error, _error);
+		return NULL;
+	}
+
+	full_name = find_sent_folder (fi);
+	if (full_name == NULL)
+		full_name = find_sent_folder_by_name (fi);
+	if (full_name == NULL) {
+		const gchar *names[] = IM_SERVICE_MGR_SENT_NAMES;
+		full_name = names[0];
+	}
+	sent_name = g_strdup (full_name);
+	camel_store_free_folder_info (CAMEL_STORE (store), fi);
+
+	folder = camel_store_get_folder_sync (CAMEL_STORE (store), sent_name,
+					      CAMEL_STORE_FOLDER_CREATE,
+					      cancellable, error);
+	g_free (sent_name);
+
+	return folder;
+}
+
 gboolean
 im_service_mgr_has_local_inbox (ImServiceMgr *self,
 				const char *account_name)
@@ -1189,11 +1911,24 @@ im_service_mgr_get_folder (ImServiceMgr *self,
 						    account_id,
 						    cancellable,
 						    error);
+	} else if (im_service_mgr_has_local_inbox (self, account_id)) {
+		ImServiceMgrPrivate *priv = IM_SERVICE_MGR_GET_PRIVATE (self);
+		gchar *full_name;
+
+		/* Non storage accounts keep their folders under their inbox */
+		full_name = g_strconcat (account_id, "/", folder_name, NULL);
+		folder = camel_store_get_folder_sync (priv->local_store, full_name,
+						      CAMEL_STORE_FOLDER_CREATE,
+						      cancellable, error);
+		g_free (full_name);
 	} else {
 		CamelStore *store;
 		store = (CamelStore *) im_service_mgr_get_service (self,
 								   account_id,
 								   IM_ACCOUNT_TYPE_STORE);
+		if (!im_service_mgr_wait_for_service (self, CAMEL_SERVICE (store),
+						      cancellable, error))
+			return NULL;
 		folder = camel_store_get_folder_sync 
 			(store, folder_name,
 			 CAMEL_STORE_FOLDER_CREATE | CAMEL_STORE_FOLDER_BODY_INDEX, 
@@ -1229,6 +1964,15 @@ create_service (ImServiceMgr *self,
 							      protocol_type);
 	g_return_val_if_fail (protocol, NULL);
 	protocol_str = im_protocol_get_name (protocol);
+
+	/* IDLE is only implemented in the imapx provider, so we use it
+	 * instead of imap for accounts with push mode enabled */
+	if (type == IM_ACCOUNT_TYPE_STORE &&
+	    protocol_type == im_protocol_registry_get_imap_type_id () &&
+	    im_account_mgr_get_push_mode (priv->account_mgr, name) &&
+	    camel_provider_get (IM_SERVICE_MGR_PUSH_PROVIDER, NULL) != NULL)
+		protocol_str = IM_SERVICE_MGR_PUSH_PROVIDER;
+
 	service = camel_session_add_service (CAMEL_SESSION (self),
 					     im_server_account_settings_get_account_name (server_settings),
 					     protocol_str,
@@ -1240,12 +1984,17 @@ create_service (ImServiceMgr *self,
 		settings = camel_service_get_settings (service);
 		if (CAMEL_IS_NETWORK_SETTINGS (settings))
 			fill_network_settings (server_settings, type, CAMEL_NETWORK_SETTINGS (settings));
+		if (g_object_class_find_property (G_OBJECT_GET_CLASS (settings), "use-idle"))
+			g_object_set (settings, "use-idle",
+				      im_account_mgr_get_push_mode (priv->account_mgr, name),
+				      NULL);
 
 		if (type == IM_ACCOUNT_TYPE_STORE) {
 			CamelProvider *provider;
 			provider = camel_service_get_provider (service);
 			if (!(provider->flags & CAMEL_PROVIDER_IS_STORAGE))
 				init_local_inbox (self, name, NULL);
+			watch_store (self, CAMEL_STORE (service));
 		}
 		
 	}
@@ -75,6 +75,7 @@ G_BEGIN_DECLS
 
 typedef struct _ImServiceMgr      ImServiceMgr;
 typedef struct _ImServiceMgrClass ImServiceMgrClass;
+typedef struct _ImFolderChanges   ImFolderChanges;
 
 struct _ImServiceMgr {
 	CamelSession parent;
@@ -124,8 +125,51 @@ struct _ImServiceMgrClass {
 	void (*service_changed) (ImServiceMgr *self, CamelService *account);
 	void (*service_inserted) (ImServiceMgr *self, CamelService *account);
 	void (*service_removed) (ImServiceMgr *self, CamelService *account);
+	void (*folder_changed) (ImServiceMgr *self, ImFolderChanges *changes);
 };
 
+/**
+ * ImFolderChanges:
+ * @folder: the #CamelFolder that changed
+ * @account_id: the account id, or %NULL for folders shared by all accounts (drafts)
+ * @folder_name: the folder name, as used by the UI (it may be an special tag)
+ * @uids_added: (element-type utf8): uids added since last notification
+ * @uids_removed: (element-type utf8): uids removed since last notification
+ * @uids_changed: (element-type utf8): uids whose flags or tags changed
+ * @unread_count: the current unread count of the folder
+ * @message_count: the current message count of the folder
+ *
+ * Coalesced set of changes in a folder, passed on #ImServiceMgr::folder_changed.
+ */
+struct _ImFolderChanges {
+	CamelFolder *folder;
+	gchar *account_id;
+	gchar *folder_name;
+	GPtrArray *uids_added;
+	GPtrArray *uids_removed;
+	GPtrArray *uids_changed;
+	gint unread_count;
+	gint message_count;
+};
+
+/* Changes in folders are coalesced during this time (in ms) before notifying */
+#define IM_SERVICE_MGR_FOLDER_CHANGED_DELAY 500
+
+/* Time (in seconds) we wait for the network to come back before
+ * dropping all the connections */
+#define IM_SERVICE_MGR_OFFLINE_GRACE 10
+
+/* Maximum time (in seconds) an operation waits for its service to
+ * be reconnected */
+#define IM_SERVICE_MGR_RECONNECT_TIMEOUT 30
+
+/* Camel provider used for IMAP accounts in push mode, as it implements IDLE */
+#define IM_SERVICE_MGR_PUSH_PROVIDER "imapx"
+
+/* Names of the sent folder, for servers not flagging it. The first one
+ * is used to create it if there's none */
+#define IM_SERVICE_MGR_SENT_NAMES { "Sent", "Sent Items", "Sent Messages", "Sent Mail", NULL }
+
 /* We set 5Mb as the upper limit to consider disk full conditions */
 #define IM_SERVICE_MGR_MIN_FREE_SPACE 5 * 1024 * 1024
 
@@ -160,6 +204,36 @@ CamelService* im_service_mgr_get_service (ImServiceMgr *self,
 					  const gchar *account_id,
 					  ImAccountType type);
 
+/**
+ * im_service_mgr_wait_for_service:
+ * @self: a #ImServiceMgr instance
+ * @service: a #CamelService
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Blocks while the connection of @service is being checked after a
+ * network change, so operations submitted meanwhile are run once the
+ * connection is back, instead of failing. It never blocks the main
+ * loop, and waits at most #IM_SERVICE_MGR_RECONNECT_TIMEOUT seconds.
+ *
+ * Returns: %TRUE, or %FALSE if @cancellable was cancelled
+ */
+gboolean im_service_mgr_wait_for_service (ImServiceMgr *self,
+					  CamelService *service,
+					  GCancellable *cancellable,
+					  GError **error);
+
+/**
+ * im_service_mgr_set_current_account:
+ * @self: a #ImServiceMgr instance
+ * @account_id: (allow-none): an account id
+ *
+ * Sets the account the user is currently looking at. Its connections
+ * are restored first after a network change.
+ */
+void im_service_mgr_set_current_account (ImServiceMgr *self,
+					 const gchar *account_id);
+
 /**
  * im_service_mgr_get_folder:
  * @self: a #ImServiceMgr instance
@@ -197,6 +271,26 @@ CamelFolder *im_service_mgr_get_outbox (ImServiceMgr *self,
 					GCancellable *cancellable,
 					GError **error);
 
+/**
+ * im_service_mgr_get_sent:
+ * @self: an #ImServiceMgr instance
+ * @account_name: the account name
+ * @cancellable: a #GCancellable
+ * @error: a #GError pointer
+ *
+ * Obtains the folder of the account store where sent messages are
+ * kept. It's the folder flagged as sent by the server or, if there's
+ * none, the first one named as in #IM_SERVICE_MGR_SENT_NAMES, that is
+ * created if needed. Stores without storage, as POP3, have no sent
+ * folder, and %NULL is returned without setting @error.
+ *
+ * Returns: (transfer full): a #CamelFolder, or %NULL
+ */
+CamelFolder *im_service_mgr_get_sent (ImServiceMgr *self,
+				      const char *account_name,
+				      GCancellable *cancellable,
+				      GError **error);
+
 /**
  * im_service_mgr_get_drafts:
  * @self: an #ImServiceMgr instance
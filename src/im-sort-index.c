@@ -0,0 +1,616 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-sort-index.c : Cached sort orders of the folders */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-sort-index.h"
+
+#include "im-account-mgr.h"
+
+#include <string.h>
+
+typedef struct _ImSortIndexPrivate ImSortIndexPrivate;
+struct _ImSortIndexPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* Protects the folders, as they're loaded from the mail
+	 * operation threads */
+	GMutex lock;
+	GCond loaded_cond;
+	/* "account_id\nfolder_name\nsort_key" -> SortedFolder */
+	GHashTable *folders;
+};
+
+#define IM_SORT_INDEX_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					   IM_TYPE_SORT_INDEX, \
+					   ImSortIndexPrivate))
+
+typedef struct _SortEntry {
+	gchar *uid;
+	gint64 value;
+	gchar *text;
+	time_t date;
+} SortEntry;
+
+typedef struct _SortedFolder {
+	gchar *account_id;
+	gchar *folder_name;
+	ImSortKey sort_key;
+	/* SortEntry, in display order */
+	GSequence *entries;
+	/* uid -> GSequenceIter */
+	GHashTable *iters;
+
+	/* Changes received while the entries are being sorted */
+	gboolean loading;
+	GPtrArray *pending_added;
+	GPtrArray *pending_removed;
+	GPtrArray *pending_changed;
+} SortedFolder;
+
+G_DEFINE_TYPE (ImSortIndex, im_sort_index, G_TYPE_OBJECT);
+
+static void
+sort_entry_free (SortEntry *entry)
+{
+	g_free (entry->uid);
+	g_free (entry->text);
+	g_slice_free (SortEntry, entry);
+}
+
+static gchar *
+get_collate_key (const gchar *text)
+{
+	gchar *folded, *result;
+
+	folded = g_utf8_casefold (text ? text : "", -1);
+	result = g_utf8_collate_key (folded, -1);
+	g_free (folded);
+
+	return result;
+}
+
+static SortEntry *
+sort_entry_new (CamelFolder *folder,
+		const gchar *uid,
+		ImSortKey sort_key)
+{
+	CamelMessageInfo *mi;
+	SortEntry *entry;
+
+	mi = camel_folder_get_message_info (folder, uid);
+	if (mi == NULL)
+		return NULL;
+
+	entry = g_slice_new0 (SortEntry);
+	entry->uid = g_strdup (uid);
+	entry->date = camel_message_info_date_received (mi);
+
+	switch (sort_key) {
+	case IM_SORT_KEY_DATE_RECEIVED:
+		entry->value = entry->date;
+		break;
+	case IM_SORT_KEY_DATE_SENT:
+		entry->value = camel_message_info_date_sent (mi);
+		break;
+	case IM_SORT_KEY_FROM:
+		entry->text = get_collate_key (camel_message_info_from (mi));
+		break;
+	case IM_SORT_KEY_SUBJECT:
+		entry->text = get_collate_key (camel_message_info_subject (mi));
+		break;
+	case IM_SORT_KEY_SIZE:
+		entry->value = camel_message_info_size (mi);
+		break;
+	case IM_SORT_KEY_UNREAD_FIRST:
+		entry->value = (camel_message_info_flags (mi) & CAMEL_MESSAGE_SEEN) ? 1 : 0;
+		break;
+	default:
+		break;
+	}
+
+	camel_folder_free_message_info (folder, mi);
+
+	return entry;
+}
+
+static gint
+compare_entries (gconstpointer a,
+		 gconstpointer b,
+		 gpointer userdata)
+{
+	const SortEntry *entry_a = (const SortEntry *) a;
+	const SortEntry *entry_b = (const SortEntry *) b;
+	gint result = 0;
+
+	switch ((ImSortKey) GPOINTER_TO_INT (userdata)) {
+	case IM_SORT_KEY_DATE_RECEIVED:
+	case IM_SORT_KEY_DATE_SENT:
+	case IM_SORT_KEY_SIZE:
+		if (entry_a->value != entry_b->value)
+			result = entry_a->value > entry_b->value ? -1 : 1;
+		break;
+	case IM_SORT_KEY_FROM:
+	case IM_SORT_KEY_SUBJECT:
+		result = strcmp (entry_a->text, entry_b->text);
+		break;
+	case IM_SORT_KEY_UNREAD_FIRST:
+		if (entry_a->value != entry_b->value)
+			result = entry_a->value < entry_b->value ? -1 : 1;
+		break;
+	default:
+		break;
+	}
+
+	/* Ties are sorted by date, and then uid, so each message has a
+	 * fixed position */
+	if (result == 0 && entry_a->date != entry_b->date)
+		result = entry_a->date > entry_b->date ? -1 : 1;
+	if (result == 0)
+		result = -strcmp (entry_a->uid, entry_b->uid);
+
+	return result;
+}
+
+static void
+sorted_folder_free (SortedFolder *sorted_folder)
+{
+	g_hash_table_destroy (sorted_folder->iters);
+	g_sequence_free (sorted_folder->entries);
+	g_ptr_array_unref (sorted_folder->pending_added);
+	g_ptr_array_unref (sorted_folder->pending_removed);
+	g_ptr_array_unref (sorted_folder->pending_changed);
+	g_free (sorted_folder->account_id);
+	g_free (sorted_folder->folder_name);
+	g_slice_free (SortedFolder, sorted_folder);
+}
+
+static void
+sorted_folder_add (SortedFolder *sorted_folder,
+		   CamelFolder *folder,
+		   const gchar *uid)
+{
+	SortEntry *entry;
+	GSequenceIter *iter;
+
+	if (g_hash_table_contains (sorted_folder->iters, uid))
+		return;
+
+	entry = sort_entry_new (folder, uid, sorted_folder->sort_key);
+	if (entry == NULL)
+		return;
+
+	iter = g_sequence_insert_sorted (sorted_folder->entries, entry, compare_entries,
+					 GINT_TO_POINTER (sorted_folder->sort_key));
+	g_hash_table_insert (sorted_folder->iters, entry->uid, iter);
+}
+
+static void
+sorted_folder_remove (SortedFolder *sorted_folder,
+		      const gchar *uid)
+{
+	GSequenceIter *iter;
+
+	iter = g_hash_table_lookup (sorted_folder->iters, uid);
+	if (iter == NULL)
+		return;
+
+	g_hash_table_remove (sorted_folder->iters, uid);
+	g_sequence_remove (iter);
+}
+
+/* Only the unread state of a message can change its position */
+static void
+sorted_folder_change (SortedFolder *sorted_folder,
+		      CamelFolder *folder,
+		      const gchar *uid)
+{
+	if (sorted_folder->sort_key != IM_SORT_KEY_UNREAD_FIRST ||
+	    !g_hash_table_contains (sorted_folder->iters, uid))
+		return;
+
+	sorted_folder_remove (sorted_folder, uid);
+	sorted_folder_add (sorted_folder, folder, uid);
+}
+
+static gchar *
+get_sorted_folder_key (const gchar *account_id,
+		       const gchar *folder_name,
+		       ImSortKey sort_key)
+{
+	return g_strdup_printf ("%s\n%s\n%d", account_id, folder_name, sort_key);
+}
+
+gboolean
+im_sort_index_load_sync (ImSortIndex *self,
+			 const gchar *account_id,
+			 const gchar *folder_name,
+			 CamelFolder *folder,
+			 ImSortKey sort_key,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	ImSortIndexPrivate *priv;
+	SortedFolder *sorted_folder;
+	GSequence *entries;
+	GHashTable *iters;
+	GSequenceIter *iter;
+	GPtrArray *uids;
+	GError *_error = NULL;
+	gchar *key;
+	gint64 start;
+	guint i;
+
+	g_return_val_if_fail (IM_IS_SORT_INDEX (self), FALSE);
+	g_return_val_if_fail (sort_key != IM_SORT_KEY_UID, FALSE);
+
+	priv = IM_SORT_INDEX_GET_PRIVATE (self);
+	key = get_sorted_folder_key (account_id, folder_name, sort_key);
+
+	g_mutex_lock (&priv->lock);
+	while ((sorted_folder = g_hash_table_lookup (priv->folders, key)) &&
+	       sorted_folder->loading)
+		g_cond_wait (&priv->loaded_cond, &priv->lock);
+	if (sorted_folder) {
+		g_mutex_unlock (&priv->lock);
+		g_free (key);
+		return TRUE;
+	}
+
+	sorted_folder = g_slice_new0 (SortedFolder);
+	sorted_folder->account_id = g_strdup (account_id);
+	sorted_folder->folder_name = g_strdup (folder_name);
+	sorted_folder->sort_key = sort_key;
+	sorted_folder->loading = TRUE;
+	sorted_folder->pending_added = g_ptr_array_new_with_free_func (g_free);
+	sorted_folder->pending_removed = g_ptr_array_new_with_free_func (g_free);
+	sorted_folder->pending_changed = g_ptr_array_new_with_free_func (g_free);
+	g_hash_table_insert (priv->folders, g_strdup (key), sorted_folder);
+	g_mutex_unlock (&priv->lock);
+
+	/* Sorted out of the lock, as a single sort instead of inserting
+	 * the messages one by one */
+	start = g_get_monotonic_time ();
+	entries = g_sequence_new ((GDestroyNotify) sort_entry_free);
+	iters = g_hash_table_new (g_str_hash, g_str_equal);
+	uids = camel_folder_get_uids (folder);
+	for (i = 0; i < uids->len; i++) {
+		SortEntry *entry;
+
+		if (i % 1000 == 0 &&
+		    g_cancellable_set_error_if_cancelled (cancellable, &_error))
+			break;
+
+		entry = sort_entry_new (folder, uids->pdata[i], sort_key);
+		if (entry)
+			g_sequence_append (entries, entry);
+	}
+	camel_folder_free_uids (folder, uids);
+
+	if (_error == NULL) {
+		g_sequence_sort (entries, compare_entries, GINT_TO_POINTER (sort_key));
+		for (iter = g_sequence_get_begin_iter (entries);
+		     !g_sequence_iter_is_end (iter);
+		     iter = g_sequence_iter_next (iter))
+			g_hash_table_insert (iters, ((SortEntry *) g_sequence_get (iter))->uid, iter);
+		g_debug ("%s: sorted %u messages of %s in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+			 g_sequence_get_length (entries), folder_name, g_get_monotonic_time () - start);
+	}
+
+	g_mutex_lock (&priv->lock);
+	sorted_folder->entries = entries;
+	sorted_folder->iters = iters;
+	if (_error || g_hash_table_lookup (priv->folders, key) != sorted_folder) {
+		/* Cancelled, or the account was removed meanwhile */
+		if (g_hash_table_lookup (priv->folders, key) == sorted_folder)
+			g_hash_table_steal (priv->folders, key);
+		sorted_folder_free (sorted_folder);
+	} else {
+		sorted_folder->loading = FALSE;
+		for (i = 0; i < sorted_folder->pending_removed->len; i++)
+			sorted_folder_remove (sorted_folder, sorted_folder->pending_removed->pdata[i]);
+		for (i = 0; i < sorted_folder->pending_added->len; i++)
+			sorted_folder_add (sorted_folder, folder, sorted_folder->pending_added->pdata[i]);
+		for (i = 0; i < sorted_folder->pending_changed->len; i++)
+			sorted_folder_change (sorted_folder, folder, sorted_folder->pending_changed->pdata[i]);
+		g_ptr_array_set_size (sorted_folder->pending_removed, 0);
+		g_ptr_array_set_size (sorted_folder->pending_added, 0);
+		g_ptr_array_set_size (sorted_folder->pending_changed, 0);
+	}
+	g_cond_broadcast (&priv->loaded_cond);
+	g_mutex_unlock (&priv->lock);
+	g_free (key);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+GPtrArray *
+im_sort_index_get_uids (ImSortIndex *self,
+			const gchar *account_id,
+			const gchar *folder_name,
+			ImSortKey sort_key,
+			const gchar *oldest_uid,
+			guint count)
+{
+	ImSortIndexPrivate *priv;
+	SortedFolder *sorted_folder;
+	GPtrArray *result = NULL;
+	gchar *key;
+
+	g_return_val_if_fail (IM_IS_SORT_INDEX (self), NULL);
+
+	priv = IM_SORT_INDEX_GET_PRIVATE (self);
+	key = get_sorted_folder_key (account_id, folder_name, sort_key);
+
+	g_mutex_lock (&priv->lock);
+	sorted_folder = g_hash_table_lookup (priv->folders, key);
+	if (sorted_folder && !sorted_folder->loading) {
+		GSequenceIter *iter;
+
+		result = g_ptr_array_new_with_free_func (g_free);
+		if (oldest_uid) {
+			iter = g_hash_table_lookup (sorted_folder->iters, oldest_uid);
+			if (iter)
+				iter = g_sequence_iter_next (iter);
+		} else {
+			iter = g_sequence_get_begin_iter (sorted_folder->entries);
+		}
+
+		for (; iter && !g_sequence_iter_is_end (iter) && result->len < count;
+		     iter = g_sequence_iter_next (iter))
+			g_ptr_array_add (result, g_strdup (((SortEntry *) g_sequence_get (iter))->uid));
+	}
+	g_mutex_unlock (&priv->lock);
+	g_free (key);
+
+	return result;
+}
+
+GPtrArray *
+im_sort_index_get_uids_by_date (ImSortIndex *self,
+				const gchar *account_id,
+				const gchar *folder_name,
+				const gchar *uid,
+				gint64 date,
+				gboolean newer,
+				guint count)
+{
+	ImSortIndexPrivate *priv;
+	SortedFolder *sorted_folder;
+	GPtrArray *result = NULL;
+	SortEntry cursor;
+	gpointer sort_key = GINT_TO_POINTER (IM_SORT_KEY_DATE_RECEIVED);
+	gchar *key;
+
+	g_return_val_if_fail (IM_IS_SORT_INDEX (self), NULL);
+
+	priv = IM_SORT_INDEX_GET_PRIVATE (self);
+	key = get_sorted_folder_key (account_id, folder_name, IM_SORT_KEY_DATE_RECEIVED);
+
+	/* The position the cursor message has, or had */
+	memset (&cursor, 0, sizeof (SortEntry));
+	cursor.uid = (gchar *) uid;
+	cursor.value = date;
+	cursor.date = (time_t) date;
+
+	g_mutex_lock (&priv->lock);
+	sorted_folder = g_hash_table_lookup (priv->folders, key);
+	if (sorted_folder && !sorted_folder->loading) {
+		GSequenceIter *iter;
+
+		result = g_ptr_array_new_with_free_func (g_free);
+		if (newer) {
+			for (iter = g_sequence_get_begin_iter (sorted_folder->entries);
+			     !g_sequence_iter_is_end (iter) && result->len < count;
+			     iter = g_sequence_iter_next (iter)) {
+				SortEntry *entry = (SortEntry *) g_sequence_get (iter);
+
+				if (compare_entries (entry, &cursor, sort_key) >= 0)
+					break;
+				g_ptr_array_add (result, g_strdup (entry->uid));
+			}
+		} else {
+			iter = g_sequence_search (sorted_folder->entries, &cursor,
+						  compare_entries, sort_key);
+			/* It may point to the cursor message itself */
+			while (!g_sequence_iter_is_end (iter) &&
+			       compare_entries (g_sequence_get (iter), &cursor, sort_key) <= 0)
+				iter = g_sequence_iter_next (iter);
+			for (; !g_sequence_iter_is_end (iter) && result->len < count;
+			     iter = g_sequence_iter_next (iter))
+				g_ptr_array_add (result, g_strdup (((SortEntry *) g_sequence_get (iter))->uid));
+		}
+	}
+	g_mutex_unlock (&priv->lock);
+	g_free (key);
+
+	return result;
+}
+
+static void
+on_folder_changed (ImServiceMgr *service_mgr,
+		   ImFolderChanges *changes,
+		   gpointer userdata)
+{
+	ImSortIndexPrivate *priv = IM_SORT_INDEX_GET_PRIVATE (userdata);
+	GHashTableIter iter;
+	gpointer value;
+	guint i;
+
+	if (changes->account_id == NULL)
+		return;
+
+	g_mutex_lock (&priv->lock);
+	g_hash_table_iter_init (&iter, priv->folders);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		SortedFolder *sorted_folder = (SortedFolder *) value;
+
+		if (g_strcmp0 (sorted_folder->account_id, changes->account_id) != 0 ||
+		    g_strcmp0 (sorted_folder->folder_name, changes->folder_name) != 0)
+			continue;
+
+		for (i = 0; i < changes->uids_removed->len; i++) {
+			if (sorted_folder->loading)
+				g_ptr_array_add (sorted_folder->pending_removed,
+						 g_strdup (changes->uids_removed->pdata[i]));
+			else
+				sorted_folder_remove (sorted_folder, changes->uids_removed->pdata[i]);
+		}
+		for (i = 0; i < changes->uids_added->len; i++) {
+			if (sorted_folder->loading)
+				g_ptr_array_add (sorted_folder->pending_added,
+						 g_strdup (changes->uids_added->pdata[i]));
+			else
+				sorted_folder_add (sorted_folder, changes->folder,
+						   changes->uids_added->pdata[i]);
+		}
+		if (sorted_folder->sort_key != IM_SORT_KEY_UNREAD_FIRST)
+			continue;
+		for (i = 0; i < changes->uids_changed->len; i++) {
+			if (sorted_folder->loading)
+				g_ptr_array_add (sorted_folder->pending_changed,
+						 g_strdup (changes->uids_changed->pdata[i]));
+			else
+				sorted_folder_change (sorted_folder, changes->folder,
+						      changes->uids_changed->pdata[i]);
+		}
+	}
+	g_mutex_unlock (&priv->lock);
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImSortIndexPrivate *priv = IM_SORT_INDEX_GET_PRIVATE (userdata);
+	GHashTableIter iter;
+	gpointer value;
+
+	g_mutex_lock (&priv->lock);
+	g_hash_table_iter_init (&iter, priv->folders);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		SortedFolder *sorted_folder = (SortedFolder *) value;
+
+		if (g_strcmp0 (sorted_folder->account_id, account_id) != 0)
+			continue;
+
+		/* The thread loading it frees it */
+		if (sorted_folder->loading)
+			g_hash_table_iter_steal (&iter);
+		else
+			g_hash_table_iter_remove (&iter);
+	}
+	g_mutex_unlock (&priv->lock);
+}
+
+static void
+im_sort_index_init (ImSortIndex *self)
+{
+	ImSortIndexPrivate *priv = IM_SORT_INDEX_GET_PRIVATE (self);
+
+	g_mutex_init (&priv->lock);
+	g_cond_init (&priv->loaded_cond);
+	priv->folders = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) sorted_folder_free);
+}
+
+static void
+im_sort_index_finalize (GObject *object)
+{
+	ImSortIndexPrivate *priv = IM_SORT_INDEX_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+	g_hash_table_unref (priv->folders);
+	g_cond_clear (&priv->loaded_cond);
+	g_mutex_clear (&priv->lock);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_sort_index_parent_class)->finalize (object);
+}
+
+static void
+im_sort_index_class_init (ImSortIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_sort_index_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImSortIndexPrivate));
+}
+
+static ImSortIndex *
+im_sort_index_new (ImServiceMgr *service_mgr,
+		   ImAccountMgr *account_mgr)
+{
+	ImSortIndex *self;
+	ImSortIndexPrivate *priv;
+
+	self = g_object_new (IM_TYPE_SORT_INDEX, NULL);
+	priv = IM_SORT_INDEX_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "folder_changed",
+			  G_CALLBACK (on_folder_changed), self);
+
+	return self;
+}
+
+ImSortIndex *
+im_sort_index_get_instance (void)
+{
+	static ImSortIndex *instance = 0;
+
+	if (instance == 0)
+		instance = im_sort_index_new (im_service_mgr_get_instance (),
+					      im_account_mgr_get_instance ());
+
+	return instance;
+}
@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-sort-index.h : Cached sort orders of the folders */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_SORT_INDEX_H__
+#define __IM_SORT_INDEX_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_SORT_INDEX             (im_sort_index_get_type())
+#define IM_SORT_INDEX(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_SORT_INDEX,ImSortIndex))
+#define IM_SORT_INDEX_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_SORT_INDEX,ImSortIndexClass))
+#define IM_IS_SORT_INDEX(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_SORT_INDEX))
+#define IM_IS_SORT_INDEX_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_SORT_INDEX))
+#define IM_SORT_INDEX_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_SORT_INDEX,ImSortIndexClass))
+
+typedef struct _ImSortIndex      ImSortIndex;
+typedef struct _ImSortIndexClass ImSortIndexClass;
+
+struct _ImSortIndex {
+	GObject parent;
+};
+
+struct _ImSortIndexClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImSortKey:
+ * @IM_SORT_KEY_UID: order of arrival to the folder, newest first
+ * @IM_SORT_KEY_DATE_RECEIVED: date received, newest first
+ * @IM_SORT_KEY_DATE_SENT: date sent, newest first
+ * @IM_SORT_KEY_FROM: sender, alphabetically
+ * @IM_SORT_KEY_SUBJECT: subject, alphabetically
+ * @IM_SORT_KEY_SIZE: size, biggest first
+ * @IM_SORT_KEY_UNREAD_FIRST: unread messages first, then by date received
+ *
+ * Orders of the messages of a folder.
+ */
+typedef enum {
+	IM_SORT_KEY_UID,
+	IM_SORT_KEY_DATE_RECEIVED,
+	IM_SORT_KEY_DATE_SENT,
+	IM_SORT_KEY_FROM,
+	IM_SORT_KEY_SUBJECT,
+	IM_SORT_KEY_SIZE,
+	IM_SORT_KEY_UNREAD_FIRST
+} ImSortKey;
+
+/**
+ * im_sort_index_get_type:
+ *
+ * Returns: GType of the sort index
+ */
+GType  im_sort_index_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_sort_index_get_instance:
+ *
+ * obtains the singleton #ImSortIndex.
+ *
+ * Returns: (transfer none): an #ImSortIndex
+ */
+ImSortIndex*        im_sort_index_get_instance (void);
+
+/**
+ * im_sort_index_load_sync:
+ * @self: a #ImSortIndex
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @folder: the #CamelFolder of @folder_name
+ * @sort_key: a #ImSortKey other than %IM_SORT_KEY_UID
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Makes the messages of @folder available sorted by @sort_key. The
+ * first time, all the messages are sorted. From then on, the order is
+ * kept in memory, and updated on each change of the folder, so later
+ * calls return immediately.
+ *
+ * It blocks, so it should be called from a thread.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean            im_sort_index_load_sync (ImSortIndex *self,
+					     const gchar *account_id,
+					     const gchar *folder_name,
+					     CamelFolder *folder,
+					     ImSortKey sort_key,
+					     GCancellable *cancellable,
+					     GError **error);
+
+/**
+ * im_sort_index_get_uids:
+ * @self: a #ImSortIndex
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @sort_key: a #ImSortKey
+ * @oldest_uid: (allow-none): the last uid of the previous page, or %NULL
+ * for the first page
+ * @count: maximum number of uids
+ *
+ * Obtains a page of the uids of a folder loaded with
+ * im_sort_index_load_sync(), in @sort_key order.
+ *
+ * Returns: (transfer full) (element-type utf8): the uids, or %NULL if
+ * the folder is not loaded with @sort_key
+ */
+GPtrArray *         im_sort_index_get_uids (ImSortIndex *self,
+					    const gchar *account_id,
+					    const gchar *folder_name,
+					    ImSortKey sort_key,
+					    const gchar *oldest_uid,
+					    guint count);
+
+/**
+ * im_sort_index_get_uids_by_date:
+ * @self: a #ImSortIndex
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @uid: the uid of the cursor message
+ * @date: the date received of the cursor message
+ * @newer: %TRUE to get the messages newer than the cursor, %FALSE
+ * for the older ones
+ * @count: maximum number of uids
+ *
+ * Obtains the uids of a folder loaded with im_sort_index_load_sync()
+ * and %IM_SORT_KEY_DATE_RECEIVED, next to the position of the message
+ * @uid received at @date. The message doesn't need to be in the folder
+ * anymore, so cursors keep working after it's removed.
+ *
+ * Returns: (transfer full) (element-type utf8): the uids, newest
+ * first, or %NULL if the folder is not loaded by date received
+ */
+GPtrArray *         im_sort_index_get_uids_by_date (ImSortIndex *self,
+						    const gchar *account_id,
+						    const gchar *folder_name,
+						    const gchar *uid,
+						    gint64 date,
+						    gboolean newer,
+						    guint count);
+
+G_END_DECLS
+
+#endif /* __IM_SORT_INDEX_H__ */
@@ -48,6 +48,7 @@
 #include "im-error.h"
 #include "im-mail-ops.h"
 #include "im-protocol-registry.h"
+#include "im-send-queue-mgr.h"
 #include "im-server-account-settings.h"
 #include "im-service-mgr.h"
 
@@ -59,8 +60,6 @@
 #include <libsoup/soup.h>
 #include <libsoup/soup-uri.h>
 
-#define IM_X_MAILER ("Igalia WebKit Mail " VERSION)
-
 G_DEFINE_TYPE (ImSoupRequest, im_soup_request, SOUP_TYPE_REQUEST)
 
 struct _ImSoupRequestPrivate {
@@ -151,56 +150,82 @@ typedef struct _RunSendQueueData {
 } RunSendQueueData;
 
 static void
-finish_run_send_queue (RunSendQueueData *data, GError *error)
+finish_run_send_queue (RunSendQueueData *data, ImSendQueueStats *stats, GError *error)
 {
-	response_finish (data->result, data->callback_id, NULL, error);
+	JsonNode *result_node = NULL;
+
+	if (stats) {
+		JsonBuilder *builder = json_builder_new ();
+
+		json_builder_begin_object (builder);
+		json_builder_set_member_name (builder, "queued");
+		json_builder_add_int_value (builder, stats->queued);
+		json_builder_set_member_name (builder, "sent");
+		json_builder_add_int_value (builder, stats->sent);
+		json_builder_set_member_name (builder, "retried");
+		json_builder_add_int_value (builder, stats->retried);
+		json_builder_set_member_name (builder, "failed");
+		json_builder_add_int_value (builder, stats->failed);
+		json_builder_set_member_name (builder, "elapsed");
+		json_builder_add_double_value (builder, (gdouble) stats->elapsed / G_USEC_PER_SEC);
+		json_builder_set_member_name (builder, "nextAttempt");
+		if (stats->next_attempt > 0)
+			json_builder_add_int_value (builder, stats->next_attempt * 1000);
+		else
+			json_builder_add_null_value (builder);
+		json_builder_set_member_name (builder, "messagesPerSecond");
+		json_builder_add_double_value (builder,
+					       stats->sent * (gdouble) G_USEC_PER_SEC / MAX (stats->elapsed, 1));
+		json_builder_end_object (builder);
+		result_node = json_builder_get_root (builder);
+		g_object_unref (builder);
+	}
+
+	response_finish (data->result, data->callback_id, result_node, error);
+	if (result_node)
+		json_node_free (result_node);
 	g_object_unref (data->result);
 	g_free (data->callback_id);
 	g_free (data);
 }
 
 static void
-run_send_queue_mail_op_cb (GObject *source_object,
-			   GAsyncResult *result,
-			   gpointer userdata)
+run_send_queue_cb (GObject *source_object,
+		   GAsyncResult *result,
+		   gpointer userdata)
 {
 	RunSendQueueData *data = userdata;
-	CamelFolder *outbox = (CamelFolder *) source_object;
 	GError *_error = NULL;
+	ImSendQueueStats stats;
 
-	im_mail_op_run_send_queue_finish (outbox, result, &_error);
-	finish_run_send_queue (data, _error);
+	im_send_queue_mgr_run_finish (IM_SEND_QUEUE_MGR (source_object), result, &stats, &_error);
+	finish_run_send_queue (data, &stats, _error);
 	if (_error) g_error_free (_error);
 }
 
 static void
 run_send_queue (GAsyncResult *result, GHashTable *params, GCancellable *cancellable)
 {
-	GError *_error = NULL;
 	RunSendQueueData *data = g_new0(RunSendQueueData, 1);
 	const gchar *account_id = g_hash_table_lookup (params, "account");
-	CamelFolder *outbox;
 
 	data->result = g_object_ref (result);
 	data->callback_id = g_strdup (g_hash_table_lookup (params, "callback"));
 
-	outbox = im_service_mgr_get_outbox (im_service_mgr_get_instance (),
-					    account_id,
-					    cancellable,
-					    &_error);
-	if (outbox) {
-		im_mail_op_run_send_queue_async (outbox,
-						 G_PRIORITY_DEFAULT_IDLE,
-						 cancellable,
-						 run_send_queue_mail_op_cb,
-						 data);
-		g_object_unref (outbox);
+	if (account_id) {
+		/* Runs are shared by all the requests for the account, so
+		 * we don't pass the request cancellable */
+		im_send_queue_mgr_run_async (im_send_queue_mgr_get_instance (),
+					     account_id,
+					     run_send_queue_cb,
+					     data);
 	} else {
-		if (_error == NULL)
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_INTERNAL,
-				     _("Could not find account %s outbox"), account_id);
-		finish_run_send_queue (data, _error);
+		GError *_error = NULL;
+
+		g_set_error (&_error, IM_ERROR_DOMAIN,
+			     IM_ERROR_INTERNAL,
+			     _("No account requested"));
+		finish_run_send_queue (data, NULL, _error);
 		g_error_free (_error);
 	}
 }
@@ -229,7 +254,7 @@ sync_outbox_store_synchronize_cb (GObject *source_object,
 	GError *_error = NULL;
 	CamelFolderInfo *fi;
 
-	fi = im_mail_op_synchronize_store_finish (outbox_store, result, &_error);
+	fi = im_mail_op_synchronize_store_finish (outbox_store, result, NULL, NULL, &_error);
 	if (fi) camel_store_free_folder_info (outbox_store, fi);
 	finish_sync_outbox_store (data, _error);
 	if (_error) g_error_free (_error);
@@ -577,205 +602,6 @@ get_message (GAsyncResult *result, GHashTable *params, GCancellable *cancellable
 				      data);
 }
 
-typedef struct _ComposerSaveData {
-	GAsyncResult *result;
-	gchar *callback_id;
-	GError *error;
-	gchar *result_uid;
-} ComposerSaveData;
-
-static void
-finish_composer_save (ComposerSaveData *data)
-{
-	JsonNode *result_node = NULL;
-	if (data->result_uid) {
-		JsonBuilder *builder;
-
-		builder = json_builder_new ();
-		json_builder_begin_object (builder);
-		json_builder_set_member_name (builder, "messageUid");
-		json_builder_add_string_value (builder, data->result_uid);
-		json_builder_end_object (builder);
-
-		result_node = json_builder_get_root (builder);
-		g_object_unref (builder);
-		g_free (data->result_uid);
-	}
-	response_finish (data->result, data->callback_id, result_node, data->error);
-	if (result_node) json_node_free (result_node);
-
-	g_object_unref (data->result);
-	g_free (data->callback_id);
-	if (data->error) g_error_free (data->error);
-	g_free (data);
-}
-
-static void
-composer_save_mail_op_cb (GObject *source_object,
-			  GAsyncResult *result,
-			  gpointer userdata)
-{
-	ComposerSaveData *data = (ComposerSaveData *) userdata;
-	GError *_error = NULL;
-	CamelFolder *folder = (CamelFolder *) source_object;
-
-	im_mail_op_composer_save_finish (folder, result, &data->result_uid, &_error);
-
-	if (_error)
-		g_propagate_error (&data->error, _error);
-
-	finish_composer_save (data);
-}
-
-static void
-composer_save (GAsyncResult *result, GHashTable *params, gboolean is_sending, GCancellable *cancellable)
-{
-	GError *_error = NULL;
-	const char *form_data;
-	GHashTable *form_params;
-	const char *account_id;
-	const char *to, *cc, *bcc;
-	const char *subject;
-	const char *body;
-	const char *attachments;
-	CamelFolder *folder = NULL;
-	CamelMimeMessage *message = NULL;
-	ComposerSaveData *data = NULL;
-
-	data = g_new0 (ComposerSaveData, 1);
-	data->result = g_object_ref (result);
-	data->callback_id = g_strdup (g_hash_table_lookup (params, "callback"));
-
-	form_data = g_hash_table_lookup (params, "formData");
-	form_params = soup_form_decode (form_data);
-
-	account_id = g_hash_table_lookup (form_params, "composer-from-choice");
-	to = g_hash_table_lookup (form_params, "composer-to");
-	cc = g_hash_table_lookup (form_params, "composer-cc");
-	bcc = g_hash_table_lookup (form_params, "composer-bcc");
-	subject = g_hash_table_lookup (form_params, "composer-subject");
-	body = g_hash_table_lookup (form_params, "composer-body");
-	attachments = g_hash_table_lookup (form_params, "composer-attachments");
-
-	if (_error == NULL && account_id == NULL) {
-		g_set_error (&_error, IM_ERROR_DOMAIN,
-			     IM_ERROR_SEND_INVALID_PARAMETERS,
-			     _("No transport account specified trying to send the message"));
-	}
-
-	if (_error == NULL) {
-		if (!im_account_mgr_account_exists (im_account_mgr_get_instance (),
-						    account_id, FALSE)) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_SEND_INVALID_PARAMETERS,
-				     _("Invalid transport account specified trying to send the message"));
-		}
-	}
-
-	if (_error == NULL) {
-		gchar *from_string;
-		gint from_count;
-		CamelInternetAddress *from_cia;
-
-		message = camel_mime_message_new ();
-		camel_medium_set_header (CAMEL_MEDIUM (message), "X-Mailer", IM_X_MAILER);
-		camel_mime_message_set_subject (message, subject);
-		camel_mime_message_set_date (message, CAMEL_MESSAGE_DATE_CURRENT, 0);
-
-		from_string = im_account_mgr_get_from_string (im_account_mgr_get_instance (),
-							      account_id, NULL);
-
-		from_cia = camel_internet_address_new ();
-		from_count = camel_address_unformat (CAMEL_ADDRESS (from_cia), from_string);
-		if (from_count != 1) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_SEND_INVALID_ACCOUNT_FROM,
-				     _("Account has an invalid from field"));
-		} else {
-			camel_mime_message_set_from (message,
-						     from_cia);
-		}
-		g_object_unref (from_cia);
-		g_free (from_string);
-	}						
-
-
-	if (_error == NULL) {
-		CamelInternetAddress *to_cia, *cc_cia, *bcc_cia;
-		gint to_count, cc_count, bcc_count;
-
-		to_cia = camel_internet_address_new ();
-		to_count = camel_address_unformat (CAMEL_ADDRESS (to_cia), to);
-		cc_cia = camel_internet_address_new ();
-		cc_count = camel_address_unformat (CAMEL_ADDRESS (cc_cia), cc);
-		bcc_cia = camel_internet_address_new ();
-		bcc_count = camel_address_unformat (CAMEL_ADDRESS (bcc_cia), bcc);
-
-		if (to_count == -1 || cc_count == -1 || bcc_count == -1) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_SEND_PARSING_RECIPIENTS,
-				     _("Failed to parse recipients"));
-		} else if (is_sending && (to_count + cc_count + bcc_count == 0)) {
-			g_set_error (&_error, IM_ERROR_DOMAIN,
-				     IM_ERROR_SEND_NO_RECIPIENTS,
-				     _("User didn't set recipients trying to send"));
-		} else {
-			camel_mime_message_set_recipients (message,
-							   CAMEL_RECIPIENT_TYPE_TO,
-							   to_cia);
-			camel_mime_message_set_recipients (message,
-							   CAMEL_RECIPIENT_TYPE_CC,
-							   cc_cia);
-			camel_mime_message_set_recipients (message,
-							   CAMEL_RECIPIENT_TYPE_BCC,
-							   bcc_cia);
-		}
-		g_object_unref (to_cia);
-		g_object_unref (cc_cia);
-		g_object_unref (bcc_cia);
-	}
-
-	if (_error == NULL) {
-		if (is_sending)
-			folder = im_service_mgr_get_outbox (im_service_mgr_get_instance (),
-							    account_id,
-							    cancellable,
-							    &_error);
-		else
-			folder = im_service_mgr_get_drafts (im_service_mgr_get_instance (),
-							    cancellable,
-							    &_error);
-	}
-
-	if (_error == NULL) {
-		GList *uri_list = NULL;
-		gchar **attachments_v, **node;
-
-		attachments_v = g_strsplit (attachments, ",", 0);
-		for (node = attachments_v; *node != NULL; node++) {
-			uri_list = g_list_prepend (uri_list, g_strdup (*node));
-		}
-		g_strfreev (attachments_v);
-		uri_list = g_list_reverse (uri_list);
-
-		im_mail_op_composer_save_async (folder, message,
-						body, uri_list,
-						G_PRIORITY_DEFAULT_IDLE,
-						cancellable,
-						composer_save_mail_op_cb,
-						data);
-	}
-
-	if (_error) {
-		g_propagate_error (&data->error, _error);
-		finish_composer_save (data);
-	}
-
-	if (message) g_object_unref (message);
-	if (folder) g_object_unref (folder);
-	g_hash_table_destroy (form_params);
-}
-
 static void
 open_file_uri (GAsyncResult *result, GHashTable *params)
 {
@@ -844,10 +670,6 @@ im_soup_request_send_async (SoupRequest          *soup_request,
 	  sync_outbox_store (result, params, cancellable);
   } else if (!g_strcmp0 (uri->path, "getMessage")) {
 	  get_message (result, params, cancellable);
-  } else if (!g_strcmp0 (uri->path, "composerSend")) {
-	  composer_save (result, params, TRUE, cancellable);
-  } else if (!g_strcmp0 (uri->path, "composerSaveDraft")) {
-	  composer_save (result, params, FALSE, cancellable);
   } else if (!g_strcmp0 (uri->path, "openFileURI")) {
 	  open_file_uri (result, params);
   } else {
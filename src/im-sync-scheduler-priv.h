@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-sync-scheduler-priv.h : Private methods for ImSyncScheduler */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IM_SYNC_SCHEDULER_PRIV_H__
+#define __IM_SYNC_SCHEDULER_PRIV_H__
+
+#include <im-sync-scheduler.h>
+
+/*
+ * private functions, only for use in im-sync-scheduler and its
+ * tests. They run the scheduler without the account and service
+ * managers
+ */
+
+G_BEGIN_DECLS
+
+typedef struct _ImSyncSchedulerBackend ImSyncSchedulerBackend;
+
+/**
+ * ImSyncSchedulerBackend:
+ * @is_online: checks if the accounts can be synchronized
+ * @get_interval: obtains the interval between synchronizations, in seconds
+ * @is_push_active: checks if an account gets its new messages with push
+ * @get_last_updated: obtains the time of the last successful
+ * synchronization of an account, in seconds since the epoch
+ * @set_last_updated: stores the time of the last successful
+ * synchronization of an account
+ * @synchronize_async: starts synchronizing an account, calling back
+ * when it's finished. It returns %FALSE if the account can't be
+ * synchronized, and then the callback is not called
+ * @synchronize_finish: finishes the synchronization started with
+ * @synchronize_async
+ *
+ * Access of the scheduler to the accounts. The default one goes through
+ * #ImAccountMgr, #ImServiceMgr and #ImPushMgr. Its methods are called
+ * from the main loop.
+ */
+struct _ImSyncSchedulerBackend {
+	gboolean	(*is_online)		(ImSyncScheduler *self);
+	gint		(*get_interval)		(ImSyncScheduler *self);
+	gboolean	(*is_push_active)	(ImSyncScheduler *self,
+						 const gchar *account_id);
+	gint64		(*get_last_updated)	(ImSyncScheduler *self,
+						 const gchar *account_id);
+	void		(*set_last_updated)	(ImSyncScheduler *self,
+						 const gchar *account_id,
+						 gint64 last_updated);
+	gboolean	(*synchronize_async)	(ImSyncScheduler *self,
+						 const gchar *account_id,
+						 GCancellable *cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer userdata);
+	gboolean	(*synchronize_finish)	(ImSyncScheduler *self,
+						 GObject *source_object,
+						 GAsyncResult *result,
+						 GError **error);
+};
+
+/**
+ * _im_sync_scheduler_new:
+ * @backend: a #ImSyncSchedulerBackend, that should be valid while in use
+ *
+ * Creates a scheduler with no accounts, that reaches them through
+ * @backend. It does not follow the accounts nor the network, so use
+ * _im_sync_scheduler_add_account() and _im_sync_scheduler_set_online().
+ *
+ * Returns: (transfer full): a #ImSyncScheduler
+ */
+ImSyncScheduler *   _im_sync_scheduler_new          (const ImSyncSchedulerBackend *backend);
+
+/**
+ * _im_sync_scheduler_add_account:
+ * @self: a #ImSyncScheduler
+ * @account_id: an account id
+ *
+ * Adds @account_id to the scheduled accounts. It's scheduled on next
+ * _im_sync_scheduler_set_online().
+ */
+void                _im_sync_scheduler_add_account  (ImSyncScheduler *self,
+						     const gchar *account_id);
+
+/**
+ * _im_sync_scheduler_set_online:
+ * @self: a #ImSyncScheduler
+ * @online: %TRUE if the network is available
+ *
+ * Schedules the accounts if @online, or pauses them otherwise.
+ */
+void                _im_sync_scheduler_set_online   (ImSyncScheduler *self,
+						     gboolean online);
+
+/**
+ * _im_sync_scheduler_run_now:
+ * @self: a #ImSyncScheduler
+ * @account_id: an account id
+ *
+ * Runs now the scheduled synchronization of @account_id, as if its
+ * timeout had expired.
+ *
+ * Returns: %TRUE if the synchronization started
+ */
+gboolean            _im_sync_scheduler_run_now      (ImSyncScheduler *self,
+						     const gchar *account_id);
+
+G_END_DECLS
+
+#endif /* __IM_SYNC_SCHEDULER_PRIV_H__ */
@@ -0,0 +1,597 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-sync-scheduler.c : Periodic synchronization of accounts */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-sync-scheduler.h"
+#include "im-sync-scheduler-priv.h"
+
+#include "im-account-mgr-helpers.h"
+#include "im-mail-ops.h"
+#include "im-push-mgr.h"
+
+#include <glib/gi18n.h>
+
+typedef struct _ImSyncSchedulerPrivate ImSyncSchedulerPrivate;
+struct _ImSyncSchedulerPrivate {
+	/* NULL if created with _im_sync_scheduler_new() */
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+	const ImSyncSchedulerBackend *backend;
+
+	/* account id -> SyncEntry */
+	GHashTable *entries;
+};
+
+#define IM_SYNC_SCHEDULER_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					       IM_TYPE_SYNC_SCHEDULER, \
+					       ImSyncSchedulerPrivate))
+
+typedef struct _SyncEntry {
+	ImSyncScheduler *self;
+	gchar *account_id;
+	gint64 next_run;
+	guint failures;
+	guint timeout_id;
+	gboolean running;
+	/* Increased on each run and pause, so completions of cancelled
+	 * runs are ignored */
+	guint generation;
+	GCancellable *cancellable;
+} SyncEntry;
+
+typedef struct _SyncAsyncContext {
+	ImSyncScheduler *self;
+	gchar *account_id;
+	guint generation;
+} SyncAsyncContext;
+
+G_DEFINE_TYPE (ImSyncScheduler, im_sync_scheduler, G_TYPE_OBJECT);
+
+static gint64
+now_seconds (void)
+{
+	return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static void
+sync_entry_free (SyncEntry *entry)
+{
+	g_cancellable_cancel (entry->cancellable);
+	g_object_unref (entry->cancellable);
+	if (entry->timeout_id)
+		g_source_remove (entry->timeout_id);
+	g_free (entry->account_id);
+	g_slice_free (SyncEntry, entry);
+}
+
+static gint
+get_interval (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	return priv->backend->get_interval (self);
+}
+
+/* Randomly deviates @delay, so accounts with the same interval do not
+ * end up synchronizing at the same time */
+static gint
+add_jitter (gint delay)
+{
+	gint delta;
+
+	delta = delay * IM_SYNC_SCHEDULER_JITTER / 100;
+	if (delta > 0)
+		delay += g_random_int_range (-delta, delta + 1);
+
+	return MAX (delay, 1);
+}
+
+static gboolean on_sync_timeout (gpointer userdata);
+
+static void
+schedule_entry (SyncEntry *entry,
+		gint delay)
+{
+	if (entry->timeout_id)
+		g_source_remove (entry->timeout_id);
+
+	entry->next_run = now_seconds () + delay;
+	entry->timeout_id = g_timeout_add_seconds (delay, on_sync_timeout, entry);
+}
+
+static void
+on_sync_finished (GObject *source_object,
+		  GAsyncResult *result,
+		  gpointer userdata)
+{
+	SyncAsyncContext *context = (SyncAsyncContext *) userdata;
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (context->self);
+	GError *_error = NULL;
+	SyncEntry *entry;
+
+	priv->backend->synchronize_finish (context->self, source_object, result, &_error);
+
+	/* The account may have been removed meanwhile, or the run
+	 * cancelled and a new one started */
+	entry = g_hash_table_lookup (priv->entries, context->account_id);
+	if (entry == NULL || entry->generation != context->generation) {
+		goto finish;
+	}
+	entry->running = FALSE;
+
+	if (_error == NULL) {
+		entry->failures = 0;
+		priv->backend->set_last_updated (context->self, entry->account_id,
+						 now_seconds ());
+		schedule_entry (entry, add_jitter (get_interval (context->self)));
+	} else if (g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		/* We were paused, resume will schedule again */
+	} else {
+		gint delay;
+
+		g_warning (_("%s: failed to synchronize %s: %s"), __FUNCTION__,
+			   entry->account_id, _error->message);
+		entry->failures++;
+		delay = IM_SYNC_SCHEDULER_MIN_BACKOFF << MIN (entry->failures - 1, 16);
+		schedule_entry (entry, add_jitter (MIN (delay, IM_SYNC_SCHEDULER_MAX_BACKOFF)));
+	}
+
+finish:
+	if (_error)
+		g_error_free (_error);
+	g_free (context->account_id);
+	g_slice_free (SyncAsyncContext, context);
+}
+
+static gboolean
+on_sync_timeout (gpointer userdata)
+{
+	SyncEntry *entry = (SyncEntry *) userdata;
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (entry->self);
+	SyncAsyncContext *context;
+
+	entry->timeout_id = 0;
+
+	if (!priv->backend->is_online (entry->self)) {
+		entry->next_run = 0;
+		return FALSE;
+	}
+
+	/* Push may be disabled later (i.e. if the account changes), so we
+	 * keep checking on each interval */
+	if (priv->backend->is_push_active (entry->self, entry->account_id)) {
+		schedule_entry (entry, add_jitter (get_interval (entry->self)));
+		return FALSE;
+	}
+
+	context = g_slice_new0 (SyncAsyncContext);
+	context->self = entry->self;
+	context->account_id = g_strdup (entry->account_id);
+	context->generation = ++entry->generation;
+
+	if (!priv->backend->synchronize_async (entry->self, entry->account_id,
+					       entry->cancellable,
+					       on_sync_finished, context)) {
+		g_free (context->account_id);
+		g_slice_free (SyncAsyncContext, context);
+		entry->next_run = 0;
+		return FALSE;
+	}
+	entry->running = TRUE;
+
+	return FALSE;
+}
+
+/* Schedules all the accounts not running nor scheduled. The ones that
+ * are overdue are staggered, so they do not run at the same time */
+static void
+resume_all (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+	GHashTableIter iter;
+	SyncEntry *entry;
+	gint64 now;
+	gint interval;
+	gint overdue = 0;
+
+	now = now_seconds ();
+	interval = get_interval (self);
+
+	g_hash_table_iter_init (&iter, priv->entries);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+		gint64 due;
+
+		if (entry->running || entry->timeout_id)
+			continue;
+
+		due = priv->backend->get_last_updated (self, entry->account_id) + interval;
+		if (due > now) {
+			schedule_entry (entry, add_jitter (due - now));
+		} else {
+			schedule_entry (entry,
+					overdue * IM_SYNC_SCHEDULER_STAGGER +
+					g_random_int_range (0, IM_SYNC_SCHEDULER_STAGGER));
+			overdue++;
+		}
+	}
+}
+
+static void
+pause_all (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+	GHashTableIter iter;
+	SyncEntry *entry;
+
+	g_hash_table_iter_init (&iter, priv->entries);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+		if (entry->timeout_id) {
+			g_source_remove (entry->timeout_id);
+			entry->timeout_id = 0;
+		}
+		entry->next_run = 0;
+		entry->running = FALSE;
+		entry->generation++;
+		g_cancellable_cancel (entry->cancellable);
+		g_object_unref (entry->cancellable);
+		entry->cancellable = g_cancellable_new ();
+	}
+}
+
+static void
+add_entry (ImSyncScheduler *self,
+	   const gchar *account_id)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+	SyncEntry *entry;
+
+	entry = g_slice_new0 (SyncEntry);
+	entry->self = self;
+	entry->account_id = g_strdup (account_id);
+	entry->cancellable = g_cancellable_new ();
+	g_hash_table_replace (priv->entries, g_strdup (account_id), entry);
+}
+
+static void
+on_account_inserted (ImAccountMgr *account_mgr,
+		     const gchar *account_id,
+		     gpointer userdata)
+{
+	ImSyncScheduler *self = IM_SYNC_SCHEDULER (userdata);
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	if (!im_account_mgr_get_enabled (account_mgr, account_id))
+		return;
+
+	add_entry (self, account_id);
+	if (priv->backend->is_online (self))
+		resume_all (self);
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (userdata);
+
+	g_hash_table_remove (priv->entries, account_id);
+}
+
+static void
+on_online_changed (GObject *object,
+		   GParamSpec *pspec,
+		   gpointer userdata)
+{
+	if (camel_session_get_online (CAMEL_SESSION (object)))
+		resume_all (IM_SYNC_SCHEDULER (userdata));
+	else
+		pause_all (IM_SYNC_SCHEDULER (userdata));
+}
+
+static void
+im_sync_scheduler_init (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) sync_entry_free);
+}
+
+static void
+im_sync_scheduler_finalize (GObject *object)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (object);
+
+	if (priv->account_mgr) {
+		g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+		g_object_unref (priv->account_mgr);
+	}
+	if (priv->service_mgr) {
+		g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+		g_object_unref (priv->service_mgr);
+	}
+	g_hash_table_unref (priv->entries);
+
+	G_OBJECT_CLASS (im_sync_scheduler_parent_class)->finalize (object);
+}
+
+static void
+im_sync_scheduler_class_init (ImSyncSchedulerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_sync_scheduler_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImSyncSchedulerPrivate));
+}
+
+static gboolean
+default_is_online (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	return camel_session_get_online (CAMEL_SESSION (priv->service_mgr));
+}
+
+static gint
+default_get_interval (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	return im_account_mgr_get_update_interval (priv->account_mgr) * 60;
+}
+
+static gboolean
+default_is_push_active (ImSyncScheduler *self,
+			const gchar *account_id)
+{
+	return im_push_mgr_is_push_active (im_push_mgr_get_instance (), account_id);
+}
+
+static gint64
+default_get_last_updated (ImSyncScheduler *self,
+			  const gchar *account_id)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	return (gint64) im_account_mgr_get_last_updated (priv->account_mgr, account_id);
+}
+
+static void
+default_set_last_updated (ImSyncScheduler *self,
+			  const gchar *account_id,
+			  gint64 last_updated)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	im_account_mgr_set_last_updated (priv->account_mgr, account_id, (gint) last_updated);
+}
+
+static gboolean
+default_synchronize_async (ImSyncScheduler *self,
+			   const gchar *account_id,
+			   GCancellable *cancellable,
+			   GAsyncReadyCallback callback,
+			   gpointer userdata)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+	CamelService *store;
+
+	store = im_service_mgr_get_service (priv->service_mgr, account_id,
+					    IM_ACCOUNT_TYPE_STORE);
+	if (!CAMEL_IS_STORE (store))
+		return FALSE;
+
+	im_mail_op_synchronize_store_async (CAMEL_STORE (store),
+					    G_PRIORITY_LOW,
+					    cancellable,
+					    callback,
+					    userdata);
+
+	return TRUE;
+}
+
+static gboolean
+default_synchronize_finish (ImSyncScheduler *self,
+			    GObject *source_object,
+			    GAsyncResult *result,
+			    GError **error)
+{
+	GError *_error = NULL;
+	CamelFolderInfo *fi;
+
+	fi = im_mail_op_synchronize_store_finish (CAMEL_STORE (source_object),
+						  result, NULL, NULL, &_error);
+	if (fi)
+		camel_store_free_folder_info (CAMEL_STORE (source_object), fi);
+
+	if (_error) {
+		g_propagate_error (error, _error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static const ImSyncSchedulerBackend default_backend = {
+	default_is_online,
+	default_get_interval,
+	default_is_push_active,
+	default_get_last_updated,
+	default_set_last_updated,
+	default_synchronize_async,
+	default_synchronize_finish
+};
+
+static ImSyncScheduler *
+im_sync_scheduler_new (ImServiceMgr *service_mgr,
+		       ImAccountMgr *account_mgr)
+{
+	ImSyncScheduler *self;
+	ImSyncSchedulerPrivate *priv;
+	GSList *account_ids, *node;
+
+	self = g_object_new (IM_TYPE_SYNC_SCHEDULER, NULL);
+	priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+	priv->backend = &default_backend;
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_inserted",
+			  G_CALLBACK (on_account_inserted), self);
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "notify::online",
+			  G_CALLBACK (on_online_changed), self);
+
+	account_ids = im_account_mgr_get_account_ids (account_mgr, TRUE);
+	for (node = account_ids; node != NULL; node = g_slist_next (node))
+		add_entry (self, (const gchar *) node->data);
+	im_account_mgr_free_account_ids (account_ids);
+
+	if (camel_session_get_online (CAMEL_SESSION (service_mgr)))
+		resume_all (self);
+
+	return self;
+}
+
+ImSyncScheduler *
+im_sync_scheduler_get_instance (void)
+{
+	static ImSyncScheduler *instance = 0;
+
+	if (instance == 0)
+		instance = im_sync_scheduler_new (im_service_mgr_get_instance (),
+						  im_account_mgr_get_instance ());
+
+	return instance;
+}
+
+GList *
+im_sync_scheduler_get_schedule (ImSyncScheduler *self)
+{
+	ImSyncSchedulerPrivate *priv;
+	GHashTableIter iter;
+	SyncEntry *entry;
+	GList *result = NULL;
+
+	g_return_val_if_fail (IM_IS_SYNC_SCHEDULER (self), NULL);
+
+	priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+
+	g_hash_table_iter_init (&iter, priv->entries);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+		ImSyncSchedule *schedule;
+
+		schedule = g_slice_new0 (ImSyncSchedule);
+		schedule->account_id = g_strdup (entry->account_id);
+		schedule->next_run = entry->timeout_id ? entry->next_run : 0;
+		schedule->last_updated = priv->backend->get_last_updated (self, entry->account_id);
+		schedule->failures = entry->failures;
+		schedule->push = priv->backend->is_push_active (self, entry->account_id);
+		result = g_list_prepend (result, schedule);
+	}
+
+	return g_list_reverse (result);
+}
+
+static void
+sync_schedule_free (ImSyncSchedule *schedule)
+{
+	g_free (schedule->account_id);
+	g_slice_free (ImSyncSchedule, schedule);
+}
+
+void
+im_sync_scheduler_free_schedule (GList *schedule)
+{
+	g_list_free_full (schedule, (GDestroyNotify) sync_schedule_free);
+}
+
+ImSyncScheduler *
+_im_sync_scheduler_new (const ImSyncSchedulerBackend *backend)
+{
+	ImSyncScheduler *self;
+
+	self = g_object_new (IM_TYPE_SYNC_SCHEDULER, NULL);
+	IM_SYNC_SCHEDULER_GET_PRIVATE (self)->backend = backend;
+
+	return self;
+}
+
+void
+_im_sync_scheduler_add_account (ImSyncScheduler *self,
+				const gchar *account_id)
+{
+	add_entry (self, account_id);
+}
+
+void
+_im_sync_scheduler_set_online (ImSyncScheduler *self,
+			       gboolean online)
+{
+	if (online)
+		resume_all (self);
+	else
+		pause_all (self);
+}
+
+gboolean
+_im_sync_scheduler_run_now (ImSyncScheduler *self,
+			    const gchar *account_id)
+{
+	ImSyncSchedulerPrivate *priv = IM_SYNC_SCHEDULER_GET_PRIVATE (self);
+	SyncEntry *entry;
+
+	entry = g_hash_table_lookup (priv->entries, account_id);
+	if (entry == NULL || entry->running)
+		return FALSE;
+
+	if (entry->timeout_id) {
+		g_source_remove (entry->timeout_id);
+		entry->timeout_id = 0;
+	}
+	on_sync_timeout (entry);
+
+	return entry->running;
+}
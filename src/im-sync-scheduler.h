@@ -0,0 +1,134 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-sync-scheduler.h : Periodic synchronization of accounts */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_SYNC_SCHEDULER_H__
+#define __IM_SYNC_SCHEDULER_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_SYNC_SCHEDULER             (im_sync_scheduler_get_type())
+#define IM_SYNC_SCHEDULER(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_SYNC_SCHEDULER,ImSyncScheduler))
+#define IM_SYNC_SCHEDULER_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_SYNC_SCHEDULER,ImSyncSchedulerClass))
+#define IM_IS_SYNC_SCHEDULER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_SYNC_SCHEDULER))
+#define IM_IS_SYNC_SCHEDULER_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_SYNC_SCHEDULER))
+#define IM_SYNC_SCHEDULER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_SYNC_SCHEDULER,ImSyncSchedulerClass))
+
+typedef struct _ImSyncScheduler      ImSyncScheduler;
+typedef struct _ImSyncSchedulerClass ImSyncSchedulerClass;
+typedef struct _ImSyncSchedule       ImSyncSchedule;
+
+struct _ImSyncScheduler {
+	GObject parent;
+};
+
+struct _ImSyncSchedulerClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImSyncSchedule:
+ * @account_id: the account id
+ * @next_run: time of next synchronization, in seconds since the epoch, or 0 if paused
+ * @last_updated: time of last successful synchronization, in seconds since the epoch
+ * @failures: number of consecutive failed synchronizations
+ * @push: %TRUE if the account is not scheduled as it gets new messages with push
+ *
+ * Scheduling state of an account, as returned by im_sync_scheduler_get_schedule().
+ */
+struct _ImSyncSchedule {
+	gchar *account_id;
+	gint64 next_run;
+	gint64 last_updated;
+	guint failures;
+	gboolean push;
+};
+
+/* Maximum random deviation from the update interval, in percent */
+#define IM_SYNC_SCHEDULER_JITTER 10
+/* Delay after first failure, in seconds. It doubles on each failure */
+#define IM_SYNC_SCHEDULER_MIN_BACKOFF 30
+/* Maximum delay after failures, in seconds */
+#define IM_SYNC_SCHEDULER_MAX_BACKOFF (2 * 60 * 60)
+/* Separation between accounts synchronized on startup or when going
+ * back online, in seconds */
+#define IM_SYNC_SCHEDULER_STAGGER 5
+
+/**
+ * im_sync_scheduler_get_type:
+ *
+ * Returns: GType of the sync scheduler
+ */
+GType  im_sync_scheduler_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_sync_scheduler_get_instance:
+ *
+ * obtains the singleton #ImSyncScheduler. On first call it starts
+ * synchronizing the enabled accounts not using push, every
+ * im_account_mgr_get_update_interval() minutes.
+ *
+ * Returns: (transfer none): an #ImSyncScheduler
+ */
+ImSyncScheduler*    im_sync_scheduler_get_instance (void);
+
+/**
+ * im_sync_scheduler_get_schedule:
+ * @self: a #ImSyncScheduler
+ *
+ * Obtains the scheduling state of all the enabled accounts.
+ *
+ * Returns: (transfer full) (element-type ImSyncSchedule): a list
+ * to free with im_sync_scheduler_free_schedule()
+ */
+GList *             im_sync_scheduler_get_schedule (ImSyncScheduler *self);
+
+/**
+ * im_sync_scheduler_free_schedule:
+ * @schedule: (element-type ImSyncSchedule): a list returned by
+ * im_sync_scheduler_get_schedule()
+ *
+ * Frees @schedule.
+ */
+void                im_sync_scheduler_free_schedule (GList *schedule);
+
+G_END_DECLS
+
+#endif /* __IM_SYNC_SCHEDULER_H__ */
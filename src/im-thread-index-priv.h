@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-thread-index-priv.h : Private methods for ImThreadIndex */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IM_THREAD_INDEX_PRIV_H__
+#define __IM_THREAD_INDEX_PRIV_H__
+
+#include <im-thread-index.h>
+
+/*
+ * private functions, only for use in im-thread-index and its
+ * benchmark. They don't lock, so the tree must not be shared
+ */
+
+G_BEGIN_DECLS
+
+typedef struct _ImThreadTree ImThreadTree;
+
+/**
+ * _im_thread_tree_new:
+ *
+ * Creates an empty threads tree. It starts building, so the threads are
+ * not sorted until _im_thread_tree_end_build() is called.
+ *
+ * Returns: (transfer full): a #ImThreadTree
+ */
+ImThreadTree *      _im_thread_tree_new             (void);
+
+/**
+ * _im_thread_tree_end_build:
+ * @tree: a #ImThreadTree
+ *
+ * Sorts the threads added while building. Later changes keep them
+ * sorted one by one.
+ */
+void                _im_thread_tree_end_build       (ImThreadTree *tree);
+
+/**
+ * _im_thread_tree_free:
+ * @tree: a #ImThreadTree
+ *
+ * Frees @tree.
+ */
+void                _im_thread_tree_free            (ImThreadTree *tree);
+
+/**
+ * _im_thread_tree_add_message:
+ * @tree: a #ImThreadTree
+ * @uid: the uid of the message
+ * @id: the hash of the Message-ID of the message, or 0
+ * @date: the date of the message
+ * @references: the hashes of the references, from the parent to the root
+ * @references_count: the number of @references
+ *
+ * Adds a message to its thread.
+ */
+void                _im_thread_tree_add_message     (ImThreadTree *tree,
+						     const gchar *uid,
+						     guint64 id,
+						     time_t date,
+						     const guint64 *references,
+						     guint references_count);
+
+/**
+ * _im_thread_tree_remove_message:
+ * @tree: a #ImThreadTree
+ * @uid: the uid of the message
+ *
+ * Removes a message from its thread.
+ */
+void                _im_thread_tree_remove_message  (ImThreadTree *tree,
+						     const gchar *uid);
+
+/**
+ * _im_thread_tree_get_messages_count:
+ * @tree: a #ImThreadTree
+ *
+ * Returns: the number of messages in @tree
+ */
+guint               _im_thread_tree_get_messages_count (ImThreadTree *tree);
+
+/**
+ * _im_thread_tree_get_threads:
+ * @tree: a #ImThreadTree
+ * @oldest_cursor: (allow-none): the cursor of the last thread of the
+ * previous page, or %NULL for the first page
+ * @count: the maximum number of threads
+ *
+ * Obtains a page of threads, as im_thread_index_get_threads().
+ *
+ * Returns: (transfer full) (element-type ImMessageThread): the threads
+ */
+GPtrArray *         _im_thread_tree_get_threads     (ImThreadTree *tree,
+						     const gchar *oldest_cursor,
+						     guint count);
+
+/**
+ * _im_thread_tree_load:
+ * @tree: a #ImThreadTree
+ * @path: the file stored by a previous run
+ *
+ * Adds the messages stored in @path, if it exists.
+ */
+void                _im_thread_tree_load            (ImThreadTree *tree,
+						     const gchar *path);
+
+/**
+ * _im_thread_tree_dump:
+ * @tree: a #ImThreadTree
+ *
+ * Obtains the contents of the file storing @tree.
+ *
+ * Returns: (transfer full): the contents
+ */
+GString *           _im_thread_tree_dump            (ImThreadTree *tree);
+
+G_END_DECLS
+
+#endif /* __IM_THREAD_INDEX_PRIV_H__ */
@@ -0,0 +1,1072 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-thread-index.c : Conversation threads of the folders */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-thread-index.h"
+#include "im-thread-index-priv.h"
+
+#include "im-account-mgr.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _ImThreadIndexPrivate ImThreadIndexPrivate;
+struct _ImThreadIndexPrivate {
+	ImServiceMgr *service_mgr;
+	ImAccountMgr *account_mgr;
+
+	/* Protects the folders, as they're loaded from the mail
+	 * operation threads */
+	GMutex lock;
+	GCond loaded_cond;
+	/* "account_id\nfolder_name" -> FolderThreads */
+	GHashTable *folders;
+	/* Serializes the writes and removals of the files */
+	GMutex save_lock;
+};
+
+#define IM_THREAD_INDEX_GET_PRIVATE(o)      (G_TYPE_INSTANCE_GET_PRIVATE((o), \
+					     IM_TYPE_THREAD_INDEX, \
+					     ImThreadIndexPrivate))
+
+/* A node of the threads tree, as in the JWZ algorithm. Placeholders are
+ * messages referenced by others, but not in the folder */
+typedef struct _Container Container;
+struct _Container {
+	guint64 id;
+	gchar *uid;
+	time_t date;
+	guint64 *references;
+	guint references_count;
+
+	Container *parent;
+	GSList *children;
+
+	/* Only for roots */
+	GSequenceIter *root_iter;
+	time_t latest;
+};
+
+struct _ImThreadTree {
+	/* message id -> Container */
+	GHashTable *ids;
+	/* uid -> Container */
+	GHashTable *uids;
+	/* roots, the thread with the newest message first */
+	GSequence *roots;
+	/* Roots are indexed at the end of a build */
+	gboolean building;
+};
+
+typedef struct _FolderThreads {
+	gchar *account_id;
+	gchar *folder_name;
+	gchar *path;
+	ImThreadTree *tree;
+
+	/* Changes received while the tree is being loaded */
+	gboolean loading;
+	GPtrArray *pending_added;
+	GPtrArray *pending_removed;
+
+	guint save_id;
+} FolderThreads;
+
+G_DEFINE_TYPE (ImThreadIndex, im_thread_index, G_TYPE_OBJECT);
+
+static Container *
+container_new (guint64 id)
+{
+	Container *container;
+
+	container = g_slice_new0 (Container);
+	container->id = id;
+
+	return container;
+}
+
+static void
+container_free (Container *container)
+{
+	g_free (container->uid);
+	g_free (container->references);
+	g_slist_free (container->children);
+	g_slice_free (Container, container);
+}
+
+static Container *
+container_get_root (Container *container)
+{
+	while (container->parent)
+		container = container->parent;
+
+	return container;
+}
+
+/* TRUE if @ancestor is @container or any of its parents */
+static gboolean
+container_is_ancestor (Container *ancestor,
+		       Container *container)
+{
+	for (; container != NULL; container = container->parent) {
+		if (container == ancestor)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static time_t
+container_get_latest (Container *container)
+{
+	time_t latest = container->uid ? container->date : 0;
+	GSList *node;
+
+	for (node = container->children; node != NULL; node = g_slist_next (node))
+		latest = MAX (latest, container_get_latest ((Container *) node->data));
+
+	return latest;
+}
+
+/* Newest threads first. Ties are sorted by message id and uid, so
+ * cursors point to a fixed position */
+static gint
+compare_roots (gconstpointer a,
+	       gconstpointer b,
+	       gpointer userdata)
+{
+	const Container *root_a = (const Container *) a;
+	const Container *root_b = (const Container *) b;
+
+	if (root_a->latest != root_b->latest)
+		return root_a->latest > root_b->latest ? -1 : 1;
+	if (root_a->id != root_b->id)
+		return root_a->id < root_b->id ? -1 : 1;
+
+	return g_strcmp0 (root_a->uid, root_b->uid);
+}
+
+static void
+tree_remove_root (ImThreadTree *tree,
+		  Container *container)
+{
+	if (container->root_iter) {
+		g_sequence_remove (container->root_iter);
+		container->root_iter = NULL;
+	}
+}
+
+/* Places the thread of @root in its position after a change */
+static void
+tree_update_root (ImThreadTree *tree,
+		  Container *root)
+{
+	if (tree->building)
+		return;
+
+	tree_remove_root (tree, root);
+	root->latest = container_get_latest (root);
+	root->root_iter = g_sequence_insert_sorted (tree->roots, root, compare_roots, NULL);
+}
+
+static void
+tree_link (ImThreadTree *tree,
+	   Container *parent,
+	   Container *child)
+{
+	tree_remove_root (tree, child);
+	child->parent = parent;
+	parent->children = g_slist_prepend (parent->children, child);
+}
+
+static void
+tree_unlink (ImThreadTree *tree,
+	     Container *child)
+{
+	child->parent->children = g_slist_remove (child->parent->children, child);
+	child->parent = NULL;
+}
+
+/* Frees @container and its ancestors while they are placeholders
+ * without children. Returns the first one kept, if any */
+static Container *
+tree_prune (ImThreadTree *tree,
+	    Container *container)
+{
+	while (container && container->uid == NULL && container->children == NULL) {
+		Container *parent = container->parent;
+
+		if (parent)
+			tree_unlink (tree, container);
+		tree_remove_root (tree, container);
+		if (g_hash_table_lookup (tree->ids, &container->id) == container)
+			g_hash_table_remove (tree->ids, &container->id);
+		container_free (container);
+		container = parent;
+	}
+
+	return container;
+}
+
+static Container *
+tree_get_placeholder (ImThreadTree *tree,
+		      guint64 id,
+		      GSList **created)
+{
+	Container *container;
+
+	container = g_hash_table_lookup (tree->ids, &id);
+	if (container == NULL) {
+		container = container_new (id);
+		g_hash_table_insert (tree->ids, &container->id, container);
+		*created = g_slist_prepend (*created, container);
+	}
+
+	return container;
+}
+
+/* Adds a message following JWZ: the first reference is the parent of
+ * the message, and the following ones its ancestors. Messages
+ * referenced but not yet in the tree become placeholders, filled when
+ * the message arrives, so adding a message only touches its thread */
+void
+_im_thread_tree_add_message (ImThreadTree *tree,
+			     const gchar *uid,
+			     guint64 id,
+			     time_t date,
+			     const guint64 *references,
+			     guint references_count)
+{
+	Container *container = NULL, *child, *old_parent = NULL;
+	GSList *created = NULL, *node;
+	guint i;
+
+	if (g_hash_table_lookup (tree->uids, uid))
+		return;
+
+	if (id != 0)
+		container = g_hash_table_lookup (tree->ids, &id);
+	if (container == NULL || container->uid != NULL) {
+		/* Duplicated message ids are kept out of the ids table */
+		gboolean duplicated = container != NULL;
+
+		container = container_new (id);
+		if (id != 0 && !duplicated)
+			g_hash_table_insert (tree->ids, &container->id, container);
+	}
+
+	container->uid = g_strdup (uid);
+	container->date = date;
+	container->references = g_memdup (references, references_count * sizeof (guint64));
+	container->references_count = references_count;
+	g_hash_table_insert (tree->uids, container->uid, container);
+
+	child = container;
+	for (i = 0; i < references_count; i++) {
+		Container *reference;
+
+		if (references[i] == 0 || references[i] == id)
+			continue;
+
+		reference = tree_get_placeholder (tree, references[i], &created);
+		if (container_is_ancestor (child, reference)) {
+			/* Would create a loop */
+		} else if (child == container) {
+			if (container->parent != reference) {
+				if (container->parent) {
+					old_parent = container->parent;
+					tree_unlink (tree, container);
+				}
+				tree_link (tree, reference, container);
+			}
+		} else if (child->parent == NULL) {
+			tree_link (tree, reference, child);
+		} else {
+			/* The rest of the chain was linked by other messages */
+			break;
+		}
+		child = reference;
+	}
+
+	/* Placeholders not linked to the thread */
+	for (node = created; node != NULL; node = g_slist_next (node)) {
+		Container *placeholder = (Container *) node->data;
+
+		if (placeholder->parent == NULL && placeholder->children == NULL)
+			tree_prune (tree, placeholder);
+	}
+	g_slist_free (created);
+
+	if (old_parent) {
+		old_parent = tree_prune (tree, old_parent);
+		if (old_parent)
+			tree_update_root (tree, container_get_root (old_parent));
+	}
+	tree_update_root (tree, container_get_root (container));
+}
+
+void
+_im_thread_tree_remove_message (ImThreadTree *tree,
+				const gchar *uid)
+{
+	Container *container, *kept;
+
+	container = g_hash_table_lookup (tree->uids, uid);
+	if (container == NULL)
+		return;
+
+	g_hash_table_remove (tree->uids, uid);
+	g_free (container->uid);
+	container->uid = NULL;
+	g_free (container->references);
+	container->references = NULL;
+	container->references_count = 0;
+
+	/* It's kept as a placeholder while it has replies */
+	kept = tree_prune (tree, container);
+	if (kept)
+		tree_update_root (tree, container_get_root (kept));
+}
+
+static void
+tree_add_message_info (ImThreadTree *tree,
+		       CamelFolder *folder,
+		       const gchar *uid)
+{
+	CamelMessageInfo *mi;
+	const CamelSummaryMessageID *message_id;
+	const CamelSummaryReferences *references;
+	guint64 *ids = NULL;
+	guint i, count = 0;
+	time_t date;
+
+	mi = camel_folder_get_message_info (folder, uid);
+	if (mi == NULL)
+		return;
+
+	message_id = camel_message_info_message_id (mi);
+	references = camel_message_info_references (mi);
+	if (references && references->size > 0) {
+		count = references->size;
+		ids = g_new (guint64, count);
+		for (i = 0; i < count; i++)
+			ids[i] = references->references[i].id.id;
+	}
+	date = camel_message_info_date_received (mi);
+	if (date <= 0)
+		date = camel_message_info_date_sent (mi);
+
+	_im_thread_tree_add_message (tree, uid, message_id ? message_id->id.id : 0,
+				     date, ids, count);
+
+	g_free (ids);
+	camel_folder_free_message_info (folder, mi);
+}
+
+ImThreadTree *
+_im_thread_tree_new (void)
+{
+	ImThreadTree *tree;
+
+	tree = g_slice_new0 (ImThreadTree);
+	tree->ids = g_hash_table_new (g_int64_hash, g_int64_equal);
+	tree->uids = g_hash_table_new (g_str_hash, g_str_equal);
+	tree->roots = g_sequence_new (NULL);
+	tree->building = TRUE;
+
+	return tree;
+}
+
+void
+_im_thread_tree_free (ImThreadTree *tree)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GSList *containers = NULL;
+
+	/* Placeholders are only in ids table, and messages without or
+	 * with duplicated ids only in uids table */
+	g_hash_table_iter_init (&iter, tree->ids);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		if (((Container *) value)->uid == NULL)
+			containers = g_slist_prepend (containers, value);
+	}
+	g_hash_table_iter_init (&iter, tree->uids);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		containers = g_slist_prepend (containers, value);
+	g_slist_free_full (containers, (GDestroyNotify) container_free);
+
+	g_sequence_free (tree->roots);
+	g_hash_table_destroy (tree->ids);
+	g_hash_table_destroy (tree->uids);
+	g_slice_free (ImThreadTree, tree);
+}
+
+static void
+index_root (gpointer key,
+	    gpointer value,
+	    gpointer userdata)
+{
+	ImThreadTree *tree = (ImThreadTree *) userdata;
+	Container *container = (Container *) value;
+
+	if (container->parent == NULL && container->root_iter == NULL)
+		tree_update_root (tree, container);
+}
+
+guint
+_im_thread_tree_get_messages_count (ImThreadTree *tree)
+{
+	return g_hash_table_size (tree->uids);
+}
+
+void
+_im_thread_tree_end_build (ImThreadTree *tree)
+{
+	tree->building = FALSE;
+	g_hash_table_foreach (tree->ids, index_root, tree);
+	g_hash_table_foreach (tree->uids, index_root, tree);
+}
+
+/* Each line of the file is a message: escaped uid, message id, date
+ * and the list of references, separated by tabs */
+void
+_im_thread_tree_load (ImThreadTree *tree,
+		      const gchar *path)
+{
+	gchar *contents = NULL;
+	gchar **lines, **node;
+
+	if (!g_file_get_contents (path, &contents, NULL, NULL))
+		return;
+
+	lines = g_strsplit (contents, "\n", 0);
+	g_free (contents);
+	for (node = lines; *node != NULL; node++) {
+		gchar **fields, **references;
+		guint64 *ids;
+		guint i, count;
+
+		fields = g_strsplit (*node, "\t", 4);
+		if (g_strv_length (fields) == 4) {
+			gchar *uid = g_strcompress (fields[0]);
+
+			references = g_strsplit (fields[3], ",", 0);
+			count = 0;
+			ids = g_new (guint64, g_strv_length (references) + 1);
+			for (i = 0; references[i] != NULL; i++) {
+				if (*references[i] != '\0')
+					ids[count++] = g_ascii_strtoull (references[i], NULL, 16);
+			}
+			_im_thread_tree_add_message (tree, uid,
+						     g_ascii_strtoull (fields[1], NULL, 16),
+						     (time_t) g_ascii_strtoll (fields[2], NULL, 10),
+						     ids, count);
+			g_free (ids);
+			g_strfreev (references);
+			g_free (uid);
+		}
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+}
+
+GString *
+_im_thread_tree_dump (ImThreadTree *tree)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GString *result;
+
+	result = g_string_new (NULL);
+	g_hash_table_iter_init (&iter, tree->uids);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		Container *container = (Container *) value;
+		gchar *uid;
+		guint i;
+
+		uid = g_strescape (container->uid, NULL);
+		g_string_append_printf (result, "%s\t%" G_GINT64_MODIFIER "x\t%" G_GINT64_FORMAT "\t",
+					uid, container->id, (gint64) container->date);
+		for (i = 0; i < container->references_count; i++)
+			g_string_append_printf (result, i ? ",%" G_GINT64_MODIFIER "x" : "%" G_GINT64_MODIFIER "x",
+						container->references[i]);
+		g_string_append_c (result, '\n');
+		g_free (uid);
+	}
+
+	return result;
+}
+
+static gchar *
+get_folder_key (const gchar *account_id,
+		const gchar *folder_name)
+{
+	return g_strconcat (account_id, "\n", folder_name, NULL);
+}
+
+static gchar *
+get_account_dir (const gchar *account_id)
+{
+	return g_build_filename (im_service_mgr_get_user_data_dir (),
+				 "threads", account_id, NULL);
+}
+
+static void
+folder_threads_free (FolderThreads *folder_threads)
+{
+	if (folder_threads->save_id)
+		g_source_remove (folder_threads->save_id);
+	if (folder_threads->tree)
+		_im_thread_tree_free (folder_threads->tree);
+	g_ptr_array_unref (folder_threads->pending_added);
+	g_ptr_array_unref (folder_threads->pending_removed);
+	g_free (folder_threads->account_id);
+	g_free (folder_threads->folder_name);
+	g_free (folder_threads->path);
+	g_slice_free (FolderThreads, folder_threads);
+}
+
+typedef struct _SaveData {
+	ImThreadIndex *self;
+	gchar *key;
+} SaveData;
+
+static void
+save_data_free (SaveData *data)
+{
+	g_free (data->key);
+	g_slice_free (SaveData, data);
+}
+
+/* The tree is dumped and written out of the main loop, as it takes
+ * a few megabytes in big folders */
+static void
+save_thread (GSimpleAsyncResult *simple,
+	     GObject *object,
+	     GCancellable *cancellable)
+{
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (object);
+	const gchar *key;
+	FolderThreads *folder_threads;
+	GString *contents = NULL;
+	gchar *path = NULL;
+
+	key = (const gchar *) g_simple_async_result_get_op_res_gpointer (simple);
+
+	/* A later save writes a newer tree, so it waits for this one */
+	g_mutex_lock (&priv->save_lock);
+	g_mutex_lock (&priv->lock);
+	folder_threads = g_hash_table_lookup (priv->folders, key);
+	if (folder_threads && folder_threads->tree) {
+		contents = _im_thread_tree_dump (folder_threads->tree);
+		path = g_strdup (folder_threads->path);
+	}
+	g_mutex_unlock (&priv->lock);
+
+	if (contents) {
+		GError *_error = NULL;
+		gchar *dir = g_path_get_dirname (path);
+
+		g_mkdir_with_parents (dir, 0700);
+		if (!g_file_set_contents (path, contents->str, contents->len, &_error)) {
+			g_warning ("%s: failed to write %s: %s", __FUNCTION__,
+				   path, _error->message);
+			g_error_free (_error);
+		}
+		g_string_free (contents, TRUE);
+		g_free (dir);
+	}
+	g_mutex_unlock (&priv->save_lock);
+	g_free (path);
+}
+
+static gboolean
+on_save_timeout (gpointer userdata)
+{
+	SaveData *data = (SaveData *) userdata;
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (data->self);
+	FolderThreads *folder_threads;
+	GSimpleAsyncResult *simple;
+
+	g_mutex_lock (&priv->lock);
+	folder_threads = g_hash_table_lookup (priv->folders, data->key);
+	if (folder_threads)
+		folder_threads->save_id = 0;
+	g_mutex_unlock (&priv->lock);
+
+	simple = g_simple_async_result_new (G_OBJECT (data->self),
+					    NULL, NULL,
+					    on_save_timeout);
+	g_simple_async_result_set_op_res_gpointer (simple, g_strdup (data->key), g_free);
+	g_simple_async_result_run_in_thread (simple, save_thread,
+					     G_PRIORITY_LOW, NULL);
+	g_object_unref (simple);
+
+	return FALSE;
+}
+
+/* Requires the lock */
+static void
+schedule_save (ImThreadIndex *self,
+	       FolderThreads *folder_threads)
+{
+	SaveData *data;
+
+	if (folder_threads->save_id)
+		return;
+
+	data = g_slice_new (SaveData);
+	data->self = self;
+	data->key = get_folder_key (folder_threads->account_id, folder_threads->folder_name);
+	folder_threads->save_id = g_timeout_add_seconds_full (G_PRIORITY_LOW,
+							      IM_THREAD_INDEX_SAVE_DELAY,
+							      on_save_timeout, data,
+							      (GDestroyNotify) save_data_free);
+}
+
+/* Updates the tree with the messages added and removed since it was
+ * stored */
+static void
+reconcile_tree (ImThreadTree *tree,
+		CamelFolder *folder)
+{
+	GPtrArray *uids;
+	GHashTable *present;
+	GHashTableIter iter;
+	gpointer key;
+	GSList *removed = NULL, *node;
+	guint i;
+
+	uids = camel_folder_get_uids (folder);
+	present = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < uids->len; i++) {
+		g_hash_table_add (present, uids->pdata[i]);
+		if (!g_hash_table_contains (tree->uids, uids->pdata[i]))
+			tree_add_message_info (tree, folder, uids->pdata[i]);
+	}
+
+	g_hash_table_iter_init (&iter, tree->uids);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		if (!g_hash_table_contains (present, key))
+			removed = g_slist_prepend (removed, g_strdup (key));
+	}
+	for (node = removed; node != NULL; node = g_slist_next (node))
+		_im_thread_tree_remove_message (tree, (gchar *) node->data);
+	g_slist_free_full (removed, g_free);
+
+	g_hash_table_destroy (present);
+	camel_folder_free_uids (folder, uids);
+}
+
+gboolean
+im_thread_index_load_sync (ImThreadIndex *self,
+			   const gchar *account_id,
+			   const gchar *folder_name,
+			   CamelFolder *folder,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	ImThreadIndexPrivate *priv;
+	FolderThreads *folder_threads;
+	ImThreadTree *tree;
+	GError *_error = NULL;
+	gchar *key, *dir, *file_name, *path;
+	gint64 start;
+	guint i;
+
+	g_return_val_if_fail (IM_IS_THREAD_INDEX (self), FALSE);
+
+	priv = IM_THREAD_INDEX_GET_PRIVATE (self);
+	key = get_folder_key (account_id, folder_name);
+
+	g_mutex_lock (&priv->lock);
+	while ((folder_threads = g_hash_table_lookup (priv->folders, key)) &&
+	       folder_threads->loading)
+		g_cond_wait (&priv->loaded_cond, &priv->lock);
+	if (folder_threads) {
+		g_mutex_unlock (&priv->lock);
+		g_free (key);
+		return TRUE;
+	}
+
+	dir = get_account_dir (account_id);
+	file_name = g_compute_checksum_for_string (G_CHECKSUM_MD5, folder_name, -1);
+	path = g_build_filename (dir, file_name, NULL);
+	g_free (file_name);
+	g_free (dir);
+
+	folder_threads = g_slice_new0 (FolderThreads);
+	folder_threads->account_id = g_strdup (account_id);
+	folder_threads->folder_name = g_strdup (folder_name);
+	folder_threads->path = path;
+	folder_threads->loading = TRUE;
+	folder_threads->pending_added = g_ptr_array_new_with_free_func (g_free);
+	folder_threads->pending_removed = g_ptr_array_new_with_free_func (g_free);
+	g_hash_table_insert (priv->folders, g_strdup (key), folder_threads);
+	g_mutex_unlock (&priv->lock);
+
+	/* The tree is built out of the lock, so changes of other folders
+	 * are not blocked meanwhile */
+	start = g_get_monotonic_time ();
+	tree = _im_thread_tree_new ();
+	_im_thread_tree_load (tree, path);
+	g_debug ("%s: read %u messages of %s in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+		 g_hash_table_size (tree->uids), folder_name, g_get_monotonic_time () - start);
+	if (!g_cancellable_set_error_if_cancelled (cancellable, &_error)) {
+		reconcile_tree (tree, folder);
+		_im_thread_tree_end_build (tree);
+		g_debug ("%s: threaded %u messages of %s in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+			 g_hash_table_size (tree->uids), folder_name, g_get_monotonic_time () - start);
+	}
+
+	g_mutex_lock (&priv->lock);
+	if (_error || g_hash_table_lookup (priv->folders, key) != folder_threads) {
+		/* Cancelled, or the account was removed meanwhile */
+		if (g_hash_table_lookup (priv->folders, key) == folder_threads)
+			g_hash_table_steal (priv->folders, key);
+		_im_thread_tree_free (tree);
+		folder_threads_free (folder_threads);
+	} else {
+		folder_threads->tree = tree;
+		folder_threads->loading = FALSE;
+		for (i = 0; i < folder_threads->pending_removed->len; i++)
+			_im_thread_tree_remove_message (tree, folder_threads->pending_removed->pdata[i]);
+		for (i = 0; i < folder_threads->pending_added->len; i++)
+			tree_add_message_info (tree, folder, folder_threads->pending_added->pdata[i]);
+		g_ptr_array_set_size (folder_threads->pending_removed, 0);
+		g_ptr_array_set_size (folder_threads->pending_added, 0);
+		schedule_save (self, folder_threads);
+	}
+	g_cond_broadcast (&priv->loaded_cond);
+	g_mutex_unlock (&priv->lock);
+	g_free (key);
+
+	if (_error)
+		g_propagate_error (error, _error);
+
+	return _error == NULL;
+}
+
+static gint
+compare_children (gconstpointer a,
+		  gconstpointer b)
+{
+	const Container *child_a = (const Container *) a;
+	const Container *child_b = (const Container *) b;
+
+	if (child_a->date != child_b->date)
+		return child_a->date < child_b->date ? -1 : 1;
+
+	return g_strcmp0 (child_a->uid, child_b->uid);
+}
+
+/* Adds the messages of @container, replies sorted by date. Placeholders
+ * are skipped, so their replies keep their depth */
+static void
+dump_thread (ImMessageThread *thread,
+	     Container *container,
+	     guint depth)
+{
+	GSList *children, *node;
+
+	if (container->uid) {
+		g_ptr_array_add (thread->uids, g_strdup (container->uid));
+		g_array_append_val (thread->depths, depth);
+		depth++;
+	}
+
+	children = g_slist_sort (g_slist_copy (container->children), compare_children);
+	for (node = children; node != NULL; node = g_slist_next (node))
+		dump_thread (thread, (Container *) node->data, depth);
+	g_slist_free (children);
+}
+
+GPtrArray *
+_im_thread_tree_get_threads (ImThreadTree *tree,
+			     const gchar *oldest_cursor,
+			     guint count)
+{
+	GPtrArray *result;
+	GSequenceIter *iter;
+
+	result = g_ptr_array_new_with_free_func ((GDestroyNotify) im_message_thread_free);
+
+	iter = g_sequence_get_begin_iter (tree->roots);
+	if (oldest_cursor) {
+		gchar **fields = g_strsplit (oldest_cursor, "\t", 3);
+
+		/* The cursor has the sort key of the last thread
+		 * returned, so the page starts after it even if
+		 * that thread changed */
+		if (g_strv_length (fields) == 3) {
+			Container position = { 0, };
+
+			position.latest = (time_t) g_ascii_strtoll (fields[0], NULL, 10);
+			position.id = g_ascii_strtoull (fields[1], NULL, 16);
+			position.uid = *fields[2] ? g_strcompress (fields[2]) : NULL;
+			iter = g_sequence_search (tree->roots, &position, compare_roots, NULL);
+			g_free (position.uid);
+		}
+		g_strfreev (fields);
+	}
+
+	for (; !g_sequence_iter_is_end (iter) && result->len < count;
+	     iter = g_sequence_iter_next (iter)) {
+		Container *root = (Container *) g_sequence_get (iter);
+		ImMessageThread *thread;
+		gchar *uid;
+
+		thread = g_slice_new0 (ImMessageThread);
+		thread->uids = g_ptr_array_new_with_free_func (g_free);
+		thread->depths = g_array_new (FALSE, FALSE, sizeof (guint));
+		dump_thread (thread, root, 0);
+
+		uid = g_strescape (root->uid ? root->uid : "", NULL);
+		thread->cursor = g_strdup_printf ("%" G_GINT64_FORMAT "\t%" G_GINT64_MODIFIER "x\t%s",
+						  (gint64) root->latest, root->id, uid);
+		g_free (uid);
+
+		g_ptr_array_add (result, thread);
+	}
+
+	return result;
+}
+
+GPtrArray *
+im_thread_index_get_threads (ImThreadIndex *self,
+			     const gchar *account_id,
+			     const gchar *folder_name,
+			     const gchar *oldest_cursor,
+			     guint count)
+{
+	ImThreadIndexPrivate *priv;
+	FolderThreads *folder_threads;
+	GPtrArray *result = NULL;
+	gchar *key;
+
+	g_return_val_if_fail (IM_IS_THREAD_INDEX (self), NULL);
+
+	priv = IM_THREAD_INDEX_GET_PRIVATE (self);
+	key = get_folder_key (account_id, folder_name);
+
+	g_mutex_lock (&priv->lock);
+	folder_threads = g_hash_table_lookup (priv->folders, key);
+	if (folder_threads && folder_threads->tree)
+		result = _im_thread_tree_get_threads (folder_threads->tree, oldest_cursor, count);
+	g_mutex_unlock (&priv->lock);
+	g_free (key);
+
+	return result;
+}
+
+void
+im_message_thread_free (ImMessageThread *thread)
+{
+	g_free (thread->cursor);
+	g_ptr_array_unref (thread->uids);
+	g_array_unref (thread->depths);
+	g_slice_free (ImMessageThread, thread);
+}
+
+static void
+on_folder_changed (ImServiceMgr *service_mgr,
+		   ImFolderChanges *changes,
+		   gpointer userdata)
+{
+	ImThreadIndex *self = (ImThreadIndex *) userdata;
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (self);
+	FolderThreads *folder_threads;
+	gchar *key;
+	guint i;
+
+	if (changes->account_id == NULL ||
+	    (changes->uids_added->len == 0 && changes->uids_removed->len == 0))
+		return;
+
+	key = get_folder_key (changes->account_id, changes->folder_name);
+
+	g_mutex_lock (&priv->lock);
+	folder_threads = g_hash_table_lookup (priv->folders, key);
+	if (folder_threads && folder_threads->loading) {
+		for (i = 0; i < changes->uids_removed->len; i++)
+			g_ptr_array_add (folder_threads->pending_removed,
+					 g_strdup (changes->uids_removed->pdata[i]));
+		for (i = 0; i < changes->uids_added->len; i++)
+			g_ptr_array_add (folder_threads->pending_added,
+					 g_strdup (changes->uids_added->pdata[i]));
+	} else if (folder_threads) {
+		gint64 start = g_get_monotonic_time ();
+
+		for (i = 0; i < changes->uids_removed->len; i++)
+			_im_thread_tree_remove_message (folder_threads->tree, changes->uids_removed->pdata[i]);
+		for (i = 0; i < changes->uids_added->len; i++)
+			tree_add_message_info (folder_threads->tree, changes->folder,
+					       changes->uids_added->pdata[i]);
+		schedule_save (self, folder_threads);
+
+		g_debug ("%s: threaded %u added and %u removed messages of %s in %" G_GINT64_FORMAT " usec",
+			 __FUNCTION__, changes->uids_added->len, changes->uids_removed->len,
+			 changes->folder_name, g_get_monotonic_time () - start);
+	}
+	g_mutex_unlock (&priv->lock);
+
+	g_free (key);
+}
+
+static void
+on_account_removed (ImAccountMgr *account_mgr,
+		    const gchar *account_id,
+		    gpointer userdata)
+{
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (userdata);
+	GHashTableIter iter;
+	gpointer value;
+	GDir *dir;
+	gchar *dir_path;
+
+	g_mutex_lock (&priv->lock);
+	g_hash_table_iter_init (&iter, priv->folders);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		FolderThreads *folder_threads = (FolderThreads *) value;
+
+		if (g_strcmp0 (folder_threads->account_id, account_id) != 0)
+			continue;
+
+		/* The thread loading it frees it */
+		if (folder_threads->loading)
+			g_hash_table_iter_steal (&iter);
+		else
+			g_hash_table_iter_remove (&iter);
+	}
+	g_mutex_unlock (&priv->lock);
+
+	/* A save running now would write the file again */
+	g_mutex_lock (&priv->save_lock);
+	dir_path = get_account_dir (account_id);
+	dir = g_dir_open (dir_path, 0, NULL);
+	if (dir) {
+		const gchar *name;
+
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			gchar *path = g_build_filename (dir_path, name, NULL);
+			g_unlink (path);
+			g_free (path);
+		}
+		g_dir_close (dir);
+		g_rmdir (dir_path);
+	}
+	g_mutex_unlock (&priv->save_lock);
+	g_free (dir_path);
+}
+
+static void
+im_thread_index_init (ImThreadIndex *self)
+{
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (self);
+
+	g_mutex_init (&priv->lock);
+	g_mutex_init (&priv->save_lock);
+	g_cond_init (&priv->loaded_cond);
+	priv->folders = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) folder_threads_free);
+}
+
+static void
+im_thread_index_finalize (GObject *object)
+{
+	ImThreadIndexPrivate *priv = IM_THREAD_INDEX_GET_PRIVATE (object);
+
+	g_signal_handlers_disconnect_by_data (priv->account_mgr, object);
+	g_signal_handlers_disconnect_by_data (priv->service_mgr, object);
+	g_hash_table_unref (priv->folders);
+	g_cond_clear (&priv->loaded_cond);
+	g_mutex_clear (&priv->save_lock);
+	g_mutex_clear (&priv->lock);
+	g_object_unref (priv->account_mgr);
+	g_object_unref (priv->service_mgr);
+
+	G_OBJECT_CLASS (im_thread_index_parent_class)->finalize (object);
+}
+
+static void
+im_thread_index_class_init (ImThreadIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = im_thread_index_finalize;
+
+	g_type_class_add_private (object_class, sizeof (ImThreadIndexPrivate));
+}
+
+static ImThreadIndex *
+im_thread_index_new (ImServiceMgr *service_mgr,
+		     ImAccountMgr *account_mgr)
+{
+	ImThreadIndex *self;
+	ImThreadIndexPrivate *priv;
+
+	self = g_object_new (IM_TYPE_THREAD_INDEX, NULL);
+	priv = IM_THREAD_INDEX_GET_PRIVATE (self);
+
+	priv->service_mgr = g_object_ref (service_mgr);
+	priv->account_mgr = g_object_ref (account_mgr);
+
+	g_signal_connect (G_OBJECT (account_mgr), "account_removed",
+			  G_CALLBACK (on_account_removed), self);
+	g_signal_connect (G_OBJECT (service_mgr), "folder_changed",
+			  G_CALLBACK (on_folder_changed), self);
+
+	return self;
+}
+
+ImThreadIndex *
+im_thread_index_get_instance (void)
+{
+	static ImThreadIndex *instance = 0;
+
+	if (instance == 0)
+		instance = im_thread_index_new (im_service_mgr_get_instance (),
+						im_account_mgr_get_instance ());
+
+	return instance;
+}
@@ -0,0 +1,158 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-thread-index.h : Conversation threads of the folders */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_THREAD_INDEX_H__
+#define __IM_THREAD_INDEX_H__
+
+#include <im-service-mgr.h>
+
+G_BEGIN_DECLS
+
+/* convenience macros */
+#define IM_TYPE_THREAD_INDEX             (im_thread_index_get_type())
+#define IM_THREAD_INDEX(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj),IM_TYPE_THREAD_INDEX,ImThreadIndex))
+#define IM_THREAD_INDEX_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass),IM_TYPE_THREAD_INDEX,ImThreadIndexClass))
+#define IM_IS_THREAD_INDEX(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj),IM_TYPE_THREAD_INDEX))
+#define IM_IS_THREAD_INDEX_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass),IM_TYPE_THREAD_INDEX))
+#define IM_THREAD_INDEX_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj),IM_TYPE_THREAD_INDEX,ImThreadIndexClass))
+
+typedef struct _ImThreadIndex      ImThreadIndex;
+typedef struct _ImThreadIndexClass ImThreadIndexClass;
+typedef struct _ImMessageThread    ImMessageThread;
+
+struct _ImThreadIndex {
+	GObject parent;
+};
+
+struct _ImThreadIndexClass {
+	GObjectClass parent_class;
+};
+
+/**
+ * ImMessageThread:
+ * @cursor: cursor to pass to get the threads after this one
+ * @uids: (element-type utf8): uids of the messages of the thread, in
+ * thread order
+ * @depths: (element-type guint): depth in the thread of each message
+ *
+ * A conversation thread. Free it with im_message_thread_free().
+ */
+struct _ImMessageThread {
+	gchar *cursor;
+	GPtrArray *uids;
+	GArray *depths;
+};
+
+/* Delay before storing the threads of a folder after a change, in seconds */
+#define IM_THREAD_INDEX_SAVE_DELAY 10
+
+/**
+ * im_thread_index_get_type:
+ *
+ * Returns: GType of the thread index
+ */
+GType  im_thread_index_get_type   (void) G_GNUC_CONST;
+
+/**
+ * im_thread_index_get_instance:
+ *
+ * obtains the singleton #ImThreadIndex.
+ *
+ * Returns: (transfer none): an #ImThreadIndex
+ */
+ImThreadIndex*      im_thread_index_get_instance (void);
+
+/**
+ * im_thread_index_load_sync:
+ * @self: a #ImThreadIndex
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @folder: the #CamelFolder of @folder_name
+ * @cancellable: optional #GCancellable object, or %NULL.
+ * @error: (out) (allow-none): return location for a #GError, or %NULL.
+ *
+ * Makes the threads of @folder available. The first time, they're read
+ * from disk, and only the messages added or removed since they were
+ * stored are threaded again. If they were never stored, all messages
+ * are threaded. From then on, threads are updated on each change of
+ * the folder.
+ *
+ * It blocks, so it should be called from a thread.
+ *
+ * Returns: %TRUE if successful, %FALSE otherwise.
+ */
+gboolean            im_thread_index_load_sync (ImThreadIndex *self,
+					       const gchar *account_id,
+					       const gchar *folder_name,
+					       CamelFolder *folder,
+					       GCancellable *cancellable,
+					       GError **error);
+
+/**
+ * im_thread_index_get_threads:
+ * @self: a #ImThreadIndex
+ * @account_id: an account id
+ * @folder_name: a folder name
+ * @oldest_cursor: (allow-none): cursor of the last thread of the previous
+ * page, or %NULL for the first page
+ * @count: maximum number of threads
+ *
+ * Obtains a page of the threads of a folder loaded with
+ * im_thread_index_load_sync(), the ones with the newest messages
+ * first.
+ *
+ * Returns: (transfer full) (element-type ImMessageThread): the threads,
+ * or %NULL if the folder is not loaded
+ */
+GPtrArray *         im_thread_index_get_threads (ImThreadIndex *self,
+						 const gchar *account_id,
+						 const gchar *folder_name,
+						 const gchar *oldest_cursor,
+						 guint count);
+
+/**
+ * im_message_thread_free:
+ * @thread: a #ImMessageThread
+ *
+ * Frees @thread.
+ */
+void                im_message_thread_free (ImMessageThread *thread);
+
+G_END_DECLS
+
+#endif /* __IM_THREAD_INDEX_H__ */
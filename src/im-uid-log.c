@@ -0,0 +1,251 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-uid-log.c : Resident set of uids persisted as an append-only log */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "im-uid-log.h"
+
+#include <camel/camel.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct _ImUidLog {
+	gchar *path;
+	/* uid -> uid */
+	GHashTable *uids;
+	/* lines of the file, including repeated and expired uids */
+	guint lines;
+	/* open while there are appended uids not synced */
+	FILE *file;
+	/* uids removed, the file still has them */
+	gboolean removed;
+};
+
+static void
+load_legacy_cache (ImUidLog *log,
+		   const gchar *legacy_path)
+{
+	CamelUIDCache *cache;
+	GHashTableIter iter;
+	gpointer key;
+
+	if (!g_file_test (legacy_path, G_FILE_TEST_EXISTS))
+		return;
+
+	cache = camel_uid_cache_new (legacy_path);
+	if (cache == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, cache->uids);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_hash_table_add (log->uids, g_strdup ((const gchar *) key));
+	camel_uid_cache_destroy (cache);
+}
+
+static gboolean
+rewrite_log (ImUidLog *log)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GString *contents;
+	GError *_error = NULL;
+	gboolean result;
+
+	contents = g_string_new (NULL);
+	g_hash_table_iter_init (&iter, log->uids);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		g_string_append (contents, (const gchar *) key);
+		g_string_append_c (contents, '\n');
+	}
+
+	result = g_file_set_contents (log->path, contents->str, contents->len, &_error);
+	if (result) {
+		log->lines = g_hash_table_size (log->uids);
+		log->removed = FALSE;
+	} else {
+		g_warning ("%s: failed to write %s: %s", __FUNCTION__,
+			   log->path, _error->message);
+		g_error_free (_error);
+	}
+	g_string_free (contents, TRUE);
+
+	return result;
+}
+
+ImUidLog *
+im_uid_log_open (const gchar *path,
+		 const gchar *legacy_path)
+{
+	ImUidLog *log;
+	gchar *contents = NULL;
+	gsize length;
+	gint64 start;
+
+	start = g_get_monotonic_time ();
+	log = g_slice_new0 (ImUidLog);
+	log->path = g_strdup (path);
+	log->uids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (g_file_get_contents (path, &contents, &length, NULL)) {
+		gchar *line, *end;
+
+		for (line = contents; line < contents + length; line = end + 1) {
+			end = strchr (line, '\n');
+			if (end == NULL)
+				break;
+			*end = '\0';
+			log->lines++;
+			if (*line != '\0')
+				g_hash_table_add (log->uids, g_strdup (line));
+		}
+		g_free (contents);
+	} else if (legacy_path) {
+		load_legacy_cache (log, legacy_path);
+		if (rewrite_log (log))
+			g_unlink (legacy_path);
+	}
+
+	g_debug ("%s: loaded %u uids of %s in %" G_GINT64_FORMAT " usec", __FUNCTION__,
+		 g_hash_table_size (log->uids), path, g_get_monotonic_time () - start);
+
+	return log;
+}
+
+GPtrArray *
+im_uid_log_get_new_uids (ImUidLog *log,
+			 GPtrArray *uids)
+{
+	GPtrArray *result;
+	guint i;
+
+	result = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < uids->len; i++) {
+		if (!g_hash_table_contains (log->uids, uids->pdata[i]))
+			g_ptr_array_add (result, g_strdup (uids->pdata[i]));
+	}
+
+	return result;
+}
+
+gboolean
+im_uid_log_contains (ImUidLog *log,
+		     const gchar *uid)
+{
+	return g_hash_table_contains (log->uids, uid);
+}
+
+void
+im_uid_log_add (ImUidLog *log,
+		const gchar *uid)
+{
+	if (g_hash_table_contains (log->uids, uid))
+		return;
+
+	g_hash_table_add (log->uids, g_strdup (uid));
+
+	if (log->file == NULL) {
+		log->file = g_fopen (log->path, "a");
+		if (log->file == NULL) {
+			g_warning ("%s: failed to open %s", __FUNCTION__, log->path);
+			return;
+		}
+	}
+
+	/* Flushed on each uid, so a crash only loses the uid being
+	 * retrieved */
+	fputs (uid, log->file);
+	fputc ('\n', log->file);
+	fflush (log->file);
+	log->lines++;
+}
+
+void
+im_uid_log_remove (ImUidLog *log,
+		   const gchar *uid)
+{
+	if (g_hash_table_remove (log->uids, uid))
+		log->removed = TRUE;
+}
+
+void
+im_uid_log_sync (ImUidLog *log,
+		 GPtrArray *uids)
+{
+	if (log->file) {
+		fsync (fileno (log->file));
+		fclose (log->file);
+		log->file = NULL;
+	}
+
+	/* An empty list is more likely a failed refresh than an empty
+	 * mailbox, so it never expires the uids */
+	if (uids != NULL && uids->len > 0 &&
+	    log->lines > 2 * uids->len + IM_UID_LOG_COMPACT_SLACK) {
+		GHashTable *present;
+		guint i;
+
+		present = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		for (i = 0; i < uids->len; i++) {
+			if (g_hash_table_contains (log->uids, uids->pdata[i]))
+				g_hash_table_add (present, g_strdup (uids->pdata[i]));
+		}
+		g_debug ("%s: compacting %s from %u lines to %u", __FUNCTION__,
+			 log->path, log->lines, g_hash_table_size (present));
+		g_hash_table_unref (log->uids);
+		log->uids = present;
+		rewrite_log (log);
+	} else if (log->removed) {
+		rewrite_log (log);
+	}
+}
+
+void
+im_uid_log_free (ImUidLog *log)
+{
+	if (log->file) {
+		fsync (fileno (log->file));
+		fclose (log->file);
+	}
+	g_hash_table_unref (log->uids);
+	g_free (log->path);
+	g_slice_free (ImUidLog, log);
+}
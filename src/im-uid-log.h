@@ -0,0 +1,132 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* im-uid-log.h : Resident set of uids persisted as an append-only log */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __IM_UID_LOG_H__
+#define __IM_UID_LOG_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ImUidLog ImUidLog;
+
+/* Lines the log may have over twice the uids still in the server
+ * before it's compacted */
+#define IM_UID_LOG_COMPACT_SLACK 1024
+
+/**
+ * im_uid_log_open:
+ * @path: the path of the log
+ * @legacy_path: (allow-none): path of a #CamelUIDCache to import if
+ * there's no log yet, or %NULL
+ *
+ * Loads the set of uids stored in @path. From then on, the set is kept
+ * in memory, and the uids added are appended to the log.
+ *
+ * Returns: (transfer full): a #ImUidLog, to free with im_uid_log_free()
+ */
+ImUidLog *          im_uid_log_open          (const gchar *path,
+					      const gchar *legacy_path);
+
+/**
+ * im_uid_log_get_new_uids:
+ * @log: a #ImUidLog
+ * @uids: (element-type utf8): the uids in the server
+ *
+ * Obtains the uids of @uids not in @log, in the same order.
+ *
+ * Returns: (transfer full) (element-type utf8): the new uids
+ */
+GPtrArray *         im_uid_log_get_new_uids  (ImUidLog *log,
+					      GPtrArray *uids);
+
+/**
+ * im_uid_log_contains:
+ * @log: a #ImUidLog
+ * @uid: a uid
+ *
+ * Returns: %TRUE if @uid is in @log
+ */
+gboolean            im_uid_log_contains      (ImUidLog *log,
+					      const gchar *uid);
+
+/**
+ * im_uid_log_add:
+ * @log: a #ImUidLog
+ * @uid: a uid
+ *
+ * Adds @uid to @log, appending it to the file.
+ */
+void                im_uid_log_add           (ImUidLog *log,
+					      const gchar *uid);
+
+/**
+ * im_uid_log_remove:
+ * @log: a #ImUidLog
+ * @uid: a uid
+ *
+ * Removes @uid from @log. The file is rewritten without it on next
+ * im_uid_log_sync().
+ */
+void                im_uid_log_remove        (ImUidLog *log,
+					      const gchar *uid);
+
+/**
+ * im_uid_log_sync:
+ * @log: a #ImUidLog
+ * @uids: (element-type utf8) (allow-none): the uids in the server, or
+ * %NULL if the uids never expire
+ *
+ * Flushes the uids added to disk. If most of the lines of the log are
+ * repeated, or uids not in @uids anymore, the log is rewritten with
+ * only the uids in @uids. It's rewritten too if uids were removed.
+ */
+void                im_uid_log_sync          (ImUidLog *log,
+					      GPtrArray *uids);
+
+/**
+ * im_uid_log_free:
+ * @log: a #ImUidLog
+ *
+ * Flushes and frees @log.
+ */
+void                im_uid_log_free          (ImUidLog *log);
+
+G_END_DECLS
+
+#endif /* __IM_UID_LOG_H__ */
@@ -0,0 +1,243 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* test-credential-mgr.c : Test of the password cache and backends */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-credential-mgr-priv.h"
+
+#include <glib/gstdio.h>
+
+/* Authentications asking for the same password at once */
+#define CONCURRENT 20
+/* Time a backend lookup takes, in microseconds */
+#define LOOKUP_USEC (50 * 1000)
+
+/* Backend that takes a while to answer, and counts the queries */
+static gint lookups = 0;
+
+static gchar *
+slow_lookup (const ImCredentialKey *key,
+	     GError **error)
+{
+	g_atomic_int_inc (&lookups);
+	g_usleep (LOOKUP_USEC);
+
+	return g_strdup ("secret");
+}
+
+static gboolean
+slow_store (const ImCredentialKey *key,
+	    const gchar *password,
+	    GError **error)
+{
+	return TRUE;
+}
+
+static gboolean
+slow_forget (const ImCredentialKey *key,
+	     GError **error)
+{
+	return TRUE;
+}
+
+static const ImCredentialBackend slow_backend = {
+	"slow",
+	slow_lookup,
+	slow_store,
+	slow_forget
+};
+
+typedef struct _ConcurrentLookups {
+	GMainLoop *loop;
+	guint pending;
+	guint found;
+} ConcurrentLookups;
+
+static void
+on_looked_up (GObject *source_object,
+	      GAsyncResult *result,
+	      gpointer userdata)
+{
+	ConcurrentLookups *data = (ConcurrentLookups *) userdata;
+	GError *_error = NULL;
+	gchar *password;
+
+	password = im_credential_mgr_lookup_finish (IM_CREDENTIAL_MGR (source_object),
+						    result, &_error);
+	g_assert_no_error (_error);
+	if (g_strcmp0 (password, "secret") == 0)
+		data->found++;
+	g_free (password);
+
+	if (--data->pending == 0)
+		g_main_loop_quit (data->loop);
+}
+
+/* Passwords survive the cache in the key file, and rejected ones are
+ * only forgotten if nobody stored a new one */
+static void
+test_key_file (CamelService *service,
+	       const gchar *path)
+{
+	GError *_error = NULL;
+	ImCredentialMgr *mgr;
+	gchar *password;
+
+	mgr = g_object_new (IM_TYPE_CREDENTIAL_MGR, NULL);
+	_im_credential_mgr_use_key_file (mgr, path);
+
+	password = im_credential_mgr_lookup_sync (mgr, service, &_error);
+	g_assert_no_error (_error);
+	g_assert (password == NULL);
+
+	im_credential_mgr_store_sync (mgr, service, "old", &_error);
+	g_assert_no_error (_error);
+	g_assert (g_file_test (path, G_FILE_TEST_EXISTS));
+
+	/* A new manager has an empty cache, so it reads the file */
+	g_object_unref (mgr);
+	mgr = g_object_new (IM_TYPE_CREDENTIAL_MGR, NULL);
+	_im_credential_mgr_use_key_file (mgr, path);
+	password = im_credential_mgr_lookup_sync (mgr, service, &_error);
+	g_assert_no_error (_error);
+	g_assert_cmpstr (password, ==, "old");
+	g_free (password);
+
+	/* Another authentication already stored a new password */
+	im_credential_mgr_store_sync (mgr, service, "new", &_error);
+	g_assert_no_error (_error);
+	im_credential_mgr_reject_sync (mgr, service, "old", &_error);
+	g_assert_no_error (_error);
+	password = im_credential_mgr_lookup_sync (mgr, service, &_error);
+	g_assert_cmpstr (password, ==, "new");
+	g_free (password);
+
+	/* The server rejected it, so neither the cache nor the file
+	 * give it again */
+	im_credential_mgr_reject_sync (mgr, service, "new", &_error);
+	g_assert_no_error (_error);
+	password = im_credential_mgr_lookup_sync (mgr, service, &_error);
+	g_assert_no_error (_error);
+	g_assert (password == NULL);
+
+	g_object_unref (mgr);
+}
+
+/* Concurrent lookups of a password share a single backend query */
+static void
+test_concurrent_lookups (CamelService *service)
+{
+	ImCredentialMgr *mgr;
+	ConcurrentLookups data;
+	gint64 start, elapsed;
+	guint i;
+
+	mgr = g_object_new (IM_TYPE_CREDENTIAL_MGR, NULL);
+	im_credential_mgr_set_backend (mgr, &slow_backend);
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	data.pending = CONCURRENT;
+	data.found = 0;
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < CONCURRENT; i++)
+		im_credential_mgr_lookup_async (mgr, service, G_PRIORITY_DEFAULT, NULL,
+						on_looked_up, &data);
+	g_main_loop_run (data.loop);
+	elapsed = g_get_monotonic_time () - start;
+
+	g_print ("%u concurrent lookups in %" G_GINT64_FORMAT " usec, %d backend queries\n",
+		 CONCURRENT, elapsed, g_atomic_int_get (&lookups));
+	g_assert_cmpuint (data.found, ==, CONCURRENT);
+	g_assert_cmpint (g_atomic_int_get (&lookups), ==, 1);
+	/* Way less than a query per authentication */
+	g_assert_cmpint (elapsed, <, (CONCURRENT / 2) * LOOKUP_USEC);
+
+	g_main_loop_unref (data.loop);
+	g_object_unref (mgr);
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *_error = NULL;
+	CamelSession *session;
+	CamelService *service;
+	CamelSettings *settings;
+	gchar *path, *key_file;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	path = g_build_filename (g_get_tmp_dir (), "test-credential-mgr.XXXXXX", NULL);
+	g_assert (g_mkdtemp (path) != NULL);
+	key_file = g_build_filename (path, "credentials", NULL);
+
+	camel_init (path, FALSE);
+	camel_provider_init ();
+	session = g_object_new (CAMEL_TYPE_SESSION,
+				"user-data-dir", path,
+				"user-cache-dir", path,
+				NULL);
+
+	service = camel_session_add_service (session, "test", "smtp",
+					     CAMEL_PROVIDER_TRANSPORT, &_error);
+	if (service == NULL) {
+		/* Skipped without the provider */
+		g_print ("no smtp provider: %s\n", _error->message);
+		g_error_free (_error);
+		g_object_unref (session);
+		g_rmdir (path);
+		g_free (key_file);
+		g_free (path);
+		return 77;
+	}
+	settings = camel_service_get_settings (service);
+	camel_network_settings_set_host (CAMEL_NETWORK_SETTINGS (settings), "smtp.example.com");
+	camel_network_settings_set_user (CAMEL_NETWORK_SETTINGS (settings), "user");
+
+	test_key_file (service, key_file);
+	test_concurrent_lookups (service);
+
+	g_object_unref (service);
+	g_object_unref (session);
+	g_unlink (key_file);
+	g_rmdir (path);
+	g_free (key_file);
+	g_free (path);
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* test-push-mgr.c : Test of the IDLE check of ImPushMgr */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-push-mgr-priv.h"
+
+#include <signal.h>
+#include <string.h>
+
+/* A session of the stand-in IMAP server */
+typedef struct _Scenario {
+	const gchar *greeting;
+	/* Untagged answer to CAPABILITY, or NULL to close the
+	 * connection after the greeting */
+	const gchar *capability;
+	gboolean has_idle;
+	gboolean fails;
+} Scenario;
+
+static const Scenario scenarios[] = {
+	{ "* OK [CAPABILITY IMAP4rev1 IDLE AUTH=PLAIN] Ready", NULL, TRUE, FALSE },
+	{ "* OK [CAPABILITY IMAP4rev1 AUTH=PLAIN] Ready", NULL, FALSE, FALSE },
+	{ "* OK Ready", "* CAPABILITY IMAP4rev1 STARTTLS IDLE", TRUE, FALSE },
+	{ "* OK Ready", "* CAPABILITY IMAP4rev1 STARTTLS", FALSE, FALSE },
+	{ "* OK Ready", NULL, FALSE, TRUE },
+};
+
+typedef struct _Server {
+	GSocketListener *listener;
+	const Scenario *scenario;
+	/* Commands received */
+	GString *commands;
+} Server;
+
+static void
+write_line (GOutputStream *output,
+	    const gchar *line)
+{
+	g_output_stream_write_all (output, line, strlen (line), NULL, NULL, NULL);
+	g_output_stream_write_all (output, "\r\n", 2, NULL, NULL, NULL);
+}
+
+/* Accepts one connection and answers it as in @server->scenario */
+static gpointer
+serve_func (gpointer userdata)
+{
+	Server *server = (Server *) userdata;
+	const Scenario *scenario = server->scenario;
+	GSocketConnection *connection;
+	GDataInputStream *input;
+	GOutputStream *output;
+	gchar *line;
+
+	connection = g_socket_listener_accept (server->listener, NULL, NULL, NULL);
+	g_assert (connection != NULL);
+	input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	g_data_input_stream_set_newline_type (input, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+	output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+
+	write_line (output, scenario->greeting);
+	if (scenario->capability || !scenario->fails) {
+		while ((line = g_data_input_stream_read_line (input, NULL, NULL, NULL)) != NULL) {
+			gboolean logout = g_str_has_suffix (line, " LOGOUT");
+
+			g_string_append_printf (server->commands, "%s\n", line);
+			if (g_str_has_suffix (line, " CAPABILITY")) {
+				write_line (output, scenario->capability);
+				write_line (output, "A1 OK CAPABILITY completed");
+			} else if (logout) {
+				write_line (output, "* BYE Logging out");
+				write_line (output, "A2 OK LOGOUT completed");
+			}
+			g_free (line);
+			if (logout)
+				break;
+		}
+	}
+
+	g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+	g_object_unref (input);
+	g_object_unref (connection);
+
+	return NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+	GError *_error = NULL;
+	CamelSession *session;
+	CamelService *store;
+	CamelSettings *settings;
+	Server server;
+	gchar *path;
+	guint16 port;
+	guint i;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+	/* The server may close before the client logs out */
+	signal (SIGPIPE, SIG_IGN);
+
+	path = g_build_filename (g_get_tmp_dir (), "test-push-mgr.XXXXXX", NULL);
+	g_assert (g_mkdtemp (path) != NULL);
+
+	camel_init (path, FALSE);
+	camel_provider_init ();
+	session = g_object_new (CAMEL_TYPE_SESSION,
+				"user-data-dir", path,
+				"user-cache-dir", path,
+				"online", TRUE,
+				NULL);
+
+	store = camel_session_add_service (session, "test", IM_SERVICE_MGR_PUSH_PROVIDER,
+					   CAMEL_PROVIDER_STORE, &_error);
+	if (store == NULL) {
+		/* Skipped without the provider */
+		g_print ("no %s provider: %s\n", IM_SERVICE_MGR_PUSH_PROVIDER, _error->message);
+		g_error_free (_error);
+		g_object_unref (session);
+		g_rmdir (path);
+		g_free (path);
+		return 77;
+	}
+
+	server.listener = g_socket_listener_new ();
+	port = g_socket_listener_add_any_inet_port (server.listener, NULL, &_error);
+	g_assert_no_error (_error);
+
+	settings = camel_service_get_settings (store);
+	camel_network_settings_set_host (CAMEL_NETWORK_SETTINGS (settings), "127.0.0.1");
+	camel_network_settings_set_port (CAMEL_NETWORK_SETTINGS (settings), port);
+	camel_network_settings_set_security_method (CAMEL_NETWORK_SETTINGS (settings),
+						    CAMEL_NETWORK_SECURITY_METHOD_NONE);
+
+	for (i = 0; i < G_N_ELEMENTS (scenarios); i++) {
+		GThread *thread;
+		gboolean has_idle;
+
+		server.scenario = &scenarios[i];
+		server.commands = g_string_new (NULL);
+		thread = g_thread_new ("imap-server", serve_func, &server);
+
+		has_idle = _im_push_mgr_server_has_idle_sync (store, NULL, &_error);
+		g_thread_join (thread);
+
+		g_print ("%s: IDLE %s\n", scenarios[i].greeting, has_idle ? "supported" : "not supported");
+		if (scenarios[i].fails) {
+			g_assert (_error != NULL);
+			g_clear_error (&_error);
+		} else {
+			g_assert_no_error (_error);
+		}
+		g_assert (has_idle == scenarios[i].has_idle);
+
+		/* Capabilities are asked before authentication */
+		g_assert (strstr (server.commands->str, "LOGIN") == NULL);
+		g_assert (strstr (server.commands->str, "AUTHENTICATE") == NULL);
+		g_string_free (server.commands, TRUE);
+	}
+
+	g_object_unref (server.listener);
+	g_object_unref (store);
+	g_object_unref (session);
+	g_rmdir (path);
+	g_free (path);
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* test-sync-scheduler.c : Backoff of the failed synchronizations */
+
+/*
+ * Authors:
+ *  Jose Dapena Paz <jdapena@igalia.com>
+ *
+ * Copyright (c) 2012, Igalia, S.L.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * * Neither the name of the Nokia Corporation nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "im-sync-scheduler-priv.h"
+
+#define ACCOUNT_ID "account"
+#define INTERVAL (15 * 60)
+#define FAILURES 12
+
+/* State of the fake accounts backend */
+static gboolean fail = TRUE;
+static guint finished = 0;
+static gint64 last_updated = 0;
+
+static gboolean
+fake_is_online (ImSyncScheduler *self)
+{
+	return TRUE;
+}
+
+static gint
+fake_get_interval (ImSyncScheduler *self)
+{
+	return INTERVAL;
+}
+
+static gboolean
+fake_is_push_active (ImSyncScheduler *self,
+		     const gchar *account_id)
+{
+	return FALSE;
+}
+
+static gint64
+fake_get_last_updated (ImSyncScheduler *self,
+		       const gchar *account_id)
+{
+	return last_updated;
+}
+
+static void
+fake_set_last_updated (ImSyncScheduler *self,
+		       const gchar *account_id,
+		       gint64 value)
+{
+	last_updated = value;
+}
+
+/* Fails at once as an unreachable server would */
+static gboolean
+fake_synchronize_async (ImSyncScheduler *self,
+			const gchar *account_id,
+			GCancellable *cancellable,
+			GAsyncReadyCallback callback,
+			gpointer userdata)
+{
+	GSimpleAsyncResult *simple;
+
+	simple = g_simple_async_result_new (G_OBJECT (self), callback, userdata,
+					    fake_synchronize_async);
+	if (fail)
+		g_simple_async_result_set_error (simple, G_IO_ERROR, G_IO_ERROR_HOST_NOT_FOUND,
+						 "Could not connect to %s", account_id);
+	g_simple_async_result_complete_in_idle (simple);
+	g_object_unref (simple);
+
+	return TRUE;
+}
+
+static gboolean
+fake_synchronize_finish (ImSyncScheduler *self,
+			 GObject *source_object,
+			 GAsyncResult *result,
+			 GError **error)
+{
+	finished++;
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+static const ImSyncSchedulerBackend fake_backend = {
+	fake_is_online,
+	fake_get_interval,
+	fake_is_push_active,
+	fake_get_last_updated,
+	fake_set_last_updated,
+	fake_synchronize_async,
+	fake_synchronize_finish
+};
+
+/* Runs the synchronization now, and returns the delay of the next
+ * one, in seconds */
+static gint64
+run_and_get_delay (ImSyncScheduler *scheduler,
+		   guint *failures)
+{
+	ImSyncSchedule *schedule;
+	GList *schedules;
+	guint run;
+	gint64 delay;
+
+	run = finished + 1;
+	g_assert (_im_sync_scheduler_run_now (scheduler, ACCOUNT_ID));
+	while (finished < run)
+		g_main_context_iteration (NULL, TRUE);
+
+	schedules = im_sync_scheduler_get_schedule (scheduler);
+	g_assert_cmpuint (g_list_length (schedules), ==, 1);
+	schedule = (ImSyncSchedule *) schedules->data;
+	g_assert (schedule->next_run > 0);
+	delay = schedule->next_run - g_get_real_time () / G_USEC_PER_SEC;
+	*failures = schedule->failures;
+	im_sync_scheduler_free_schedule (schedules);
+
+	return delay;
+}
+
+/* The delay is within the jitter, plus a second for the clock ticking
+ * while we check */
+static void
+check_delay (gint64 delay,
+	     gint64 expected)
+{
+	gint64 jitter = expected * IM_SYNC_SCHEDULER_JITTER / 100;
+
+	g_assert_cmpint (delay, >=, expected - jitter - 1);
+	g_assert_cmpint (delay, <=, expected + jitter);
+}
+
+int
+main (int argc, char **argv)
+{
+	ImSyncScheduler *scheduler;
+	gint64 delay, previous = 0, expected;
+	guint i, failures;
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	scheduler = _im_sync_scheduler_new (&fake_backend);
+	_im_sync_scheduler_add_account (scheduler, ACCOUNT_ID);
+	_im_sync_scheduler_set_online (scheduler, TRUE);
+
+	/* Each failure doubles the delay of the retry, up to the maximum */
+	for (i = 1; i <= FAILURES; i++) {
+		delay = run_and_get_delay (scheduler, &failures);
+		expected = MIN ((gint64) IM_SYNC_SCHEDULER_MIN_BACKOFF << (i - 1),
+				IM_SYNC_SCHEDULER_MAX_BACKOFF);
+		g_print ("failure %u: retry in %" G_GINT64_FORMAT " seconds\n", i, delay);
+		g_assert_cmpuint (failures, ==, i);
+		check_delay (delay, expected);
+		if (expected < IM_SYNC_SCHEDULER_MAX_BACKOFF)
+			g_assert_cmpint (delay, >, previous);
+		previous = delay;
+	}
+	g_assert_cmpint (expected, ==, IM_SYNC_SCHEDULER_MAX_BACKOFF);
+	g_assert_cmpint (last_updated, ==, 0);
+
+	/* A success goes back to the interval */
+	fail = FALSE;
+	delay = run_and_get_delay (scheduler, &failures);
+	g_print ("success: next in %" G_GINT64_FORMAT " seconds\n", delay);
+	g_assert_cmpuint (failures, ==, 0);
+	check_delay (delay, INTERVAL);
+	g_assert_cmpint (last_updated, >, 0);
+
+	g_object_unref (scheduler);
+
+	return 0;
+}